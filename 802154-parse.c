@@ -16,10 +16,13 @@
    along with this program. If not, see <http://www.gnu.org/licenses/>. */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <ctype.h>
 #include <err.h>
 
 #include "xatoi.h"
+#include "mac.h"
 #include "802154-parse.h"
 
 int parse_channel(const char *arg)
@@ -43,3 +46,219 @@ int parse_channel(const char *arg)
 
   return channel;
 }
+
+/* Parse a decimal value that ends with one of the specified delimiters.
+   Return the delimiter. */
+static const char * parse_dec(const char *s, const char *delim,
+                              unsigned long *value, const char *error)
+{
+  const char *start = s;
+
+  for(*value = 0 ; isdigit(*s) && *value < 100000 ; s++)
+    *value = *value * 10 + *s - '0';
+
+  if(s == start || !strchr(delim, *s))
+    errx(EXIT_FAILURE, "%s", error);
+
+  return s;
+}
+
+unsigned int parse_channels(const char *arg, unsigned int weights[NB_CHANNELS])
+{
+  const char *s = arg;
+  unsigned long first, last, weight;
+  unsigned int nb_channels = 0;
+
+  memset(weights, 0, NB_CHANNELS * sizeof(unsigned int));
+
+  while(1) {
+    s = parse_dec(s, "-:,", &first, "invalid channel number");
+    last = first;
+
+    if(*s == '-')
+      s = parse_dec(s + 1, ":,", &last, "invalid channel number");
+
+    weight = 1;
+    if(*s == ':') {
+      s = parse_dec(s + 1, ",", &weight, "invalid channel weight");
+      if(weight == 0 || weight > MAX_CHANNEL_WEIGHT)
+        errx(EXIT_FAILURE, "channel weight must be between 1 and %d",
+             MAX_CHANNEL_WEIGHT);
+    }
+
+    if(first > last || last >= NB_CHANNELS)
+      errx(EXIT_FAILURE, "invalid channel number");
+
+    for(; first <= last ; first++) {
+      if(weights[first])
+        errx(EXIT_FAILURE, "channel %lu specified twice", first);
+
+      weights[first] = weight;
+      nb_channels++;
+    }
+
+    if(*s == '\0')
+      break;
+    s++;
+  }
+
+  return nb_channels;
+}
+
+unsigned int parse_frame_types(const char *arg)
+{
+  const struct {
+    const char   *name;
+    enum mac_type type;
+  } *t, names[] = {
+    { "beacon", MT_BEACON },
+    { "data", MT_DATA },
+    { "ack", MT_ACK },
+    { "cmd", MT_CMD },
+    { "command", MT_CMD },
+    { NULL, 0 }};
+
+  unsigned int types = 0;
+  const char *s = arg;
+
+  while(1) {
+    size_t len = strcspn(s, ",");
+
+    for(t = names ; t->name ; t++)
+      if(strlen(t->name) == len && !strncmp(t->name, s, len))
+        break;
+
+    if(!t->name)
+      errx(EXIT_FAILURE, "invalid frame type -- '%.*s'", (int)len, s);
+
+    types |= 1 << t->type;
+
+    if(s[len] == '\0')
+      break;
+    s += len + 1;
+  }
+
+  return types;
+}
+
+#define HEX_DIGIT(c) (isdigit(c) ? (c) - '0' : tolower(c) - 'a' + 10)
+
+/* Parse an hexadecimal value of at most the specified number of digits which
+   ends with one of the specified delimiters. Return the delimiter. */
+static const char * parse_hex(const char *s, unsigned int digits,
+                              const char *delim, unsigned long *value,
+                              const char *error)
+{
+  const char *start = s;
+
+  for(*value = 0 ; isxdigit(*s) ; s++) {
+    *value <<= 4;
+    *value  |= HEX_DIGIT(*s);
+  }
+
+  if(s == start || s - start > digits || !strchr(delim, *s))
+    errx(EXIT_FAILURE, "%s", error);
+
+  return s;
+}
+
+uint16_t parse_pan(const char *arg)
+{
+  unsigned long pan;
+
+  parse_hex(arg, 4, "", &pan, "invalid PAN identifier");
+
+  return pan;
+}
+
+int parse_address(const char *arg, uint64_t *addr)
+{
+  const char *s = arg;
+  unsigned long value;
+  int i;
+
+  /* Short addresses are up to four hexadecimal digits, extended addresses are
+     eight bytes separated by colons. The delimiter tells them apart. */
+  s = parse_hex(s, 4, ":", &value, "invalid address");
+  if(*s == '\0') {
+    *addr = value;
+    return MAM_SHORT;
+  }
+
+  if(value > 0xff)
+    errx(EXIT_FAILURE, "invalid extended address");
+  *addr = value;
+
+  for(i = 1 ; i < 8 ; i++) {
+    if(*s != ':')
+      errx(EXIT_FAILURE, "invalid extended address");
+
+    s = parse_hex(s + 1, 2, i == 7 ? "" : ":", &value,
+                  "invalid extended address");
+
+    *addr = *addr << 8 | value;
+  }
+
+  return MAM_LONG;
+}
+
+int parse_key(const char *arg, unsigned char key[16],
+              uint64_t *source, uint8_t *index)
+{
+  const char *s = arg;
+  unsigned long value;
+  int mode = KIM_IMPLICIT;
+  int i;
+
+  *source = 0;
+  *index  = 0;
+
+  /* The identifier ends with a colon which a key never contains. */
+  if(strchr(arg, ':')) {
+    if(strchr(arg, '/')) {
+      const char *start = s;
+
+      s    = parse_hex(s, 16, "/", &value, "invalid key source");
+      mode = s - start > 8 ? KIM_SOURCE_8 : KIM_SOURCE_4;
+      *source = value;
+      s++;
+    }
+    else
+      mode = KIM_INDEX;
+
+    s = parse_hex(s, 2, ":", &value, "invalid key index");
+    *index = value;
+    s++;
+  }
+
+  for(i = 0 ; i < 16 ; i++, s += 2) {
+    if(!isxdigit(s[0]) || !isxdigit(s[1]))
+      errx(EXIT_FAILURE, "invalid key (expected 32 hexadecimal digits)");
+    key[i] = HEX_DIGIT(s[0]) << 4 | HEX_DIGIT(s[1]);
+  }
+
+  if(*s)
+    errx(EXIT_FAILURE, "invalid key (expected 32 hexadecimal digits)");
+
+  return mode;
+}
+
+void parse_device(const char *arg, uint16_t *short_addr, uint64_t *ext_addr)
+{
+  char buf[sizeof("ABCD")];
+  const char *eq = strchr(arg, '=');
+  uint64_t addr;
+
+  if(!eq || eq - arg >= sizeof(buf))
+    errx(EXIT_FAILURE, "invalid device (expected SHORT=EXTENDED)");
+
+  memcpy(buf, arg, eq - arg);
+  buf[eq - arg] = '\0';
+
+  if(parse_address(buf, &addr) != MAM_SHORT)
+    errx(EXIT_FAILURE, "invalid short address");
+  *short_addr = addr;
+
+  if(parse_address(eq + 1, ext_addr) != MAM_LONG)
+    errx(EXIT_FAILURE, "invalid extended address");
+}
@@ -18,6 +18,8 @@
 #ifndef _802154_PARSE_H_
 #define _802154_PARSE_H_
 
+#include <stdint.h>
+
 /* TODO: Extend the channel API.
 
    The API should comprise a channel structure encompassing the channel's
@@ -35,4 +37,35 @@
    informations about the selected channel (see TODO above). */
 int parse_channel(const char *arg);
 
+/* Number of channel numbers and largest weight of a channel. */
+#define NB_CHANNELS        27
+#define MAX_CHANNEL_WEIGHT 100
+
+/* Convert a comma separated list of channels or ranges of channels (11-26),
+   each optionally followed by a weight (15:4), into the weight of each
+   channel. Channels which are not listed have a zero weight. Return the number
+   of channels in the list. */
+unsigned int parse_channels(const char *arg, unsigned int weights[NB_CHANNELS]);
+
+/* Convert a comma separated list of frame types (beacon, data, ack, command)
+   into a mask with the bit n set for the type n. */
+unsigned int parse_frame_types(const char *arg);
+
+/* Convert an hexadecimal PAN identifier. */
+uint16_t parse_pan(const char *arg);
+
+/* Convert a short address (ABCD) or an extended address (00:11:...:77). Return
+   the corresponding addressing mode (MAM_SHORT or MAM_LONG). */
+int parse_address(const char *arg, uint64_t *addr);
+
+/* Convert a key of 32 hexadecimal digits, optionally preceded by its key index
+   (01:KEY) or by its key source and index (01020304/01:KEY). Return the key
+   identifier mode (enum mac_key_mode). */
+int parse_key(const char *arg, unsigned char key[16],
+              uint64_t *source, uint8_t *index);
+
+/* Convert the association of a short address with an extended address
+   (ABCD=00:11:...:77). */
+void parse_device(const char *arg, uint16_t *short_addr, uint64_t *ext_addr);
+
 #endif /* _802154_PARSE_H_ */
@@ -0,0 +1,259 @@
+/* File: aes.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "aes.h"
+
+/* Informations about AES came from FIPS-197 and the Intel white paper
+   "Advanced Encryption Standard (AES) New Instructions Set". */
+
+#ifdef __AES__ /* AES-NI */
+# include <wmmintrin.h>
+
+/* Blocks encrypted at once. There are enough registers for the round keys
+   and four blocks on x86-64. */
+# define INTERLEAVE 4
+
+static __m128i expand_step(__m128i key, __m128i assist)
+{
+  assist = _mm_shuffle_epi32(assist, _MM_SHUFFLE(3, 3, 3, 3));
+  key    = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key    = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key    = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, assist);
+}
+
+/* The round constant must be an immediate. */
+# define EXPAND(i, rcon) \
+  rk[i] = expand_step(rk[i - 1], _mm_aeskeygenassist_si128(rk[i - 1], rcon))
+
+void aes_expand_key(struct aes_key *key, const unsigned char raw[AES_KEY_SIZE])
+{
+  __m128i *rk = (__m128i *)key->rk;
+
+  rk[0] = _mm_loadu_si128((const __m128i *)raw);
+  EXPAND(1, 0x01);
+  EXPAND(2, 0x02);
+  EXPAND(3, 0x04);
+  EXPAND(4, 0x08);
+  EXPAND(5, 0x10);
+  EXPAND(6, 0x20);
+  EXPAND(7, 0x40);
+  EXPAND(8, 0x80);
+  EXPAND(9, 0x1b);
+  EXPAND(10, 0x36);
+}
+
+void aes_encrypt(const struct aes_key *key,
+                 const unsigned char in[AES_BLOCK_SIZE],
+                 unsigned char out[AES_BLOCK_SIZE])
+{
+  const __m128i *rk = (const __m128i *)key->rk;
+  __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in), rk[0]);
+  int i;
+
+  for(i = 1 ; i < 10 ; i++)
+    b = _mm_aesenc_si128(b, rk[i]);
+  b = _mm_aesenclast_si128(b, rk[10]);
+
+  _mm_storeu_si128((__m128i *)out, b);
+}
+
+void aes_encrypt_blocks(const struct aes_key *key,
+                        const unsigned char *in,
+                        unsigned char *out,
+                        unsigned int n)
+{
+  const __m128i *rk = (const __m128i *)key->rk;
+
+  for(; n >= INTERLEAVE ; n -= INTERLEAVE) {
+    const __m128i *src = (const __m128i *)in;
+    __m128i *dst = (__m128i *)out;
+    __m128i b0 = _mm_xor_si128(_mm_loadu_si128(src),     rk[0]);
+    __m128i b1 = _mm_xor_si128(_mm_loadu_si128(src + 1), rk[0]);
+    __m128i b2 = _mm_xor_si128(_mm_loadu_si128(src + 2), rk[0]);
+    __m128i b3 = _mm_xor_si128(_mm_loadu_si128(src + 3), rk[0]);
+    int i;
+
+    for(i = 1 ; i < 10 ; i++) {
+      b0 = _mm_aesenc_si128(b0, rk[i]);
+      b1 = _mm_aesenc_si128(b1, rk[i]);
+      b2 = _mm_aesenc_si128(b2, rk[i]);
+      b3 = _mm_aesenc_si128(b3, rk[i]);
+    }
+
+    _mm_storeu_si128(dst,     _mm_aesenclast_si128(b0, rk[10]));
+    _mm_storeu_si128(dst + 1, _mm_aesenclast_si128(b1, rk[10]));
+    _mm_storeu_si128(dst + 2, _mm_aesenclast_si128(b2, rk[10]));
+    _mm_storeu_si128(dst + 3, _mm_aesenclast_si128(b3, rk[10]));
+
+    in  += INTERLEAVE * AES_BLOCK_SIZE;
+    out += INTERLEAVE * AES_BLOCK_SIZE;
+  }
+
+  for(; n ; n--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE)
+    aes_encrypt(key, in, out);
+}
+#else /* generic */
+
+static const uint8_t sbox[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+  0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+  0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+  0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+  0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+  0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+  0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+  0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+  0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+  0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+  0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+  0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+  0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+  0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+  0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+  0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+  0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+/* SubBytes and MixColumns of a byte in the first row. The other rows are
+   rotations of this table. Computed with the first key. */
+static uint32_t te[256];
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define GET32(p) ((uint32_t)(p)[0] << 24 | (uint32_t)(p)[1] << 16 | \
+                  (uint32_t)(p)[2] << 8  | (uint32_t)(p)[3])
+
+#define PUT32(p, v) do {                        \
+    (p)[0] = (v) >> 24; (p)[1] = (v) >> 16;     \
+    (p)[2] = (v) >> 8;  (p)[3] = (v);           \
+  } while(0)
+
+static void init_table(void)
+{
+  int i;
+
+  for(i = 0 ; i < 256 ; i++) {
+    uint32_t s  = sbox[i];
+    uint32_t s2 = (s << 1) ^ (s & 0x80 ? 0x11b : 0);
+
+    te[i] = s2 << 24 | s << 16 | s << 8 | (s2 ^ s);
+  }
+}
+
+static uint32_t sub_word(uint32_t w)
+{
+  return (uint32_t)sbox[w >> 24] << 24 | (uint32_t)sbox[(w >> 16) & 0xff] << 16 |
+         (uint32_t)sbox[(w >> 8) & 0xff] << 8 | sbox[w & 0xff];
+}
+
+void aes_expand_key(struct aes_key *key, const unsigned char raw[AES_KEY_SIZE])
+{
+  static const uint8_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10,
+                                    0x20, 0x40, 0x80, 0x1b, 0x36 };
+  uint32_t *rk = key->rk;
+  int i;
+
+  if(!te[0])
+    init_table();
+
+  for(i = 0 ; i < 4 ; i++)
+    rk[i] = GET32(raw + 4 * i);
+
+  for(i = 4 ; i < 44 ; i++) {
+    uint32_t t = rk[i - 1];
+
+    if(i % 4 == 0)
+      t = sub_word(ROR(t, 24)) ^ (uint32_t)rcon[i / 4 - 1] << 24;
+
+    rk[i] = rk[i - 4] ^ t;
+  }
+}
+
+void aes_encrypt(const struct aes_key *key,
+                 const unsigned char in[AES_BLOCK_SIZE],
+                 unsigned char out[AES_BLOCK_SIZE])
+{
+  const uint32_t *rk = key->rk;
+  uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+  int i;
+
+  s0 = GET32(in)      ^ rk[0];
+  s1 = GET32(in + 4)  ^ rk[1];
+  s2 = GET32(in + 8)  ^ rk[2];
+  s3 = GET32(in + 12) ^ rk[3];
+
+  for(i = 1 ; i < 10 ; i++) {
+    rk += 4;
+
+    t0 = te[s0 >> 24] ^ ROR(te[(s1 >> 16) & 0xff], 8) ^
+         ROR(te[(s2 >> 8) & 0xff], 16) ^ ROR(te[s3 & 0xff], 24) ^ rk[0];
+    t1 = te[s1 >> 24] ^ ROR(te[(s2 >> 16) & 0xff], 8) ^
+         ROR(te[(s3 >> 8) & 0xff], 16) ^ ROR(te[s0 & 0xff], 24) ^ rk[1];
+    t2 = te[s2 >> 24] ^ ROR(te[(s3 >> 16) & 0xff], 8) ^
+         ROR(te[(s0 >> 8) & 0xff], 16) ^ ROR(te[s1 & 0xff], 24) ^ rk[2];
+    t3 = te[s3 >> 24] ^ ROR(te[(s0 >> 16) & 0xff], 8) ^
+         ROR(te[(s1 >> 8) & 0xff], 16) ^ ROR(te[s2 & 0xff], 24) ^ rk[3];
+
+    s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+  }
+
+  /* The last round has no MixColumns. */
+  rk += 4;
+
+  t0 = ((uint32_t)sbox[s0 >> 24] << 24 | (uint32_t)sbox[(s1 >> 16) & 0xff] << 16 |
+        (uint32_t)sbox[(s2 >> 8) & 0xff] << 8 | sbox[s3 & 0xff]) ^ rk[0];
+  t1 = ((uint32_t)sbox[s1 >> 24] << 24 | (uint32_t)sbox[(s2 >> 16) & 0xff] << 16 |
+        (uint32_t)sbox[(s3 >> 8) & 0xff] << 8 | sbox[s0 & 0xff]) ^ rk[1];
+  t2 = ((uint32_t)sbox[s2 >> 24] << 24 | (uint32_t)sbox[(s3 >> 16) & 0xff] << 16 |
+        (uint32_t)sbox[(s0 >> 8) & 0xff] << 8 | sbox[s1 & 0xff]) ^ rk[2];
+  t3 = ((uint32_t)sbox[s3 >> 24] << 24 | (uint32_t)sbox[(s0 >> 16) & 0xff] << 16 |
+        (uint32_t)sbox[(s1 >> 8) & 0xff] << 8 | sbox[s2 & 0xff]) ^ rk[3];
+
+  PUT32(out, t0);
+  PUT32(out + 4, t1);
+  PUT32(out + 8, t2);
+  PUT32(out + 12, t3);
+}
+
+void aes_encrypt_blocks(const struct aes_key *key,
+                        const unsigned char *in,
+                        unsigned char *out,
+                        unsigned int n)
+{
+  for(; n ; n--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE)
+    aes_encrypt(key, in, out);
+}
+#endif /* __AES__ */
@@ -0,0 +1,49 @@
+/* File: aes.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _AES_H_
+#define _AES_H_
+
+#include <stdint.h>
+
+/* AES-128 encryption only, which is all that CCM* needs. The AES-NI
+   instructions are used when the compiler targets them. */
+
+#define AES_BLOCK_SIZE 16
+#define AES_KEY_SIZE   16
+
+struct aes_key {
+  /* Round keys, their layout depends on the implementation. */
+  uint32_t rk[44] __attribute__((aligned(16)));
+};
+
+/* Compute the round keys. */
+void aes_expand_key(struct aes_key *key, const unsigned char raw[AES_KEY_SIZE]);
+
+/* Encrypt a single block. The input and the output may overlap. */
+void aes_encrypt(const struct aes_key *key,
+                 const unsigned char in[AES_BLOCK_SIZE],
+                 unsigned char out[AES_BLOCK_SIZE]);
+
+/* Encrypt n independent blocks. With AES-NI the rounds of consecutive blocks
+   are interleaved, which is much faster than one block after the other. */
+void aes_encrypt_blocks(const struct aes_key *key,
+                        const unsigned char *in,
+                        unsigned char *out,
+                        unsigned int n);
+
+#endif /* _AES_H_ */
@@ -0,0 +1,981 @@
+/* File: bench.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "version.h"
+#include "mac.h"
+#include "mac-decode.h"
+#include "mac-encode.h"
+#include "mac-display.h"
+#include "mac-security.h"
+#include "lowpan-decode.h"
+#include "dump.h"
+#include "input.h"
+#include "protocol.h"
+#include "crc32.h"
+#include "iobuf.h"
+#include "pcap-write.h"
+#include "pcap-read.h"
+#include "pcap-scan.h"
+#include "xatoi.h"
+#include "help.h"
+#include "firmware/format.h"
+
+#define TARGET "WSN-Bench"
+
+/* Number of distinct frames in the mix. They are processed in a loop. */
+#define MIX_SIZE        4096
+
+/* Largest MAC frame including the FCS. */
+#define MAX_FRAME_SIZE  127
+
+/* Size of the chunks fed to the input parser (same as the UART buffer). */
+#define INPUT_CHUNK     4096
+
+#define DEFAULT_FRAMES  200000
+#define DEFAULT_ROUNDS  5
+#define DEFAULT_SEED    1
+#define MAX_ROUNDS      1000
+
+struct sample {
+  struct mac_frame frame;
+  unsigned char payload[MAX_FRAME_SIZE];
+  unsigned char raw[MAX_FRAME_SIZE];
+  unsigned int size;
+  struct mac_security security;
+};
+
+struct bench {
+  const char *name;
+  void (*setup)(unsigned long n);
+  unsigned long (*run)(unsigned long n); /* return the frames processed */
+  void (*teardown)(void);
+  bool quiet; /* redirect stdout to /dev/null */
+};
+
+static struct sample mix[MIX_SIZE];
+static struct sample secured[MIX_SIZE];
+static struct sample lowpan[MIX_SIZE];
+
+static unsigned char *stream;
+static size_t stream_size;
+static unsigned long parsed;
+
+static char tmp_path[] = "/tmp/wsn-bench.XXXXXX";
+static iofile_t tmp_file;
+
+static uint32_t state = DEFAULT_SEED;
+
+/* We use our own generator so that the mix does not depend on the libc. */
+static uint32_t xorshift32(void)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+
+  return state;
+}
+
+static void seed(uint32_t value)
+{
+  /* The generator cannot leave zero. */
+  state = value ? value : DEFAULT_SEED;
+}
+
+static uint64_t random_address(enum mac_addr_mode mode)
+{
+  uint64_t mac = xorshift32();
+
+  if(mode == MAM_LONG)
+    mac = (mac << 32) | xorshift32();
+  else
+    mac &= 0xffff;
+
+  return mac;
+}
+
+/* Build a mix covering every addressing mode combination, with and without
+   PAN ID compression, and random payload sizes. */
+static void build_mix(void)
+{
+  static const enum mac_addr_mode modes[] = { MAM_FULL, MAM_SHORT, MAM_LONG };
+  unsigned int i, j;
+
+  for(i = 0 ; i < MIX_SIZE ; i++) {
+    struct sample *s = &mix[i];
+    enum mac_addr_mode dam = modes[i % 3];
+    enum mac_addr_mode sam = modes[(i / 3) % 3];
+    bool pancomp = (i / 9) % 2;
+    unsigned int header, max_payload;
+    int size;
+
+    memset(&s->frame, 0, sizeof(s->frame));
+
+    s->frame.control = (dam == MAM_FULL && sam == MAM_FULL) ? MT_ACK : MT_DATA;
+    s->frame.control |= dam << MC_DAM_SHR;
+    s->frame.control |= sam << MC_SAM_SHR;
+    s->frame.control |= (xorshift32() % 2) << MC_VERSION_SHR;
+    if(pancomp)
+      s->frame.control |= MC_PANCOMP;
+    if(xorshift32() % 2)
+      s->frame.control |= MC_ACK;
+
+    s->frame.seqno   = xorshift32();
+    s->frame.dst.pan = xorshift32();
+    s->frame.dst.mac = random_address(dam);
+    s->frame.src.pan = pancomp ? s->frame.dst.pan : xorshift32();
+    s->frame.src.mac = random_address(sam);
+
+    /* Control, sequence number, addresses and FCS. */
+    header  = 3 + 2;
+    header += dam == MAM_FULL ? 0 : (dam == MAM_SHORT ? 4 : 10);
+    header += sam == MAM_FULL ? 0 : (sam == MAM_SHORT ? 2 : 8);
+    header += (sam != MAM_FULL && !pancomp) ? 2 : 0;
+
+    max_payload = MAX_FRAME_SIZE - header;
+
+    if(dam != MAM_FULL || sam != MAM_FULL) {
+      s->frame.size = xorshift32() % (max_payload + 1);
+      for(j = 0 ; j < s->frame.size ; j++)
+        s->payload[j] = xorshift32();
+      s->frame.payload = s->frame.size ? s->payload : NULL;
+    }
+
+    size = mac_encode(&s->frame, s->raw);
+    if(size < 0)
+      errx(EXIT_FAILURE, "cannot encode frame %u", i);
+
+    /* We do not care about the FCS value. */
+    s->raw[size++] = xorshift32();
+    s->raw[size++] = xorshift32();
+    s->size = size;
+  }
+}
+
+static unsigned long run_mac_decode(unsigned long n)
+{
+  unsigned long i;
+
+  for(i = 0 ; i < n ; i++) {
+    const struct sample *s = &mix[i % MIX_SIZE];
+    struct mac_frame frame;
+
+    if(mac_decode(&frame, s->raw, true, s->size) < 0)
+      errx(EXIT_FAILURE, "cannot decode frame");
+    free_mac_frame(&frame);
+  }
+
+  return n;
+}
+
+static unsigned long run_mac_encode(unsigned long n)
+{
+  unsigned char buf[MAX_FRAME_SIZE];
+  unsigned long i;
+
+  for(i = 0 ; i < n ; i++)
+    if(mac_encode(&mix[i % MIX_SIZE].frame, buf) < 0)
+      errx(EXIT_FAILURE, "cannot encode frame");
+
+  return n;
+}
+
+/* Data frames from extended addresses, encrypted and authenticated with a
+   64 bits MIC. The MIC does not match but checking it costs just the same. */
+static void setup_mac_unsecure(unsigned long n)
+{
+  static const unsigned char key[MAC_KEY_SIZE] = { 0xc0, 0xc1, 0xc2, 0xc3,
+                                                   0xc4, 0xc5, 0xc6, 0xc7,
+                                                   0xc8, 0xc9, 0xca, 0xcb,
+                                                   0xcc, 0xcd, 0xce, 0xcf };
+  unsigned int i, j;
+
+  (void)n;
+
+  mac_security_add_key(KIM_INDEX, 0, 1, key);
+
+  for(i = 0 ; i < MIX_SIZE ; i++) {
+    struct sample *s = &secured[i];
+    int size;
+
+    memset(&s->frame, 0, sizeof(s->frame));
+
+    s->frame.control  = MT_DATA | MC_SECURITY | MC_PANCOMP;
+    s->frame.control |= MAM_SHORT << MC_DAM_SHR;
+    s->frame.control |= MAM_LONG << MC_SAM_SHR;
+    s->frame.control |= MV_CURRENT << MC_VERSION_SHR;
+
+    s->frame.seqno   = xorshift32();
+    s->frame.dst.pan = xorshift32();
+    s->frame.dst.mac = random_address(MAM_SHORT);
+    s->frame.src.pan = s->frame.dst.pan;
+    s->frame.src.mac = random_address(MAM_LONG);
+
+    s->security.control   = SL_ENC_MIC_64 | KIM_INDEX << SC_KIM_SHR;
+    s->security.counter   = xorshift32();
+    s->security.key_index = 1;
+    s->security.mic_size  = 8;
+    for(j = 0 ; j < s->security.mic_size ; j++)
+      s->security.mic[j] = xorshift32();
+    s->frame.security = &s->security;
+
+    /* Header (15), auxiliary header (6), MIC (8) and FCS (2). */
+    s->frame.size = xorshift32() % (MAX_FRAME_SIZE - 31 + 1);
+    for(j = 0 ; j < s->frame.size ; j++)
+      s->payload[j] = xorshift32();
+    s->frame.payload = s->frame.size ? s->payload : NULL;
+
+    size = mac_encode(&s->frame, s->raw);
+    if(size < 0)
+      errx(EXIT_FAILURE, "cannot encode frame %u", i);
+
+    s->raw[size++] = xorshift32();
+    s->raw[size++] = xorshift32();
+    s->size = size;
+  }
+}
+
+static unsigned long run_mac_unsecure(unsigned long n)
+{
+  unsigned long i;
+
+  for(i = 0 ; i < n ; i++) {
+    const struct sample *s = &secured[i % MIX_SIZE];
+    struct mac_frame frame;
+
+    if(mac_decode(&frame, s->raw, true, s->size) < 0)
+      errx(EXIT_FAILURE, "cannot decode frame");
+    mac_unsecure(&frame, s->raw);
+    if(frame.security->status != MS_INVALID)
+      errx(EXIT_FAILURE, "cannot unsecure frame");
+    free_mac_frame(&frame);
+  }
+
+  return n;
+}
+
+/* Data frames carrying IPHC and NHC UDP headers with every stateless
+   compression of the IPv6 fields, some of them in a first fragment. */
+static void setup_lowpan_decode(unsigned long n)
+{
+  static const unsigned int tf_sizes[]   = { 4, 3, 1, 0 };
+  static const unsigned int sam_sizes[]  = { 16, 8, 2, 0 };
+  static const unsigned int mdam_sizes[] = { 16, 6, 4, 1 };
+  static const unsigned int port_sizes[] = { 4, 3, 3, 1 };
+  unsigned int i, j;
+
+  (void)n;
+
+  for(i = 0 ; i < MIX_SIZE ; i++) {
+    struct sample *s = &lowpan[i];
+    unsigned char *p = s->payload;
+    uint16_t iphc = LD_IPHC << 8 | IPHC_NH | (xorshift32() & 0x1b3b);
+    uint8_t nhc = NHC_UDP | (xorshift32() & (NHC_UDP_C | NHC_UDP_P));
+    unsigned int inline_size;
+    int size;
+
+    memset(&s->frame, 0, sizeof(s->frame));
+
+    s->frame.control  = MT_DATA | MC_PANCOMP;
+    s->frame.control |= MAM_SHORT << MC_DAM_SHR;
+    s->frame.control |= (i % 2 ? MAM_SHORT : MAM_LONG) << MC_SAM_SHR;
+    s->frame.control |= MV_CURRENT << MC_VERSION_SHR;
+
+    s->frame.seqno   = xorshift32();
+    s->frame.dst.pan = xorshift32();
+    s->frame.dst.mac = random_address(MAM_SHORT);
+    s->frame.src.pan = s->frame.dst.pan;
+    s->frame.src.mac = random_address(i % 2 ? MAM_SHORT : MAM_LONG);
+
+    if(i % 4 == 0) {
+      *p++ = LD_FRAG1 | 1;
+      *p++ = 0x40;
+      *p++ = xorshift32();
+      *p++ = xorshift32();
+    }
+
+    *p++ = iphc >> 8;
+    *p++ = iphc;
+
+    inline_size  = tf_sizes[(iphc & IPHC_TF) >> IPHC_TF_SHR];
+    inline_size += (iphc & IPHC_HLIM) ? 0 : 1;
+    inline_size += sam_sizes[(iphc & IPHC_SAM) >> IPHC_SAM_SHR];
+    inline_size += (iphc & IPHC_M) ? mdam_sizes[iphc & IPHC_DAM]
+                                   : sam_sizes[iphc & IPHC_DAM];
+    for(j = 0 ; j < inline_size ; j++)
+      *p++ = xorshift32();
+
+    *p++ = nhc;
+    inline_size  = port_sizes[nhc & NHC_UDP_P];
+    inline_size += (nhc & NHC_UDP_C) ? 0 : 2;
+    inline_size += xorshift32() % 32;
+    for(j = 0 ; j < inline_size ; j++)
+      *p++ = xorshift32();
+
+    s->frame.payload = s->payload;
+    s->frame.size    = p - s->payload;
+
+    size = mac_encode(&s->frame, s->raw);
+    if(size < 0)
+      errx(EXIT_FAILURE, "cannot encode frame %u", i);
+
+    s->raw[size++] = xorshift32();
+    s->raw[size++] = xorshift32();
+    s->size = size;
+  }
+}
+
+static unsigned long run_lowpan_decode(unsigned long n)
+{
+  unsigned long i;
+
+  for(i = 0 ; i < n ; i++) {
+    const struct sample *s = &lowpan[i % MIX_SIZE];
+    struct lowpan_packet packet;
+    struct mac_frame frame;
+
+    if(mac_decode(&frame, s->raw, true, s->size) < 0)
+      errx(EXIT_FAILURE, "cannot decode frame");
+    if(lowpan_decode(&packet, &frame) < 0)
+      errx(EXIT_FAILURE, "cannot decode 6LoWPAN packet");
+    free_mac_frame(&frame);
+  }
+
+  return n;
+}
+
+static bool parse_callback(const unsigned char *message,
+                           enum prot_mtype type,
+                           size_t size)
+{
+  (void)message;
+  (void)type;
+  (void)size;
+
+  parsed++;
+
+  return true;
+}
+
+/* Build the stream that the firmware would send for the mix. */
+static void setup_input_parse(unsigned long n)
+{
+  unsigned char *p;
+  unsigned int i;
+
+  (void)n;
+
+  prot_set_version(1);
+
+  for(i = 0 ; i < MIX_SIZE ; i++)
+    stream_size += 1 + mix[i].size;
+
+  p = stream = malloc(stream_size);
+  if(!stream)
+    errx(EXIT_FAILURE, "out of memory");
+
+  for(i = 0 ; i < MIX_SIZE ; i++) {
+    *p++ = mix[i].size; /* information byte of a frame message */
+    memcpy(p, mix[i].raw, mix[i].size);
+    p += mix[i].size;
+  }
+}
+
+/* Same stream with the version 2 of the protocol. The frames are grouped
+   into packets as the firmware does when it receives bursts of frames. */
+static void setup_input_parse_v2(unsigned long n)
+{
+  unsigned char messages[MAX_PACKET_SIZE];
+  size_t size = 0;
+  unsigned int i;
+
+  (void)n;
+
+  prot_set_version(2);
+
+  /* Worst case with all bytes escaped and one packet per frame. */
+  stream = malloc(MIX_SIZE * (2 * (MAX_FRAME_SIZE + 3) + 2));
+  if(!stream)
+    errx(EXIT_FAILURE, "out of memory");
+
+  for(i = 0 ; i < MIX_SIZE ; i++) {
+    if(size + 1 + mix[i].size > MAX_PACKET_SIZE - 2) {
+      stream_size += prot_encode_packet(stream + stream_size, messages, size);
+      size = 0;
+    }
+
+    messages[size++] = mix[i].size;
+    memcpy(messages + size, mix[i].raw, mix[i].size);
+    size += mix[i].size;
+  }
+
+  stream_size += prot_encode_packet(stream + stream_size, messages, size);
+}
+
+static void free_stream(void)
+{
+  free(stream);
+  stream      = NULL;
+  stream_size = 0;
+}
+
+/* Feed the stream in chunks as the input loop does with the UART. */
+static unsigned long run_input_parse(unsigned long n)
+{
+  unsigned char buf[INPUT_CHUNK];
+  size_t offset = 0;
+  int start = 0;
+
+  parsed = 0;
+
+  while(parsed < n) {
+    size_t chunk = sizeof(buf) - start;
+
+    if(chunk > stream_size - offset)
+      chunk = stream_size - offset;
+
+    memcpy(buf + start, stream + offset, chunk);
+    offset += chunk;
+    if(offset == stream_size)
+      offset = 0;
+
+    start = input_parse(buf, start + chunk, parse_callback);
+  }
+
+  return parsed;
+}
+
+static unsigned long run_crc32_c(unsigned long n)
+{
+  volatile uint32_t crc = 0;
+  unsigned long i;
+
+  for(i = 0 ; i < n ; i++) {
+    const struct sample *s = &mix[i % MIX_SIZE];
+    crc = crc32_c(s->raw, s->size, crc);
+  }
+
+  return n;
+}
+
+static unsigned long run_hex_dump(unsigned long n)
+{
+  unsigned long i;
+
+  for(i = 0 ; i < n ; i++) {
+    const struct sample *s = &mix[i % MIX_SIZE];
+    hex_dump(s->raw, s->size);
+  }
+
+  return n;
+}
+
+static unsigned long run_mac_display(unsigned long n)
+{
+  unsigned long i;
+
+  for(i = 0 ; i < n ; i++)
+    mac_display(&mix[i % MIX_SIZE].frame, MI_ALL);
+
+  return n;
+}
+
+static void open_tmp(int flags)
+{
+  tmp_file = iobuf_open(tmp_path, flags, 0600);
+  if(!tmp_file)
+    err(EXIT_FAILURE, "cannot open temporary file");
+}
+
+static void close_tmp(void)
+{
+  if(iobuf_close(tmp_file) < 0)
+    err(EXIT_FAILURE, "cannot close temporary file");
+}
+
+static void write_frames(unsigned long n)
+{
+  unsigned long i;
+
+  for(i = 0 ; i < n ; i++) {
+    const struct sample *s = &mix[i % MIX_SIZE];
+
+    if(iobuf_write(tmp_file, s->raw, s->size) != s->size)
+      err(EXIT_FAILURE, "cannot write to temporary file");
+  }
+}
+
+static void setup_iobuf_write(unsigned long n)
+{
+  (void)n;
+  open_tmp(O_WRONLY | O_TRUNC);
+}
+
+static unsigned long run_iobuf_write(unsigned long n)
+{
+  write_frames(n);
+  iobuf_flush(tmp_file);
+  return n;
+}
+
+static void setup_iobuf_read(unsigned long n)
+{
+  open_tmp(O_WRONLY | O_TRUNC);
+  write_frames(n);
+  close_tmp();
+
+  open_tmp(O_RDONLY);
+}
+
+static unsigned long run_iobuf_read(unsigned long n)
+{
+  unsigned char buf[MAX_FRAME_SIZE];
+  unsigned long i;
+
+  for(i = 0 ; i < n ; i++) {
+    const struct sample *s = &mix[i % MIX_SIZE];
+
+    if(iobuf_read(tmp_file, buf, s->size) != s->size)
+      err(EXIT_FAILURE, "cannot read from temporary file");
+  }
+
+  return n;
+}
+
+static unsigned long run_pcap_write(unsigned long n)
+{
+  unsigned long i;
+
+  open_writing_pcap(tmp_path);
+
+  for(i = 0 ; i < n ; i++) {
+    const struct sample *s = &mix[i % MIX_SIZE];
+    pcap_append_frame(s->raw, s->size);
+  }
+
+  close_writing_pcap();
+
+  return n;
+}
+
+static void setup_pcap_read(unsigned long n)
+{
+  run_pcap_write(n);
+}
+
+static unsigned long run_pcap_read(unsigned long n)
+{
+  unsigned long count = 0;
+
+  open_reading_pcap(tmp_path);
+
+  while(1) {
+    /* Only the lower bits are read into these. */
+    struct timeval tv = { 0 };
+    size_t size = 0;
+    unsigned char *frame = pcap_read_frame(&size, &tv);
+
+    if(!frame)
+      break;
+
+    free(frame);
+    count++;
+  }
+
+  close_reading_pcap();
+
+  if(count != n)
+    errx(EXIT_FAILURE, "unexpected number of frames in pcap file");
+
+  return count;
+}
+
+static unsigned long run_pcap_scan(unsigned long n)
+{
+  unsigned char data[PCAP_MAX_RECORD_SIZE];
+  struct pcap_record rec;
+  unsigned long count = 0;
+  pcap_scan_t ps;
+
+  ps = pcap_scan_open(tmp_path);
+
+  while(pcap_scan_next(ps, &rec, data))
+    count++;
+
+  pcap_scan_close(ps);
+
+  if(count != n)
+    errx(EXIT_FAILURE, "unexpected number of frames in pcap file");
+
+  return count;
+}
+
+/* Sink of the firmware formatter. This is what the extra protocol does
+   without the send_control() call. */
+struct chunk {
+  unsigned int size;
+  unsigned long sent;
+  char buf[MAX_MESSAGE_SIZE - 1];
+};
+
+static void put_chunk(const char *s, unsigned int size, void *data)
+{
+  struct chunk *chunk = data;
+
+  while(size) {
+    unsigned int n = sizeof(chunk->buf) - chunk->size;
+
+    if(n > size)
+      n = size;
+
+    memcpy(chunk->buf + chunk->size, s, n);
+    chunk->size += n;
+    s           += n;
+    size        -= n;
+
+    if(chunk->size == sizeof(chunk->buf)) {
+      chunk->sent += chunk->size;
+      chunk->size  = 0;
+    }
+  }
+}
+
+static int format_chunk(struct chunk *chunk, const char *fmt, ...)
+{
+  va_list ap;
+  int size;
+
+  va_start(ap, fmt);
+  size = vformat(put_chunk, chunk, fmt, ap);
+  va_end(ap);
+
+  chunk->sent += chunk->size;
+  chunk->size  = 0;
+
+  return size;
+}
+
+/* The firmware formatter used to format twice into a buffer on the heap. */
+static int format_malloc(unsigned long *sent, const char *fmt, ...)
+{
+  va_list ap, aq;
+  char *buf;
+  int size;
+
+  va_start(ap, fmt);
+  va_copy(aq, ap);
+
+  size = vsnprintf(NULL, 0, fmt, ap);
+  buf  = malloc(size + 1);
+  if(!buf)
+    errx(EXIT_FAILURE, "out of memory");
+  size = vsprintf(buf, fmt, aq);
+
+  va_end(aq);
+  va_end(ap);
+
+  *sent += strlen(buf);
+  free(buf);
+
+  return size;
+}
+
+/* A typical debug line of a firmware, one per frame. */
+#define DEBUG_LINE "rx frame #%lu from %04x: %u bytes, seqno %u, rssi %d dBm%s"
+
+static unsigned long run_format(unsigned long n)
+{
+  struct chunk chunk = { .size = 0, .sent = 0 };
+  unsigned long i;
+
+  for(i = 0 ; i < n ; i++) {
+    const struct sample *s = &mix[i % MIX_SIZE];
+    format_chunk(&chunk, DEBUG_LINE, i, (unsigned int)(s->frame.src.mac & 0xffff), s->size,
+                 s->frame.seqno, -(int)(s->size % 64) - 30,
+                 s->frame.control & MC_ACK ? " (ack)" : "");
+  }
+
+  return chunk.sent ? n : 0;
+}
+
+static unsigned long run_format_malloc(unsigned long n)
+{
+  unsigned long i, sent = 0;
+
+  for(i = 0 ; i < n ; i++) {
+    const struct sample *s = &mix[i % MIX_SIZE];
+    format_malloc(&sent, DEBUG_LINE, i, (unsigned int)(s->frame.src.mac & 0xffff), s->size,
+                  s->frame.seqno, -(int)(s->size % 64) - 30,
+                  s->frame.control & MC_ACK ? " (ack)" : "");
+  }
+
+  return sent ? n : 0;
+}
+
+static const struct bench benches[] = {
+  { "mac_decode", NULL, run_mac_decode, NULL, false },
+  { "mac_encode", NULL, run_mac_encode, NULL, false },
+  { "mac_unsecure", setup_mac_unsecure, run_mac_unsecure, NULL, false },
+  { "lowpan_decode", setup_lowpan_decode, run_lowpan_decode, NULL, false },
+  { "input_parse", setup_input_parse, run_input_parse, free_stream, false },
+  { "input_parse_v2", setup_input_parse_v2, run_input_parse, free_stream, false },
+  { "crc32_c", NULL, run_crc32_c, NULL, false },
+  { "hex_dump", NULL, run_hex_dump, NULL, true },
+  { "mac_display", NULL, run_mac_display, NULL, true },
+  { "iobuf_write", setup_iobuf_write, run_iobuf_write, close_tmp, false },
+  { "iobuf_read", setup_iobuf_read, run_iobuf_read, close_tmp, false },
+  { "pcap_write", NULL, run_pcap_write, NULL, false },
+  { "pcap_read", setup_pcap_read, run_pcap_read, NULL, false },
+  { "pcap_scan", setup_pcap_read, run_pcap_scan, NULL, false },
+  { "format", NULL, run_format, NULL, false },
+  { "format_malloc", NULL, run_format_malloc, NULL, false },
+  { NULL, NULL, NULL, NULL, false }
+};
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* Run a benchmark for the specified number of rounds and report the median
+   and the best time per frame. */
+static void run_bench(const struct bench *b, unsigned long n, unsigned int rounds)
+{
+  double results[MAX_ROUNDS];
+  double median;
+  unsigned int i;
+  int null_fd = -1, saved_fd = -1;
+
+  if(b->quiet) {
+    null_fd  = open("/dev/null", O_WRONLY);
+    saved_fd = dup(STDOUT_FILENO);
+    if(null_fd < 0 || saved_fd < 0)
+      err(EXIT_FAILURE, "cannot redirect output");
+  }
+
+  for(i = 0 ; i < rounds ; i++) {
+    unsigned long count;
+    double start;
+
+    if(b->setup)
+      b->setup(n);
+
+    if(b->quiet) {
+      fflush(stdout);
+      dup2(null_fd, STDOUT_FILENO);
+    }
+
+    start = now();
+    count = b->run(n);
+    if(b->quiet)
+      fflush(stdout);
+    results[i] = (now() - start) / count;
+
+    if(b->quiet)
+      dup2(saved_fd, STDOUT_FILENO);
+
+    if(b->teardown)
+      b->teardown();
+  }
+
+  if(b->quiet) {
+    close(null_fd);
+    close(saved_fd);
+  }
+
+  qsort(results, rounds, sizeof(double), compare_double);
+
+  if(rounds % 2)
+    median = results[rounds / 2];
+  else
+    median = (results[rounds / 2 - 1] + results[rounds / 2]) / 2;
+
+  printf("%s\t%lu\t%.1f\t%.1f\t%.0f\n", b->name, n, median, results[0],
+         1e9 / median);
+  fflush(stdout);
+}
+
+static bool selected(const char *name, char *argv[], int argc)
+{
+  int i;
+
+  if(!argc)
+    return true;
+
+  for(i = 0 ; i < argc ; i++)
+    if(!strcmp(name, argv[i]))
+      return true;
+
+  return false;
+}
+
+static void remove_tmp(void)
+{
+  unlink(tmp_path);
+}
+
+int main(int argc, char *argv[])
+{
+  const struct bench *b;
+  const char *name;
+  unsigned long frames = DEFAULT_FRAMES;
+  unsigned int rounds  = DEFAULT_ROUNDS;
+  unsigned int seed_value = DEFAULT_SEED;
+  int err_v;
+  int fd;
+  int i;
+
+  int exit_status = EXIT_FAILURE;
+
+  name = (const char *)strrchr(argv[0], '/');
+  name = name ? (name + 1) : argv[0];
+
+  enum opt {
+    OPT_COMMIT = 0x100
+  };
+
+  struct opt_help helps[] = {
+    { 'h', "help", "Show this help message" },
+    { 'V', "version", "Print version information" },
+#ifdef COMMIT
+    { 0, "commit", "Display commit information" },
+#endif /* COMMIT */
+    { 'l', "list", "List the available benchmarks" },
+    { 'n', "frames", "Number of frames per round (default: 200000)" },
+    { 'r', "rounds", "Number of rounds (default: 5)" },
+    { 's', "seed", "Seed of the frame mix (default: 1)" },
+    { 0, NULL, NULL }
+  };
+
+  struct option opts[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "version", no_argument, NULL, 'V' },
+#ifdef COMMIT
+    { "commit", no_argument, NULL, OPT_COMMIT },
+#endif /* COMMIT */
+    { "list", no_argument, NULL, 'l' },
+    { "frames", required_argument, NULL, 'n' },
+    { "rounds", required_argument, NULL, 'r' },
+    { "seed", required_argument, NULL, 's' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while(1) {
+    int c = getopt_long(argc, argv, "hVln:r:s:", opts, NULL);
+
+    if(c == -1)
+      break;
+
+    switch(c) {
+    case('l'):
+      for(b = benches ; b->name ; b++)
+        printf("%s\n", b->name);
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+    case('n'):
+      frames = xatou(optarg, &err_v);
+      if(err_v || frames == 0)
+        errx(EXIT_FAILURE, "invalid number of frames");
+      break;
+    case('r'):
+      rounds = xatou(optarg, &err_v);
+      if(err_v || rounds == 0 || rounds > MAX_ROUNDS)
+        errx(EXIT_FAILURE, "invalid number of rounds");
+      break;
+    case('s'):
+      seed_value = xatou(optarg, &err_v);
+      if(err_v)
+        errx(EXIT_FAILURE, "invalid seed");
+      break;
+#ifdef COMMIT
+    case(OPT_COMMIT):
+      commit();
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+#endif /* COMMIT */
+    case('V'):
+      version(TARGET);
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+    case('h'):
+      exit_status = EXIT_SUCCESS;
+    default:
+      help(name, "[OPTIONS] ... [BENCHMARK]...", helps);
+      goto EXIT;
+    }
+  }
+
+  argc -= optind;
+  argv += optind;
+
+  for(i = 0 ; i < argc ; i++) {
+    for(b = benches ; b->name ; b++)
+      if(!strcmp(b->name, argv[i]))
+        break;
+    if(!b->name)
+      errx(EXIT_FAILURE, "unknown benchmark '%s'", argv[i]);
+  }
+
+  fd = mkstemp(tmp_path);
+  if(fd < 0)
+    err(EXIT_FAILURE, "cannot create temporary file");
+  close(fd);
+  atexit(remove_tmp);
+
+  seed(seed_value);
+  build_mix();
+
+  /* The header identifies the build so that results
+     of different commits can be compared. */
+  printf("# %s seed=%u frames=%lu rounds=%u\n", PACKAGE_VERSION, seed_value,
+         frames, rounds);
+  printf("bench\tframes\tns/frame\tmin-ns/frame\tframes/s\n");
+
+  for(b = benches ; b->name ; b++)
+    if(selected(b->name, argv, argc))
+      run_bench(b, frames, rounds);
+
+  exit_status = EXIT_SUCCESS;
+
+EXIT:
+  return exit_status;
+}
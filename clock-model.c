@@ -0,0 +1,149 @@
+/* File: clock-model.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <err.h>
+
+#include "clock-model.h"
+
+/* The regression is only trusted when the samples span at least this time.
+   Before that the nominal frequency is more accurate than a slope fitted on
+   a few milliseconds of jittery samples. */
+#define MIN_SPREAD 1000000 /* us */
+
+struct clock_model {
+  double nominal;     /* nominal microseconds per tick */
+  double lambda;      /* forgetting factor */
+
+  bool started;
+  uint64_t last_tick; /* unwrapped */
+  uint64_t last_host; /* microseconds */
+
+  /* Origin of the samples to keep the values small. */
+  uint64_t tick0;
+  uint64_t host0;
+
+  /* Exponentially weighted means and co-moments (West's algorithm)
+     with x the ticks and y the host time. */
+  double w;
+  double mx, my;
+  double cxx, cxy, cyy;
+};
+
+clock_model_t clock_model_create(unsigned long hz, unsigned int window)
+{
+  struct clock_model *model = malloc(sizeof(struct clock_model));
+
+  if(!model)
+    errx(EXIT_FAILURE, "out of memory");
+
+  memset(model, 0, sizeof(struct clock_model));
+
+  model->nominal = 1e6 / hz;
+  model->lambda  = exp(-1. / window);
+
+  return model;
+}
+
+/* Slope of the model in microseconds per tick. */
+static double slope(const struct clock_model *model)
+{
+  if(model->w == 0 ||
+     sqrt(model->cxx / model->w) * model->nominal < MIN_SPREAD)
+    return model->nominal;
+
+  return model->cxy / model->cxx;
+}
+
+/* Extend the tick counter to 64 bits. The host time tells us how many times
+   the counter wrapped around when we did not receive anything for long. */
+static uint64_t unwrap(struct clock_model *model, uint32_t tick, uint64_t host)
+{
+  uint64_t delta = (uint32_t)(tick - (uint32_t)model->last_tick);
+
+  if(host > model->last_host) {
+    double expected = (host - model->last_host) / slope(model);
+
+    if(expected > delta + 2147483648.)
+      delta += (uint64_t)((expected - delta) / 4294967296. + .5) << 32;
+  }
+
+  return model->last_tick + delta;
+}
+
+void clock_model_convert(clock_model_t model, uint32_t tick, struct timeval *tv)
+{
+  uint64_t host = (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+  uint64_t time;
+  double x, y, dx, dy;
+
+  if(!model->started) {
+    model->started   = true;
+    model->last_tick = model->tick0 = tick;
+    model->host0     = host;
+  }
+  else
+    model->last_tick = unwrap(model, tick, host);
+
+  model->last_host = host;
+
+  x = model->last_tick - model->tick0;
+  y = (double)host - model->host0;
+
+  dx = x - model->mx;
+  dy = y - model->my;
+
+  model->w    = model->lambda * model->w + 1;
+  model->mx  += dx / model->w;
+  model->my  += dy / model->w;
+  model->cxx  = model->lambda * model->cxx + dx * (x - model->mx);
+  model->cxy  = model->lambda * model->cxy + dx * (y - model->my);
+  model->cyy  = model->lambda * model->cyy + dy * (y - model->my);
+
+  time = model->host0 + llround(model->my + slope(model) * (x - model->mx));
+
+  tv->tv_sec  = time / 1000000;
+  tv->tv_usec = time % 1000000;
+}
+
+double clock_model_drift(clock_model_t model)
+{
+  return (model->nominal / slope(model) - 1) * 1e6;
+}
+
+double clock_model_jitter(clock_model_t model)
+{
+  double s = slope(model);
+  double var;
+
+  if(model->w == 0)
+    return 0;
+
+  var = (model->cyy - 2 * s * model->cxy + s * s * model->cxx) / model->w;
+
+  return var > 0 ? sqrt(var) : 0;
+}
+
+void clock_model_destroy(clock_model_t model)
+{
+  free(model);
+}
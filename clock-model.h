@@ -0,0 +1,57 @@
+/* File: clock-model.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _CLOCK_MODEL_H_
+#define _CLOCK_MODEL_H_
+
+#include <sys/time.h>
+#include <stdint.h>
+
+/* Map the ticks of the firmware clock to the host clock. The host time at
+   which each message is received includes the latency of the serial line
+   (up to a few milliseconds with USB adapters). A linear regression of the
+   host time against the ticks averages the jitter of this latency out while
+   following the drift between both clocks. The mean latency remains as a
+   constant offset which does not change the interval between frames. Older
+   samples are forgotten exponentially so that the model adapts to slow
+   changes of the drift (eg. temperature). */
+
+typedef struct clock_model * clock_model_t;
+
+/* Create a model for a clock of the specified nominal frequency. The window
+   is the number of samples after which the weight of a sample is divided by
+   e. The nominal frequency is used until enough samples are known. */
+clock_model_t clock_model_create(unsigned long hz, unsigned int window);
+
+/* Add a sample, that is the 32-bits tick counter received along with a
+   message and the host time at which the message was received. The time is
+   replaced by the time of the tick according to the model. The counter may
+   wrap around, even more than once between two samples. */
+void clock_model_convert(clock_model_t model, uint32_t tick, struct timeval *tv);
+
+/* Drift of the firmware clock relative to the host clock in parts per
+   million. This is positive when the firmware clock is faster. */
+double clock_model_drift(clock_model_t model);
+
+/* Standard deviation of the host time around the model in microseconds.
+   This is mostly the jitter of the serial line. */
+double clock_model_jitter(clock_model_t model);
+
+/* Destroy the model. */
+void clock_model_destroy(clock_model_t model);
+
+#endif /* _CLOCK_MODEL_H_ */
@@ -0,0 +1,72 @@
+/* File: crc16.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "crc16.h"
+
+/* Reflected polynomial 0x1021 (x^16 + x^12 + x^5 + 1). */
+#define CRC16_POLY 0x8408
+
+/* Tables for slicing-by-8. The first one is the usual byte-wise table and
+   table k gives the CRC of a byte followed by k zero bytes. */
+static uint16_t crc16_tbl[8][256];
+static bool crc16_ready;
+
+static void crc16_init(void)
+{
+  unsigned int i, k;
+
+  for(i = 0 ; i < 256 ; i++) {
+    uint16_t crc = i;
+
+    for(k = 0 ; k < 8 ; k++)
+      crc = (crc & 1) ? (crc >> 1) ^ CRC16_POLY : crc >> 1;
+
+    crc16_tbl[0][i] = crc;
+  }
+
+  for(i = 0 ; i < 256 ; i++)
+    for(k = 1 ; k < 8 ; k++)
+      crc16_tbl[k][i] = (crc16_tbl[k - 1][i] >> 8) ^
+                        crc16_tbl[0][crc16_tbl[k - 1][i] & 0xff];
+
+  crc16_ready = true;
+}
+
+uint16_t crc16(const unsigned char *s, size_t len, uint16_t crc)
+{
+  if(!crc16_ready)
+    crc16_init();
+
+  /* Eight bytes at a time. The first two are combined with the
+     current CRC while the other ones are independent lookups. */
+  for(; len >= 8 ; len -= 8, s += 8) {
+    crc ^= s[0] | s[1] << 8;
+    crc  = crc16_tbl[7][crc & 0xff] ^ crc16_tbl[6][crc >> 8] ^
+           crc16_tbl[5][s[2]] ^ crc16_tbl[4][s[3]] ^
+           crc16_tbl[3][s[4]] ^ crc16_tbl[2][s[5]] ^
+           crc16_tbl[1][s[6]] ^ crc16_tbl[0][s[7]];
+  }
+
+  while(len--)
+    crc = (crc >> 8) ^ crc16_tbl[0][(crc ^ *s++) & 0xff];
+
+  return crc;
+}
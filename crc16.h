@@ -0,0 +1,29 @@
+/* File: crc16.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _CRC16_H_
+#define _CRC16_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* CRC-16 ITU-T with the bits in reverse order as used for the FCS of
+   IEEE 802.15.4 frames. Start with zero and pass the previous value to
+   compute the CRC of a buffer in multiple parts. */
+uint16_t crc16(const unsigned char *s, size_t len, uint16_t crc);
+
+#endif /* _CRC16_H_ */
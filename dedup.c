@@ -0,0 +1,339 @@
+/* File: dedup.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#define _BSD_SOURCE
+
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <err.h>
+
+#include "crc32.h"
+#include "dedup.h"
+
+/* The window is split into time buckets. Frames are always inserted into the
+   most recent bucket and a whole bucket is emitted when it leaves the window.
+   With N buckets each one spans window / (N - 1) so that two frames closer
+   than the window are always present at the same time. */
+#define DEDUP_BUCKETS 5
+
+struct entry {
+  struct timeval tv;     /* timestamp of the earliest copy */
+  uint32_t hash;
+  uint32_t sources;
+  unsigned int origin;   /* source of the earliest copy */
+  unsigned int copies;
+  unsigned char size;
+  unsigned int length;
+  unsigned char data[DEDUP_MAX_FRAME_SIZE];
+};
+
+struct bucket {
+  unsigned int count;    /* entries are kept in insertion order */
+  struct entry *entries;
+  uint32_t *index;       /* open addressing, position + 1 or zero if free */
+};
+
+struct dedup {
+  uint64_t width;        /* span of a bucket in microseconds */
+  uint64_t head;         /* time slot of the most recent bucket */
+  bool started;
+  bool ignore_fcs;
+
+  unsigned int capacity; /* per bucket */
+  uint32_t index_mask;
+
+  struct bucket buckets[DEDUP_BUCKETS];
+  struct dedup_stats stats;
+
+  void (*emit)(const struct dedup_frame *, void *);
+  void *data;
+};
+
+static void * xmalloc(size_t size)
+{
+  void *p = malloc(size);
+  if(!p)
+    errx(EXIT_FAILURE, "out of memory");
+  return p;
+}
+
+dedup_t dedup_create(unsigned long window,
+                     unsigned int capacity,
+                     bool ignore_fcs,
+                     void (*emit)(const struct dedup_frame *frame, void *data),
+                     void *data)
+{
+  struct dedup *dd = xmalloc(sizeof(struct dedup));
+  uint32_t index_size;
+  int i;
+
+  memset(dd, 0, sizeof(struct dedup));
+
+  dd->width      = (window + DEDUP_BUCKETS - 2) / (DEDUP_BUCKETS - 1);
+  dd->ignore_fcs = ignore_fcs;
+  dd->emit       = emit;
+  dd->data       = data;
+
+  if(dd->width == 0)
+    dd->width = 1;
+
+  dd->capacity = capacity / DEDUP_BUCKETS;
+  if(dd->capacity == 0)
+    dd->capacity = 1;
+
+  /* Keep the load of the index below one half. */
+  for(index_size = 2 ; index_size < dd->capacity * 2 ; index_size <<= 1);
+  dd->index_mask = index_size - 1;
+
+  for(i = 0 ; i < DEDUP_BUCKETS ; i++) {
+    struct bucket *b = &dd->buckets[i];
+
+    b->entries = xmalloc(dd->capacity * sizeof(struct entry));
+    b->index   = xmalloc(index_size * sizeof(uint32_t));
+    memset(b->index, 0, index_size * sizeof(uint32_t));
+  }
+
+  return dd;
+}
+
+static void emit_frame(struct dedup *dd,
+                       const unsigned char *data,
+                       unsigned int size,
+                       unsigned int length,
+                       const struct timeval *tv,
+                       uint32_t sources,
+                       unsigned int origin,
+                       unsigned int copies)
+{
+  struct dedup_frame frame = {
+    .data    = data,
+    .size    = size,
+    .length  = length,
+    .tv      = *tv,
+    .sources = sources,
+    .origin  = origin,
+    .copies  = copies
+  };
+
+  dd->stats.unique++;
+  dd->emit(&frame, dd->data);
+}
+
+/* Emit all the entries of a bucket and clear it. */
+static unsigned int expire_bucket(struct dedup *dd, struct bucket *b)
+{
+  unsigned int i, count = b->count;
+
+  if(!count)
+    return 0;
+
+  for(i = 0 ; i < count ; i++) {
+    const struct entry *e = &b->entries[i];
+    emit_frame(dd, e->data, e->size, e->length, &e->tv, e->sources, e->origin,
+               e->copies);
+  }
+
+  b->count = 0;
+  memset(b->index, 0, (dd->index_mask + 1) * sizeof(uint32_t));
+
+  return count;
+}
+
+/* Move the head to a new time slot and expire
+   the buckets which are now out of the window. */
+static void advance(struct dedup *dd, uint64_t slot)
+{
+  uint64_t s;
+
+  if(!dd->started) {
+    dd->head    = slot;
+    dd->started = true;
+    return;
+  }
+
+  if(slot <= dd->head)
+    return;
+
+  /* Oldest buckets first so that frames are emitted in order. */
+  for(s = dd->head + 1 ; s <= slot && s <= dd->head + DEDUP_BUCKETS ; s++)
+    expire_bucket(dd, &dd->buckets[s % DEDUP_BUCKETS]);
+
+  dd->head = slot;
+}
+
+/* Make room in the head bucket by emitting the oldest frames early. */
+static void evict(struct dedup *dd)
+{
+  uint64_t s;
+
+  for(s = dd->head + 1 ; s < dd->head + DEDUP_BUCKETS ; s++)
+    dd->stats.evicted += expire_bucket(dd, &dd->buckets[s % DEDUP_BUCKETS]);
+
+  dd->stats.evicted += expire_bucket(dd, &dd->buckets[dd->head % DEDUP_BUCKETS]);
+}
+
+/* Find a copy of the frame which was not yet seen by this source. A frame
+   seen twice by the same source is a retransmission, not a duplicate. */
+static struct entry * lookup(struct dedup *dd,
+                             const unsigned char *frame,
+                             unsigned int size,
+                             unsigned int length,
+                             unsigned int key_size,
+                             uint32_t hash,
+                             uint32_t source_bit)
+{
+  int i;
+
+  for(i = 0 ; i < DEDUP_BUCKETS ; i++) {
+    struct bucket *b = &dd->buckets[i];
+    uint32_t pos;
+
+    if(!b->count)
+      continue;
+
+    for(pos = hash & dd->index_mask ; b->index[pos] ;
+        pos = (pos + 1) & dd->index_mask) {
+      struct entry *e = &b->entries[b->index[pos] - 1];
+
+      if(e->hash == hash && e->size == size &&
+         e->length == length &&
+         !(e->sources & source_bit) &&
+         !memcmp(e->data, frame, key_size))
+        return e;
+    }
+  }
+
+  return NULL;
+}
+
+static void insert(struct dedup *dd,
+                   const unsigned char *frame,
+                   unsigned int size,
+                   unsigned int length,
+                   uint32_t hash,
+                   const struct timeval *tv,
+                   unsigned int source)
+{
+  struct bucket *b = &dd->buckets[dd->head % DEDUP_BUCKETS];
+  struct entry *e;
+  uint32_t pos;
+
+  if(b->count == dd->capacity) {
+    evict(dd);
+    assert(b->count == 0);
+  }
+
+  e = &b->entries[b->count++];
+  e->tv      = *tv;
+  e->hash    = hash;
+  e->sources = (uint32_t)1 << source;
+  e->origin  = source;
+  e->copies  = 1;
+  e->size    = size;
+  e->length  = length;
+  memcpy(e->data, frame, size);
+
+  for(pos = hash & dd->index_mask ; b->index[pos] ;
+      pos = (pos + 1) & dd->index_mask);
+  b->index[pos] = b->count;
+}
+
+void dedup_push(dedup_t dd,
+                const unsigned char *frame,
+                unsigned int size,
+                unsigned int length,
+                const struct timeval *tv,
+                unsigned int source)
+{
+  unsigned int key_size = size;
+  uint64_t usec;
+  uint32_t hash;
+  struct entry *e;
+
+  assert(source < DEDUP_MAX_SOURCES);
+
+  dd->stats.frames++;
+
+  usec = (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+  advance(dd, usec / dd->width);
+
+  /* No 802.15.4 frame should be that large. We cannot retain it so we just
+     let it pass. This does not change the order much as it would only be
+     emitted before frames that are at most one window older. */
+  if(size > DEDUP_MAX_FRAME_SIZE) {
+    emit_frame(dd, frame, size, length, tv, (uint32_t)1 << source, source, 1);
+    return;
+  }
+
+  if(dd->ignore_fcs && size > 2)
+    key_size -= 2;
+
+  hash = crc32_c(frame, key_size, 0);
+
+  e = lookup(dd, frame, size, length, key_size, hash, (uint32_t)1 << source);
+  if(e) {
+    dd->stats.duplicates++;
+
+    e->sources |= (uint32_t)1 << source;
+    e->copies++;
+
+    /* With live sources the copies may not arrive in order. */
+    if(timercmp(tv, &e->tv, <)) {
+      e->tv     = *tv;
+      e->origin = source;
+      memcpy(e->data, frame, size);
+    }
+
+    return;
+  }
+
+  insert(dd, frame, size, length, hash, tv, source);
+}
+
+void dedup_flush(dedup_t dd)
+{
+  uint64_t s;
+
+  if(!dd->started)
+    return;
+
+  for(s = dd->head + 1 ; s <= dd->head + DEDUP_BUCKETS ; s++)
+    expire_bucket(dd, &dd->buckets[s % DEDUP_BUCKETS]);
+}
+
+void dedup_get_stats(dedup_t dd, struct dedup_stats *stats)
+{
+  *stats = dd->stats;
+}
+
+void dedup_destroy(dedup_t dd)
+{
+  int i;
+
+  dedup_flush(dd);
+
+  for(i = 0 ; i < DEDUP_BUCKETS ; i++) {
+    free(dd->buckets[i].entries);
+    free(dd->buckets[i].index);
+  }
+
+  free(dd);
+}
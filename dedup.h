@@ -0,0 +1,93 @@
+/* File: dedup.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include <sys/time.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* This is a streaming stage which removes frames captured more than once,
+   typically by several sniffers listening on the same channel. Frames are
+   identified by a hash of their raw bytes and are considered duplicates
+   when they are seen again within a time window. Frames are retained in
+   time buckets until they leave the window, then they are emitted with the
+   list of sources which saw them. The stage is fed in time order and emits
+   frames in the same order with a delay of about one window.
+
+   The memory is bounded by the capacity given at creation. When the
+   capacity is exceeded, the oldest frames are emitted early and may not
+   be recognized as duplicates anymore. */
+
+/* Maximum number of sources (bits in the sources mask). */
+#define DEDUP_MAX_SOURCES    32
+
+/* Larger frames are emitted immediately without deduplication. */
+#define DEDUP_MAX_FRAME_SIZE 127
+
+struct dedup_frame {
+  const unsigned char *data;
+  unsigned int size;
+  unsigned int length; /* original length of the frame */
+  struct timeval tv;   /* timestamp of the earliest copy */
+  uint32_t sources;    /* mask of the sources which saw the frame */
+  unsigned int origin; /* source of the earliest copy */
+  unsigned int copies; /* number of copies received */
+};
+
+struct dedup_stats {
+  unsigned long frames;     /* frames pushed */
+  unsigned long unique;     /* frames emitted */
+  unsigned long duplicates; /* copies removed */
+  unsigned long evicted;    /* frames emitted early because of the capacity */
+};
+
+typedef struct dedup * dedup_t;
+
+/* Create a deduplication stage. The window is expressed in microseconds and
+   the capacity is the maximum number of frames retained at the same time.
+   The emit callback is called for each unique frame. When ignore_fcs is
+   true, the last two bytes of the frames are not considered (some firmwares
+   replace the FCS with link quality information). */
+dedup_t dedup_create(unsigned long window,
+                     unsigned int capacity,
+                     bool ignore_fcs,
+                     void (*emit)(const struct dedup_frame *frame, void *data),
+                     void *data);
+
+/* Push a frame received from the specified source (below
+   DEDUP_MAX_SOURCES). Only the first size bytes over length were captured.
+   A frame seen again by the same source is a retransmission and is never
+   considered as a duplicate. */
+void dedup_push(dedup_t dd,
+                const unsigned char *frame,
+                unsigned int size,
+                unsigned int length,
+                const struct timeval *tv,
+                unsigned int source);
+
+/* Emit all the frames still retained. */
+void dedup_flush(dedup_t dd);
+
+/* Get the statistics of the stage. */
+void dedup_get_stats(dedup_t dd, struct dedup_stats *stats);
+
+/* Flush and destroy the stage. */
+void dedup_destroy(dedup_t dd);
+
+#endif /* _DEDUP_H_ */
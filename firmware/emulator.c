@@ -0,0 +1,814 @@
+/* File: emulator.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+/* This is a host build of the firmware protocol behind a pseudo-terminal.
+   The host tools open the slave side as they would open the UART of a real
+   transceiver. The emulated radio answers to the host (ready byte, pings,
+   injections) and generates synthetic traffic. The traffic goes through an
+   output buffer of limited size, which is drained at the speed of the
+   emulated UART. Frames are dropped when this buffer is full, as a real
+   transceiver would do when the host cannot keep up. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#include "version.h"
+#include "xatoi.h"
+#include "help.h"
+#include "802154-parse.h"
+#include "protocol.h"
+
+#define TARGET "WSN-Emulator"
+
+/* Smallest frame that we generate. That is a data frame with short
+   addresses, PAN ID compression and no payload (with the FCS). */
+#define MIN_FRAME_SIZE      11
+
+#define DEFAULT_BUFFER_SIZE 4096
+#define DEFAULT_BOOT_DELAY  100 /* ms */
+#define DEFAULT_NODES       4
+#define DEFAULT_SEED        1
+
+/* Interval used to check whether the host opened the terminal. */
+#define HANGUP_INTERVAL     100 /* ms */
+
+/* Maximum number of frames generated at once when we are late. */
+#define MAX_BURST           1024
+
+/* Bytes that the emulated UART may send at once when paced. */
+#define UART_FIFO_SIZE      64
+
+/* Interval at which the main loop parses the bytes queued by the emulated
+   UART interrupt. */
+#define POLL_INTERVAL       1 /* ms */
+
+struct stats {
+  unsigned long generated; /* frames received by the emulated radio */
+  unsigned long sent;      /* frames sent to the host */
+  unsigned long dropped;   /* frames dropped on output buffer overrun */
+  unsigned long injected;  /* frames injected by the host */
+  unsigned long controls;  /* control messages from the host */
+  unsigned long long bytes;
+};
+
+static int master;
+static const char *link_path;
+static volatile sig_atomic_t stop;
+
+/* With the ISR mode the terminal is read from another thread which stands
+   for the UART interrupt. It queues the bytes with input_isr() while the
+   main loop parses them with protocol_poll(). */
+static bool isr_mode;
+static volatile sig_atomic_t isr_enabled;
+
+/* The output buffer. Responses to the host are always accepted while
+   synthetic traffic is limited to the configured size. */
+static unsigned char *out;
+static size_t out_head;
+static size_t out_size;
+static size_t out_capacity;
+static size_t out_limit = DEFAULT_BUFFER_SIZE;
+
+static struct stats stats;
+
+/* Traffic configuration. */
+static unsigned int rate;
+static unsigned int min_size = MIN_FRAME_SIZE;
+static unsigned int max_size = MAX_MESSAGE_SIZE;
+static unsigned int nb_nodes = DEFAULT_NODES;
+static unsigned long count;
+static bool poisson;
+static unsigned char *seqnos;
+
+static unsigned short channel = 11;
+
+/* Relative traffic on each channel. There is traffic
+   on all the channels when none is specified. */
+static unsigned int traffic[NB_CHANNELS];
+static unsigned int max_traffic;
+
+/* Speed of the emulated UART, zero when unlimited. */
+static unsigned int baud;
+static unsigned int initial_baud;
+
+static uint32_t state = DEFAULT_SEED;
+
+static uint32_t xorshift32(void)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+
+  return state;
+}
+
+static uint64_t now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* CRC-16 used by IEEE 802.15.4 (ITU-T, LSB first). */
+static uint16_t crc16(const unsigned char *data, unsigned int size)
+{
+  uint16_t crc = 0;
+  int i;
+
+  while(size--) {
+    crc ^= *data++;
+    for(i = 0 ; i < 8 ; i++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+  }
+
+  return crc;
+}
+
+static void out_reserve(size_t size)
+{
+  /* Move the pending data to the beginning first. */
+  if(out_head) {
+    memmove(out, out + out_head, out_size);
+    out_head = 0;
+  }
+
+  if(out_size + size <= out_capacity)
+    return;
+
+  while(out_size + size > out_capacity)
+    out_capacity = out_capacity ? out_capacity * 2 : out_limit;
+
+  out = realloc(out, out_capacity);
+  if(!out)
+    errx(EXIT_FAILURE, "out of memory");
+}
+
+/* This is the send function of the protocol, that is our UART. */
+static void uart_send(const unsigned char *data, unsigned int size)
+{
+  if(out_head + out_size + size > out_capacity)
+    out_reserve(size);
+
+  memcpy(out + out_head + out_size, data, size);
+  out_size += size;
+}
+
+static void frame_cb(unsigned char *frame, unsigned int size)
+{
+  stats.injected++;
+
+  /* The frame would be sent by the radio here. We confirm the processing and
+     acknowledge the frame immediately when an ACK is requested. */
+  send_control(PROT_CTYPE_OK, NULL, 0);
+
+  if(size >= 1 && frame[0] & 0x20 /* ACK request */)
+    send_control(PROT_CTYPE_ACK, NULL, 0);
+}
+
+static void control_cb(enum prot_ctype type, unsigned char *data,
+                       unsigned int size)
+{
+  unsigned short value;
+
+  stats.controls++;
+
+  switch(type) {
+  case(PROT_CTYPE_CONFIG_CHANNEL):
+    if(size != sizeof(unsigned short)) {
+      cli_error();
+      break;
+    }
+
+    memcpy(&value, data, sizeof(unsigned short));
+    if(value < 11 || value > 26) {
+      cli_error();
+      break;
+    }
+
+    /* The host does not expect any answer. */
+    channel = value;
+    break;
+  default:
+    cli_error();
+    break;
+  }
+}
+
+/* The emulated radio clock counts microseconds. */
+#define CLOCK_HZ 1000000
+
+static unsigned long radio_clock(void)
+{
+  return now() / 1000;
+}
+
+/* Generate a data frame as received by the emulated radio at the specified
+   time (in nanoseconds). Each node sends frames with its own sequence number
+   so that the drops can be found in the captures with pcap-stats. */
+static void generate_frame(uint64_t when)
+{
+  unsigned char frame[MAX_MESSAGE_SIZE];
+  unsigned int size, node, i;
+  uint16_t fcs;
+
+  size = min_size + xorshift32() % (max_size - min_size + 1);
+  node = xorshift32() % nb_nodes;
+
+  frame[0] = 0x41; /* data frame with PAN ID compression */
+  frame[1] = 0x88; /* short addresses */
+  frame[2] = seqnos[node]++;
+  frame[3] = 0xcd; /* PAN ID */
+  frame[4] = 0xab;
+  frame[5] = 0xff; /* broadcast */
+  frame[6] = 0xff;
+  frame[7] = (node + 1) & 0xff;
+  frame[8] = (node + 1) >> 8;
+
+  for(i = 9 ; i < size - 2 ; i++)
+    frame[i] = xorshift32();
+
+  fcs = crc16(frame, size - 2);
+  frame[size - 2] = fcs & 0xff;
+  frame[size - 1] = fcs >> 8;
+
+  stats.generated++;
+  protocol_count(PROT_COUNTER_RX_FRAMES);
+
+  /* The message would not fit in the output buffer. */
+  if(out_size + size + 1 > out_limit) {
+    stats.dropped++;
+    protocol_count(PROT_COUNTER_RX_OVERFLOW);
+    return;
+  }
+
+  /* The frame is timestamped when it was due and not when it is generated. */
+  send_timestamped_frame(frame, size, when / 1000);
+
+  stats.sent++;
+  stats.bytes += size;
+}
+
+/* Frames are only heard on the channels with traffic
+   and in proportion of the traffic on the channel. */
+static bool on_air(void)
+{
+  if(!max_traffic)
+    return true;
+
+  return traffic[channel] && xorshift32() % max_traffic < traffic[channel];
+}
+
+/* Time until the next frame in nanoseconds. */
+static uint64_t next_interval(void)
+{
+  double interval = 1e9 / rate;
+
+  if(poisson) {
+    /* Uniform in (0, 1]. */
+    double u = (xorshift32() + 1.) / 4294967296.;
+    interval *= -log(u);
+  }
+
+  return interval;
+}
+
+/* Write as much as we can to the host. */
+static void drain(size_t credit)
+{
+  ssize_t n;
+
+  if(credit > out_size)
+    credit = out_size;
+
+  if(!credit)
+    return;
+
+  n = write(master, out + out_head, credit);
+  if(n < 0) {
+    /* The host does not read fast enough or is gone. */
+    if(errno == EAGAIN || errno == EINTR || errno == EIO)
+      return;
+    err(EXIT_FAILURE, "cannot write to terminal");
+  }
+
+  out_head += n;
+  out_size -= n;
+
+  if(!out_size)
+    out_head = 0;
+}
+
+/* Change the speed requested by the host. The pending bytes are written
+   at once since the pseudo-terminal does not care about the speed. */
+static int set_baud(unsigned long speed)
+{
+  drain(out_size);
+
+  baud = speed ? speed : initial_baud;
+
+  return 1;
+}
+
+/* Read and process the messages from the host. */
+static void receive(void)
+{
+  unsigned char buf[256];
+  ssize_t n, i;
+
+  n = read(master, buf, sizeof(buf));
+  if(n < 0) {
+    if(errno == EAGAIN || errno == EINTR || errno == EIO)
+      return;
+    err(EXIT_FAILURE, "cannot read from terminal");
+  }
+
+  for(i = 0 ; i < n ; i++)
+    input_step(buf[i]);
+}
+
+/* Emulated UART interrupt. */
+static void * isr_thread(void *arg)
+{
+  unsigned char buf[64];
+  ssize_t n, i;
+
+  (void)arg;
+
+  while(!stop) {
+    struct pollfd pfd = { .fd = master, .events = POLLIN };
+
+    if(poll(&pfd, 1, HANGUP_INTERVAL) <= 0)
+      continue;
+
+    /* The main loop handles the hangups. */
+    if(pfd.revents & POLLHUP) {
+      usleep(HANGUP_INTERVAL * 1000);
+      continue;
+    }
+
+    n = read(master, buf, sizeof(buf));
+    if(n < 0) {
+      if(errno == EAGAIN || errno == EINTR || errno == EIO)
+        continue;
+      err(EXIT_FAILURE, "cannot read from terminal");
+    }
+
+    /* The interrupt is disabled until the firmware has booted. */
+    if(!isr_enabled)
+      continue;
+
+    for(i = 0 ; i < n ; i++)
+      input_isr(buf[i]);
+  }
+
+  return NULL;
+}
+
+static void start_isr_thread(void)
+{
+  pthread_t thread;
+  sigset_t set, old;
+  int ret;
+
+  /* The signals are handled by the main loop. */
+  sigfillset(&set);
+  pthread_sigmask(SIG_BLOCK, &set, &old);
+
+  ret = pthread_create(&thread, NULL, isr_thread, NULL);
+  if(ret)
+    errx(EXIT_FAILURE, "cannot create the interrupt thread");
+  pthread_detach(thread);
+
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static void sig_stop(int signum)
+{
+  (void)signum;
+  stop = 1;
+}
+
+static void display_stats(void)
+{
+  fprintf(stderr, "Generated : %lu frames\n", stats.generated);
+  fprintf(stderr, "Sent      : %lu frames (%llu bytes)\n", stats.sent,
+          stats.bytes);
+  fprintf(stderr, "Dropped   : %lu frames\n", stats.dropped);
+  fprintf(stderr, "Injected  : %lu frames\n", stats.injected);
+  fprintf(stderr, "Controls  : %lu messages\n", stats.controls);
+  fprintf(stderr, "Channel   : %u\n", channel);
+}
+
+/* Open the pseudo-terminal in raw mode so the host may use it without
+   configuring the line (that is when it does not set the speed). */
+static const char * open_terminal(void)
+{
+  struct termios options;
+  const char *slave_path;
+  int slave;
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if(master < 0)
+    err(EXIT_FAILURE, "cannot open pseudo-terminal");
+
+  if(grantpt(master) < 0 || unlockpt(master) < 0)
+    err(EXIT_FAILURE, "cannot unlock pseudo-terminal");
+
+  slave_path = ptsname(master);
+  if(!slave_path)
+    err(EXIT_FAILURE, "cannot get the slave name");
+
+  slave = open(slave_path, O_RDWR | O_NOCTTY);
+  if(slave < 0)
+    err(EXIT_FAILURE, "cannot open slave terminal");
+
+  if(tcgetattr(slave, &options) < 0)
+    err(EXIT_FAILURE, "cannot get tty attributes");
+
+  cfmakeraw(&options);
+
+  if(tcsetattr(slave, TCSANOW, &options) < 0)
+    err(EXIT_FAILURE, "cannot set tty attributes");
+
+  /* We do not keep the slave open. This way we can tell when the host
+     opens and closes the terminal as the master side hangs up. */
+  close(slave);
+
+  if(fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK) < 0)
+    err(EXIT_FAILURE, "cannot configure pseudo-terminal");
+
+  return slave_path;
+}
+
+static void remove_link(void)
+{
+  if(link_path)
+    unlink(link_path);
+}
+
+static void parse_size(const char *arg)
+{
+  const char *sep = strchr(arg, '-');
+  int err_v;
+
+  if(sep) {
+    char min_arg[sizeof("4294967295")];
+
+    if((size_t)(sep - arg) >= sizeof(min_arg))
+      errx(EXIT_FAILURE, "invalid frame size");
+
+    memcpy(min_arg, arg, sep - arg);
+    min_arg[sep - arg] = '\0';
+
+    min_size = xatou(min_arg, &err_v);
+    if(err_v)
+      errx(EXIT_FAILURE, "invalid frame size");
+    max_size = xatou(sep + 1, &err_v);
+  }
+  else
+    min_size = max_size = xatou(arg, &err_v);
+
+  if(err_v || min_size > max_size)
+    errx(EXIT_FAILURE, "invalid frame size");
+
+  if(min_size < MIN_FRAME_SIZE || max_size > MAX_MESSAGE_SIZE)
+    errx(EXIT_FAILURE, "frame size must be between %d and %d",
+         MIN_FRAME_SIZE, MAX_MESSAGE_SIZE);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *name;
+  const char *slave_path;
+  unsigned int boot_delay = DEFAULT_BOOT_DELAY;
+  uint64_t boot_time = 0, next_frame = 0, last_drain = 0, next_timer = 0;
+  double credit = 0;
+  bool connected = false;
+  bool booted    = false;
+  struct sigaction act = { .sa_handler = sig_stop };
+  int err_v, i;
+
+  int exit_status = EXIT_FAILURE;
+
+  name = (const char *)strrchr(argv[0], '/');
+  name = name ? (name + 1) : argv[0];
+
+  enum opt {
+    OPT_COMMIT = 0x100
+  };
+
+  struct opt_help helps[] = {
+    { 'h', "help", "Show this help message" },
+    { 'V', "version", "Print version information" },
+#ifdef COMMIT
+    { 0, "commit", "Display commit information" },
+#endif /* COMMIT */
+    { 'r', "rate", "Synthetic frames per second (default: none)" },
+    { 's', "size", "Frame size or uniform range MIN-MAX (default: 11-127)" },
+    { 'P', "poisson", "Poisson arrivals instead of a constant rate" },
+    { 'N', "nodes", "Number of emulated nodes (default: 4)" },
+    { 'c', "channels", "Channels with traffic, weighted (default: all)" },
+    { 'n', "count", "Stop the traffic after this number of frames" },
+    { 'b', "baud", "Emulated UART speed (default: unlimited)" },
+    { 'B', "buffer", "Output buffer size in bytes (default: 4096)" },
+    { 'D', "boot-delay", "Delay before the ready byte in ms (default: 100)" },
+    { 'l', "link", "Create a symbolic link to the terminal" },
+    { 'S', "seed", "Seed of the synthetic traffic (default: 1)" },
+    { 'I', "isr", "Read the terminal from an emulated UART interrupt" },
+    { 0, NULL, NULL }
+  };
+
+  struct option opts[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "version", no_argument, NULL, 'V' },
+#ifdef COMMIT
+    { "commit", no_argument, NULL, OPT_COMMIT },
+#endif /* COMMIT */
+    { "rate", required_argument, NULL, 'r' },
+    { "size", required_argument, NULL, 's' },
+    { "poisson", no_argument, NULL, 'P' },
+    { "nodes", required_argument, NULL, 'N' },
+    { "channels", required_argument, NULL, 'c' },
+    { "count", required_argument, NULL, 'n' },
+    { "baud", required_argument, NULL, 'b' },
+    { "buffer", required_argument, NULL, 'B' },
+    { "boot-delay", required_argument, NULL, 'D' },
+    { "link", required_argument, NULL, 'l' },
+    { "seed", required_argument, NULL, 'S' },
+    { "isr", no_argument, NULL, 'I' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while(1) {
+    int c = getopt_long(argc, argv, "hVr:s:PN:c:n:b:B:D:l:S:I", opts, NULL);
+
+    if(c == -1)
+      break;
+
+    switch(c) {
+    case('r'):
+      rate = xatou(optarg, &err_v);
+      if(err_v)
+        errx(EXIT_FAILURE, "invalid rate");
+      break;
+    case('s'):
+      parse_size(optarg);
+      break;
+    case('P'):
+      poisson = true;
+      break;
+    case('N'):
+      nb_nodes = xatou(optarg, &err_v);
+      if(err_v || nb_nodes == 0 || nb_nodes > 0xfffe)
+        errx(EXIT_FAILURE, "invalid number of nodes");
+      break;
+    case('c'):
+      parse_channels(optarg, traffic);
+      for(i = 0 ; i < NB_CHANNELS ; i++)
+        if(traffic[i] > max_traffic)
+          max_traffic = traffic[i];
+      break;
+    case('n'):
+      count = xatou(optarg, &err_v);
+      if(err_v)
+        errx(EXIT_FAILURE, "invalid number of frames");
+      break;
+    case('b'):
+      initial_baud = xatou(optarg, &err_v);
+      if(err_v)
+        errx(EXIT_FAILURE, "invalid speed");
+      break;
+    case('B'):
+      out_limit = xatou(optarg, &err_v);
+      if(err_v || out_limit <= MAX_MESSAGE_SIZE)
+        errx(EXIT_FAILURE, "buffer must be larger than %d bytes",
+             MAX_MESSAGE_SIZE);
+      break;
+    case('D'):
+      boot_delay = xatou(optarg, &err_v);
+      if(err_v)
+        errx(EXIT_FAILURE, "invalid boot delay");
+      break;
+    case('l'):
+      link_path = optarg;
+      break;
+    case('S'):
+      state = xatou(optarg, &err_v);
+      if(err_v)
+        errx(EXIT_FAILURE, "invalid seed");
+      if(!state)
+        state = DEFAULT_SEED;
+      break;
+    case('I'):
+      isr_mode = true;
+      break;
+#ifdef COMMIT
+    case(OPT_COMMIT):
+      commit();
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+#endif /* COMMIT */
+    case('V'):
+      version(TARGET);
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+    case('h'):
+      exit_status = EXIT_SUCCESS;
+    default:
+      help(name, "[OPTIONS] ...", helps);
+      goto EXIT;
+    }
+  }
+
+  seqnos = calloc(nb_nodes, sizeof(unsigned char));
+  if(!seqnos)
+    errx(EXIT_FAILURE, "out of memory");
+
+  out_reserve(out_limit);
+
+  baud = initial_baud;
+
+  slave_path = open_terminal();
+
+  if(link_path) {
+    unlink(link_path);
+    if(symlink(slave_path, link_path) < 0)
+      err(EXIT_FAILURE, "cannot create link");
+    atexit(remove_link);
+  }
+
+  printf("Emulating on %s\n", link_path ? link_path : slave_path);
+  fflush(stdout);
+
+  sigfillset(&act.sa_mask);
+  sigaction(SIGINT, &act, NULL);
+  sigaction(SIGTERM, &act, NULL);
+
+  if(isr_mode)
+    start_isr_thread();
+
+  while(!stop) {
+    struct pollfd pfd = { .fd = master, .events = isr_mode ? 0 : POLLIN };
+    uint64_t t = now();
+    int timeout = -1;
+    int ret;
+
+    if(booted) {
+      /* Parse the bytes queued by the interrupt. */
+      if(isr_mode)
+        protocol_poll();
+
+      /* Generate the frames received since the last iteration. */
+      unsigned int burst;
+
+      for(burst = 0 ; rate && next_frame <= t && burst < MAX_BURST ; burst++) {
+        if(count && stats.generated >= count)
+          break;
+
+        if(on_air())
+          generate_frame(next_frame);
+        next_frame += next_interval();
+      }
+
+      /* The frames of a burst are sent in the same packet. */
+      protocol_flush();
+
+      /* The timer of the protocol is used for the speed negotiation. */
+      if(t >= next_timer) {
+        protocol_timer();
+        next_timer += PROTOCOL_TIMER_INTERVAL * 1000000ULL;
+      }
+
+      /* Drain the output buffer at the speed of the UART. */
+      if(baud) {
+        credit += (t - last_drain) * (baud / 10.) / 1e9;
+        if(credit > UART_FIFO_SIZE)
+          credit = UART_FIFO_SIZE;
+
+        if(credit >= 1) {
+          size_t before = out_size;
+          drain(credit);
+          credit -= before - out_size;
+        }
+      }
+      else
+        drain(out_size);
+      last_drain = t;
+
+      if(out_size) {
+        if(baud)
+          timeout = 1;
+        else
+          pfd.events |= POLLOUT;
+      }
+
+      if(rate && !(count && stats.generated >= count)) {
+        int wait = next_frame > t ? (next_frame - t) / 1000000 : 0;
+        if(timeout < 0 || wait < timeout)
+          timeout = wait;
+      }
+
+      {
+        int wait = next_timer > t ? (next_timer - t) / 1000000 + 1 : 0;
+        if(timeout < 0 || wait < timeout)
+          timeout = wait;
+      }
+
+      if(isr_mode && (timeout < 0 || timeout > POLL_INTERVAL))
+        timeout = POLL_INTERVAL;
+    }
+    else if(connected) {
+      /* Wait until the firmware has booted. */
+      if(t >= boot_time) {
+        protocol_set_baud(set_baud);
+        protocol_set_clock(radio_clock, CLOCK_HZ);
+        protocol_init(frame_cb, control_cb, uart_send);
+        booted      = true;
+        isr_enabled = true;
+        next_frame  = t;
+        next_timer  = t + PROTOCOL_TIMER_INTERVAL * 1000000ULL;
+        last_drain  = t;
+        credit      = 0;
+        continue;
+      }
+
+      timeout = (boot_time - t) / 1000000 + 1;
+    }
+    else
+      timeout = HANGUP_INTERVAL;
+
+    ret = poll(&pfd, 1, timeout);
+    if(ret < 0) {
+      if(errno == EINTR)
+        continue;
+      err(EXIT_FAILURE, "cannot poll");
+    }
+
+    /* The master hangs up when no one has the slave opened. Note that the
+       input buffer of the firmware is not reset just like a real UART. */
+    if(pfd.revents & POLLHUP) {
+      if(connected)
+        fprintf(stderr, "Host disconnected\n");
+
+      connected   = booted = false;
+      isr_enabled = false;
+      out_head    = out_size = 0;
+
+      usleep(HANGUP_INTERVAL * 1000);
+      continue;
+    }
+    else if(!connected) {
+      fprintf(stderr, "Host connected\n");
+
+      connected = true;
+      boot_time = now() + boot_delay * 1000000ULL;
+    }
+
+    if(pfd.revents & POLLIN) {
+      /* The UART is ignored until the firmware has booted. */
+      if(booted)
+        receive();
+      else
+        tcflush(master, TCIFLUSH);
+    }
+  }
+
+  display_stats();
+
+  exit_status = EXIT_SUCCESS;
+
+EXIT:
+  return exit_status;
+}
@@ -15,58 +15,72 @@
    You should have received a copy of the GNU General Public License
    along with this program. If not, see <http://www.gnu.org/licenses/>. */
 
-#include <stdlib.h>
-#include <stdio.h>
+#include <string.h>
 #include <stdarg.h>
 
 #include "protocol.h"
+#include "format.h"
+#include "extra-protocol.h"
 
-static void _info(const char *s)
-{
-  send_info(s);
-}
+/* The formatted string is sent in control messages as it is produced. So we
+   only need a buffer for one message and nothing on the heap. */
+struct chunk {
+  enum prot_ctype type;
+  unsigned int size;
+  unsigned char buf[MAX_MESSAGE_SIZE - 1];
+};
 
-static void _debug(const char *s)
+static void put_chunk(const char *s, unsigned int size, void *data)
 {
-  send_debug(s);
+  struct chunk *chunk = data;
+
+  while(size) {
+    unsigned int n = sizeof(chunk->buf) - chunk->size;
+
+    if(n > size)
+      n = size;
+
+    memcpy(chunk->buf + chunk->size, s, n);
+    chunk->size += n;
+    s           += n;
+    size        -= n;
+
+    if(chunk->size == sizeof(chunk->buf)) {
+      send_control(chunk->type, chunk->buf, chunk->size);
+      chunk->size = 0;
+    }
+  }
 }
 
-static int generic_printf(void (*send)(const char *), const char *fmt, va_list ap)
+int control_vprintf(enum prot_ctype type, const char *fmt, va_list ap)
 {
-  char *buf;
+  struct chunk chunk;
   int size;
 
-  /* We do this in three step.
-     1) We get the size of the string.
-     2) We allocate a string large enough.
-     3) We store the result in this string.
-     This is slow but it guarantees that our buffer
-     is large enough. */
-  size = vsnprintf(NULL, 0, fmt, ap);
-  buf  = malloc(size + 1);
-  size = vsprintf(buf, fmt, ap);
+  chunk.type = type;
+  chunk.size = 0;
 
-  /* Now we send the formatted buffer. */
-  send(buf);
+  size = vformat(put_chunk, &chunk, fmt, ap);
 
-  /* We also have to free our allocated buffer. */
-  free(buf);
+  /* Send what is left. */
+  if(chunk.size)
+    send_control(type, chunk.buf, chunk.size);
 
   return size;
 }
 
-#define _PRINTF(name, func)                        \
+#define _PRINTF(name, type)                        \
   int name ## _printf(const char *fmt, ...)        \
   {                                                \
   int ret;                                         \
                                                    \
   va_list ap;                                      \
   va_start(ap, fmt);                               \
-  ret = generic_printf(func, fmt, ap);             \
+  ret = control_vprintf(type, fmt, ap);            \
   va_end(ap);                                      \
                                                    \
   return ret;                                      \
   }
 
-_PRINTF(info, _info);
-_PRINTF(debug, _debug);
+_PRINTF(info, PROT_CTYPE_INFO);
+_PRINTF(debug, PROT_CTYPE_DEBUG);
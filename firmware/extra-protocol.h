@@ -18,10 +18,20 @@
 #ifndef _EXTRA_PROTOCOL_H_
 #define _EXTRA_PROTOCOL_H_
 
+#include <stdarg.h>
+
+#include "protocol.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Send a formatted string in control messages of the specified type. The
+   string is formatted with vformat() (see format.h) and fragmented into
+   messages as it is produced, without using the heap. Return the number of
+   characters sent. */
+int control_vprintf(enum prot_ctype type, const char *fmt, va_list ap);
+
 /* Send a formatted string as an informational message on UART. */
 int info_printf(const char *fmt, ...);
 
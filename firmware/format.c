@@ -0,0 +1,286 @@
+/* File: format.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stddef.h>
+#include <stdarg.h>
+
+#include "format.h"
+
+#define FL_LEFT  0x01 /* '-' */
+#define FL_ZERO  0x02 /* '0' */
+#define FL_PLUS  0x04 /* '+' */
+#define FL_SPACE 0x08 /* ' ' */
+
+/* Enough digits for a 64-bits value in octal. */
+#define MAX_DIGITS 22
+
+static const char spaces[] = "                ";
+static const char zeros[]  = "0000000000000000";
+
+/* Output count times the padding character. */
+static void pad(format_put_t put, void *data, char c, int count)
+{
+  const char *s = (c == '0') ? zeros : spaces;
+
+  for(; count > 0 ; count -= sizeof(spaces) - 1)
+    put(s, count < (int)sizeof(spaces) - 1 ? count : (int)sizeof(spaces) - 1,
+        data);
+}
+
+/* Output a string within a field of the specified width. */
+static int field(format_put_t put, void *data,
+                 const char *s, int size, int width, unsigned char flags)
+{
+  int padding = width > size ? width - size : 0;
+
+  if(!(flags & FL_LEFT))
+    pad(put, data, ' ', padding);
+
+  if(size)
+    put(s, size, data);
+
+  if(flags & FL_LEFT)
+    pad(put, data, ' ', padding);
+
+  return size + padding;
+}
+
+/* Output a number within a field of the specified width. The prefix is
+   either the sign or the base of the number. */
+static int number(format_put_t put, void *data,
+                  unsigned long long value, unsigned int base,
+                  const char *prefix, int upper, int width,
+                  unsigned char flags)
+{
+  const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+  char buf[MAX_DIGITS];
+  char *p = buf + sizeof(buf);
+  int size, padding, prefix_size = 0;
+
+  while(prefix[prefix_size])
+    prefix_size++;
+
+  do {
+    *--p = digits[value % base];
+    value /= base;
+  } while(value);
+
+  size    = buf + sizeof(buf) - p;
+  padding = width - size - prefix_size;
+  if(padding < 0)
+    padding = 0;
+
+  /* The zeros go between the prefix and the digits. */
+  if(flags & FL_ZERO && !(flags & FL_LEFT)) {
+    if(prefix_size)
+      put(prefix, prefix_size, data);
+    pad(put, data, '0', padding);
+  }
+  else {
+    if(!(flags & FL_LEFT))
+      pad(put, data, ' ', padding);
+    if(prefix_size)
+      put(prefix, prefix_size, data);
+  }
+
+  put(p, size, data);
+
+  if(flags & FL_LEFT)
+    pad(put, data, ' ', padding);
+
+  return size + padding + prefix_size;
+}
+
+int vformat(format_put_t put, void *data, const char *fmt, va_list ap)
+{
+  int total = 0;
+
+  while(*fmt) {
+    const char *start = fmt;
+    unsigned long long value;
+    unsigned char flags = 0;
+    int width = 0, precision = -1, length = 0;
+    const char *sign;
+    const char *s;
+
+    /* Literal characters are sent in one piece. */
+    while(*fmt && *fmt != '%')
+      fmt++;
+    if(fmt != start) {
+      put(start, fmt - start, data);
+      total += fmt - start;
+    }
+
+    if(!*fmt)
+      break;
+    start = fmt++;
+
+    /* flags */
+    for(;; fmt++) {
+      switch(*fmt) {
+      case('-'):
+        flags |= FL_LEFT;
+        continue;
+      case('0'):
+        flags |= FL_ZERO;
+        continue;
+      case('+'):
+        flags |= FL_PLUS;
+        continue;
+      case(' '):
+        flags |= FL_SPACE;
+        continue;
+      }
+      break;
+    }
+
+    /* width */
+    if(*fmt == '*') {
+      width = va_arg(ap, int);
+      if(width < 0) {
+        flags |= FL_LEFT;
+        width  = -width;
+      }
+      fmt++;
+    }
+    else
+      for(; *fmt >= '0' && *fmt <= '9' ; fmt++)
+        width = width * 10 + *fmt - '0';
+
+    /* precision */
+    if(*fmt == '.') {
+      fmt++;
+      precision = 0;
+      if(*fmt == '*') {
+        precision = va_arg(ap, int);
+        fmt++;
+      }
+      else
+        for(; *fmt >= '0' && *fmt <= '9' ; fmt++)
+          precision = precision * 10 + *fmt - '0';
+    }
+
+    /* length, positive for long and negative for short */
+    for(;; fmt++) {
+      switch(*fmt) {
+      case('h'):
+        length--;
+        continue;
+      case('l'):
+        length++;
+        continue;
+      case('z'):
+        length = sizeof(size_t) == sizeof(unsigned long long) ? 2 :
+                 sizeof(size_t) == sizeof(unsigned long) ? 1 : 0;
+        continue;
+      }
+      break;
+    }
+
+    switch(*fmt) {
+    case('d'):
+    case('i'):
+      {
+        long long v;
+
+        if(length >= 2)
+          v = va_arg(ap, long long);
+        else if(length == 1)
+          v = va_arg(ap, long);
+        else
+          v = va_arg(ap, int);
+
+        if(length == -1)
+          v = (short)v;
+        else if(length <= -2)
+          v = (signed char)v;
+
+        if(v < 0) {
+          sign  = "-";
+          value = -(unsigned long long)v;
+        }
+        else {
+          sign  = (flags & FL_PLUS) ? "+" : (flags & FL_SPACE) ? " " : "";
+          value = v;
+        }
+
+        total += number(put, data, value, 10, sign, 0, width, flags);
+      }
+      break;
+    case('u'):
+    case('o'):
+    case('x'):
+    case('X'):
+      if(length >= 2)
+        value = va_arg(ap, unsigned long long);
+      else if(length == 1)
+        value = va_arg(ap, unsigned long);
+      else
+        value = va_arg(ap, unsigned int);
+
+      if(length == -1)
+        value = (unsigned short)value;
+      else if(length <= -2)
+        value = (unsigned char)value;
+
+      total += number(put, data, value,
+                      *fmt == 'u' ? 10 : *fmt == 'o' ? 8 : 16,
+                      "", *fmt == 'X', width, flags);
+      break;
+    case('p'):
+      value = (size_t)va_arg(ap, void *);
+      total += number(put, data, value, 16, "0x", 0, width, flags);
+      break;
+    case('c'):
+      {
+        char c = va_arg(ap, int);
+        total += field(put, data, &c, 1, width, flags);
+      }
+      break;
+    case('s'):
+      {
+        int size = 0;
+
+        s = va_arg(ap, const char *);
+        if(!s)
+          s = "(null)";
+
+        /* We cannot use strlen() with the precision. */
+        while(s[size] && (precision < 0 || size < precision))
+          size++;
+
+        total += field(put, data, s, size, width, flags);
+      }
+      break;
+    case('%'):
+      put("%", 1, data);
+      total++;
+      break;
+    default:
+      /* Unknown conversions are kept as is. */
+      if(!*fmt)
+        fmt--;
+      put(start, fmt - start + 1, data);
+      total += fmt - start + 1;
+      break;
+    }
+
+    fmt++;
+  }
+
+  return total;
+}
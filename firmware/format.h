@@ -0,0 +1,44 @@
+/* File: format.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _FORMAT_H_
+#define _FORMAT_H_
+
+#include <stdarg.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Output function of the formatter. The formatted string is given in pieces
+   as it is produced, the pieces are not null terminated. */
+typedef void (*format_put_t)(const char *s, unsigned int size, void *data);
+
+/* A small printf-like formatter which streams its output instead of storing
+   it into a buffer. It does not use the heap and only needs a few bytes of
+   stack. It supports the flags '-', '0', '+' and ' ', the field width and
+   the precision of strings (also with '*'), the length modifiers hh, h, l,
+   ll and z and the conversions d, i, u, o, x, X, c, s, p and %. Floating
+   point conversions are not supported. Return the number of characters
+   produced. */
+int vformat(format_put_t put, void *data, const char *fmt, va_list ap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FORMAT_H_ */
@@ -51,9 +51,97 @@ enum prot_ctype { PROT_CTYPE_INFO = 0x00,
                   PROT_CTYPE_SRV_ERROR,
                   PROT_CTYPE_PING,
                   PROT_CTYPE_ACK,
-                  PROT_CTYPE_CONFIG_CHANNEL
+                  PROT_CTYPE_CONFIG_CHANNEL,
+                  PROT_CTYPE_CONFIG_FILTER,
+                  PROT_CTYPE_CONFIG_SNAPLEN,
+                  PROT_CTYPE_TRUNCATED_FRAME,
+                  PROT_CTYPE_CONFIG_BAUD,
+                  PROT_CTYPE_CONFIG_TIMESTAMP,
+                  PROT_CTYPE_TIMESTAMP,
+                  PROT_CTYPE_STATS,
+                  PROT_CTYPE_SUBSCRIBE
                   /* add new types here */ };
 
+/* firmware statistics counter */
+enum prot_counter { PROT_COUNTER_RX_FRAMES = 0x00,
+                    PROT_COUNTER_RX_OVERFLOW,
+                    PROT_COUNTER_CRC_ERRORS,
+                    PROT_COUNTER_TX_BUSY,
+                    PROT_COUNTER_UART_ERRORS,
+                    PROT_COUNTER_FILTERED,
+                    PROT_COUNTER_FORWARDED,
+                    /* add new counters here */
+                    NB_PROT_COUNTERS };
+
+/*
+  The CONFIG_FILTER control message installs a filter on the frames that the
+  transceiver forwards. An empty payload removes the filter. Otherwise the
+  payload contains (multi-bytes values are little endian):
+
+    types (1 byte)  : accepted frame types (bit n for the type n)
+    flags (1 byte)  : which of the following fields are used (FILTER_*)
+    pan   (2 bytes) : source or destination PAN identifier
+    short (2 bytes) : source or destination short address
+    long  (8 bytes) : source or destination extended address
+
+  A frame is forwarded when its type is accepted, its PAN matches and one of
+  its addresses matches either the short or the extended address.
+
+  The CONFIG_SNAPLEN control message contains one byte, the number of bytes to
+  forward for each frame or zero for the entire frame. Larger frames are sent
+  with a TRUNCATED_FRAME control message which contains the original size of
+  the frame (one byte) followed by its first bytes.
+*/
+#define FILTER_PAN        0x01
+#define FILTER_SHORT_ADDR 0x02
+#define FILTER_LONG_ADDR  0x04
+
+#define FILTER_SIZE       14
+
+/* Truncated frames are sent in a control message
+   with the control type and the original size. */
+#define MAX_SNAPLEN       (MAX_MESSAGE_SIZE - 2)
+
+/*
+  The CONFIG_BAUD control message contains the new speed of the serial line in
+  bits per second (4 bytes, little endian). The firmware switches to the new
+  speed and answers OK at this speed or CLI_ERROR when it does not support it.
+  The host confirms with the same message at the new speed which the firmware
+  answers with OK. Without confirmation within BAUD_CONFIRM_TIMEOUT, or when
+  any other message is received first, the firmware falls back to the previous
+  speed. A speed of zero restores the initial speed of the line.
+*/
+#define BAUD_CONFIRM_TIMEOUT 2 /* seconds */
+
+/*
+  The CONFIG_TIMESTAMP control message contains one byte, non-zero to enable
+  the timestamps and zero to disable them. The firmware answers with the same
+  control type and the frequency of its clock in Hz (4 bytes, little endian)
+  or with CLI_ERROR when it has no clock. Then each frame (or truncated frame)
+  is preceded by a TIMESTAMP control message which contains the value of the
+  clock when the frame was received by the radio (4 bytes, little endian).
+  The clock wraps around.
+*/
+#define TIMESTAMP_SIZE       4
+
+/*
+  The firmware answers an empty STATS control message with its counters as 4
+  bytes little endian values in the order of enum prot_counter:
+
+    RX_FRAMES   : frames received by the radio
+    RX_OVERFLOW : frames dropped because the RX buffer was full
+    CRC_ERRORS  : frames dropped by the radio on invalid FCS
+    TX_BUSY     : injected frames refused because the radio was busy
+    UART_ERRORS : corrupted messages or packets received from the host
+    FILTERED    : frames dropped by the filter installed by the host
+    FORWARDED   : frames sent to the host
+
+  The counters are reset with the ready byte and wrap around. A host which
+  knows less counters ignores the last ones. Since the answer follows the
+  frames already forwarded, the host can compare FORWARDED with the number
+  of frames that it received to find the frames lost on the serial line.
+*/
+
 /* The maximum allowed size for a message. */
 #define MAX_MESSAGE_SIZE 127
 
@@ -63,5 +151,30 @@ enum prot_ctype { PROT_CTYPE_INFO = 0x00,
 /* The time to wait for the ready byte. */
 #define READY_TIMEOUT    10
 
+/*
+  Version 2 of the protocol groups one or more messages into a packet.
+  The packet is delimited using SLIP (RFC 1055) and ends with a CRC-16
+  (ITU-T as used by 802.15.4, little endian) over the messages. So a
+  corrupted byte only costs one packet and the receiver synchronizes
+  again on the next END byte. The firmware announces the version of
+  the protocol with its ready byte.
+*/
+
+/* This byte is used by a firmware which speaks the version 2. */
+#define READY_BYTE_V2    0xfe
+
+/* SLIP special bytes. */
+#define SLIP_END         0xc0
+#define SLIP_ESC         0xdb
+#define SLIP_ESC_END     0xdc
+#define SLIP_ESC_ESC     0xdd
+
+/* The maximum size of a packet (messages and CRC) before escaping. */
+#define MAX_PACKET_SIZE  512
+
+/* The maximum size of a packet on the line, that is when all bytes are
+   escaped and with the two END bytes. */
+#define MAX_ENCODED_PACKET_SIZE (2 * MAX_PACKET_SIZE + 2)
+
 #endif /* _PRIV_PROTOCOL_H_ */
 #endif /* _PROTOCOL_H_ */
@@ -15,6 +15,8 @@
    You should have received a copy of the GNU General Public License
    along with this program. If not, see <http://www.gnu.org/licenses/>. */
 
+#include <string.h>
+
 #include "protocol.h"
 #include "extra-protocol.h"
 
@@ -24,22 +26,379 @@ static void (*_control_cb)(enum prot_ctype type,
                               unsigned int size);
 static void (*_send)(const unsigned char *, unsigned int);
 
+/* Filter installed by the host (see priv-protocol.h). */
+static unsigned char filter[FILTER_SIZE];
+static unsigned char filter_set;
+static unsigned char snaplen;
+
+/* Speed of the UART negotiated by the host (zero for the initial speed). The
+   new speed is pending until the host confirms it. Then the pending counter
+   is the number of timer ticks left before we fall back. */
+#define BAUD_CONFIRM_TICKS (BAUD_CONFIRM_TIMEOUT * 1000 / PROTOCOL_TIMER_INTERVAL)
+
+static int (*_set_baud)(unsigned long);
+static unsigned long baud_current;
+static unsigned long baud_previous;
+static unsigned int  baud_pending;
+
+/* Clock used to timestamp the frames when the host asks for it. */
+static unsigned long (*_clock)(void);
+static unsigned long clock_hz;
+static unsigned char timestamps;
+
+/* Statistics reported to the host. */
+static unsigned long counters[NB_PROT_COUNTERS];
+
+/* Bytes received in interrupt context wait in this ring until the main loop
+   parses them. There is one producer (the UART interrupt) and one consumer
+   (the main loop) so each index is only written by one side. The indices are
+   bytes so that they are read and written atomically even on 8-bit MCUs. */
+#ifndef PROTOCOL_RING_SIZE
+# define PROTOCOL_RING_SIZE 128
+#endif
+
+#if PROTOCOL_RING_SIZE > 256 || (PROTOCOL_RING_SIZE & (PROTOCOL_RING_SIZE - 1))
+# error "PROTOCOL_RING_SIZE must be a power of two up to 256"
+#endif
+
+/* Order the accesses to the ring and to its indices. This is only needed on
+   multi-core or out-of-order targets (and with the emulator) but it is cheap
+   enough on the others. */
+#ifdef __GNUC__
+# define ring_barrier() __sync_synchronize()
+#else
+# define ring_barrier()
+#endif
+
+static unsigned char ring[PROTOCOL_RING_SIZE];
+static volatile unsigned char ring_head;      /* written by the ISR */
+static volatile unsigned char ring_tail;      /* written by the main loop */
+static volatile unsigned long ring_overflows; /* written by the ISR */
+static unsigned long overflows_base;
+
+#ifdef PROTOCOL_V2
+/* Messages are grouped in this buffer until the packet is full or flushed.
+   We keep two bytes for the CRC. */
+static unsigned char batch[MAX_PACKET_SIZE];
+static unsigned int  batch_size;
+
+/* CRC-16 ITU-T (LSB first) as used by IEEE 802.15.4. */
+static unsigned short crc16(const unsigned char *data, unsigned int size)
+{
+  unsigned short crc = 0;
+  int i;
+
+  while(size--) {
+    crc ^= *data++;
+    for(i = 0 ; i < 8 ; i++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+  }
+
+  return crc;
+}
+#endif /* PROTOCOL_V2 */
+
 void protocol_init(void (*frame_cb)(unsigned char *, unsigned int),
                    void (*control_cb)(enum prot_ctype,
                                       unsigned char *,
                                       unsigned int),
                    void (*send)(const unsigned char *, unsigned int))
 {
+#ifdef PROTOCOL_V2
+  unsigned char ready = READY_BYTE_V2;
+#else
   unsigned char ready = READY_BYTE;
+#endif /* PROTOCOL_V2 */
 
   _frame_cb   = frame_cb;
   _control_cb = control_cb;
   _send       = send;
 
+  /* The host configures the filters again after the ready byte. */
+  filter_set = 0;
+  snaplen    = 0;
+
+  /* The host opens the line at the initial speed. */
+  if(baud_current && _set_baud)
+    _set_baud(0);
+  baud_current = baud_previous = 0;
+  baud_pending = 0;
+  timestamps   = 0;
+
+  memset(counters, 0, sizeof(counters));
+  overflows_base = ring_overflows;
+
+  /* Discard what the host sent before the ready byte. */
+  ring_tail = ring_head;
+
   /* Send the ready byte. */
   send(&ready, 1);
 }
 
+void protocol_count(enum prot_counter counter)
+{
+  counters[counter]++;
+}
+
+static void send_stats(unsigned int size)
+{
+  unsigned char reply[NB_PROT_COUNTERS * 4];
+  unsigned int i;
+
+  if(size != 0) {
+    cli_error();
+    return;
+  }
+
+  for(i = 0 ; i < NB_PROT_COUNTERS ; i++) {
+    unsigned long value = counters[i];
+
+    /* Bytes dropped when the ring was full are UART errors too. */
+    if(i == PROT_COUNTER_UART_ERRORS)
+      value += ring_overflows - overflows_base;
+
+    reply[i * 4]     = value;
+    reply[i * 4 + 1] = value >> 8;
+    reply[i * 4 + 2] = value >> 16;
+    reply[i * 4 + 3] = value >> 24;
+  }
+
+  send_control(PROT_CTYPE_STATS, reply, sizeof(reply));
+}
+
+void input_isr(unsigned char c)
+{
+  unsigned char head = ring_head;
+  unsigned char next = (head + 1) & (PROTOCOL_RING_SIZE - 1);
+
+  /* One slot is kept empty to tell a full ring from an empty one. */
+  if(next == ring_tail) {
+    ring_overflows++;
+    return;
+  }
+
+  ring[head] = c;
+
+  /* The byte must be stored before it is published. */
+  ring_barrier();
+  ring_head = next;
+}
+
+unsigned int protocol_poll(void)
+{
+  unsigned char tail = ring_tail;
+  unsigned int n;
+
+  for(n = 0 ; tail != ring_head ; n++) {
+    unsigned char c;
+
+    /* The byte must not be read before the head which published it. */
+    ring_barrier();
+    c = ring[tail];
+
+    /* Free the slot before parsing as the callbacks may be slow. */
+    tail = (tail + 1) & (PROTOCOL_RING_SIZE - 1);
+    ring_barrier();
+    ring_tail = tail;
+
+    input_step(c);
+  }
+
+  return n;
+}
+
+void protocol_set_clock(unsigned long (*clock)(void), unsigned long hz)
+{
+  _clock   = clock;
+  clock_hz = hz;
+}
+
+static void config_timestamp(const unsigned char *data, unsigned int size)
+{
+  unsigned char reply[4];
+
+  if(size != 1 || (data[0] && !_clock)) {
+    cli_error();
+    return;
+  }
+
+  timestamps = data[0] != 0;
+
+  reply[0] = clock_hz;
+  reply[1] = clock_hz >> 8;
+  reply[2] = clock_hz >> 16;
+  reply[3] = clock_hz >> 24;
+
+  send_control(PROT_CTYPE_CONFIG_TIMESTAMP, reply, sizeof(reply));
+}
+
+void protocol_set_baud(int (*set_baud)(unsigned long))
+{
+  _set_baud = set_baud;
+}
+
+static void baud_fallback(void)
+{
+  baud_pending = 0;
+  baud_current = baud_previous;
+
+  _set_baud(baud_current);
+}
+
+void protocol_timer(void)
+{
+  if(baud_pending && !--baud_pending)
+    baud_fallback();
+}
+
+static void config_baud(const unsigned char *data, unsigned int size)
+{
+  unsigned long baud;
+
+  if(size != 4) {
+    cli_error();
+    return;
+  }
+
+  baud = (unsigned long)data[0]       | (unsigned long)data[1] << 8 |
+         (unsigned long)data[2] << 16 | (unsigned long)data[3] << 24;
+
+  /* This is the confirmation from the host at the new speed. */
+  if(baud_pending) {
+    if(baud != baud_current) {
+      baud_fallback();
+      return;
+    }
+
+    baud_pending = 0;
+    send_control(PROT_CTYPE_OK, 0, 0);
+    return;
+  }
+
+  /* The host listens at the new speed anyway. So the error is lost but it
+     will not receive the expected answer. Note that the set_baud function
+     transmits the pending bytes at the current speed before switching. */
+  if(!_set_baud || !_set_baud(baud)) {
+    cli_error();
+    return;
+  }
+
+  baud_previous = baud_current;
+  baud_current  = baud;
+  baud_pending  = BAUD_CONFIRM_TICKS;
+
+  send_control(PROT_CTYPE_OK, 0, 0);
+}
+
+static void config_filter(const unsigned char *data, unsigned int size)
+{
+  switch(size) {
+  case(0):
+    filter_set = 0;
+    break;
+  case(FILTER_SIZE):
+    memcpy(filter, data, FILTER_SIZE);
+    filter_set = 1;
+    break;
+  default:
+    cli_error();
+    break;
+  }
+}
+
+static void config_snaplen(const unsigned char *data, unsigned int size)
+{
+  if(size != 1 || data[0] > MAX_SNAPLEN) {
+    cli_error();
+    return;
+  }
+
+  snaplen = data[0];
+}
+
+/* Locate the PAN identifier and the address for an addressing mode. Return
+   the offset of the next field or zero when the frame is too short. */
+static unsigned int locate_address(const unsigned char *frame,
+                                   unsigned int size,
+                                   unsigned int idx,
+                                   unsigned int mode,
+                                   unsigned char has_pan,
+                                   const unsigned char **pan,
+                                   const unsigned char **addr)
+{
+  unsigned int len = (mode == 2) ? 2 : 8;
+
+  if(!mode)
+    return idx;
+
+  if(has_pan) {
+    if(idx + 2 > size)
+      return 0;
+
+    *pan = frame + idx;
+    idx += 2;
+  }
+
+  if(idx + len > size)
+    return 0;
+
+  *addr = frame + idx;
+
+  return idx + len;
+}
+
+static unsigned char match_address(const unsigned char *addr,
+                                   unsigned int mode)
+{
+  if(!addr)
+    return 0;
+
+  if(mode == 2)
+    return (filter[1] & FILTER_SHORT_ADDR) && !memcmp(addr, filter + 4, 2);
+  else
+    return (filter[1] & FILTER_LONG_ADDR) && !memcmp(addr, filter + 6, 8);
+}
+
+static unsigned char match_filter(const unsigned char *frame,
+                                  unsigned int size)
+{
+  const unsigned char *dpan = 0, *daddr = 0, *span = 0, *saddr = 0;
+  unsigned int control, dam, sam, idx;
+
+  if(size < 3)
+    return 0;
+
+  control = frame[0] | frame[1] << 8;
+  dam     = (control >> 10) & 0x3;
+  sam     = (control >> 14) & 0x3;
+
+  if(!(filter[0] & (1 << (control & 0x7))))
+    return 0;
+
+  if(!filter[1])
+    return 1;
+
+  /* Skip the frame control and sequence number. The source PAN is
+     omitted with PAN ID compression (bit 6 of the frame control). */
+  idx = locate_address(frame, size, 3, dam, 1, &dpan, &daddr);
+  if(idx)
+    idx = locate_address(frame, size, idx, sam, !(control & 0x40),
+                         &span, &saddr);
+  if(!idx)
+    return 0;
+
+  if(filter[1] & FILTER_PAN) {
+    if(!(dpan && !memcmp(dpan, filter + 2, 2)) &&
+       !(span && !memcmp(span, filter + 2, 2)))
+      return 0;
+  }
+
+  if(filter[1] & (FILTER_SHORT_ADDR | FILTER_LONG_ADDR))
+    return match_address(daddr, dam) || match_address(saddr, sam);
+
+  return 1;
+}
+
 static void parse_message(unsigned char *message, unsigned int size)
 {
   switch(message[0] & 0x80) {
@@ -47,18 +406,201 @@ static void parse_message(unsigned char *message, unsigned int size)
     _frame_cb(message + 1, size);
     break;
   case(PROT_MTYPE_CONTROL):
-    if(size == 0)
+    if(size == 0) {
       cli_error(); /* error: we expect at least a control type byte */
+      break;
+    }
+
+    /* Any other message means that the host gave up the new speed. */
+    if(baud_pending && message[1] != PROT_CTYPE_CONFIG_BAUD) {
+      baud_fallback();
+      break;
+    }
 
-    /* catch and respond to ping messages automatically */
-    if(message[1] == PROT_CTYPE_PING)
+    /* Catch and respond to ping and configuration messages automatically. */
+    switch(message[1]) {
+    case(PROT_CTYPE_PING):
       send_control(PROT_CTYPE_PING, message + 2, size - 1);
-    else
+      break;
+    case(PROT_CTYPE_CONFIG_FILTER):
+      config_filter(message + 2, size - 1);
+      break;
+    case(PROT_CTYPE_CONFIG_SNAPLEN):
+      config_snaplen(message + 2, size - 1);
+      break;
+    case(PROT_CTYPE_CONFIG_BAUD):
+      config_baud(message + 2, size - 1);
+      break;
+    case(PROT_CTYPE_CONFIG_TIMESTAMP):
+      config_timestamp(message + 2, size - 1);
+      break;
+    case(PROT_CTYPE_STATS):
+      send_stats(size - 1);
+      break;
+    default:
       _control_cb(message[1], message + 2, size - 1);
+      break;
+    }
     break;
   }
 }
 
+#ifdef PROTOCOL_V2
+static void parse_packet(unsigned char *packet, unsigned int size)
+{
+  unsigned int i;
+
+  size -= 2;
+
+  /* The packet is silently dropped on error. The host will not receive any
+     answer so it will consider that the message was lost. */
+  if(crc16(packet, size) != (packet[size] | packet[size + 1] << 8)) {
+    protocol_count(PROT_COUNTER_UART_ERRORS);
+    return;
+  }
+
+  /* The messages must fill the packet exactly. */
+  for(i = 0 ; i < size ; i += (packet[i] & 0x7f) + 1);
+  if(i != size) {
+    protocol_count(PROT_COUNTER_UART_ERRORS);
+    return;
+  }
+
+  for(i = 0 ; i < size ; i += (packet[i] & 0x7f) + 1)
+    parse_message(packet + i, packet[i] & 0x7f);
+}
+
+void input_step(unsigned char c)
+{
+  /* The host sends one message per packet or a few small ones. So we only
+     need a buffer large enough for the largest message and the CRC. */
+  static unsigned int  idx  = 0;
+  static unsigned char escaped;
+  static unsigned char drop;
+  static unsigned char buffer[MAX_MESSAGE_SIZE + 3];
+
+  switch(c) {
+  case(SLIP_END):
+    if(drop)
+      protocol_count(PROT_COUNTER_UART_ERRORS);
+    else if(idx >= 3)
+      parse_packet(buffer, idx);
+
+    idx     = 0;
+    escaped = drop = 0;
+    return;
+  case(SLIP_ESC):
+    escaped = 1;
+    return;
+  }
+
+  if(escaped) {
+    escaped = 0;
+
+    switch(c) {
+    case(SLIP_ESC_END):
+      c = SLIP_END;
+      break;
+    case(SLIP_ESC_ESC):
+      c = SLIP_ESC;
+      break;
+    default:
+      drop = 1; /* invalid escape sequence */
+      break;
+    }
+  }
+
+  if(idx == sizeof(buffer))
+    drop = 1;
+  else
+    buffer[idx++] = c;
+}
+
+void protocol_flush(void)
+{
+  /* The packet is escaped in small chunks to limit the number of calls to
+     the send function without using another large buffer. */
+  unsigned char chunk[32];
+  unsigned short crc;
+  unsigned int i, n = 0;
+
+  if(!batch_size)
+    return;
+
+  crc = crc16(batch, batch_size);
+  batch[batch_size++] = crc & 0xff;
+  batch[batch_size++] = crc >> 8;
+
+  chunk[n++] = SLIP_END;
+
+  for(i = 0 ; i < batch_size ; i++) {
+    switch(batch[i]) {
+    case(SLIP_END):
+      chunk[n++] = SLIP_ESC;
+      chunk[n++] = SLIP_ESC_END;
+      break;
+    case(SLIP_ESC):
+      chunk[n++] = SLIP_ESC;
+      chunk[n++] = SLIP_ESC_ESC;
+      break;
+    default:
+      chunk[n++] = batch[i];
+      break;
+    }
+
+    /* Keep room for an escaped byte or the last END byte. */
+    if(n >= sizeof(chunk) - 2) {
+      _send(chunk, n);
+      n = 0;
+    }
+  }
+
+  chunk[n++] = SLIP_END;
+  _send(chunk, n);
+
+  batch_size = 0;
+}
+
+/* Ensure that the current packet has room for size more bytes. */
+static void batch_reserve(unsigned int size)
+{
+  if(batch_size + size > MAX_PACKET_SIZE - 2)
+    protocol_flush();
+}
+
+/* Append a message to the current packet. */
+static void batch_message(unsigned char info,
+                          const unsigned char *data,
+                          unsigned int size)
+{
+  batch_reserve(size + 1);
+
+  batch[batch_size++] = info;
+  memcpy(batch + batch_size, data, size);
+  batch_size += size;
+}
+
+static void write_frame(const unsigned char *frame, unsigned int size)
+{
+  batch_message(PROT_MTYPE_FRAME | size, frame, size);
+}
+
+void send_control(enum prot_ctype type,
+                  const unsigned char *data,
+                  unsigned int size)
+{
+  unsigned char message[MAX_MESSAGE_SIZE];
+
+  message[0] = type;
+  if(size)
+    memcpy(message + 1, data, size);
+
+  batch_message(PROT_MTYPE_CONTROL | (size + 1), message, size + 1);
+
+  /* The host is usually waiting for control messages. */
+  protocol_flush();
+}
+#else
 void input_step(unsigned char c)
 {
   static unsigned int  idx  = 0;
@@ -78,7 +620,12 @@ void input_step(unsigned char c)
     idx++;
 }
 
-void send_frame(const unsigned char *frame, unsigned int size)
+void protocol_flush(void)
+{
+  /* Messages are always sent immediately. */
+}
+
+static void write_frame(const unsigned char *frame, unsigned int size)
 {
   unsigned char info = PROT_MTYPE_FRAME | size;
 
@@ -99,6 +646,75 @@ void send_control(enum prot_ctype type,
 
   _send(data, size);
 }
+#endif /* PROTOCOL_V2 */
+
+/* Send the first bytes of a frame along with its original size. */
+static void write_truncated_frame(const unsigned char *frame,
+                                  unsigned int size)
+{
+  unsigned char message[MAX_MESSAGE_SIZE];
+
+  message[0] = PROT_CTYPE_TRUNCATED_FRAME;
+  message[1] = size;
+  memcpy(message + 2, frame, snaplen);
+
+#ifdef PROTOCOL_V2
+  /* Unlike the other control messages they are batched as frames. */
+  batch_message(PROT_MTYPE_CONTROL | (snaplen + 2), message, snaplen + 2);
+#else
+  send_control(PROT_CTYPE_TRUNCATED_FRAME, message + 1, snaplen + 1);
+#endif /* PROTOCOL_V2 */
+}
+
+/* Send the tick at which the next frame was received. */
+static void write_timestamp(unsigned long tick)
+{
+  unsigned char message[1 + TIMESTAMP_SIZE];
+
+  message[0] = PROT_CTYPE_TIMESTAMP;
+  message[1] = tick;
+  message[2] = tick >> 8;
+  message[3] = tick >> 16;
+  message[4] = tick >> 24;
+
+#ifdef PROTOCOL_V2
+  batch_message(PROT_MTYPE_CONTROL | sizeof(message), message, sizeof(message));
+#else
+  send_control(PROT_CTYPE_TIMESTAMP, message + 1, TIMESTAMP_SIZE);
+#endif /* PROTOCOL_V2 */
+}
+
+void send_frame(const unsigned char *frame, unsigned int size)
+{
+  send_timestamped_frame(frame, size, _clock ? _clock() : 0);
+}
+
+void send_timestamped_frame(const unsigned char *frame,
+                            unsigned int size,
+                            unsigned long tick)
+{
+  if(filter_set && !match_filter(frame, size)) {
+    protocol_count(PROT_COUNTER_FILTERED);
+    return;
+  }
+
+  protocol_count(PROT_COUNTER_FORWARDED);
+
+  if(timestamps) {
+#ifdef PROTOCOL_V2
+    /* The timestamp and the frame must be in the same packet. Otherwise the
+       host could pair the timestamp with the wrong frame on packet loss. */
+    batch_reserve(1 + TIMESTAMP_SIZE + 1 +
+                  ((snaplen && size > snaplen) ? snaplen + 2 : size));
+#endif /* PROTOCOL_V2 */
+    write_timestamp(tick);
+  }
+
+  if(snaplen && size > snaplen)
+    write_truncated_frame(frame, size);
+  else
+    write_frame(frame, size);
+}
 
 static unsigned int find_zero(const unsigned char *b)
 {
@@ -20,6 +20,8 @@
 
 #include "priv-protocol.h"
 
+#define PROTOCOL_TIMER_INTERVAL 100 /* ms */
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -35,12 +37,65 @@ void protocol_init(void (*frame_cb)(unsigned char *, unsigned int),
                                       unsigned int),
                    void (*send)(const unsigned char *, unsigned int));
 
-/* This function should be called when a character is read from UART. */
+/* Install the function which changes the speed of the UART when the host
+   requests it. The speed is given in bits per second or zero for the initial
+   speed. The function must wait until the pending bytes have been transmitted
+   and return zero when the speed is not supported. Without this function the
+   firmware refuses to change its speed. */
+void protocol_set_baud(int (*set_baud)(unsigned long));
+
+/* Increment a statistics counter reported to the host. The firmware counts
+   the frames received by the radio and the errors of the radio and of the
+   UART. The protocol counts the filtered and forwarded frames and the
+   corrupted packets itself. */
+void protocol_count(enum prot_counter counter);
+
+/* Install the clock used to timestamp the frames when the host requests it.
+   The function returns the current value of a free running counter at the
+   specified frequency. Only the 32 least significant bits are used. Without
+   clock the firmware refuses to timestamp the frames. */
+void protocol_set_clock(unsigned long (*clock)(void), unsigned long hz);
+
+/* This function should be called every PROTOCOL_TIMER_INTERVAL milliseconds.
+   It is used to fall back to the previous speed when the host does not
+   confirm the new one. */
+void protocol_timer(void);
+
+/* This function should be called when a character is read from UART. The
+   callbacks are called from this function. So it should not be called from
+   the UART interrupt unless they are fast enough. */
 void input_step(unsigned char c);
 
-/* Send a frame on UART. */
+/* Queue a character read from UART. This function is meant to be called from
+   the UART interrupt, the characters are parsed later by protocol_poll(). The
+   character is dropped when the ring (PROTOCOL_RING_SIZE) is full. */
+void input_isr(unsigned char c);
+
+/* Parse the characters queued by input_isr(). This should be called from the
+   main loop and it calls the callbacks from there. Return the number of
+   characters parsed. */
+unsigned int protocol_poll(void);
+
+/* Send a frame on UART. The frames which do not match the filter installed
+   by the host are dropped and truncated to the snap length when configured.
+   With the version 2 of the protocol (PROTOCOL_V2 defined), the frames are
+   grouped into a packet which is sent when full or flushed. Control messages
+   are always sent immediately. When the host enabled the timestamps, the
+   frame is timestamped with the current value of the clock. */
 void send_frame(const unsigned char *frame, unsigned int size);
 
+/* Same as send_frame() with the value of the clock when the frame was
+   received. The radio driver should use this function when it can capture
+   the clock at the start of the frame (eg. SFD interrupt). */
+void send_timestamped_frame(const unsigned char *frame,
+                            unsigned int size,
+                            unsigned long tick);
+
+/* Send the frames waiting in the current packet. This should be called when
+   the firmware is idle, for example when all the frames received by the
+   radio were sent. This does nothing with the version 1 of the protocol. */
+void protocol_flush(void);
+
 /* Send a control message on UART. */
 void send_control(enum prot_ctype type,
                   const unsigned char *data,
@@ -0,0 +1,197 @@
+/* File: histogram.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <err.h>
+
+#include "histogram.h"
+
+/* Each power of two is split into 2^SUB_BITS buckets. Values below 2^SUB_BITS
+   have their own bucket. So the error is below 1 / 2^SUB_BITS. */
+#define SUB_BITS    7
+#define SUB_COUNT   (1 << SUB_BITS)
+#define NB_BUCKETS  ((HISTOGRAM_MAX_BITS - SUB_BITS + 1) * SUB_COUNT)
+
+struct histogram {
+  uint64_t count;
+  uint64_t min;
+  uint64_t max;
+
+  /* Welford's online algorithm for the mean and variance. */
+  double mean;
+  double m2;
+
+  uint64_t buckets[NB_BUCKETS];
+};
+
+static int msb(uint64_t value)
+{
+  int bit = 0;
+
+  while(value >>= 1)
+    bit++;
+
+  return bit;
+}
+
+static unsigned int bucket_index(uint64_t value)
+{
+  int shift;
+
+  if(value < SUB_COUNT)
+    return value;
+
+  if(value >> HISTOGRAM_MAX_BITS)
+    return NB_BUCKETS - 1;
+
+  /* The value is in [2^m, 2^(m+1)) which is split
+     into SUB_COUNT buckets of width 2^(m - SUB_BITS). */
+  shift = msb(value) - SUB_BITS;
+
+  return (shift + 1) * SUB_COUNT + (value >> shift) - SUB_COUNT;
+}
+
+static uint64_t bucket_lower(unsigned int index)
+{
+  int shift;
+
+  if(index < SUB_COUNT)
+    return index;
+
+  shift = index / SUB_COUNT - 1;
+
+  return (uint64_t)(index % SUB_COUNT + SUB_COUNT) << shift;
+}
+
+static uint64_t bucket_upper(unsigned int index)
+{
+  int shift;
+
+  if(index < SUB_COUNT)
+    return index;
+
+  shift = index / SUB_COUNT - 1;
+
+  return bucket_lower(index) + ((uint64_t)1 << shift) - 1;
+}
+
+histogram_t histogram_create(void)
+{
+  struct histogram *h = malloc(sizeof(struct histogram));
+
+  if(!h)
+    errx(EXIT_FAILURE, "out of memory");
+
+  histogram_reset(h);
+
+  return h;
+}
+
+void histogram_add(histogram_t h, uint64_t value)
+{
+  double delta;
+
+  h->buckets[bucket_index(value)]++;
+  h->count++;
+
+  if(value < h->min)
+    h->min = value;
+  if(value > h->max)
+    h->max = value;
+
+  delta    = value - h->mean;
+  h->mean += delta / h->count;
+  h->m2   += delta * (value - h->mean);
+}
+
+void histogram_reset(histogram_t h)
+{
+  memset(h, 0, sizeof(struct histogram));
+  h->min = UINT64_MAX;
+}
+
+uint64_t histogram_count(histogram_t h)
+{
+  return h->count;
+}
+
+uint64_t histogram_min(histogram_t h)
+{
+  return h->count ? h->min : 0;
+}
+
+uint64_t histogram_max(histogram_t h)
+{
+  return h->max;
+}
+
+double histogram_mean(histogram_t h)
+{
+  return h->mean;
+}
+
+double histogram_stddev(histogram_t h)
+{
+  return h->count ? sqrt(h->m2 / h->count) : 0.;
+}
+
+uint64_t histogram_percentile(histogram_t h, double percentile)
+{
+  uint64_t rank, seen = 0;
+  unsigned int i;
+
+  if(!h->count)
+    return 0;
+
+  /* Rank of the value that we are looking for (starting at one). */
+  rank = ceil(percentile / 100. * h->count);
+  if(rank == 0)
+    rank = 1;
+
+  for(i = 0 ; i < NB_BUCKETS ; i++) {
+    seen += h->buckets[i];
+    if(seen >= rank) {
+      uint64_t upper = bucket_upper(i);
+
+      /* The exact extremes are known. */
+      return upper > h->max ? h->max : upper;
+    }
+  }
+
+  return h->max;
+}
+
+void histogram_export(histogram_t h, FILE *stream)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < NB_BUCKETS ; i++)
+    if(h->buckets[i])
+      fprintf(stream, "%llu\t%llu\t%llu\n",
+              (unsigned long long)bucket_lower(i),
+              (unsigned long long)bucket_upper(i),
+              (unsigned long long)h->buckets[i]);
+}
+
+void histogram_destroy(histogram_t h)
+{
+  free(h);
+}
@@ -0,0 +1,64 @@
+/* File: histogram.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Log-bucketed histogram in the spirit of HdrHistogram. Each power of two is
+   split into linear sub-buckets so that the relative error on recorded values
+   stays below 1%. The memory used does not depend on the number of recorded
+   values which makes it suitable for very long measurements. */
+
+/* Largest value that can be recorded precisely (2^40 ns is about 18 minutes).
+   Larger values are recorded into the last bucket. */
+#define HISTOGRAM_MAX_BITS 40
+
+typedef struct histogram * histogram_t;
+
+/* Create an empty histogram. */
+histogram_t histogram_create(void);
+
+/* Record a value. */
+void histogram_add(histogram_t h, uint64_t value);
+
+/* Clear all recorded values. */
+void histogram_reset(histogram_t h);
+
+/* Number of recorded values. */
+uint64_t histogram_count(histogram_t h);
+
+/* Exact statistics on the recorded values. */
+uint64_t histogram_min(histogram_t h);
+uint64_t histogram_max(histogram_t h);
+double histogram_mean(histogram_t h);
+double histogram_stddev(histogram_t h);
+
+/* Value below which the specified percentage (0 to 100) of the recorded values
+   fall. This is the upper bound of the bucket so the error is below 1%. */
+uint64_t histogram_percentile(histogram_t h, double percentile);
+
+/* Export the non-empty buckets as tab separated lines of the
+   form: LOWER UPPER COUNT where bounds are inclusive. */
+void histogram_export(histogram_t h, FILE *stream);
+
+/* Destroy the histogram. */
+void histogram_destroy(histogram_t h);
+
+#endif /* _HISTOGRAM_H_ */
@@ -15,9 +15,13 @@
    You should have received a copy of the GNU General Public License
    along with this program. If not, see <http://www.gnu.org/licenses/>. */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include <sys/select.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
@@ -26,12 +30,18 @@
 
 #include "input.h"
 
-#define UART_BUFFER_SIZE 1024   /* UART input buffer size */
+#define UART_BUFFER_SIZE 4096   /* UART input buffer size */
 #define SELECT_INTERVAL  200000 /* Interval between */
 
-/* We use the timeout scale to adapt it to the
-   select interval which we use as our clock. */
-#define TO_SCALE    1000000 / SELECT_INTERVAL
+/* Maximum number of periodic callbacks of the input loop. */
+#define MAX_TIMERS 4
+
+/* Periodic callbacks of the input loop. */
+static struct timer {
+  void (*callback)(void);
+  uint64_t interval;
+  uint64_t next;
+} timers[MAX_TIMERS];
 
 /* This structure describe the wait message used with select. */
 struct p_wait {
@@ -85,6 +95,138 @@ static void clear_message(const struct p_wait *wait)
   fflush(stdout);
 }
 
+static uint64_t now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void input_set_timer(unsigned int interval, void (*callback)(void))
+{
+  struct timer *t, *free_slot = NULL;
+
+  for(t = timers ; t < timers + MAX_TIMERS ; t++) {
+    if(t->callback == callback)
+      break;
+    if(!t->callback && !free_slot)
+      free_slot = t;
+  }
+
+  if(t == timers + MAX_TIMERS) {
+    if(!interval)
+      return;
+    if(!free_slot)
+      errx(EXIT_FAILURE, "too many timers");
+    t = free_slot;
+  }
+
+  if(!interval) {
+    t->callback = NULL;
+    return;
+  }
+
+  t->callback = callback;
+  t->interval = interval;
+  t->next     = now_ms() + interval;
+}
+
+/* Call the timer callbacks which are due and return the number of milliseconds
+   until the next one, at most the select interval. We do not try to catch up
+   when we are late as the callbacks are not meant to count time. */
+static uint64_t check_timers(void)
+{
+  uint64_t t, wait = SELECT_INTERVAL / 1000;
+  int i;
+
+  t = now_ms();
+
+  for(i = 0 ; i < MAX_TIMERS ; i++) {
+    struct timer *timer = &timers[i];
+
+    if(!timer->callback)
+      continue;
+
+    if(t >= timer->next) {
+      timer->next += timer->interval;
+      if(timer->next <= t)
+        timer->next = t + timer->interval;
+
+      /* The callback may change its own timer. */
+      timer->callback();
+
+      t = now_ms();
+      if(!timer->callback || timer->next <= t)
+        continue;
+    }
+
+    if(timer->next - t < wait)
+      wait = timer->next - t;
+  }
+
+  return wait;
+}
+
+/* Move the last incomplete message or packet at the beginning of the buffer
+   and return its size. */
+static int keep_tail(unsigned char *buffer,
+                     const unsigned char *p,
+                     const unsigned char *buffer_end)
+{
+  if(p >= buffer_end)
+    return 0;
+  else if(p == buffer)
+    return buffer_end - p;
+  else { /* p < buffer_end */
+    size_t last_frame_size = buffer_end - p;
+    memmove(buffer, p, last_frame_size);
+    return last_frame_size;
+  }
+}
+
+/* Same as parse_uart_buffer() for the version 2 of the protocol. Here the
+   buffer is split on END bytes and each packet is parsed by the protocol. */
+static int parse_slip_buffer(unsigned char *buffer,
+                             size_t size,
+                             bool (*callback)(const unsigned char *,
+                                              enum prot_mtype,
+                                              size_t),
+                             const struct p_wait *w)
+{
+  const unsigned char *buffer_end = buffer + size;
+  unsigned char *p, *end;
+
+  for(p = buffer ; p < buffer_end ; p = end + 1) {
+    end = memchr(p, SLIP_END, buffer_end - p);
+    if(!end)
+      break;
+
+    /* Consecutive END bytes are empty packets. */
+    if(end == p)
+      continue;
+
+    clear_message(w);
+
+    switch(prot_parse_packet(p, end - p, callback)) {
+    case(-1):
+      return end + 1 >= buffer_end ? -1 : -2;
+    case(-2):
+      return -2;
+    }
+  }
+
+  /* The packet cannot be that large. We lost the END byte so we drop what we
+     have and synchronize on the next one. */
+  if(buffer_end - p > MAX_ENCODED_PACKET_SIZE) {
+    prot_parse_packet(p, buffer_end - p, callback);
+    return 0;
+  }
+
+  return keep_tail(buffer, p, buffer_end);
+}
+
 /* This function will parse the buffer. This is where we bind ourself to the
    protocol. We don't know about the protocol directly here, except that it is
    composed of messages with a certain length and of a certain type. This
@@ -103,6 +245,9 @@ static int parse_uart_buffer(unsigned char *buffer,
   const unsigned char *buffer_end = buffer + size;
   const unsigned char *p;
 
+  if(prot_get_version() == 2)
+    return parse_slip_buffer(buffer, size, callback, w);
+
   for(p = buffer ; p < buffer_end ; p += frame_size) {
     enum prot_mtype type;
 
@@ -137,15 +282,50 @@ static int parse_uart_buffer(unsigned char *buffer,
      of interest when the first frame is incomplete and we still lie at the
      beginning of the buffer. In such case we may avoid an unnecessary call to
      memmove which would have copied the frame anyway. */
-  if(p >= buffer_end)
-    return 0;
-  else if(p == buffer)
-    return buffer_end - p;
-  else { /* p < buffer_end */
-    size_t last_frame_size = buffer_end - p;
-    memmove(buffer, p, last_frame_size);
-    return last_frame_size;
+  return keep_tail(buffer, p, buffer_end);
+}
+
+int input_parse(unsigned char *buffer,
+                size_t size,
+                bool (*callback)(const unsigned char *,
+                                 enum prot_mtype,
+                                 size_t))
+{
+  static const struct p_wait no_wait = { .message = NULL, .clear = NULL };
+
+  return parse_uart_buffer(buffer, size, callback, &no_wait);
+}
+
+int input_read(int fd,
+               bool (*callback)(const unsigned char *,
+                                enum prot_mtype,
+                                size_t))
+{
+  /* The last incomplete message is kept between two calls. */
+  static unsigned char buf[UART_BUFFER_SIZE];
+  static int start = 0;
+  ssize_t size;
+
+  size = read(fd, buf + start, sizeof(buf) - start);
+
+  if(size < 0) {
+    if(errno == EINTR || errno == EAGAIN)
+      return 0;
+    err(EXIT_FAILURE, "cannot read");
   }
+  else if(size == 0)
+    errx(EXIT_FAILURE, "end of file on input");
+
+  start = input_parse(buf, size + start, callback);
+
+  /* Like the input loop, we discard what is left
+     when the callback asked us to stop. */
+  if(start < 0) {
+    start = 0;
+    return -1;
+  }
+
+  return size;
 }
 
 int input_loop(int fd,
@@ -160,7 +340,7 @@ int input_loop(int fd,
   fd_set rfds;
   int start  = 0;
   int retval = 0;
-  int ttl    = timeout * TO_SCALE;
+  uint64_t deadline = now_ms() + timeout * 1000;
 
   /* Prepare the wait message. */
   prepare_wait_message(&w, w_message);
@@ -178,6 +358,9 @@ int input_loop(int fd,
     struct timeval tv = { .tv_sec  = 0,
                           .tv_usec = SELECT_INTERVAL };
 
+    /* Wake up in time for the next timer. */
+    tv.tv_usec = check_timers() * 1000;
+
     /* Wait for something to read. */
     ret = select(fd + 1, &rfds, NULL, NULL, &tv);
 
@@ -192,7 +375,7 @@ int input_loop(int fd,
       wait_message(&w);
 
       /* Since we didn't receive any message we have to check for timeout. */
-      if(timeout && ttl-- == 0) {
+      if(timeout && now_ms() >= deadline) {
         retval = -2;
         goto EXIT;
       }
@@ -200,8 +383,8 @@ int input_loop(int fd,
       continue;
     }
 
-    /* Reset the TTL */
-    ttl = timeout * TO_SCALE;
+    /* Reset the timeout. */
+    deadline = now_ms() + timeout * 1000;
 
     /* Fill the buffer. */
     size = read(fd, buf + start, sizeof(buf) - start);
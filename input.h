@@ -19,9 +19,32 @@
 #define _INPUT_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #include "protocol.h"
 
+/* Parse the messages contained in a buffer as done by the input loop. The
+   callback is called for each complete message. The last incomplete message
+   is moved to the beginning of the buffer and its size is returned. When the
+   callback returns false, the function returns -1 if the buffer is empty and
+   -2 otherwise. This is mainly useful for benchmarks. */
+int input_parse(unsigned char *buffer,
+                size_t size,
+                bool (*callback)(const unsigned char *,
+                                 enum prot_mtype,
+                                 size_t));
+
+/* Read the available bytes from the file descriptor and parse the complete
+   messages. This is meant for event loops, that is when the file descriptor
+   is known to be readable. The last incomplete message is kept until the
+   next call. Only one file descriptor may be read this way. Return the number
+   of bytes read or -1 if the callback returned false, in which case the
+   messages left in the buffer are discarded. */
+int input_read(int fd,
+               bool (*callback)(const unsigned char *,
+                                enum prot_mtype,
+                                size_t));
+
 /* This will start a buffered input loop which will read the specified
    file descriptor for messages. When a message is found, the specified
    callback will be called with the message type and its size. An optional
@@ -38,4 +61,11 @@ int input_loop(int fd,
                const char *w_message,
                int timeout);
 
+/* Call the callback every interval milliseconds from the input loop. The
+   callback is called between two reads so it may write to the file descriptor
+   but it should not block. Up to four callbacks may have a timer. Setting the
+   timer of a callback again changes its interval, even from the callback
+   itself, and a zero interval removes it. */
+void input_set_timer(unsigned int interval, void (*callback)(void));
+
 #endif /* _INPUT_H_ */
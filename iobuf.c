@@ -68,13 +68,16 @@ static ssize_t fill_buffer(iofile_t file)
 int iobuf_flush(iofile_t file)
 {
   int write_size  = file->write_size;
+  const char *p   = file->buf;
 
+  /* Pipes may accept only a part of the buffer. */
   while(write_size) {
-    ssize_t partial_write = write(file->fd, file->buf, write_size);
+    ssize_t partial_write = write(file->fd, p, write_size);
     if(partial_write < 0)
       return partial_write;
 
     write_size -= partial_write;
+    p          += partial_write;
   }
 
   file->write_size = 0;
@@ -181,6 +184,11 @@ int iobuf_close(iofile_t file)
   return ret;
 }
 
+int iobuf_fileno(iofile_t file)
+{
+  return file->fd;
+}
+
 int iobuf_putc(char c, iofile_t file)
 {
   if(file->write_size == IOBUF_SIZE) {
@@ -81,6 +81,10 @@ int iobuf_flush(iofile_t file);
    when needed. */
 int iobuf_close(iofile_t file);
 
+/* File descriptor of the stream. Data still in the user-space buffer is not
+   seen through it until the stream is flushed. */
+int iobuf_fileno(iofile_t file);
+
 /* Write a single character to the specified file. */
 int iobuf_putc(char c, iofile_t file);
 
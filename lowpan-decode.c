@@ -0,0 +1,560 @@
+/* File: lowpan-decode.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mac.h"
+#include "lowpan.h"
+#include "lowpan-decode.h"
+
+/* Check that there are at least n bytes left. */
+#define NEED(raw, end, n) if((end) - (raw) < (n)) return -1
+
+/* Multi-bytes fields are in network byte order. */
+#define BE16(raw) ((raw)[0] << 8 | (raw)[1])
+
+/* Link-layer address from which an elided IPv6 address is derived. */
+struct ll_addr {
+  enum mac_addr_mode mode;
+  uint64_t mac;
+};
+
+/* Fill the interface identifier from a link-layer address (RFC 6282 3.2.2).
+   Return false when the frame does not have this address. */
+static bool derive_iid(uint8_t *iid, const struct ll_addr *ll)
+{
+  int i;
+
+  switch(ll->mode) {
+  case MAM_SHORT:
+    memcpy(iid, "\x00\x00\x00\xff\xfe\x00", 6);
+    iid[6] = ll->mac >> 8;
+    iid[7] = ll->mac;
+    return true;
+  case MAM_LONG:
+    for(i = 0 ; i < 8 ; i++)
+      iid[i] = ll->mac >> (56 - 8 * i);
+    iid[0] ^= 0x02; /* universal/local bit */
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* Unicast address, stateless or stateful. With a context, the prefix is
+   unknown and left to zero. Return the number of inline bytes consumed. */
+static int decode_unicast(uint8_t *addr, unsigned int mode, bool context,
+                          const struct ll_addr *ll,
+                          const unsigned char *raw, const unsigned char *end)
+{
+  memset(addr, 0, 16);
+
+  /* Link-local prefix. */
+  if(!context) {
+    addr[0] = 0xfe;
+    addr[1] = 0x80;
+  }
+
+  switch(mode) {
+  case 0:
+    /* The unspecified address with a context. */
+    if(context)
+      return 0;
+    NEED(raw, end, 16);
+    memcpy(addr, raw, 16);
+    return 16;
+  case 1:
+    NEED(raw, end, 8);
+    memcpy(addr + 8, raw, 8);
+    return 8;
+  case 2:
+    NEED(raw, end, 2);
+    memcpy(addr + 8, "\x00\x00\x00\xff\xfe\x00", 6);
+    addr[14] = raw[0];
+    addr[15] = raw[1];
+    return 2;
+  default:
+    return derive_iid(addr + 8, ll) ? 0 : -1;
+  }
+}
+
+/* Multicast address, stateless only. */
+static int decode_multicast(uint8_t *addr, unsigned int mode,
+                            const unsigned char *raw, const unsigned char *end)
+{
+  memset(addr, 0, 16);
+  addr[0] = 0xff;
+
+  switch(mode) {
+  case 0:
+    NEED(raw, end, 16);
+    memcpy(addr, raw, 16);
+    return 16;
+  case 1: /* ffXX::00XX:XXXX:XXXX */
+    NEED(raw, end, 6);
+    addr[1] = raw[0];
+    memcpy(addr + 11, raw + 1, 5);
+    return 6;
+  case 2: /* ffXX::00XX:XXXX */
+    NEED(raw, end, 4);
+    addr[1] = raw[0];
+    memcpy(addr + 13, raw + 1, 3);
+    return 4;
+  default: /* ff02::00XX */
+    NEED(raw, end, 1);
+    addr[1]  = 0x02;
+    addr[15] = raw[0];
+    return 1;
+  }
+}
+
+/* Compressed UDP header (RFC 6282 4.3). The length is always elided. */
+static int decode_nhc_udp(struct lowpan_udp *udp, const unsigned char *raw,
+                          const unsigned char *end)
+{
+  const unsigned char *orig = raw;
+  uint8_t nhc = *raw++;
+
+  switch(nhc & NHC_UDP_P) {
+  case 0:
+    NEED(raw, end, 4);
+    udp->sport = BE16(raw);
+    udp->dport = BE16(raw + 2);
+    raw += 4;
+    break;
+  case 1:
+    NEED(raw, end, 3);
+    udp->sport = BE16(raw);
+    udp->dport = 0xf000 | raw[2];
+    raw += 3;
+    break;
+  case 2:
+    NEED(raw, end, 3);
+    udp->sport = 0xf000 | raw[0];
+    udp->dport = BE16(raw + 1);
+    raw += 3;
+    break;
+  default:
+    NEED(raw, end, 1);
+    udp->sport = 0xf0b0 | raw[0] >> 4;
+    udp->dport = 0xf0b0 | (raw[0] & 0xf);
+    raw++;
+    break;
+  }
+
+  udp->checksum_elided = nhc & NHC_UDP_C;
+  if(!udp->checksum_elided) {
+    NEED(raw, end, 2);
+    udp->checksum = BE16(raw);
+    raw += 2;
+  }
+  else
+    udp->checksum = 0;
+
+  return raw - orig;
+}
+
+/* Chain of compressed headers following IPHC. The extension headers are
+   skipped and the UDP header is decoded. Return the number of bytes
+   consumed. */
+static int decode_nhc(struct lowpan_packet *packet, const unsigned char *raw,
+                      const unsigned char *end)
+{
+  static const uint8_t eids[] = { IP_HOPOPTS, IP_ROUTING, IP_FRAGMENT,
+                                  IP_DSTOPTS, IP_MOBILITY, 0, 0, IP_IPV6 };
+  const unsigned char *orig = raw;
+  int n;
+
+  while(1) {
+    NEED(raw, end, 1);
+
+    if((*raw & NHC_UDP_MASK) == NHC_UDP) {
+      n = decode_nhc_udp(&packet->udp, raw, end);
+      if(n < 0)
+        return -1;
+
+      packet->headers    |= LH_UDP;
+      packet->next_header = IP_UDP;
+      return raw + n - orig;
+    }
+    else if((*raw & NHC_EXT_MASK) == NHC_EXT) {
+      uint8_t nhc = *raw++;
+
+      packet->next_header = eids[(nhc & NHC_EXT_EID) >> NHC_EXT_EID_SHR];
+
+      /* The encapsulated IPv6 header starts with its own IPHC which we leave
+         to the upper layer. */
+      if(packet->next_header == IP_IPV6) {
+        packet->nb_ext++;
+        return raw - orig;
+      }
+
+      if(!(nhc & NHC_EXT_NH)) {
+        NEED(raw, end, 2);
+        packet->next_header = raw[0];
+        raw += 2 + raw[1];
+        NEED(raw, end, 0);
+        packet->nb_ext++;
+        return raw - orig;
+      }
+
+      NEED(raw, end, 1);
+      raw += 1 + raw[0];
+      NEED(raw, end, 0);
+      packet->nb_ext++;
+    }
+    else
+      return -1;
+  }
+}
+
+/* IPHC compressed IPv6 header (RFC 6282 3). */
+static int decode_iphc(struct lowpan_packet *packet,
+                       const struct ll_addr *src,
+                       const struct ll_addr *dst,
+                       const unsigned char *raw, const unsigned char *end)
+{
+  static const uint8_t hop_limits[] = { 0, 1, 64, 255 };
+  const unsigned char *orig = raw;
+  uint16_t iphc;
+  int n;
+
+  NEED(raw, end, 2);
+  iphc = packet->iphc = BE16(raw);
+  raw += 2;
+
+  packet->context = 0;
+  if(iphc & IPHC_CID) {
+    NEED(raw, end, 1);
+    packet->context = *raw++;
+  }
+
+  /* The ECN comes before the DSCP on the wire. */
+  switch((iphc & IPHC_TF) >> IPHC_TF_SHR) {
+  case 0:
+    NEED(raw, end, 4);
+    packet->traffic_class = raw[0] << 2 | raw[0] >> 6;
+    packet->flow_label    = (raw[1] & 0xf) << 16 | raw[2] << 8 | raw[3];
+    raw += 4;
+    break;
+  case 1:
+    NEED(raw, end, 3);
+    packet->traffic_class = raw[0] >> 6;
+    packet->flow_label    = (raw[0] & 0xf) << 16 | raw[1] << 8 | raw[2];
+    raw += 3;
+    break;
+  case 2:
+    NEED(raw, end, 1);
+    packet->traffic_class = raw[0] << 2 | raw[0] >> 6;
+    packet->flow_label    = 0;
+    raw++;
+    break;
+  default:
+    packet->traffic_class = 0;
+    packet->flow_label    = 0;
+    break;
+  }
+
+  if(!(iphc & IPHC_NH)) {
+    NEED(raw, end, 1);
+    packet->next_header = *raw++;
+  }
+
+  packet->hop_limit = hop_limits[(iphc & IPHC_HLIM) >> IPHC_HLIM_SHR];
+  if(!packet->hop_limit) {
+    NEED(raw, end, 1);
+    packet->hop_limit = *raw++;
+  }
+
+  n = decode_unicast(packet->src, (iphc & IPHC_SAM) >> IPHC_SAM_SHR,
+                     iphc & IPHC_SAC, src, raw, end);
+  if(n < 0)
+    return -1;
+  raw += n;
+
+  /* The unspecified address does not need a context. */
+  if(iphc & IPHC_SAC && iphc & IPHC_SAM)
+    packet->unknown_context |= LC_SRC;
+
+  switch(iphc & (IPHC_M | IPHC_DAC)) {
+  case 0:
+  case IPHC_DAC:
+    /* The unspecified destination address is reserved. */
+    if((iphc & IPHC_DAC) && !(iphc & IPHC_DAM))
+      return -1;
+
+    n = decode_unicast(packet->dst, iphc & IPHC_DAM, iphc & IPHC_DAC,
+                       dst, raw, end);
+    if(iphc & IPHC_DAC)
+      packet->unknown_context |= LC_DST;
+    break;
+  case IPHC_M:
+    n = decode_multicast(packet->dst, iphc & IPHC_DAM, raw, end);
+    break;
+  default:
+    /* Unicast-prefix based multicast (RFC 3306) whose prefix comes from the
+       context: ffXX:XXLL:PPPP:PPPP:PPPP:PPPP:XXXX:XXXX. */
+    if(iphc & IPHC_DAM)
+      return -1;
+
+    NEED(raw, end, 6);
+    memset(packet->dst, 0, 16);
+    packet->dst[0] = 0xff;
+    memcpy(packet->dst + 1, raw, 2);
+    memcpy(packet->dst + 12, raw + 2, 4);
+    packet->unknown_context |= LC_DST;
+    n = 6;
+    break;
+  }
+  if(n < 0)
+    return -1;
+  raw += n;
+
+  if(iphc & IPHC_NH) {
+    n = decode_nhc(packet, raw, end);
+    if(n < 0)
+      return -1;
+    raw += n;
+  }
+
+  return raw - orig;
+}
+
+/* Uncompressed IPv6 header and UDP header. */
+static int decode_ipv6(struct lowpan_packet *packet,
+                       const unsigned char *raw, const unsigned char *end)
+{
+  const unsigned char *orig = raw;
+
+  NEED(raw, end, IPV6_HEADER_SIZE);
+
+  packet->traffic_class = (raw[0] & 0xf) << 4 | raw[1] >> 4;
+  packet->flow_label    = (raw[1] & 0xf) << 16 | raw[2] << 8 | raw[3];
+  packet->next_header   = raw[6];
+  packet->hop_limit     = raw[7];
+  memcpy(packet->src, raw + 8, 16);
+  memcpy(packet->dst, raw + 24, 16);
+  raw += IPV6_HEADER_SIZE;
+
+  if(packet->next_header == IP_UDP) {
+    NEED(raw, end, UDP_HEADER_SIZE);
+
+    packet->udp.sport    = BE16(raw);
+    packet->udp.dport    = BE16(raw + 2);
+    packet->udp.length   = BE16(raw + 4);
+    packet->udp.checksum = BE16(raw + 6);
+    packet->udp.checksum_elided = false;
+    packet->headers |= LH_UDP;
+    raw += UDP_HEADER_SIZE;
+  }
+
+  return raw - orig;
+}
+
+int lowpan_decode(struct lowpan_packet *packet, const struct mac_frame *frame)
+{
+  const unsigned char *orig = frame->payload;
+  const unsigned char *raw  = orig;
+  const unsigned char *end  = orig + frame->size;
+  struct ll_addr src, dst;
+  int n;
+
+  packet->headers = 0;
+  packet->unknown_context = 0;
+  packet->nb_ext = 0;
+
+  /* Only data frames carry packets. Encrypted payloads must have been
+     unsecured first. */
+  if((frame->control & MC_TYPE) != MT_DATA || !orig)
+    return -1;
+  if(frame->security && (frame->security->control & SC_LEVEL) >= SL_ENC &&
+     frame->security->status != MS_VALID)
+    return -1;
+
+  src.mode = (frame->control & MC_SAM) >> MC_SAM_SHR;
+  src.mac  = frame->src.mac;
+  dst.mode = (frame->control & MC_DAM) >> MC_DAM_SHR;
+  dst.mac  = frame->dst.mac;
+
+  NEED(raw, end, 1);
+
+  /* Mesh header (RFC 4944 5.2). Elided addresses then derive from the
+     originator and final destination instead of the link-layer hop. */
+  if((*raw & LD_MESH_MASK) == LD_MESH) {
+    struct lowpan_mesh *mesh = &packet->mesh;
+    uint8_t dispatch = *raw++;
+
+    mesh->hops       = dispatch & LM_HOPS;
+    mesh->orig_mode  = dispatch & LM_ORIG_SHORT ? MAM_SHORT : MAM_LONG;
+    mesh->final_mode = dispatch & LM_FINAL_SHORT ? MAM_SHORT : MAM_LONG;
+
+    NEED(raw, end, mesh->orig_mode == MAM_SHORT ? 2 : 8);
+    for(mesh->orig = 0, n = mesh->orig_mode == MAM_SHORT ? 2 : 8 ; n ; n--)
+      mesh->orig = mesh->orig << 8 | *raw++;
+
+    NEED(raw, end, mesh->final_mode == MAM_SHORT ? 2 : 8);
+    for(mesh->final = 0, n = mesh->final_mode == MAM_SHORT ? 2 : 8 ; n ; n--)
+      mesh->final = mesh->final << 8 | *raw++;
+
+    src.mode = mesh->orig_mode;
+    src.mac  = mesh->orig;
+    dst.mode = mesh->final_mode;
+    dst.mac  = mesh->final;
+
+    packet->headers |= LH_MESH;
+    NEED(raw, end, 1);
+  }
+
+  if(*raw == LD_BC0) {
+    NEED(raw, end, 2);
+    packet->bc0_seqno = raw[1];
+    packet->headers  |= LH_BC0;
+    raw += 2;
+    NEED(raw, end, 1);
+  }
+
+  switch(*raw & LD_FRAG_MASK) {
+  case LD_FRAGN:
+    NEED(raw, end, 5);
+    packet->frag.first  = false;
+    packet->frag.size   = BE16(raw) & 0x7ff;
+    packet->frag.tag    = BE16(raw + 2);
+    packet->frag.offset = raw[4] * 8;
+    packet->headers    |= LH_FRAG;
+    raw += 5;
+
+    /* The rest is the continuation of the datagram. */
+    goto EXIT;
+  case LD_FRAG1:
+    NEED(raw, end, 4);
+    packet->frag.first  = true;
+    packet->frag.size   = BE16(raw) & 0x7ff;
+    packet->frag.tag    = BE16(raw + 2);
+    packet->frag.offset = 0;
+    packet->headers    |= LH_FRAG;
+    raw += 4;
+    NEED(raw, end, 1);
+    break;
+  }
+
+  if((*raw & LD_IPHC_MASK) == LD_IPHC) {
+    n = decode_iphc(packet, &src, &dst, raw, end);
+    if(n < 0)
+      return -1;
+    packet->headers |= LH_IPV6 | LH_IPHC;
+    raw += n;
+  }
+  else if(*raw == LD_IPV6) {
+    n = decode_ipv6(packet, raw + 1, end);
+    if(n < 0)
+      return -1;
+    packet->headers |= LH_IPV6;
+    raw += 1 + n;
+  }
+  else
+    return -1;
+
+  /* The compressed UDP length is that of the whole datagram. */
+  if(packet->headers & LH_UDP && packet->headers & LH_IPHC) {
+    if(packet->headers & LH_FRAG)
+      packet->udp.length = packet->frag.size - IPV6_HEADER_SIZE;
+    else
+      packet->udp.length = end - raw + UDP_HEADER_SIZE;
+  }
+
+EXIT:
+  packet->offset = raw - orig;
+  packet->size   = end - raw;
+
+  return 0;
+}
+
+int lowpan_uncompress(const struct lowpan_packet *packet,
+                      unsigned int datagram_size,
+                      unsigned char *buf)
+{
+  unsigned int size = IPV6_HEADER_SIZE;
+  unsigned int payload_length = datagram_size - IPV6_HEADER_SIZE;
+
+  /* We do not know the size of the uncompressed extension headers. Neither
+     do we know the prefix of the addresses compressed with a context. */
+  if(!(packet->headers & LH_IPV6) || packet->nb_ext ||
+     packet->unknown_context || datagram_size < IPV6_HEADER_SIZE)
+    return -1;
+
+  buf[0] = 0x60 | packet->traffic_class >> 4;
+  buf[1] = packet->traffic_class << 4 | packet->flow_label >> 16;
+  buf[2] = packet->flow_label >> 8;
+  buf[3] = packet->flow_label;
+  buf[4] = payload_length >> 8;
+  buf[5] = payload_length;
+  buf[6] = packet->next_header;
+  buf[7] = packet->hop_limit;
+  memcpy(buf + 8, packet->src, 16);
+  memcpy(buf + 24, packet->dst, 16);
+
+  if(packet->headers & LH_UDP) {
+    unsigned char *udp = buf + IPV6_HEADER_SIZE;
+
+    udp[0] = packet->udp.sport >> 8;
+    udp[1] = packet->udp.sport;
+    udp[2] = packet->udp.dport >> 8;
+    udp[3] = packet->udp.dport;
+    udp[4] = packet->udp.length >> 8;
+    udp[5] = packet->udp.length;
+    udp[6] = packet->udp.checksum >> 8;
+    udp[7] = packet->udp.checksum;
+    size += UDP_HEADER_SIZE;
+  }
+
+  return size;
+}
+
+void lowpan_udp_checksum(unsigned char *datagram, unsigned int size)
+{
+  unsigned char *udp = datagram + IPV6_HEADER_SIZE;
+  uint32_t sum = 0;
+  unsigned int i;
+
+  if(size < IPV6_HEADER_SIZE + UDP_HEADER_SIZE ||
+     datagram[6] != IP_UDP || udp[6] || udp[7])
+    return;
+
+  /* Pseudo-header: addresses, upper layer length and next header. */
+  for(i = 8 ; i < IPV6_HEADER_SIZE ; i += 2)
+    sum += BE16(datagram + i);
+  sum += size - IPV6_HEADER_SIZE;
+  sum += IP_UDP;
+
+  for(i = IPV6_HEADER_SIZE ; i + 1 < size ; i += 2)
+    sum += BE16(datagram + i);
+  if(i < size)
+    sum += datagram[i] << 8;
+
+  while(sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  sum = ~sum & 0xffff;
+
+  /* Zero means that there is no checksum. */
+  if(!sum)
+    sum = 0xffff;
+
+  udp[6] = sum >> 8;
+  udp[7] = sum;
+}
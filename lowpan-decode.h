@@ -0,0 +1,44 @@
+/* File: lowpan-decode.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _LOWPAN_DECODE_H_
+#define _LOWPAN_DECODE_H_
+
+#include "mac.h"
+#include "lowpan.h"
+
+/* Decode the 6LoWPAN headers (mesh, broadcast, fragment, IPHC and NHC UDP)
+   in the payload of a decoded MAC frame. Addresses elided by IPHC are derived
+   from the MAC frame. The packet only refers to the payload of the frame
+   which must outlive it. Return a negative number if the payload is not a
+   6LoWPAN packet, if it is truncated or if it is still encrypted. */
+int lowpan_decode(struct lowpan_packet *packet, const struct mac_frame *frame);
+
+/* Write the uncompressed IPv6 and UDP headers of a decoded packet into buf
+   for a datagram of the specified size. The upper layer data follows at the
+   returned offset. Return a negative number if the headers cannot be
+   uncompressed, that is when compressed extension headers were skipped or
+   when an address depends on an unknown context. */
+int lowpan_uncompress(const struct lowpan_packet *packet,
+                      unsigned int datagram_size,
+                      unsigned char *buf);
+
+/* Compute the UDP checksum of an uncompressed datagram when it was elided by
+   the compression. Other datagrams are left untouched. */
+void lowpan_udp_checksum(unsigned char *datagram, unsigned int size);
+
+#endif /* _LOWPAN_DECODE_H_ */
@@ -0,0 +1,151 @@
+/* File: lowpan-display.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <arpa/inet.h>
+#include <stdio.h>
+
+#include "lowpan.h"
+#include "lowpan-reasm.h"
+#include "lowpan-display.h"
+
+static void display_link_addr(enum mac_addr_mode mode, uint64_t addr)
+{
+  int i;
+
+  if(mode == MAM_SHORT) {
+    printf("%04X", (uint16_t)addr);
+    return;
+  }
+
+  for(i = 0 ; i < 7 ; i++)
+    printf("%02X:", (unsigned int)(addr >> (56 - 8 * i)) & 0xff);
+  printf("%02X", (unsigned int)addr & 0xff);
+}
+
+static const char * next_header_name(uint8_t next_header)
+{
+  switch(next_header) {
+  case(IP_HOPOPTS):
+    return "Hop-by-Hop";
+  case(IP_UDP):
+    return "UDP";
+  case(IP_IPV6):
+    return "IPv6";
+  case(IP_ROUTING):
+    return "Routing";
+  case(IP_FRAGMENT):
+    return "Fragment";
+  case(IP_ICMPV6):
+    return "ICMPv6";
+  case(IP_DSTOPTS):
+    return "Destination Options";
+  case(IP_MOBILITY):
+    return "Mobility";
+  default:
+    return "unknown";
+  }
+}
+
+void lowpan_display_ipv6(FILE *stream, const uint8_t addr[16])
+{
+  char buf[INET6_ADDRSTRLEN];
+
+  fputs(inet_ntop(AF_INET6, addr, buf, sizeof(buf)), stream);
+}
+
+void lowpan_display(const struct lowpan_packet *packet)
+{
+  printf("6LoWPAN:\n");
+
+  if(packet->headers & LH_MESH) {
+    printf(" Mesh          : ");
+    display_link_addr(packet->mesh.orig_mode, packet->mesh.orig);
+    printf(" -> ");
+    display_link_addr(packet->mesh.final_mode, packet->mesh.final);
+    printf(" (%u hops left)\n", packet->mesh.hops);
+  }
+
+  if(packet->headers & LH_BC0)
+    printf(" Broadcast     : %u\n", packet->bc0_seqno);
+
+  if(packet->headers & LH_FRAG) {
+    printf(" Fragment      : %s at %u of %u bytes\n",
+           packet->frag.first ? "first" : "next",
+           packet->frag.offset, packet->frag.size);
+    printf(" Datagram tag  : 0x%04x\n", packet->frag.tag);
+  }
+
+  if(!(packet->headers & LH_IPV6))
+    return;
+
+  printf(" IPv6 source   : ");
+  lowpan_display_ipv6(stdout, packet->src);
+  if(packet->unknown_context & LC_SRC)
+    printf(" (context %u)", packet->context >> 4);
+  putchar('\n');
+
+  printf(" IPv6 dest.    : ");
+  lowpan_display_ipv6(stdout, packet->dst);
+  if(packet->unknown_context & LC_DST)
+    printf(" (context %u)", packet->context & 0xf);
+  putchar('\n');
+
+  printf(" Traffic class : 0x%02x\n", packet->traffic_class);
+  printf(" Flow label    : 0x%05x\n", packet->flow_label);
+  printf(" Hop limit     : %u\n", packet->hop_limit);
+
+  if(packet->nb_ext)
+    printf(" Ext. headers  : %u\n", packet->nb_ext);
+
+  printf(" Next header   : %s (%u)\n", next_header_name(packet->next_header),
+         packet->next_header);
+
+  if(packet->headers & LH_UDP) {
+    printf(" UDP ports     : %u -> %u\n", packet->udp.sport, packet->udp.dport);
+    printf(" UDP length    : %u\n", packet->udp.length);
+
+    if(packet->udp.checksum_elided)
+      printf(" UDP checksum  : elided\n");
+    else
+      printf(" UDP checksum  : 0x%04x\n", packet->udp.checksum);
+  }
+}
+
+void lowpan_display_datagram(const struct lowpan_datagram *datagram)
+{
+  printf("Reassembled:\n");
+  printf(" Link source   : ");
+  display_link_addr(datagram->src_mode, datagram->src);
+  putchar('\n');
+  printf(" Link dest.    : ");
+  display_link_addr(datagram->dst_mode, datagram->dst);
+  putchar('\n');
+  printf(" Datagram      : %u bytes in %u fragments (tag 0x%04x)\n",
+         datagram->size, datagram->fragments, datagram->tag);
+
+  /* The datagram is at least as large as the IPv6 header. */
+  printf(" IPv6 source   : ");
+  lowpan_display_ipv6(stdout, datagram->data + 8);
+  putchar('\n');
+  printf(" IPv6 dest.    : ");
+  lowpan_display_ipv6(stdout, datagram->data + 24);
+  putchar('\n');
+  printf(" Next header   : %s (%u)\n", next_header_name(datagram->data[6]),
+         datagram->data[6]);
+}
@@ -0,0 +1,35 @@
+/* File: lowpan-display.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _LOWPAN_DISPLAY_H_
+#define _LOWPAN_DISPLAY_H_
+
+#include <stdio.h>
+
+#include "lowpan.h"
+#include "lowpan-reasm.h"
+
+/* Display the headers of a decoded 6LoWPAN packet. */
+void lowpan_display(const struct lowpan_packet *packet);
+
+/* Display a reassembled datagram. */
+void lowpan_display_datagram(const struct lowpan_datagram *datagram);
+
+/* Display an IPv6 address in its textual representation (RFC 5952). */
+void lowpan_display_ipv6(FILE *stream, const uint8_t addr[16]);
+
+#endif /* _LOWPAN_DISPLAY_H_ */
@@ -0,0 +1,201 @@
+/* File: lowpan-flows.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+
+#include "crc32.h"
+#include "lowpan.h"
+#include "lowpan-display.h"
+#include "lowpan-flows.h"
+
+/* Source, destination, next header and ports. */
+#define KEY_SIZE (16 + 16 + 1 + 2 + 2)
+
+struct flow {
+  unsigned char key[KEY_SIZE];
+  unsigned long datagrams;
+  unsigned long bytes;
+};
+
+struct lowpan_flows {
+  unsigned int capacity;
+  unsigned int count;
+  uint32_t index_mask;
+
+  struct flow *flows;
+  uint32_t *index;         /* open addressing, position + 1 or zero if free */
+
+  unsigned long datagrams; /* all the datagrams, including other flows */
+  unsigned long bytes;
+  unsigned long others;    /* datagrams of the flows beyond the capacity */
+};
+
+static void * xmalloc(size_t size)
+{
+  void *p = malloc(size);
+  if(!p)
+    errx(EXIT_FAILURE, "out of memory");
+  return p;
+}
+
+lowpan_flows_t lowpan_flows_create(unsigned int capacity)
+{
+  struct lowpan_flows *flows = xmalloc(sizeof(struct lowpan_flows));
+  unsigned int index_size = 1;
+
+  /* The index is kept at most half full. */
+  while(index_size < 2 * capacity)
+    index_size <<= 1;
+
+  flows->capacity   = capacity;
+  flows->count      = 0;
+  flows->index_mask = index_size - 1;
+  flows->flows      = xmalloc(capacity * sizeof(struct flow));
+  flows->index      = calloc(index_size, sizeof(uint32_t));
+  if(!flows->index)
+    errx(EXIT_FAILURE, "out of memory");
+
+  flows->datagrams = 0;
+  flows->bytes     = 0;
+  flows->others    = 0;
+
+  return flows;
+}
+
+void lowpan_flows_add(lowpan_flows_t flows, const struct lowpan_packet *packet)
+{
+  unsigned char key[KEY_SIZE];
+  unsigned long size;
+  struct flow *flow;
+  uint32_t i;
+
+  if(!(packet->headers & LH_IPV6))
+    return;
+
+  memcpy(key, packet->src, 16);
+  memcpy(key + 16, packet->dst, 16);
+  key[32] = packet->next_header;
+  if(packet->headers & LH_UDP) {
+    key[33] = packet->udp.sport >> 8;
+    key[34] = packet->udp.sport;
+    key[35] = packet->udp.dport >> 8;
+    key[36] = packet->udp.dport;
+  }
+  else
+    memset(key + 33, 0, 4);
+
+  /* Headers compressed by IPHC count for their uncompressed size. */
+  if(packet->headers & LH_FRAG)
+    size = packet->frag.size;
+  else
+    size = IPV6_HEADER_SIZE + packet->size +
+           (packet->headers & LH_UDP ? UDP_HEADER_SIZE : 0);
+
+  flows->datagrams++;
+  flows->bytes += size;
+
+  for(i = crc32_c(key, KEY_SIZE, 0) ; ; i++) {
+    uint32_t pos = flows->index[i & flows->index_mask];
+
+    if(!pos) {
+      if(flows->count == flows->capacity) {
+        flows->others++;
+        return;
+      }
+
+      flow = &flows->flows[flows->count++];
+      memcpy(flow->key, key, KEY_SIZE);
+      flow->datagrams = 0;
+      flow->bytes     = 0;
+      flows->index[i & flows->index_mask] = flows->count;
+      break;
+    }
+
+    flow = &flows->flows[pos - 1];
+    if(!memcmp(flow->key, key, KEY_SIZE))
+      break;
+  }
+
+  flow->datagrams++;
+  flow->bytes += size;
+}
+
+static int compare_flows(const void *a, const void *b)
+{
+  const struct flow *fa = *(const struct flow **)a;
+  const struct flow *fb = *(const struct flow **)b;
+
+  if(fa->bytes != fb->bytes)
+    return fa->bytes < fb->bytes ? 1 : -1;
+  return 0;
+}
+
+void lowpan_flows_display(lowpan_flows_t flows, FILE *stream)
+{
+  const struct flow **sorted = NULL;
+  unsigned int i;
+
+  if(flows->count)
+    sorted = xmalloc(flows->count * sizeof(struct flow *));
+
+  for(i = 0 ; i < flows->count ; i++)
+    sorted[i] = &flows->flows[i];
+  qsort(sorted, flows->count, sizeof(struct flow *), compare_flows);
+
+  fprintf(stream, "Datagrams  Bytes  Flow\n");
+  for(i = 0 ; i < flows->count ; i++) {
+    const struct flow *f = sorted[i];
+    unsigned int sport = f->key[33] << 8 | f->key[34];
+    unsigned int dport = f->key[35] << 8 | f->key[36];
+
+    fprintf(stream, "%9lu  %5lu  ", f->datagrams, f->bytes);
+
+    if(f->key[32] == IP_UDP) {
+      fputs("UDP [", stream);
+      lowpan_display_ipv6(stream, f->key);
+      fprintf(stream, "]:%u -> [", sport);
+      lowpan_display_ipv6(stream, f->key + 16);
+      fprintf(stream, "]:%u\n", dport);
+    }
+    else {
+      fprintf(stream, "%u ", f->key[32]);
+      lowpan_display_ipv6(stream, f->key);
+      fputs(" -> ", stream);
+      lowpan_display_ipv6(stream, f->key + 16);
+      fputc('\n', stream);
+    }
+  }
+
+  fprintf(stream, "%lu datagrams, %lu bytes in %u flows\n",
+          flows->datagrams, flows->bytes, flows->count);
+  if(flows->others)
+    fprintf(stream, "%lu datagrams from other flows (table full)\n",
+            flows->others);
+
+  free(sorted);
+}
+
+void lowpan_flows_destroy(lowpan_flows_t flows)
+{
+  free(flows->flows);
+  free(flows->index);
+  free(flows);
+}
@@ -0,0 +1,45 @@
+/* File: lowpan-flows.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _LOWPAN_FLOWS_H_
+#define _LOWPAN_FLOWS_H_
+
+#include <stdio.h>
+
+#include "lowpan.h"
+
+/* Counters of the IPv6 datagrams for each flow, that is each combination of
+   addresses, upper layer protocol and UDP ports. The table is allocated once
+   with a fixed capacity. When it is full, the datagrams of new flows are only
+   counted as a whole. */
+
+typedef struct lowpan_flows * lowpan_flows_t;
+
+/* Create a table for the specified number of flows. */
+lowpan_flows_t lowpan_flows_create(unsigned int capacity);
+
+/* Account for a decoded packet. The fragments which do not carry the IPv6
+   header cannot be attributed to a flow and are ignored. The size of a
+   fragmented datagram is taken from its fragment header. */
+void lowpan_flows_add(lowpan_flows_t flows, const struct lowpan_packet *packet);
+
+/* Display the flows from the busiest to the quietest. */
+void lowpan_flows_display(lowpan_flows_t flows, FILE *stream);
+
+void lowpan_flows_destroy(lowpan_flows_t flows);
+
+#endif /* _LOWPAN_FLOWS_H_ */
@@ -0,0 +1,489 @@
+/* File: lowpan-reasm.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+
+#include "slab.h"
+#include "lowpan.h"
+#include "lowpan-decode.h"
+#include "lowpan-reasm.h"
+
+/* Buffers come in power of two sizes from the smallest class up to the
+   largest datagram. Each class has its own slab. */
+#define MIN_CLASS_SHIFT 7 /* 128 bytes */
+#define NB_CLASSES      5 /* up to 2048 bytes */
+#define SLAB_PAGE_SIZE       16384
+
+/* Datagrams and sources are found with chained hash tables. */
+#define NB_BUCKETS 1024
+
+/* Datagrams are linked into the slot of the tick at which they expire. The
+   timeout spans half of the wheel so that the slots of two turns never
+   mix. */
+#define WHEEL_SLOTS 64
+
+/* Fragment offsets are expressed in units of 8 bytes. */
+#define UNIT_SIZE  8
+#define NB_UNITS   ((LOWPAN_REASM_MAX_SIZE + UNIT_SIZE - 1) / UNIT_SIZE)
+
+struct key {
+  uint64_t src;
+  uint64_t dst;
+  uint8_t src_mode;
+  uint8_t dst_mode;
+  uint16_t tag;
+  uint16_t size;
+};
+
+struct source {
+  struct source *next; /* hash chain */
+  uint64_t addr;
+  uint8_t mode;
+  size_t memory;
+};
+
+struct entry {
+  struct entry *next;      /* hash chain */
+  struct entry *wheel_prev;
+  struct entry *wheel_next;
+  uint64_t expire;         /* tick */
+
+  struct key key;
+  struct source *source;
+  struct timeval tv;       /* last fragment */
+
+  unsigned int class;
+  unsigned char *buf;
+  unsigned int missing;    /* units */
+  unsigned int fragments;
+  uint32_t received[(NB_UNITS + 31) / 32];
+};
+
+struct lowpan_reasm {
+  uint64_t width;    /* span of a tick in microseconds */
+  uint64_t ticks;    /* timeout in ticks */
+  uint64_t now;      /* last tick processed */
+  bool started;
+
+  size_t memory;
+  size_t source_memory;
+
+  slab_t classes[NB_CLASSES];
+  slab_t entries;
+  slab_t sources;
+
+  struct entry *buckets[NB_BUCKETS];
+  struct source *source_buckets[NB_BUCKETS];
+  struct entry wheel[WHEEL_SLOTS]; /* list heads */
+
+  struct lowpan_reasm_stats stats;
+
+  void (*emit)(const struct lowpan_datagram *, void *);
+  void *data;
+};
+
+static uint64_t tv_to_us(const struct timeval *tv)
+{
+  return (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+static uint32_t hash_addr(uint64_t addr, uint8_t mode)
+{
+  uint64_t h = (addr ^ mode) * 0x9e3779b97f4a7c15ULL;
+  return h >> 32;
+}
+
+static uint32_t hash_key(const struct key *key)
+{
+  return hash_addr(key->src, key->src_mode) ^
+         hash_addr(key->dst ^ ((uint64_t)key->tag << 16 | key->size),
+                   key->dst_mode);
+}
+
+static bool key_equal(const struct key *a, const struct key *b)
+{
+  return a->src == b->src && a->dst == b->dst &&
+         a->src_mode == b->src_mode && a->dst_mode == b->dst_mode &&
+         a->tag == b->tag && a->size == b->size;
+}
+
+lowpan_reasm_t lowpan_reasm_create(unsigned long timeout,
+                                   size_t memory,
+                                   size_t source_memory,
+                                   void (*emit)(const struct lowpan_datagram *,
+                                                void *),
+                                   void *data)
+{
+  struct lowpan_reasm *reasm = malloc(sizeof(struct lowpan_reasm));
+  unsigned int i;
+
+  if(!reasm)
+    errx(EXIT_FAILURE, "out of memory");
+
+  memset(reasm, 0, sizeof(struct lowpan_reasm));
+
+  reasm->width = (timeout + WHEEL_SLOTS / 2 - 1) / (WHEEL_SLOTS / 2);
+  if(!reasm->width)
+    reasm->width = 1;
+  reasm->ticks = (timeout + reasm->width - 1) / reasm->width;
+
+  reasm->memory        = memory;
+  reasm->source_memory = source_memory < memory ? source_memory : memory;
+
+  for(i = 0 ; i < NB_CLASSES ; i++) {
+    size_t size = 1 << (MIN_CLASS_SHIFT + i);
+    reasm->classes[i] = slab_create(size, SLAB_PAGE_SIZE / size);
+  }
+  reasm->entries = slab_create(sizeof(struct entry), 64);
+  reasm->sources = slab_create(sizeof(struct source), 64);
+
+  for(i = 0 ; i < WHEEL_SLOTS ; i++)
+    reasm->wheel[i].wheel_prev = reasm->wheel[i].wheel_next = &reasm->wheel[i];
+
+  reasm->emit = emit;
+  reasm->data = data;
+
+  return reasm;
+}
+
+static struct source * get_source(struct lowpan_reasm *reasm,
+                                  uint64_t addr, uint8_t mode)
+{
+  struct source **bucket;
+  struct source *source;
+
+  bucket = &reasm->source_buckets[hash_addr(addr, mode) % NB_BUCKETS];
+  for(source = *bucket ; source ; source = source->next)
+    if(source->addr == addr && source->mode == mode)
+      return source;
+
+  source = slab_alloc(reasm->sources);
+  source->addr   = addr;
+  source->mode   = mode;
+  source->memory = 0;
+  source->next   = *bucket;
+  *bucket        = source;
+
+  return source;
+}
+
+static void put_source(struct lowpan_reasm *reasm, struct source *source)
+{
+  struct source **p;
+
+  if(source->memory)
+    return;
+
+  p = &reasm->source_buckets[hash_addr(source->addr, source->mode) %
+                             NB_BUCKETS];
+  while(*p != source)
+    p = &(*p)->next;
+  *p = source->next;
+
+  slab_free(reasm->sources, source);
+}
+
+static size_t class_size(unsigned int class)
+{
+  return (size_t)1 << (MIN_CLASS_SHIFT + class);
+}
+
+/* Release a datagram, complete or not. */
+static void release(struct lowpan_reasm *reasm, struct entry *entry)
+{
+  struct entry **p = &reasm->buckets[hash_key(&entry->key) % NB_BUCKETS];
+  size_t size = class_size(entry->class);
+
+  while(*p != entry)
+    p = &(*p)->next;
+  *p = entry->next;
+
+  entry->wheel_prev->wheel_next = entry->wheel_next;
+  entry->wheel_next->wheel_prev = entry->wheel_prev;
+
+  reasm->stats.pending--;
+  reasm->stats.memory   -= size;
+  entry->source->memory -= size;
+  put_source(reasm, entry->source);
+
+  slab_free(reasm->classes[entry->class], entry->buf);
+  slab_free(reasm->entries, entry);
+}
+
+/* Drop the datagram which expires first. Return false if there is none. */
+static bool evict_oldest(struct lowpan_reasm *reasm)
+{
+  unsigned int i;
+
+  for(i = 1 ; i <= WHEEL_SLOTS ; i++) {
+    struct entry *slot = &reasm->wheel[(reasm->now + i) % WHEEL_SLOTS];
+
+    if(slot->wheel_next != slot) {
+      release(reasm, slot->wheel_next);
+      reasm->stats.evicted++;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void advance(struct lowpan_reasm *reasm, uint64_t tick)
+{
+  uint64_t steps;
+  unsigned int i;
+
+  if(!reasm->started) {
+    reasm->now     = tick;
+    reasm->started = true;
+    return;
+  }
+
+  /* The clock went backward. The datagrams will expire a bit late. */
+  if(tick <= reasm->now)
+    return;
+
+  /* A whole turn covers all the datagrams. */
+  steps = tick - reasm->now;
+  if(steps > WHEEL_SLOTS)
+    steps = WHEEL_SLOTS;
+
+  for(i = 1 ; i <= steps ; i++) {
+    struct entry *slot = &reasm->wheel[(reasm->now + i) % WHEEL_SLOTS];
+    struct entry *entry = slot->wheel_next;
+
+    while(entry != slot) {
+      struct entry *next = entry->wheel_next;
+
+      if(entry->expire <= tick) {
+        release(reasm, entry);
+        reasm->stats.expired++;
+      }
+
+      entry = next;
+    }
+  }
+
+  reasm->now = tick;
+}
+
+void lowpan_reasm_expire(lowpan_reasm_t reasm, const struct timeval *tv)
+{
+  advance(reasm, tv_to_us(tv) / reasm->width);
+}
+
+static struct entry * create_entry(struct lowpan_reasm *reasm,
+                                   const struct key *key)
+{
+  struct entry **bucket;
+  struct entry *entry, *slot;
+  struct source *source;
+  unsigned int class = 0;
+  size_t size;
+
+  while(class_size(class) < key->size)
+    class++;
+  size = class_size(class);
+
+  if(size > reasm->memory) {
+    reasm->stats.refused++;
+    return NULL;
+  }
+
+  source = get_source(reasm, key->src, key->src_mode);
+  if(source->memory + size > reasm->source_memory) {
+    put_source(reasm, source);
+    reasm->stats.refused++;
+    return NULL;
+  }
+
+  /* The source is kept alive even when its own datagrams are evicted. */
+  source->memory += size;
+  while(reasm->stats.memory + size > reasm->memory && evict_oldest(reasm));
+  source->memory -= size;
+
+  entry = slab_alloc(reasm->entries);
+  entry->key       = *key;
+  entry->source    = source;
+  entry->class     = class;
+  entry->buf       = slab_alloc(reasm->classes[class]);
+  entry->missing   = (key->size + UNIT_SIZE - 1) / UNIT_SIZE;
+  entry->fragments = 0;
+  memset(entry->received, 0, sizeof(entry->received));
+
+  source->memory      += size;
+  reasm->stats.memory += size;
+  reasm->stats.pending++;
+  if(reasm->stats.memory > reasm->stats.peak_memory)
+    reasm->stats.peak_memory = reasm->stats.memory;
+
+  bucket      = &reasm->buckets[hash_key(key) % NB_BUCKETS];
+  entry->next = *bucket;
+  *bucket     = entry;
+
+  /* The timeout starts with the first fragment received. The current tick
+     started before it, so the deadline is rounded up to the next tick. */
+  entry->expire = reasm->now + reasm->ticks + 1;
+  slot = &reasm->wheel[entry->expire % WHEEL_SLOTS];
+  entry->wheel_next = slot;
+  entry->wheel_prev = slot->wheel_prev;
+  slot->wheel_prev->wheel_next = entry;
+  slot->wheel_prev = entry;
+
+  return entry;
+}
+
+static struct entry * find_entry(struct lowpan_reasm *reasm,
+                                 const struct key *key)
+{
+  struct entry *entry = reasm->buckets[hash_key(key) % NB_BUCKETS];
+
+  for(; entry ; entry = entry->next)
+    if(key_equal(&entry->key, key))
+      return entry;
+
+  return NULL;
+}
+
+static void store(struct entry *entry, unsigned int offset,
+                  const unsigned char *data, unsigned int size)
+{
+  unsigned int unit, end;
+
+  memcpy(entry->buf + offset, data, size);
+
+  /* Overlapping fragments simply overwrite each other. */
+  end = (offset + size + UNIT_SIZE - 1) / UNIT_SIZE;
+  for(unit = offset / UNIT_SIZE ; unit < end ; unit++) {
+    uint32_t bit = (uint32_t)1 << (unit % 32);
+
+    if(!(entry->received[unit / 32] & bit)) {
+      entry->received[unit / 32] |= bit;
+      entry->missing--;
+    }
+  }
+}
+
+void lowpan_reasm_push(lowpan_reasm_t reasm,
+                       const struct mac_frame *frame,
+                       const struct lowpan_packet *packet,
+                       const struct timeval *tv)
+{
+  const unsigned char *data;
+  unsigned char header[IPV6_HEADER_SIZE + UDP_HEADER_SIZE];
+  unsigned int offset, header_size = 0;
+  struct entry *entry;
+  struct key key;
+
+  if(!(packet->headers & LH_FRAG))
+    return;
+
+  reasm->stats.fragments++;
+  lowpan_reasm_expire(reasm, tv);
+
+  if(packet->headers & LH_MESH) {
+    key.src      = packet->mesh.orig;
+    key.src_mode = packet->mesh.orig_mode;
+    key.dst      = packet->mesh.final;
+    key.dst_mode = packet->mesh.final_mode;
+  }
+  else {
+    key.src      = frame->src.mac;
+    key.src_mode = (frame->control & MC_SAM) >> MC_SAM_SHR;
+    key.dst      = frame->dst.mac;
+    key.dst_mode = (frame->control & MC_DAM) >> MC_DAM_SHR;
+  }
+  key.tag  = packet->frag.tag;
+  key.size = packet->frag.size;
+
+  data   = (const unsigned char *)frame->payload + packet->offset;
+  offset = packet->frag.offset;
+
+  /* The first fragment starts with the headers that we uncompress. */
+  if(packet->frag.first) {
+    int n = lowpan_uncompress(packet, key.size, header);
+    if(n < 0) {
+      reasm->stats.invalid++;
+      return;
+    }
+    header_size = n;
+  }
+
+  if(key.size < IPV6_HEADER_SIZE ||
+     offset + header_size + packet->size > key.size) {
+    reasm->stats.invalid++;
+    return;
+  }
+
+  entry = find_entry(reasm, &key);
+  if(!entry) {
+    entry = create_entry(reasm, &key);
+    if(!entry)
+      return;
+  }
+
+  entry->fragments++;
+  entry->tv = *tv;
+
+  if(header_size)
+    store(entry, 0, header, header_size);
+  store(entry, offset + header_size, data, packet->size);
+
+  if(!entry->missing) {
+    struct lowpan_datagram datagram;
+
+    lowpan_udp_checksum(entry->buf, key.size);
+
+    datagram.data      = entry->buf;
+    datagram.size      = key.size;
+    datagram.tv        = entry->tv;
+    datagram.src_mode  = key.src_mode;
+    datagram.dst_mode  = key.dst_mode;
+    datagram.src       = key.src;
+    datagram.dst       = key.dst;
+    datagram.tag       = key.tag;
+    datagram.fragments = entry->fragments;
+
+    reasm->stats.datagrams++;
+    reasm->emit(&datagram, reasm->data);
+
+    release(reasm, entry);
+  }
+}
+
+void lowpan_reasm_get_stats(lowpan_reasm_t reasm,
+                            struct lowpan_reasm_stats *stats)
+{
+  *stats = reasm->stats;
+}
+
+void lowpan_reasm_destroy(lowpan_reasm_t reasm)
+{
+  unsigned int i;
+
+  for(i = 0 ; i < NB_CLASSES ; i++)
+    slab_destroy(reasm->classes[i]);
+  slab_destroy(reasm->entries);
+  slab_destroy(reasm->sources);
+
+  free(reasm);
+}
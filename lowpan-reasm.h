@@ -0,0 +1,101 @@
+/* File: lowpan-reasm.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _LOWPAN_REASM_H_
+#define _LOWPAN_REASM_H_
+
+#include <sys/time.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mac.h"
+#include "lowpan.h"
+
+/* This is a streaming stage which reassembles the IPv6 datagrams fragmented
+   by 6LoWPAN (RFC 4944 5.3). Fragments are identified by the link-layer
+   source and destination (the mesh originator and final destination when
+   there is a mesh header), the datagram tag and the datagram size. The
+   headers of the first fragment are uncompressed so that the datagrams are
+   emitted as plain IPv6.
+
+   A datagram which is not complete within the timeout after its first
+   fragment is dropped, at most a thirty-second of the timeout later. The
+   memory used by the buffers is bounded both for each source and for the
+   whole stage. A source which exceeds its share cannot start new datagrams
+   while the oldest datagrams are dropped when the stage as a whole exceeds
+   its share. The stage is fed in time order. */
+
+/* Largest datagram that the fragment header can describe. */
+#define LOWPAN_REASM_MAX_SIZE 2047
+
+struct lowpan_datagram {
+  const unsigned char *data; /* uncompressed IPv6 datagram */
+  unsigned int size;
+  struct timeval tv;         /* timestamp of the last fragment */
+  enum mac_addr_mode src_mode;
+  enum mac_addr_mode dst_mode;
+  uint64_t src;              /* link-layer addresses */
+  uint64_t dst;
+  uint16_t tag;
+  unsigned int fragments;    /* fragments received, including duplicates */
+};
+
+struct lowpan_reasm_stats {
+  unsigned long fragments;  /* fragments pushed */
+  unsigned long datagrams;  /* datagrams emitted */
+  unsigned long expired;    /* datagrams dropped after the timeout */
+  unsigned long evicted;    /* datagrams dropped for the memory of the stage */
+  unsigned long refused;    /* datagrams refused for the memory of a source */
+  unsigned long invalid;    /* fragments out of their datagram or whose headers
+                               cannot be uncompressed (extension headers or
+                               unknown contexts) */
+  unsigned long pending;    /* datagrams being reassembled */
+  size_t memory;            /* memory of the buffers in use */
+  size_t peak_memory;
+};
+
+typedef struct lowpan_reasm * lowpan_reasm_t;
+
+/* Create a reassembly stage. The timeout is expressed in microseconds. The
+   memory limits are expressed in bytes, the per-source limit being at most
+   the global one. The emit callback is called for each complete datagram. */
+lowpan_reasm_t lowpan_reasm_create(unsigned long timeout,
+                                   size_t memory,
+                                   size_t source_memory,
+                                   void (*emit)(const struct lowpan_datagram *,
+                                                void *),
+                                   void *data);
+
+/* Push a decoded packet received at the specified time. Packets which are not
+   fragmented are ignored. */
+void lowpan_reasm_push(lowpan_reasm_t reasm,
+                       const struct mac_frame *frame,
+                       const struct lowpan_packet *packet,
+                       const struct timeval *tv);
+
+/* Drop the datagrams which timed out at the specified time. This is done
+   when pushing already but may be called when the input is idle. */
+void lowpan_reasm_expire(lowpan_reasm_t reasm, const struct timeval *tv);
+
+/* Get the statistics of the stage. */
+void lowpan_reasm_get_stats(lowpan_reasm_t reasm,
+                            struct lowpan_reasm_stats *stats);
+
+/* Destroy the stage along with the datagrams being reassembled. */
+void lowpan_reasm_destroy(lowpan_reasm_t reasm);
+
+#endif /* _LOWPAN_REASM_H_ */
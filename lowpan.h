@@ -0,0 +1,148 @@
+/* File: lowpan.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _LOWPAN_H_
+#define _LOWPAN_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mac.h"
+
+/* dispatch (RFC 4944 and RFC 6282) */
+#define LD_NALP         0x00    /* not a LoWPAN frame (00xxxxxx) */
+#define LD_NALP_MASK    0xc0
+#define LD_IPV6         0x41    /* uncompressed IPv6 header */
+#define LD_HC1          0x42    /* HC1 compressed IPv6 header (obsolete) */
+#define LD_BC0          0x50    /* broadcast header */
+#define LD_ESC          0x7f    /* additional dispatch byte follows */
+#define LD_IPHC         0x60    /* IPHC compressed IPv6 header (011xxxxx) */
+#define LD_IPHC_MASK    0xe0
+#define LD_MESH         0x80    /* mesh header (10xxxxxx) */
+#define LD_MESH_MASK    0xc0
+#define LD_FRAG1        0xc0    /* first fragment header (11000xxx) */
+#define LD_FRAGN        0xe0    /* subsequent fragment header (11100xxx) */
+#define LD_FRAG_MASK    0xf8
+
+/* mesh header */
+#define LM_ORIG_SHORT   0x20    /* originator address is short */
+#define LM_FINAL_SHORT  0x10    /* final address is short */
+#define LM_HOPS         0x0f    /* hops left */
+
+/* IPHC encoding (first byte then second byte) */
+#define IPHC_TF         0x1800  /* traffic class and flow label */
+#define IPHC_TF_SHR     11
+#define IPHC_NH         0x0400  /* next header compressed with NHC */
+#define IPHC_HLIM       0x0300  /* hop limit */
+#define IPHC_HLIM_SHR   8
+#define IPHC_CID        0x0080  /* context identifier extension */
+#define IPHC_SAC        0x0040  /* stateful source address compression */
+#define IPHC_SAM        0x0030  /* source address mode */
+#define IPHC_SAM_SHR    4
+#define IPHC_M          0x0008  /* multicast destination */
+#define IPHC_DAC        0x0004  /* stateful destination address compression */
+#define IPHC_DAM        0x0003  /* destination address mode */
+
+/* NHC encoding */
+#define NHC_EXT         0xe0    /* IPv6 extension header (1110xxxx) */
+#define NHC_EXT_MASK    0xf0
+#define NHC_EXT_EID     0x0e
+#define NHC_EXT_EID_SHR 1
+#define NHC_EXT_NH      0x01    /* next header compressed with NHC */
+#define NHC_UDP         0xf0    /* UDP header (11110xxx) */
+#define NHC_UDP_MASK    0xf8
+#define NHC_UDP_C       0x04    /* checksum elided */
+#define NHC_UDP_P       0x03    /* ports */
+
+/* IPv6 next header values */
+#define IP_HOPOPTS      0
+#define IP_UDP          17
+#define IP_IPV6         41
+#define IP_ROUTING      43
+#define IP_FRAGMENT     44
+#define IP_ICMPV6       58
+#define IP_DSTOPTS      60
+#define IP_MOBILITY     135
+
+#define IPV6_HEADER_SIZE 40
+#define UDP_HEADER_SIZE  8
+
+/* headers found in a packet */
+enum lowpan_header { LH_MESH  = 0x1,  /* mesh header */
+                     LH_BC0   = 0x2,  /* broadcast header */
+                     LH_FRAG  = 0x4,  /* fragment header */
+                     LH_IPV6  = 0x8,  /* IPv6 header (compressed or not) */
+                     LH_IPHC  = 0x10, /* the IPv6 header was compressed */
+                     LH_UDP   = 0x20  /* UDP header (compressed or not) */ };
+
+/* addresses that could not be entirely decompressed */
+enum lowpan_context { LC_SRC = 0x1, /* source prefix from an unknown context */
+                      LC_DST = 0x2  /* destination prefix from an unknown
+                                       context */ };
+
+struct lowpan_mesh {
+  uint8_t hops;                   /* hops left */
+  enum mac_addr_mode orig_mode;   /* MAM_SHORT or MAM_LONG */
+  enum mac_addr_mode final_mode;
+  uint64_t orig;                  /* originator address */
+  uint64_t final;                 /* final destination address */
+};
+
+struct lowpan_frag {
+  uint16_t size;    /* size of the whole datagram */
+  uint16_t tag;     /* datagram tag */
+  uint16_t offset;  /* offset of the fragment in bytes */
+  bool first;       /* FRAG1 (the IPv6 header follows) or FRAGN */
+};
+
+struct lowpan_udp {
+  uint16_t sport;
+  uint16_t dport;
+  uint16_t length;    /* inferred when compressed */
+  uint16_t checksum;
+  bool checksum_elided;
+};
+
+/* A decoded 6LoWPAN packet. The headers are decompressed into this structure
+   and the rest of the packet is only referenced by its offset into the
+   payload of the MAC frame so that nothing is copied nor allocated. */
+struct lowpan_packet {
+  unsigned int headers;          /* enum lowpan_header */
+
+  struct lowpan_mesh mesh;
+  uint8_t bc0_seqno;             /* broadcast sequence number */
+  struct lowpan_frag frag;
+
+  /* IPv6 header */
+  uint16_t iphc;                 /* IPHC encoding */
+  uint8_t context;               /* source and destination context ids */
+  unsigned int unknown_context;  /* enum lowpan_context */
+  uint8_t traffic_class;
+  uint32_t flow_label;
+  uint8_t next_header;           /* upper layer after the extension headers */
+  uint8_t hop_limit;
+  uint8_t src[16];
+  uint8_t dst[16];
+  unsigned int nb_ext;           /* compressed extension headers skipped */
+
+  struct lowpan_udp udp;
+
+  unsigned int offset;           /* upper layer data in the MAC payload */
+  unsigned int size;
+};
+
+#endif /* _LOWPAN_H_ */
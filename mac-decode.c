@@ -69,15 +69,66 @@ static int decode_address(struct mac_addr *addr, enum mac_addr_mode mode,
   return raw - raw_frame;
 }
 
+/* Size of the message integrity code for each security level. */
+static const unsigned int mic_sizes[] = { 0, 4, 8, 16, 0, 4, 8, 16 };
+
+static int decode_security(struct mac_security *sec, uint16_t control,
+                           const unsigned char *raw_frame, unsigned int size)
+{
+  const unsigned char *raw = raw_frame;
+
+  CHECK(raw_frame, raw + 1, size);
+  sec->control = *raw++;
+  sec->counter = 0;
+
+  if(!(sec->control & SC_FC_SUPPRESS) ||
+     (control & MC_VERSION) >> MC_VERSION_SHR <= MV_CURRENT) {
+    CHECK(raw_frame, raw + 4, size);
+    sec->counter = le32toh(U8_TO(uint32_t, raw));
+    raw += sizeof(uint32_t);
+  }
+
+  sec->key_source = 0;
+  sec->key_index  = 0;
+
+  switch((sec->control & SC_KIM) >> SC_KIM_SHR) {
+  case KIM_IMPLICIT:
+    break;
+  case KIM_SOURCE_4:
+    CHECK(raw_frame, raw + 4, size);
+    sec->key_source = le32toh(U8_TO(uint32_t, raw));
+    raw += sizeof(uint32_t);
+    goto INDEX;
+  case KIM_SOURCE_8:
+    CHECK(raw_frame, raw + 8, size);
+    sec->key_source = le64toh(U8_TO(uint64_t, raw));
+    raw += sizeof(uint64_t);
+  case KIM_INDEX:
+  INDEX:
+    CHECK(raw_frame, raw + 1, size);
+    sec->key_index = *raw++;
+    break;
+  }
+
+  sec->mic_size = mic_sizes[sec->control & SC_LEVEL];
+  sec->status   = MS_SECURED;
+
+  return raw - raw_frame;
+}
+
 int mac_decode(struct mac_frame *frame, const unsigned char *raw_frame,
                bool decode_crc, unsigned int size)
 {
   size_t payload_size;
+  unsigned int trailer = decode_crc ? sizeof(uint16_t) : 0;
   const unsigned char *raw = raw_frame;
+  int n;
 
   /* We have to initialize the payload to avoid
      a buffer overflow with crafted frames. */
-  frame->payload = NULL;
+  frame->payload  = NULL;
+  frame->size     = 0;
+  frame->security = NULL;
 
   frame->control = le16toh(U8_TO(uint16_t, raw));
   raw += sizeof(uint16_t);
@@ -93,18 +144,32 @@ int mac_decode(struct mac_frame *frame, const unsigned char *raw_frame,
   raw += decode_address(&frame->src,
                         (frame->control & MC_SAM) >> MC_SAM_SHR, raw,
                         (frame->control & MC_PANCOMP) ? &frame->dst.pan : NULL);
+  CHECK(raw_frame, raw, size);
 
   if(frame->control & MC_SECURITY) {
-    /* Auxiliary security headers are not implemented. */
-    return -1;
+    /* The security of IEEE 802.15.4-2003 is not supported. */
+    if(((frame->control & MC_VERSION) >> MC_VERSION_SHR) == MV_2003)
+      return -1;
+
+    frame->security = malloc(sizeof(struct mac_security));
+    if(!frame->security)
+      return -1;
+
+    n = decode_security(frame->security, frame->control, raw,
+                        size - (raw - raw_frame));
+    if(n < 0)
+      return -1;
+    raw += n;
+
+    frame->security->header_size = raw - raw_frame;
+    trailer += frame->security->mic_size;
   }
 
-  frame->security = NULL;
+  /* The header leaves no room for the MIC and the FCS. */
+  if(raw - raw_frame + trailer > size)
+    return -1;
 
-  if(decode_crc)
-    payload_size = size - sizeof(uint16_t) - (raw - raw_frame);
-  else
-    payload_size = size - (raw - raw_frame);
+  payload_size = size - trailer - (raw - raw_frame);
 
   /* We only copy the payload when needed. */
   if(payload_size) {
@@ -123,6 +188,11 @@ int mac_decode(struct mac_frame *frame, const unsigned char *raw_frame,
 
   CHECK(raw_frame, raw, size);
 
+  if(frame->security && frame->security->mic_size) {
+    memcpy(frame->security->mic, raw, frame->security->mic_size);
+    raw += frame->security->mic_size;
+  }
+
   if(decode_crc) {
     frame->fcs = be16toh(U8_TO(uint16_t, raw));
     CHECK(raw_frame, raw+2, size);
@@ -135,4 +205,6 @@ void free_mac_frame(struct mac_frame *frame)
 {
   if(frame->payload)
     free((void *)frame->payload);
+  if(frame->security)
+    free(frame->security);
 }
@@ -108,6 +108,42 @@ static void display_addr(enum mac_addr_mode am, const struct mac_addr *addr)
   }
 }
 
+static void display_security(const struct mac_security *sec)
+{
+  static const char *levels[] = { "none", "MIC-32", "MIC-64", "MIC-128",
+                                  "ENC", "ENC-MIC-32", "ENC-MIC-64",
+                                  "ENC-MIC-128" };
+  static const char *status[] = { "secured", "no key", "unknown device",
+                                  "unsupported", "invalid MIC", "valid" };
+  unsigned int i;
+
+  printf(" Security level: %s\n", levels[sec->control & SC_LEVEL]);
+  printf(" Frame counter : %u\n", sec->counter);
+
+  switch((sec->control & SC_KIM) >> SC_KIM_SHR) {
+  case(KIM_SOURCE_4):
+    printf(" Key source    : %08X\n", (uint32_t)sec->key_source);
+    goto INDEX;
+  case(KIM_SOURCE_8):
+    printf(" Key source    : %016llX\n", (unsigned long long)sec->key_source);
+  case(KIM_INDEX):
+  INDEX:
+    printf(" Key index     : %u\n", sec->key_index);
+    break;
+  default:
+    break;
+  }
+
+  if(sec->mic_size) {
+    printf(" MIC           : ");
+    for(i = 0 ; i < sec->mic_size ; i++)
+      printf("%02x", sec->mic[i]);
+    printf("\n");
+  }
+
+  printf(" Security      : %s\n", status[sec->status]);
+}
+
 void mac_display_saddr(const struct mac_frame *frame)
 {
   display_addr((frame->control & MC_SAM) >> MC_SAM_SHR, &frame->src);
@@ -182,7 +218,7 @@ void mac_display(const struct mac_frame *frame, unsigned int info)
   }
 
   if(frame->security && info & MI_SECURITY)
-    printf(" Security not implemented\n");
+    display_security(frame->security);
 
   if(info & MI_FCS)
     printf(" FCS           : %.4x\n", frame->fcs);
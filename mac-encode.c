@@ -58,6 +58,45 @@ static unsigned char * encode_address(const struct mac_addr *addr,
   return buf;
 }
 
+static unsigned char * encode_security(const struct mac_security *sec,
+                                       uint16_t control,
+                                       unsigned char *buf)
+{
+  *buf = sec->control;
+  buf++;
+
+  /* The frame counter may only be omitted since IEEE 802.15.4-2015. */
+  if(!(sec->control & SC_FC_SUPPRESS) ||
+     (control & MC_VERSION) >> MC_VERSION_SHR <= MV_CURRENT) {
+    UINT(32, buf) = sec->counter;
+    buf += 4;
+  }
+
+  switch((sec->control & SC_KIM) >> SC_KIM_SHR) {
+  case KIM_SOURCE_4:
+    UINT(32, buf) = sec->key_source;
+    buf += 4;
+    goto INDEX;
+  case KIM_SOURCE_8:
+    UINT(64, buf) = sec->key_source;
+    buf += 8;
+  case KIM_INDEX:
+  INDEX:
+    *buf = sec->key_index;
+    buf++;
+    break;
+  default:
+    break;
+  }
+
+  return buf;
+}
+
+static unsigned int mic_size(const struct mac_frame *frame)
+{
+  return frame->security ? frame->security->mic_size : 0;
+}
+
 int mac_encode(const struct mac_frame *frame, unsigned char *buf)
 {
   const unsigned char *orig = buf;
@@ -77,22 +116,26 @@ int mac_encode(const struct mac_frame *frame, unsigned char *buf)
                        frame->control & MC_PANCOMP,
                        buf);
 
-  if(frame->security) {
-    /* Auxiliary security headers are not implemented. */
-    return -1;
-  }
+  /* The payload is expected to be secured already. */
+  if(frame->security)
+    buf = encode_security(frame->security, frame->control, buf);
 
   if(!frame->payload)
     goto EXIT;
 
   /* check size before appending the payload */
-  if(buf + frame->size - orig > 125 /* MAC(127) - CRC(2) */)
+  if(buf + frame->size + mic_size(frame) - orig > 125 /* MAC(127) - CRC(2) */)
     return -2;
 
   memcpy(buf, frame->payload, frame->size);
   buf += frame->size;
 
 EXIT:
+  if(frame->security) {
+    memcpy(buf, frame->security->mic, frame->security->mic_size);
+    buf += frame->security->mic_size;
+  }
+
   return buf - orig;
 }
 
@@ -0,0 +1,318 @@
+/* File: mac-security.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <err.h>
+
+#include "aes.h"
+#include "mac.h"
+#include "mac-security.h"
+
+#define MAX_KEYS    16
+#define MAX_DEVICES 256
+
+/* Largest MAC frame without the FCS. */
+#define MAX_FRAME_SIZE 125
+
+#define NONCE_SIZE 13
+
+/* Counter blocks for the largest payload and the MIC. */
+#define MAX_BLOCKS (1 + (MAX_FRAME_SIZE + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE)
+
+static struct key {
+  enum mac_key_mode mode;
+  uint64_t source;
+  uint8_t index;
+  struct aes_key aes;
+} keys[MAX_KEYS];
+static unsigned int nb_keys;
+
+static struct device {
+  uint16_t short_addr;
+  uint64_t ext_addr;
+} devices[MAX_DEVICES];
+static unsigned int nb_devices;
+
+/* Running CBC-MAC. */
+struct cbc_mac {
+  const struct aes_key *key;
+  unsigned char x[AES_BLOCK_SIZE];
+  unsigned int n;
+};
+
+void mac_security_add_key(enum mac_key_mode mode,
+                          uint64_t source,
+                          uint8_t index,
+                          const unsigned char key[MAC_KEY_SIZE])
+{
+  struct key *k;
+
+  if(nb_keys == MAX_KEYS)
+    errx(EXIT_FAILURE, "too many keys");
+
+  k = &keys[nb_keys++];
+  k->mode   = mode;
+  k->source = source;
+  k->index  = index;
+  aes_expand_key(&k->aes, key);
+}
+
+void mac_security_add_device(uint16_t short_addr, uint64_t ext_addr)
+{
+  if(nb_devices == MAX_DEVICES)
+    errx(EXIT_FAILURE, "too many devices");
+
+  devices[nb_devices].short_addr = short_addr;
+  devices[nb_devices].ext_addr   = ext_addr;
+  nb_devices++;
+}
+
+static const struct aes_key * find_key(const struct mac_security *sec)
+{
+  enum mac_key_mode mode = (sec->control & SC_KIM) >> SC_KIM_SHR;
+  const struct aes_key *implicit = NULL;
+  unsigned int i;
+
+  for(i = 0 ; i < nb_keys ; i++) {
+    const struct key *k = &keys[i];
+
+    if(k->mode == KIM_IMPLICIT && !implicit)
+      implicit = &k->aes;
+
+    if(k->mode != mode || mode == KIM_IMPLICIT)
+      continue;
+    if(k->index == sec->key_index &&
+       (mode == KIM_INDEX || k->source == sec->key_source))
+      return &k->aes;
+  }
+
+  return implicit;
+}
+
+static bool find_source(const struct mac_frame *frame, uint64_t *ext_addr)
+{
+  unsigned int i;
+
+  switch((frame->control & MC_SAM) >> MC_SAM_SHR) {
+  case MAM_LONG:
+    *ext_addr = frame->src.mac;
+    return true;
+  case MAM_SHORT:
+    for(i = 0 ; i < nb_devices ; i++) {
+      if(devices[i].short_addr == frame->src.mac) {
+        *ext_addr = devices[i].ext_addr;
+        return true;
+      }
+    }
+  default:
+    return false;
+  }
+}
+
+static void cbc_update(struct cbc_mac *mac, const unsigned char *data,
+                       unsigned int size)
+{
+  while(size--) {
+    mac->x[mac->n++] ^= *data++;
+
+    if(mac->n == AES_BLOCK_SIZE) {
+      aes_encrypt(mac->key, mac->x, mac->x);
+      mac->n = 0;
+    }
+  }
+}
+
+/* Each field of the authentication is padded with zeros to a block. */
+static void cbc_pad(struct cbc_mac *mac)
+{
+  if(mac->n) {
+    aes_encrypt(mac->key, mac->x, mac->x);
+    mac->n = 0;
+  }
+}
+
+/* CCM* with a length field of two bytes. The authenticated data is a followed
+   by b and is only used for the MIC. When encrypt is set, m is decrypted in
+   place. Otherwise it must be empty. Return true when the MIC matches. */
+static bool ccm_star(const struct aes_key *key,
+                     const unsigned char nonce[NONCE_SIZE],
+                     const unsigned char *a, unsigned int a_size,
+                     const unsigned char *b, unsigned int b_size,
+                     unsigned char *m, unsigned int m_size,
+                     bool encrypt,
+                     const unsigned char *mic, unsigned int mic_size)
+{
+  unsigned char ctr[MAX_BLOCKS * AES_BLOCK_SIZE];
+  unsigned char s[MAX_BLOCKS * AES_BLOCK_SIZE];
+  unsigned int nb_blocks = 1, i;
+  unsigned char auth[2];
+  struct cbc_mac cbc;
+  unsigned char diff;
+
+  /* The key stream does not depend on the data so all the blocks are
+     encrypted at once. The first block encrypts the MIC. */
+  if(encrypt)
+    nb_blocks += (m_size + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+
+  for(i = 0 ; i < nb_blocks ; i++) {
+    unsigned char *block = ctr + i * AES_BLOCK_SIZE;
+
+    block[0] = 1; /* L - 1 */
+    memcpy(block + 1, nonce, NONCE_SIZE);
+    block[14] = i >> 8;
+    block[15] = i;
+  }
+
+  aes_encrypt_blocks(key, ctr, s, nb_blocks);
+
+  if(encrypt) {
+    for(i = 0 ; i < m_size ; i++)
+      m[i] ^= s[AES_BLOCK_SIZE + i];
+  }
+
+  /* Encryption without authentication. */
+  if(!mic_size)
+    return true;
+
+  cbc.key  = key;
+  cbc.n    = 0;
+  cbc.x[0] = (a_size + b_size ? 0x40 : 0) | ((mic_size - 2) / 2) << 3 | 1;
+  memcpy(cbc.x + 1, nonce, NONCE_SIZE);
+  cbc.x[14] = m_size >> 8;
+  cbc.x[15] = m_size;
+  aes_encrypt(key, cbc.x, cbc.x);
+
+  if(a_size + b_size) {
+    auth[0] = (a_size + b_size) >> 8;
+    auth[1] = a_size + b_size;
+    cbc_update(&cbc, auth, sizeof(auth));
+    cbc_update(&cbc, a, a_size);
+    cbc_update(&cbc, b, b_size);
+    cbc_pad(&cbc);
+  }
+
+  cbc_update(&cbc, m, m_size);
+  cbc_pad(&cbc);
+
+  for(diff = 0, i = 0 ; i < mic_size ; i++)
+    diff |= cbc.x[i] ^ s[i] ^ mic[i];
+
+  return !diff;
+}
+
+int mac_unsecure(struct mac_frame *frame, const unsigned char *raw_frame)
+{
+  struct mac_security *sec = frame->security;
+  enum mac_security_level level;
+  const struct aes_key *key;
+  unsigned char nonce[NONCE_SIZE];
+  unsigned char m[MAX_FRAME_SIZE];
+  unsigned int open_size = 0;
+  uint64_t ext_addr;
+  bool encrypt;
+  int i;
+
+  if(!sec)
+    return 0;
+
+  /* Already done. */
+  if(sec->status != MS_SECURED)
+    return sec->status == MS_VALID ? 0 : -1;
+
+  /* The payload cannot be that large in a MAC frame. */
+  if(frame->size > MAX_FRAME_SIZE) {
+    sec->status = MS_UNSUPPORTED;
+    return -1;
+  }
+
+  level   = sec->control & SC_LEVEL;
+  encrypt = level >= SL_ENC;
+
+  if(level == SL_NONE) {
+    sec->status = MS_VALID;
+    return 0;
+  }
+
+  /* Without the frame counter the nonce is made of the absolute slot number
+     of TSCH (IEEE 802.15.4-2015) which we do not know. */
+  if(sec->control & SC_FC_SUPPRESS &&
+     (frame->control & MC_VERSION) >> MC_VERSION_SHR > MV_CURRENT) {
+    sec->status = MS_UNSUPPORTED;
+    return -1;
+  }
+
+  /* The command identifier is authenticated but not encrypted. The fields of
+     the beacons that are not encrypted are not decoded. */
+  switch(frame->control & MC_TYPE) {
+  case MT_CMD:
+    if(frame->size)
+      open_size = 1;
+    break;
+  case MT_BEACON:
+    if(encrypt) {
+      sec->status = MS_UNSUPPORTED;
+      return -1;
+    }
+    break;
+  }
+
+  key = find_key(sec);
+  if(!key) {
+    sec->status = MS_NO_KEY;
+    return -1;
+  }
+
+  if(!find_source(frame, &ext_addr)) {
+    sec->status = MS_NO_DEVICE;
+    return -1;
+  }
+
+  /* The nonce is made of the extended source address, the frame counter and
+     the security level, most significant byte first. */
+  for(i = 0 ; i < 8 ; i++)
+    nonce[i] = ext_addr >> (56 - 8 * i);
+  for(i = 0 ; i < 4 ; i++)
+    nonce[8 + i] = sec->counter >> (24 - 8 * i);
+  nonce[12] = level;
+
+  if(encrypt) {
+    memcpy(m, frame->payload, frame->size);
+
+    if(!ccm_star(key, nonce, raw_frame, sec->header_size,
+                 frame->payload, open_size,
+                 m + open_size, frame->size - open_size, true,
+                 sec->mic, sec->mic_size)) {
+      sec->status = MS_INVALID;
+      return -1;
+    }
+
+    memcpy((void *)frame->payload, m, frame->size);
+  }
+  else if(!ccm_star(key, nonce, raw_frame, sec->header_size,
+                    frame->payload, frame->size,
+                    NULL, 0, false,
+                    sec->mic, sec->mic_size)) {
+    sec->status = MS_INVALID;
+    return -1;
+  }
+
+  sec->status = MS_VALID;
+  return 0;
+}
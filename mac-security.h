@@ -0,0 +1,47 @@
+/* File: mac-security.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _MAC_SECURITY_H_
+#define _MAC_SECURITY_H_
+
+#include <stdint.h>
+
+#include "mac.h"
+
+/* Authentication and decryption of secured frames with CCM* as specified in
+   IEEE 802.15.4-2006 Annex B. The keys and the devices are kept in a table
+   that is shared by all the frames. */
+
+#define MAC_KEY_SIZE 16
+
+/* Add a key to the table. An implicit key is also used for the frames whose
+   key identifier does not match any other key. */
+void mac_security_add_key(enum mac_key_mode mode,
+                          uint64_t source,
+                          uint8_t index,
+                          const unsigned char key[MAC_KEY_SIZE]);
+
+/* Frames from a short address need the extended address of their source. */
+void mac_security_add_device(uint16_t short_addr, uint64_t ext_addr);
+
+/* Check the MIC of a decoded frame and decrypt its payload in place. The raw
+   frame is the one which was decoded. The status of the security header tells
+   what happened. Return 0 when the frame is authentic, -1 otherwise. Frames
+   without security are left untouched. */
+int mac_unsecure(struct mac_frame *frame, const unsigned char *raw_frame);
+
+#endif /* _MAC_SECURITY_H_ */
@@ -50,6 +50,49 @@ enum mac_addr_mode { MAM_FULL,      /* neither PAN or address fields are present
 enum mac_version { MV_2003,    /* IEEE 802.15.4-2003 */
                    MV_CURRENT  /* IEEE 802.15.4 */ };
 
+/* auxiliary security control */
+#define SC_LEVEL        0x7     /* security level */
+#define SC_KIM          0x18    /* key identifier mode */
+#define SC_KIM_SHR      3       /* key identifier mode (shift right) */
+#define SC_FC_SUPPRESS  0x20    /* frame counter suppression (2015) */
+
+/* security level */
+enum mac_security_level { SL_NONE,        /* no security */
+                          SL_MIC_32,      /* authentication only */
+                          SL_MIC_64,
+                          SL_MIC_128,
+                          SL_ENC,         /* encryption only */
+                          SL_ENC_MIC_32,  /* encryption and authentication */
+                          SL_ENC_MIC_64,
+                          SL_ENC_MIC_128 };
+
+/* key identifier mode */
+enum mac_key_mode { KIM_IMPLICIT,  /* key determined from the addresses */
+                    KIM_INDEX,     /* key index with the default key source */
+                    KIM_SOURCE_4,  /* key index with a 4 bytes key source */
+                    KIM_SOURCE_8   /* key index with a 8 bytes key source */ };
+
+/* state of a secured frame */
+enum mac_security_status { MS_SECURED,     /* not unsecured yet */
+                           MS_NO_KEY,      /* no matching key */
+                           MS_NO_DEVICE,   /* extended source address unknown */
+                           MS_UNSUPPORTED, /* cannot unsecure this frame */
+                           MS_INVALID,     /* the MIC does not match */
+                           MS_VALID        /* authenticated and decrypted */ };
+
+struct mac_security {
+  uint8_t  control;          /* security control */
+  uint32_t counter;          /* frame counter */
+  uint64_t key_source;       /* key source (KIM_SOURCE_4/8) */
+  uint8_t  key_index;        /* key index (all but KIM_IMPLICIT) */
+
+  unsigned char mic[16];     /* message integrity code */
+  unsigned int mic_size;
+
+  unsigned int header_size;  /* MHR including this header */
+  enum mac_security_status status;
+};
+
 struct mac_addr {
   uint16_t pan;
   uint64_t mac;
@@ -62,7 +105,7 @@ struct mac_frame {
   struct mac_addr src;  /* source address */
   struct mac_addr dst;  /* destination address */
 
-  const void *security; /* auxiliary security header (not implemented) */
+  struct mac_security *security; /* auxiliary security header */
 
   const void *payload;  /* frame payload */
   unsigned int size;    /* size of the payload */
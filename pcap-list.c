@@ -102,11 +102,11 @@ EOF:
   close_reading_pcap();
 }
 
-/* Free a pcap node's internal structure. */
+/* Free a pcap node's internal structure. The frame was always decoded and
+   may hold allocations even when the decoding failed. */
 static void free_pcap_node(struct pcap_node *node)
 {
-  if(node->valid_frame)
-    free_mac_frame(&node->frame);
+  free_mac_frame(&node->frame);
   free(node->data);
 }
 
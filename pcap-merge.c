@@ -0,0 +1,318 @@
+/* File: pcap-merge.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#define _BSD_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include <string.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "version.h"
+#include "pcap-scan.h"
+#include "pcap-write.h"
+#include "dedup.h"
+#include "xatoi.h"
+#include "help.h"
+
+#define TARGET "PCAP-Merge"
+
+/* Default deduplication window in milliseconds. This must be larger than the
+   clock difference between the sniffers but smaller than the time between
+   two retransmissions of the same frame. */
+#define DEFAULT_WINDOW   5
+
+/* Default number of frames retained for deduplication. */
+#define DEFAULT_CAPACITY 65536
+
+struct input {
+  const char *path;
+  pcap_scan_t scan;
+  struct pcap_record rec;
+  unsigned char *data;
+  bool eof;
+
+  unsigned long frames;    /* frames read */
+  unsigned long first;     /* frames first seen by this input */
+  unsigned long exclusive; /* frames only seen by this input */
+};
+
+static struct input *inputs;
+static unsigned int nb_inputs;
+static FILE *report;
+
+static void next_record(struct input *in)
+{
+  if(!pcap_scan_next(in->scan, &in->rec, in->data))
+    in->eof = true;
+  else
+    in->frames++;
+}
+
+/* Find the input with the oldest pending record. */
+static struct input * oldest_input(void)
+{
+  struct input *oldest = NULL;
+  unsigned int i;
+
+  for(i = 0 ; i < nb_inputs ; i++) {
+    struct input *in = &inputs[i];
+
+    if(in->eof)
+      continue;
+
+    if(!oldest || timercmp(&in->rec.tv, &oldest->rec.tv, <))
+      oldest = in;
+  }
+
+  return oldest;
+}
+
+static void emit(const struct dedup_frame *frame, void *data)
+{
+  (void)data;
+
+  pcap_write_truncated_frame(frame->data, frame->size, frame->length,
+                             &frame->tv);
+
+  inputs[frame->origin].first++;
+  if(frame->sources == (uint32_t)1 << frame->origin)
+    inputs[frame->origin].exclusive++;
+
+  if(report) {
+    unsigned int i;
+    const char *sep = "";
+
+    fprintf(report, "%ld.%06ld %u %u ",
+            (long)frame->tv.tv_sec, (long)frame->tv.tv_usec,
+            frame->size, frame->copies);
+
+    for(i = 0 ; i < nb_inputs ; i++) {
+      if(frame->sources & ((uint32_t)1 << i)) {
+        fprintf(report, "%s%u", sep, i);
+        sep = ",";
+      }
+    }
+
+    fputc('\n', report);
+  }
+}
+
+static void display_summary(dedup_t dd)
+{
+  struct dedup_stats stats;
+  unsigned int i;
+
+  dedup_get_stats(dd, &stats);
+
+  fprintf(stderr, "Frames     : %lu\n", stats.frames);
+  fprintf(stderr, "Unique     : %lu\n", stats.unique);
+  fprintf(stderr, "Duplicates : %lu\n", stats.duplicates);
+  if(stats.evicted)
+    fprintf(stderr, "Evicted    : %lu (increase the capacity)\n", stats.evicted);
+
+  fprintf(stderr, "\nInputs:\n");
+  for(i = 0 ; i < nb_inputs ; i++)
+    fprintf(stderr, "  %u: %s : %lu frames, %lu first, %lu exclusive\n", i,
+            inputs[i].path, inputs[i].frames, inputs[i].first,
+            inputs[i].exclusive);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *name;
+  const char *output;
+  const char *report_path = NULL;
+  unsigned long window    = DEFAULT_WINDOW * 1000;
+  unsigned int capacity   = DEFAULT_CAPACITY;
+  bool ignore_fcs = false;
+  bool no_dedup   = false;
+  struct input *in;
+  dedup_t dd = NULL;
+  unsigned int i;
+  int err_v;
+
+  int exit_status = EXIT_FAILURE;
+
+  name = (const char *)strrchr(argv[0], '/');
+  name = name ? (name + 1) : argv[0];
+
+  enum opt {
+    OPT_COMMIT = 0x100
+  };
+
+  struct opt_help helps[] = {
+    { 'h', "help", "Show this help message" },
+    { 'V', "version", "Print version information" },
+#ifdef COMMIT
+    { 0, "commit", "Display commit information" },
+#endif /* COMMIT */
+    { 'w', "window", "Deduplication window in milliseconds (default: 5)" },
+    { 'm', "max-frames", "Maximum number of frames retained (default: 65536)" },
+    { 'F', "ignore-fcs", "Ignore the FCS when comparing frames" },
+    { 'D', "no-dedup", "Merge without removing duplicates" },
+    { 'r', "report", "Report the sources of each frame into a file" },
+    { 0, NULL, NULL }
+  };
+
+  struct option opts[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "version", no_argument, NULL, 'V' },
+#ifdef COMMIT
+    { "commit", no_argument, NULL, OPT_COMMIT },
+#endif /* COMMIT */
+    { "window", required_argument, NULL, 'w' },
+    { "max-frames", required_argument, NULL, 'm' },
+    { "ignore-fcs", no_argument, NULL, 'F' },
+    { "no-dedup", no_argument, NULL, 'D' },
+    { "report", required_argument, NULL, 'r' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while(1) {
+    int c = getopt_long(argc, argv, "hVw:m:FDr:", opts, NULL);
+
+    if(c == -1)
+      break;
+
+    switch(c) {
+    case('w'):
+      window = xatou(optarg, &err_v) * 1000UL;
+      if(err_v)
+        errx(EXIT_FAILURE, "invalid window");
+      break;
+    case('m'):
+      capacity = xatou(optarg, &err_v);
+      if(err_v || capacity == 0)
+        errx(EXIT_FAILURE, "invalid number of frames");
+      break;
+    case('F'):
+      ignore_fcs = true;
+      break;
+    case('D'):
+      no_dedup = true;
+      break;
+    case('r'):
+      report_path = optarg;
+      break;
+#ifdef COMMIT
+    case(OPT_COMMIT):
+      commit();
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+#endif /* COMMIT */
+    case('V'):
+      version(TARGET);
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+    case('h'):
+      exit_status = EXIT_SUCCESS;
+    default:
+      help(name, "[OPTIONS] ... OUTPUT INPUT...", helps);
+      goto EXIT;
+    }
+  }
+
+  if((argc - optind) < 2)
+    errx(EXIT_FAILURE, "except output and input files");
+
+  output    = argv[optind];
+  nb_inputs = argc - optind - 1;
+
+  if(nb_inputs > DEDUP_MAX_SOURCES)
+    errx(EXIT_FAILURE, "cannot merge more than %d files", DEDUP_MAX_SOURCES);
+
+  inputs = malloc(nb_inputs * sizeof(struct input));
+  if(!inputs)
+    errx(EXIT_FAILURE, "out of memory");
+
+  for(i = 0 ; i < nb_inputs ; i++) {
+    in = &inputs[i];
+
+    memset(in, 0, sizeof(struct input));
+
+    in->path = argv[optind + 1 + i];
+    in->scan = pcap_scan_open(in->path);
+    in->data = malloc(PCAP_MAX_RECORD_SIZE);
+    if(!in->data)
+      errx(EXIT_FAILURE, "out of memory");
+
+    next_record(in);
+  }
+
+  if(report_path) {
+    report = fopen(report_path, "w");
+    if(!report)
+      err(EXIT_FAILURE, "cannot open report file");
+  }
+
+  if(!no_dedup)
+    dd = dedup_create(window, capacity, ignore_fcs, emit, NULL);
+
+  open_writing_pcap(output);
+
+  /* Each input is expected to be sorted so we just have to take the oldest
+     pending record at each step. There are only a few inputs so a linear
+     search is cheaper than maintaining a heap. */
+  while((in = oldest_input())) {
+    unsigned int source = in - inputs;
+
+    if(no_dedup) {
+      struct dedup_frame frame = {
+        .data    = in->data,
+        .size    = in->rec.size,
+        .length  = in->rec.length,
+        .tv      = in->rec.tv,
+        .sources = (uint32_t)1 << source,
+        .origin  = source,
+        .copies  = 1
+      };
+
+      emit(&frame, NULL);
+    }
+    else
+      dedup_push(dd, in->data, in->rec.size, in->rec.length, &in->rec.tv,
+                 source);
+
+    next_record(in);
+  }
+
+  if(!no_dedup) {
+    dedup_flush(dd);
+    display_summary(dd);
+    dedup_destroy(dd);
+  }
+
+  close_writing_pcap();
+
+  if(report && fclose(report) == EOF)
+    err(EXIT_FAILURE, "cannot close report file");
+
+  for(i = 0 ; i < nb_inputs ; i++) {
+    pcap_scan_close(inputs[i].scan);
+    free(inputs[i].data);
+  }
+  free(inputs);
+
+  exit_status = EXIT_SUCCESS;
+
+EXIT:
+  return exit_status;
+}
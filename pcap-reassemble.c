@@ -0,0 +1,259 @@
+/* File: pcap-reassemble.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include <string.h>
+#include <getopt.h>
+#include <err.h>
+
+#include "version.h"
+#include "pcap.h"
+#include "pcap-scan.h"
+#include "pcap-write.h"
+#include "mac-decode.h"
+#include "lowpan-decode.h"
+#include "lowpan-display.h"
+#include "lowpan-reasm.h"
+#include "xatoi.h"
+#include "help.h"
+
+#define TARGET "PCAP-Reassemble"
+
+/* RFC 4944 recommends at most 60 seconds. */
+#define DEFAULT_TIMEOUT       60   /* seconds */
+#define DEFAULT_MEMORY        1024 /* KiB */
+#define DEFAULT_SOURCE_MEMORY 64   /* KiB */
+
+static pcap_writer_t output;
+static bool records;
+static unsigned long written;
+static unsigned long invalid;
+
+static void emit_datagram(const struct lowpan_datagram *datagram, void *data)
+{
+  (void)data;
+
+  if(output) {
+    pcap_writer_write(output, datagram->data, datagram->size, &datagram->tv);
+    written++;
+  }
+
+  if(records) {
+    lowpan_display_datagram(datagram);
+    putchar('\n');
+  }
+}
+
+/* Datagrams which were not fragmented only need their headers
+   uncompressed. Those whose headers cannot be uncompressed are invalid just
+   like the fragments. */
+static void emit_packet(const struct mac_frame *frame,
+                        const struct lowpan_packet *packet,
+                        const struct timeval *tv)
+{
+  unsigned char buf[IPV6_HEADER_SIZE + UDP_HEADER_SIZE + 127];
+  unsigned int size;
+  int n;
+
+  size  = IPV6_HEADER_SIZE + packet->size;
+  size += packet->headers & LH_UDP ? UDP_HEADER_SIZE : 0;
+
+  n = lowpan_uncompress(packet, size, buf);
+  if(n < 0) {
+    invalid++;
+    return;
+  }
+
+  memcpy(buf + n, (const unsigned char *)frame->payload + packet->offset,
+         packet->size);
+  lowpan_udp_checksum(buf, size);
+
+  pcap_writer_write(output, buf, size, tv);
+  written++;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned char data[PCAP_MAX_RECORD_SIZE];
+  unsigned long timeout = DEFAULT_TIMEOUT;
+  unsigned long memory = DEFAULT_MEMORY;
+  unsigned long source_memory = DEFAULT_SOURCE_MEMORY;
+  unsigned long frames = 0;
+  bool all = false;
+  struct lowpan_reasm_stats stats;
+  struct pcap_record rec;
+  lowpan_reasm_t reasm;
+  pcap_scan_t ps;
+  const char *name;
+  int err_v;
+
+  int exit_status = EXIT_FAILURE;
+
+  name = (const char *)strrchr(argv[0], '/');
+  name = name ? (name + 1) : argv[0];
+
+  enum opt {
+    OPT_COMMIT = 0x100
+  };
+
+  struct opt_help helps[] = {
+    { 'h', "help", "Show this help message" },
+    { 'V', "version", "Print version information" },
+#ifdef COMMIT
+    { 0, "commit", "Display commit information" },
+#endif /* COMMIT */
+    { 't', "timeout", "Drop incomplete datagrams after this delay in seconds" },
+    { 'm', "memory", "Memory for the datagrams being reassembled in KiB" },
+    { 's', "source-memory", "Memory for the datagrams of each source in KiB" },
+    { 'a', "all", "Also write the datagrams that were not fragmented" },
+    { 'r', "records", "Display the reassembled datagrams" },
+    { 0, NULL, NULL }
+  };
+
+  struct option opts[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "version", no_argument, NULL, 'V' },
+#ifdef COMMIT
+    { "commit", no_argument, NULL, OPT_COMMIT },
+#endif /* COMMIT */
+    { "timeout", required_argument, NULL, 't' },
+    { "memory", required_argument, NULL, 'm' },
+    { "source-memory", required_argument, NULL, 's' },
+    { "all", no_argument, NULL, 'a' },
+    { "records", no_argument, NULL, 'r' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while(1) {
+    int c = getopt_long(argc, argv, "hVt:m:s:ar", opts, NULL);
+
+    if(c == -1)
+      break;
+
+    switch(c) {
+    case('t'):
+      timeout = xatoul(optarg, &err_v);
+      if(err_v || timeout == 0)
+        errx(EXIT_FAILURE, "invalid timeout");
+      break;
+    case('m'):
+      memory = xatoul(optarg, &err_v);
+      if(err_v || memory < 2)
+        errx(EXIT_FAILURE, "invalid memory (at least 2 KiB)");
+      break;
+    case('s'):
+      source_memory = xatoul(optarg, &err_v);
+      if(err_v || source_memory < 2)
+        errx(EXIT_FAILURE, "invalid source memory (at least 2 KiB)");
+      break;
+    case('a'):
+      all = true;
+      break;
+    case('r'):
+      records = true;
+      break;
+#ifdef COMMIT
+    case(OPT_COMMIT):
+      commit();
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+#endif /* COMMIT */
+    case('V'):
+      version(TARGET);
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+    case('h'):
+      exit_status = EXIT_SUCCESS;
+    default:
+      help(name, "[OPTIONS] ... INPUT [OUTPUT]", helps);
+      goto EXIT;
+    }
+  }
+
+  if((argc - optind) != 1 && (argc - optind) != 2)
+    errx(EXIT_FAILURE, "except input and output files");
+
+  if(!records && (argc - optind) != 2)
+    errx(EXIT_FAILURE, "except an output file or the records");
+
+  ps = pcap_scan_open(argv[optind]);
+
+  if((argc - optind) == 2)
+    output = pcap_writer_open(argv[optind + 1], LINKTYPE_IPV6);
+
+  reasm = lowpan_reasm_create(timeout * 1000000, memory * 1024,
+                              source_memory * 1024, emit_datagram, NULL);
+
+  while(pcap_scan_next(ps, &rec, data)) {
+    struct lowpan_packet packet;
+    struct mac_frame frame;
+    bool truncated = rec.size < rec.length;
+
+    frames++;
+
+    /* A fragment which was not entirely captured cannot complete its
+       datagram. */
+    if(truncated)
+      continue;
+
+    if(mac_decode(&frame, data, true, rec.size) < 0) {
+      free_mac_frame(&frame);
+      continue;
+    }
+
+    if(lowpan_decode(&packet, &frame) == 0) {
+      if(packet.headers & LH_FRAG)
+        lowpan_reasm_push(reasm, &frame, &packet, &rec.tv);
+      else if(all && output)
+        emit_packet(&frame, &packet, &rec.tv);
+    }
+
+    free_mac_frame(&frame);
+  }
+
+  lowpan_reasm_get_stats(reasm, &stats);
+
+  fprintf(stderr, "%lu frames, %lu fragments, %lu datagrams reassembled, "
+          "%lu datagrams written\n",
+          frames, stats.fragments, stats.datagrams, written);
+  if(stats.expired || stats.pending)
+    fprintf(stderr, "%lu datagrams incomplete\n",
+            stats.expired + stats.pending);
+  if(stats.evicted || stats.refused)
+    fprintf(stderr, "%lu datagrams dropped for memory (%lu evicted, "
+            "%lu refused), peak at %zu KiB\n",
+            stats.evicted + stats.refused, stats.evicted, stats.refused,
+            stats.peak_memory / 1024);
+  if(stats.invalid)
+    fprintf(stderr, "%lu invalid fragments\n", stats.invalid);
+  if(invalid)
+    fprintf(stderr, "%lu invalid datagrams\n", invalid);
+
+  lowpan_reasm_destroy(reasm);
+
+  if(output)
+    pcap_writer_close(output);
+  pcap_scan_close(ps);
+
+  exit_status = EXIT_SUCCESS;
+
+EXIT:
+  return exit_status;
+}
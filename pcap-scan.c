@@ -0,0 +1,293 @@
+/* File: pcap-scan.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#define _BSD_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "sys-endian.h"
+#include "iobuf.h"
+#include "pcap.h"
+#include "pcap-scan.h"
+
+/* Number of consecutive valid records needed to accept a position when we
+   resynchronize on an arbitrary offset. */
+#define RESYNC_DEPTH      4
+
+/* Below this distance the bisection stops and we walk the records. */
+#define BISECT_THRESHOLD  4096
+
+struct pcap_scan {
+  iofile_t file;
+  int      fd;
+  off_t    size;
+  off_t    offset;
+  int      timezone_offset;
+  uint32_t max_length;
+  bool     big_endian;
+
+  unsigned char header[PCAP_HEADER_SIZE];
+};
+
+static uint16_t ftoh16(const struct pcap_scan *ps, const unsigned char *raw)
+{
+  uint16_t value;
+  memcpy(&value, raw, sizeof(value));
+  return ps->big_endian ? be16toh(value) : le16toh(value);
+}
+
+static uint32_t ftoh32(const struct pcap_scan *ps, const unsigned char *raw)
+{
+  uint32_t value;
+  memcpy(&value, raw, sizeof(value));
+  return ps->big_endian ? be32toh(value) : le32toh(value);
+}
+
+/* Decode a record header. Return false if the header cannot be valid. */
+static bool decode_record(const struct pcap_scan *ps,
+                          const unsigned char *raw,
+                          off_t offset,
+                          struct pcap_record *rec)
+{
+  rec->offset     = offset;
+  rec->tv.tv_sec  = ftoh32(ps, raw) + ps->timezone_offset;
+  rec->tv.tv_usec = ftoh32(ps, raw + 4);
+  rec->size       = ftoh32(ps, raw + 8);
+  rec->length     = ftoh32(ps, raw + 12);
+
+  if(rec->tv.tv_usec >= 1000000)
+    return false;
+  if(rec->size > rec->length || rec->length > PCAP_MAX_RECORD_SIZE)
+    return false;
+  if(rec->size > ps->max_length)
+    return false;
+
+  return true;
+}
+
+pcap_scan_t pcap_scan_open(const char *path)
+{
+  struct pcap_scan *ps;
+  struct stat st;
+  uint32_t magic;
+  ssize_t n;
+
+  ps = malloc(sizeof(struct pcap_scan));
+  if(!ps)
+    errx(EXIT_FAILURE, "out of memory");
+
+  ps->fd = open(path, O_RDONLY);
+  if(ps->fd < 0)
+    err(EXIT_FAILURE, "cannot open pcap file");
+
+  if(fstat(ps->fd, &st) < 0)
+    err(EXIT_FAILURE, "cannot stat pcap file");
+  ps->size = st.st_size;
+
+  n = pread(ps->fd, ps->header, PCAP_HEADER_SIZE, 0);
+  if(n < 0)
+    err(EXIT_FAILURE, "cannot read from pcap file");
+  else if(n != PCAP_HEADER_SIZE)
+    errx(EXIT_FAILURE, "incomplete pcap header");
+
+  /* Check for the magic number's endianness. */
+  memcpy(&magic, ps->header, sizeof(magic));
+  if(htobe32(PCAP_MAGIC) == magic)
+    ps->big_endian = true;
+  else if(htole32(PCAP_MAGIC) == magic)
+    ps->big_endian = false;
+  else
+    errx(EXIT_FAILURE, "invalid magic in pcap file");
+
+  if(ftoh16(ps, ps->header + 4) != PCAP_MAJOR ||
+     ftoh16(ps, ps->header + 6) != PCAP_MINOR)
+    errx(EXIT_FAILURE, "incompatible pcap version");
+
+  ps->timezone_offset = ftoh32(ps, ps->header + 8);
+  ps->max_length      = ftoh32(ps, ps->header + 16);
+
+  if(ps->max_length > UINT16_MAX)
+    ps->max_length = UINT16_MAX;
+
+  if(ftoh32(ps, ps->header + 20) != LINKTYPE_IEEE802_15_4)
+    errx(EXIT_FAILURE, "data link type not supported");
+
+  ps->file = iobuf_dopen(ps->fd);
+  if(!ps->file)
+    errx(EXIT_FAILURE, "out of memory");
+
+  pcap_scan_seek(ps, PCAP_HEADER_SIZE);
+
+  return ps;
+}
+
+const unsigned char * pcap_scan_header(pcap_scan_t ps)
+{
+  return ps->header;
+}
+
+int pcap_scan_fileno(pcap_scan_t ps)
+{
+  return ps->fd;
+}
+
+off_t pcap_scan_file_size(pcap_scan_t ps)
+{
+  return ps->size;
+}
+
+off_t pcap_scan_offset(pcap_scan_t ps)
+{
+  return ps->offset;
+}
+
+void pcap_scan_seek(pcap_scan_t ps, off_t offset)
+{
+  if(iobuf_lseek(ps->file, offset, SEEK_SET) < 0)
+    err(EXIT_FAILURE, "cannot seek into pcap file");
+  ps->offset = offset;
+}
+
+bool pcap_scan_next(pcap_scan_t ps, struct pcap_record *rec,
+                    unsigned char *data)
+{
+  unsigned char raw[PCAP_RECORD_HEADER_SIZE];
+  ssize_t n;
+
+  n = iobuf_read(ps->file, raw, sizeof(raw));
+  if(n == 0) /* end-of-file */
+    return false;
+  else if(n < 0)
+    err(EXIT_FAILURE, "cannot read from pcap file");
+  else if(n != sizeof(raw))
+    goto TRUNCATED;
+
+  if(!decode_record(ps, raw, ps->offset, rec))
+    errx(EXIT_FAILURE, "invalid record at offset %lld",
+         (long long)ps->offset);
+
+  if(rec->offset + PCAP_RECORD_HEADER_SIZE + rec->size > ps->size)
+    goto TRUNCATED;
+
+  /* We only read the frame when requested. Otherwise
+     we skip it which may spare a read on large frames. */
+  if(data) {
+    n = iobuf_read(ps->file, data, rec->size);
+    if(n < 0)
+      err(EXIT_FAILURE, "cannot read from pcap file");
+    else if(n != rec->size)
+      goto TRUNCATED;
+  }
+  else if(iobuf_lseek(ps->file, rec->size, SEEK_CUR) < 0)
+    err(EXIT_FAILURE, "cannot seek into pcap file");
+
+  ps->offset += PCAP_RECORD_HEADER_SIZE + rec->size;
+
+  return true;
+
+TRUNCATED:
+  warnx("truncated record at offset %lld", (long long)ps->offset);
+  return false;
+}
+
+/* Check that a chain of valid records starts at the specified offset.
+   Reaching the end of the file exactly also counts as valid. */
+static bool check_chain(const struct pcap_scan *ps, off_t offset)
+{
+  int depth;
+
+  for(depth = 0 ; depth < RESYNC_DEPTH ; depth++) {
+    unsigned char raw[PCAP_RECORD_HEADER_SIZE];
+    struct pcap_record rec;
+
+    if(offset == ps->size)
+      return true;
+
+    if(pread(ps->fd, raw, sizeof(raw), offset) != sizeof(raw))
+      return false;
+
+    if(!decode_record(ps, raw, offset, &rec))
+      return false;
+
+    offset += PCAP_RECORD_HEADER_SIZE + rec.size;
+    if(offset > ps->size)
+      return false;
+  }
+
+  return true;
+}
+
+off_t pcap_scan_resync(pcap_scan_t ps, off_t offset)
+{
+  if(offset <= PCAP_HEADER_SIZE)
+    return PCAP_HEADER_SIZE;
+
+  for(; offset < ps->size ; offset++)
+    if(check_chain(ps, offset))
+      return offset;
+
+  return ps->size;
+}
+
+off_t pcap_scan_find_time(pcap_scan_t ps, const struct timeval *tv)
+{
+  struct pcap_record rec;
+  off_t lo = PCAP_HEADER_SIZE;
+  off_t hi = ps->size;
+
+  /* The low bound is always a record older than the requested time (or the
+     first record). The high bound is either a record which is not older or
+     the end of the file. */
+  while(hi - lo > BISECT_THRESHOLD) {
+    unsigned char raw[PCAP_RECORD_HEADER_SIZE];
+    off_t mid = pcap_scan_resync(ps, lo + (hi - lo) / 2);
+
+    if(mid >= hi)
+      break;
+
+    if(pread(ps->fd, raw, sizeof(raw), mid) != sizeof(raw) ||
+       !decode_record(ps, raw, mid, &rec))
+      break;
+
+    if(timercmp(&rec.tv, tv, <))
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  /* Now we are close enough to walk the records. */
+  pcap_scan_seek(ps, lo);
+  while(pcap_scan_next(ps, &rec, NULL))
+    if(!timercmp(&rec.tv, tv, <))
+      return rec.offset;
+
+  return pcap_scan_offset(ps);
+}
+
+void pcap_scan_close(pcap_scan_t ps)
+{
+  iobuf_close(ps->file);
+  free(ps);
+}
@@ -0,0 +1,91 @@
+/* File: pcap-scan.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _PCAP_SCAN_H_
+#define _PCAP_SCAN_H_
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Unlike pcap-read, the scanner never loads the whole file nor allocates
+   anything per frame. It walks the record headers of a PCAP file and can
+   locate records from an arbitrary byte offset. This is what we need to
+   work on captures that are much larger than the memory. Many scanners
+   may be opened on the same file at the same time. */
+
+#define PCAP_HEADER_SIZE        24 /* size of the global header */
+#define PCAP_RECORD_HEADER_SIZE 16 /* size of a record header */
+
+/* Largest record that we accept (same limit as pcap-read). */
+#define PCAP_MAX_RECORD_SIZE    UINT16_MAX
+
+struct pcap_record {
+  off_t offset;      /* offset of the record header in the file */
+  struct timeval tv; /* timestamp (timezone corrected) */
+  uint32_t size;     /* number of octets saved in the file */
+  uint32_t length;   /* actual length of the frame */
+};
+
+typedef struct pcap_scan * pcap_scan_t;
+
+/* Open a PCAP file for scanning and check its global header. The scanner is
+   positioned on the first record. */
+pcap_scan_t pcap_scan_open(const char *path);
+
+/* Raw global header as found in the file (PCAP_HEADER_SIZE bytes).
+   Records keep the byte order of this header. */
+const unsigned char * pcap_scan_header(pcap_scan_t ps);
+
+/* File descriptor of the underlying file. Only use it with pread() like
+   functions as the position of the file is owned by the scanner. */
+int pcap_scan_fileno(pcap_scan_t ps);
+
+/* Size of the file when it was opened. */
+off_t pcap_scan_file_size(pcap_scan_t ps);
+
+/* Offset of the next record to be read. */
+off_t pcap_scan_offset(pcap_scan_t ps);
+
+/* Position the scanner on the record header starting at offset. */
+void pcap_scan_seek(pcap_scan_t ps, off_t offset);
+
+/* Read the next record header. If data is not NULL the frame is copied into
+   it, otherwise the frame is skipped without being read. The data buffer must
+   be at least PCAP_MAX_RECORD_SIZE bytes long. Return false at the end of the
+   file. A truncated record at the end of the file is reported and considered
+   as the end of the file. */
+bool pcap_scan_next(pcap_scan_t ps, struct pcap_record *rec,
+                    unsigned char *data);
+
+/* Find the first record which starts at or after the specified offset. We
+   cannot tell a record header from frame data for sure, so a position is
+   only accepted when a chain of valid records follows it. Return the size of
+   the file if no record could be found. */
+off_t pcap_scan_resync(pcap_scan_t ps, off_t offset);
+
+/* Find the offset of the first record whose timestamp is greater or equal to
+   the specified time. This does a bisection over the file so timestamps are
+   expected to be non-decreasing. Return the size of the file if there is no
+   such record. */
+off_t pcap_scan_find_time(pcap_scan_t ps, const struct timeval *tv);
+
+/* Close the scanner. */
+void pcap_scan_close(pcap_scan_t ps);
+
+#endif /* _PCAP_SCAN_H_ */
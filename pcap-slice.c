@@ -0,0 +1,372 @@
+/* File: pcap-slice.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif /* __linux__ */
+
+#include "version.h"
+#include "pcap-scan.h"
+#include "xatoi.h"
+#include "help.h"
+
+#define TARGET "PCAP-Slice"
+
+/* Size of the buffer used when the kernel cannot copy for us. */
+#define COPY_BUFFER_SIZE 65536
+
+/* A time bound given by the user. Relative bounds are
+   expressed from the timestamp of the first record. */
+struct time_bound {
+  struct timeval tv;
+  bool relative;
+  bool set;
+};
+
+/* Parse a time of the form [+]SEC[.FRAC]. */
+static void parse_time(struct time_bound *bound, const char *arg)
+{
+  char buf[sizeof("18446744073709551615.000000")];
+  char *frac;
+  int i, err;
+
+  bound->relative = false;
+  if(*arg == '+') {
+    bound->relative = true;
+    arg++;
+  }
+
+  if(strlen(arg) >= sizeof(buf))
+    errx(EXIT_FAILURE, "invalid time value");
+  strcpy(buf, arg);
+
+  bound->tv.tv_usec = 0;
+
+  frac = strchr(buf, '.');
+  if(frac) {
+    *frac++ = '\0';
+
+    /* We only keep the microseconds. */
+    for(i = 0 ; i < 6 ; i++) {
+      bound->tv.tv_usec *= 10;
+
+      if(*frac) {
+        if(*frac < '0' || *frac > '9')
+          errx(EXIT_FAILURE, "invalid time value");
+        bound->tv.tv_usec += *frac++ - '0';
+      }
+    }
+  }
+
+  bound->tv.tv_sec = xatou(buf, &err);
+  if(err)
+    errx(EXIT_FAILURE, "invalid time value");
+
+  bound->set = true;
+}
+
+/* Convert a relative bound into an absolute time. */
+static void absolute_time(struct time_bound *bound, const struct timeval *first)
+{
+  if(bound->relative) {
+    struct timeval tv = bound->tv;
+    timeradd(first, &tv, &bound->tv);
+    bound->relative = false;
+  }
+}
+
+/* Walk the records from the beginning of the file to find the offset of the
+   record at the specified position (starting at one). The frames themselves
+   are skipped so we only read the record headers. */
+static off_t find_frame(pcap_scan_t ps, unsigned int position)
+{
+  struct pcap_record rec;
+  unsigned int count = 1;
+
+  pcap_scan_seek(ps, PCAP_HEADER_SIZE);
+
+  while(pcap_scan_next(ps, &rec, NULL)) {
+    if(count++ == position)
+      return rec.offset;
+  }
+
+  return pcap_scan_offset(ps);
+}
+
+static void copy_range(int in, int out, off_t offset, off_t size)
+{
+  unsigned char buf[COPY_BUFFER_SIZE];
+  ssize_t n;
+
+  /* We try the fastest way first. That is, let the kernel (or even the
+     filesystem) copy the range for us. The copy may not be possible between
+     these two files in which case we fallback on the next method. */
+#if defined(__linux__) && defined(__GLIBC__) && \
+  (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+  while(size) {
+    n = copy_file_range(in, &offset, out, NULL, size, 0);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      break;
+    }
+    else if(n == 0)
+      errx(EXIT_FAILURE, "unexpected end-of-file");
+    size -= n;
+  }
+#endif
+
+  /* This still avoids the copy to user-space and works with pipes. */
+#ifdef __linux__
+  while(size) {
+    n = sendfile(out, in, &offset, size);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      else if(errno == EINVAL || errno == ENOSYS)
+        break;
+      err(EXIT_FAILURE, "cannot copy the records");
+    }
+    else if(n == 0)
+      errx(EXIT_FAILURE, "unexpected end-of-file");
+    size -= n;
+  }
+#endif /* __linux__ */
+
+  /* Otherwise we do the copy ourselves. */
+  while(size) {
+    ssize_t w;
+    size_t count = size > sizeof(buf) ? sizeof(buf) : size;
+
+    n = pread(in, buf, count, offset);
+    if(n < 0) {
+      if(errno == EINTR)
+        continue;
+      err(EXIT_FAILURE, "cannot read from pcap file");
+    }
+    else if(n == 0)
+      errx(EXIT_FAILURE, "unexpected end-of-file");
+
+    offset += n;
+    size   -= n;
+
+    for(w = 0 ; w < n ;) {
+      ssize_t partial = write(out, buf + w, n - w);
+      if(partial < 0) {
+        if(errno == EINTR)
+          continue;
+        err(EXIT_FAILURE, "cannot write to output");
+      }
+      w += partial;
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct time_bound start_time = { .set = false };
+  struct time_bound end_time   = { .set = false };
+  unsigned int start_frame = 0;
+  unsigned int end_frame   = 0;
+  const char *name;
+  const char *input;
+  const char *output;
+  pcap_scan_t ps;
+  off_t start, end;
+  int out;
+  int err_v;
+
+  int exit_status = EXIT_FAILURE;
+
+  name = (const char *)strrchr(argv[0], '/');
+  name = name ? (name + 1) : argv[0];
+
+  enum opt {
+    OPT_COMMIT = 0x100
+  };
+
+  struct opt_help helps[] = {
+    { 'h', "help", "Show this help message" },
+    { 'V', "version", "Print version information" },
+#ifdef COMMIT
+    { 0, "commit", "Display commit information" },
+#endif /* COMMIT */
+    { 's', "start-frame", "First frame to extract (starting at one)" },
+    { 'e', "end-frame", "Last frame to extract" },
+    { 'S', "start-time", "Extract from this time ([+]SEC[.FRAC])" },
+    { 'E', "end-time", "Extract up to this time ([+]SEC[.FRAC])" },
+    { 0, NULL, NULL }
+  };
+
+  struct option opts[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "version", no_argument, NULL, 'V' },
+#ifdef COMMIT
+    { "commit", no_argument, NULL, OPT_COMMIT },
+#endif /* COMMIT */
+    { "start-frame", required_argument, NULL, 's' },
+    { "end-frame", required_argument, NULL, 'e' },
+    { "start-time", required_argument, NULL, 'S' },
+    { "end-time", required_argument, NULL, 'E' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while(1) {
+    int c = getopt_long(argc, argv, "hVs:e:S:E:", opts, NULL);
+
+    if(c == -1)
+      break;
+
+    switch(c) {
+    case('s'):
+      start_frame = xatou(optarg, &err_v);
+      if(err_v || start_frame == 0)
+        errx(EXIT_FAILURE, "invalid start frame");
+      break;
+    case('e'):
+      end_frame = xatou(optarg, &err_v);
+      if(err_v || end_frame == 0)
+        errx(EXIT_FAILURE, "invalid end frame");
+      break;
+    case('S'):
+      parse_time(&start_time, optarg);
+      break;
+    case('E'):
+      parse_time(&end_time, optarg);
+      break;
+#ifdef COMMIT
+    case(OPT_COMMIT):
+      commit();
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+#endif /* COMMIT */
+    case('V'):
+      version(TARGET);
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+    case('h'):
+      exit_status = EXIT_SUCCESS;
+    default:
+      help(name, "[OPTIONS] ... INPUT OUTPUT", helps);
+      goto EXIT;
+    }
+  }
+
+  if((argc - optind) != 2)
+    errx(EXIT_FAILURE, "except input and output files");
+
+  input  = argv[optind];
+  output = argv[optind + 1];
+
+  if(start_frame && end_frame && start_frame > end_frame)
+    errx(EXIT_FAILURE, "the start frame comes after the end frame");
+
+  ps = pcap_scan_open(input);
+
+  /* Relative times need the timestamp of the first record. */
+  if((start_time.set && start_time.relative) ||
+     (end_time.set && end_time.relative)) {
+    struct pcap_record first;
+
+    if(!pcap_scan_next(ps, &first, NULL))
+      errx(EXIT_FAILURE, "empty pcap file");
+
+    absolute_time(&start_time, &first.tv);
+    absolute_time(&end_time, &first.tv);
+  }
+
+  /* Find the byte range that we have to copy. Time bounds are found by
+     bisection while frame bounds require a walk over the record headers.
+     When both are specified the narrowest range is used. */
+  start = PCAP_HEADER_SIZE;
+  end   = pcap_scan_file_size(ps);
+
+  if(start_frame) {
+    off_t offset = find_frame(ps, start_frame);
+    if(offset > start)
+      start = offset;
+  }
+
+  if(end_frame) {
+    off_t offset = find_frame(ps, end_frame + 1);
+    if(offset < end)
+      end = offset;
+  }
+
+  if(start_time.set) {
+    off_t offset = pcap_scan_find_time(ps, &start_time.tv);
+    if(offset > start)
+      start = offset;
+  }
+
+  if(end_time.set) {
+    /* The end time is inclusive so we search for
+       the first record strictly after it. */
+    struct timeval after, usec = { .tv_sec = 0, .tv_usec = 1 };
+    off_t offset;
+
+    timeradd(&end_time.tv, &usec, &after);
+
+    offset = pcap_scan_find_time(ps, &after);
+    if(offset < end)
+      end = offset;
+  }
+
+  if(end < start)
+    end = start;
+
+  /* Now we can write the output. */
+  if(!strcmp(output, "-"))
+    out = STDOUT_FILENO;
+  else {
+    out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(out < 0)
+      err(EXIT_FAILURE, "cannot open output file");
+  }
+
+  /* The records keep the byte order of the original
+     global header so we just copy it as is. */
+  if(write(out, pcap_scan_header(ps), PCAP_HEADER_SIZE) != PCAP_HEADER_SIZE)
+    err(EXIT_FAILURE, "cannot write to output");
+
+  copy_range(pcap_scan_fileno(ps), out, start, end - start);
+
+  if(out != STDOUT_FILENO && close(out) < 0)
+    err(EXIT_FAILURE, "cannot close output file");
+
+  pcap_scan_close(ps);
+
+  exit_status = EXIT_SUCCESS;
+
+EXIT:
+  return exit_status;
+}
@@ -0,0 +1,465 @@
+/* File: pcap-stats.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#define _BSD_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <err.h>
+
+#include "version.h"
+#include "pcap-scan.h"
+#include "mac-decode.h"
+#include "mac-display.h"
+#include "xatoi.h"
+#include "help.h"
+
+#define TARGET "PCAP-Stats"
+
+#define MAX_JOBS        256
+#define SIZE_BIN_WIDTH  16
+#define SIZE_BINS       (PCAP_MAX_RECORD_SIZE / SIZE_BIN_WIDTH + 1)
+#define SIZE_BINS_SHOWN 8   /* 802.15.4 frames are at most 127 bytes */
+#define NODES_INITIAL   64
+
+/* Counters associated to a source address. The first and last sequence
+   numbers seen in a chunk are kept so that gaps across chunk boundaries
+   can be accounted when the chunks are merged. */
+struct node {
+  bool used;
+
+  enum mac_addr_mode mode;
+  struct mac_addr addr;
+
+  unsigned long frames;
+  unsigned long bytes;
+  unsigned long missing; /* frames missing according to the seqno */
+  unsigned long repeated; /* frames repeating the last seqno */
+  uint8_t first_seqno;
+  uint8_t last_seqno;
+};
+
+struct node_table {
+  struct node *nodes;
+  unsigned int size;
+  unsigned int count;
+};
+
+/* Partial aggregate computed by one thread over one chunk. */
+struct chunk {
+  pthread_t thread;
+  pcap_scan_t scan;
+  off_t start;
+  off_t end;
+
+  unsigned long frames;
+  unsigned long invalid;
+  unsigned long long bytes;
+  unsigned long types[MC_TYPE + 1];
+  unsigned long sizes[SIZE_BINS];
+  struct node_table nodes;
+};
+
+static void node_table_init(struct node_table *table, unsigned int size)
+{
+  table->nodes = calloc(size, sizeof(struct node));
+  if(!table->nodes)
+    errx(EXIT_FAILURE, "out of memory");
+
+  table->size  = size;
+  table->count = 0;
+}
+
+static unsigned int node_hash(enum mac_addr_mode mode,
+                              const struct mac_addr *addr)
+{
+  uint64_t h = addr->mac ^ ((uint64_t)addr->pan << 48) ^ mode;
+
+  /* 64-bit finalizer from MurmurHash3 */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return h;
+}
+
+static struct node * node_lookup(struct node_table *table,
+                                 enum mac_addr_mode mode,
+                                 const struct mac_addr *addr);
+
+static void node_table_grow(struct node_table *table)
+{
+  struct node_table new;
+  unsigned int i;
+
+  node_table_init(&new, table->size << 1);
+
+  for(i = 0 ; i < table->size ; i++) {
+    struct node *o = &table->nodes[i];
+
+    if(o->used)
+      *node_lookup(&new, o->mode, &o->addr) = *o;
+  }
+
+  free(table->nodes);
+  *table = new;
+}
+
+/* Find the node associated to an address. The node is created if needed. */
+static struct node * node_lookup(struct node_table *table,
+                                 enum mac_addr_mode mode,
+                                 const struct mac_addr *addr)
+{
+  unsigned int i;
+
+  /* Keep the load factor under one half. */
+  if(table->count * 2 >= table->size)
+    node_table_grow(table);
+
+  for(i = node_hash(mode, addr) & (table->size - 1) ;
+      table->nodes[i].used ;
+      i = (i + 1) & (table->size - 1)) {
+    struct node *n = &table->nodes[i];
+
+    if(n->mode == mode && n->addr.pan == addr->pan && n->addr.mac == addr->mac)
+      return n;
+  }
+
+  table->count++;
+  table->nodes[i].used = true;
+  table->nodes[i].mode = mode;
+  table->nodes[i].addr = *addr;
+
+  return &table->nodes[i];
+}
+
+static void account_seqno(struct node *node, uint8_t seqno)
+{
+  if(node->frames == 0)
+    node->first_seqno = seqno;
+  else {
+    uint8_t delta = seqno - node->last_seqno;
+
+    if(delta == 0)
+      node->repeated++;
+    else
+      node->missing += delta - 1;
+  }
+
+  node->last_seqno = seqno;
+}
+
+static void account_frame(struct chunk *chunk,
+                          const unsigned char *data,
+                          size_t size)
+{
+  struct mac_frame frame;
+  enum mac_addr_mode sam;
+  struct node *node;
+
+  chunk->frames++;
+  chunk->bytes += size;
+  chunk->sizes[size / SIZE_BIN_WIDTH]++;
+
+  if(mac_decode(&frame, data, true, size) < 0) {
+    chunk->invalid++;
+    free_mac_frame(&frame);
+    return;
+  }
+
+  chunk->types[frame.control & MC_TYPE]++;
+
+  /* Frames without source address (such as ACK)
+     cannot be attributed to a node. */
+  sam = (frame.control & MC_SAM) >> MC_SAM_SHR;
+  if(sam != MAM_FULL) {
+    node = node_lookup(&chunk->nodes, sam, &frame.src);
+    account_seqno(node, frame.seqno);
+    node->frames++;
+    node->bytes += size;
+  }
+
+  free_mac_frame(&frame);
+}
+
+static void * chunk_thread(void *arg)
+{
+  struct chunk *chunk = arg;
+  struct pcap_record rec;
+  unsigned char *buf;
+
+  buf = malloc(PCAP_MAX_RECORD_SIZE);
+  if(!buf)
+    errx(EXIT_FAILURE, "out of memory");
+
+  pcap_scan_seek(chunk->scan, chunk->start);
+
+  while(pcap_scan_offset(chunk->scan) < chunk->end &&
+        pcap_scan_next(chunk->scan, &rec, buf))
+    account_frame(chunk, buf, rec.size);
+
+  free(buf);
+
+  return NULL;
+}
+
+/* Merge a chunk into the global aggregate. Chunks have to be merged in the
+   order of the file so that sequence numbers are followed correctly. */
+static void merge_chunk(struct chunk *total, const struct chunk *chunk)
+{
+  unsigned int i;
+
+  total->frames  += chunk->frames;
+  total->invalid += chunk->invalid;
+  total->bytes   += chunk->bytes;
+
+  for(i = 0 ; i <= MC_TYPE ; i++)
+    total->types[i] += chunk->types[i];
+  for(i = 0 ; i < SIZE_BINS ; i++)
+    total->sizes[i] += chunk->sizes[i];
+
+  for(i = 0 ; i < chunk->nodes.size ; i++) {
+    const struct node *n = &chunk->nodes.nodes[i];
+    struct node *t;
+
+    if(!n->used)
+      continue;
+
+    t = node_lookup(&total->nodes, n->mode, &n->addr);
+
+    /* account the boundary between the two chunks */
+    if(t->frames) {
+      uint8_t delta = n->first_seqno - t->last_seqno;
+
+      if(delta == 0)
+        t->repeated++;
+      else
+        t->missing += delta - 1;
+    }
+    else
+      t->first_seqno = n->first_seqno;
+
+    t->last_seqno = n->last_seqno;
+    t->frames    += n->frames;
+    t->bytes     += n->bytes;
+    t->missing   += n->missing;
+    t->repeated  += n->repeated;
+  }
+}
+
+static int node_compare(const void *a, const void *b)
+{
+  const struct node *na = a;
+  const struct node *nb = b;
+
+  if(na->frames != nb->frames)
+    return na->frames < nb->frames ? 1 : -1;
+  return 0;
+}
+
+static void display_report(const struct chunk *total)
+{
+  const char *types[] = { "BEACON", "DATA", "ACK", "COMMAND" };
+  struct node *nodes;
+  unsigned int i, j;
+
+  printf("Frames  : %lu (%lu invalid)\n", total->frames, total->invalid);
+  printf("Bytes   : %llu\n", total->bytes);
+
+  printf("\nFrame types:\n");
+  for(i = 0 ; i <= MC_TYPE ; i++) {
+    if(i <= MT_CMD)
+      printf("  %-8s: %lu\n", types[i], total->types[i]);
+    else if(total->types[i])
+      printf("  (0x%x)   : %lu\n", i, total->types[i]);
+  }
+
+  printf("\nFrame sizes:\n");
+  for(i = 0 ; i < SIZE_BINS ; i++) {
+    if(i >= SIZE_BINS_SHOWN && !total->sizes[i])
+      continue;
+    printf("  %3u-%-3u : %lu\n", i * SIZE_BIN_WIDTH,
+           (i + 1) * SIZE_BIN_WIDTH - 1, total->sizes[i]);
+  }
+
+  /* Sort the nodes by number of frames. */
+  nodes = malloc((total->nodes.count + 1) * sizeof(struct node));
+  if(!nodes)
+    errx(EXIT_FAILURE, "out of memory");
+
+  for(i = 0, j = 0 ; i < total->nodes.size ; i++)
+    if(total->nodes.nodes[i].used)
+      nodes[j++] = total->nodes.nodes[i];
+  qsort(nodes, j, sizeof(struct node), node_compare);
+
+  printf("\nNodes: %u\n", total->nodes.count);
+  for(i = 0 ; i < j ; i++) {
+    struct mac_frame frame = { .control = nodes[i].mode << MC_SAM_SHR,
+                               .src     = nodes[i].addr };
+
+    printf("  ");
+    mac_display_saddr(&frame);
+    printf(" : %lu frames, %lu bytes, %lu missing, %lu repeated\n",
+           nodes[i].frames, nodes[i].bytes,
+           nodes[i].missing, nodes[i].repeated);
+  }
+
+  free(nodes);
+}
+
+int main(int argc, char *argv[])
+{
+  struct chunk *chunks;
+  struct chunk total;
+  const char *name;
+  const char *path;
+  off_t file_size;
+  long jobs;
+  int i, err_v;
+
+  int exit_status = EXIT_FAILURE;
+
+  name = (const char *)strrchr(argv[0], '/');
+  name = name ? (name + 1) : argv[0];
+
+  jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if(jobs < 1)
+    jobs = 1;
+
+  enum opt {
+    OPT_COMMIT = 0x100
+  };
+
+  struct opt_help helps[] = {
+    { 'h', "help", "Show this help message" },
+    { 'V', "version", "Print version information" },
+#ifdef COMMIT
+    { 0, "commit", "Display commit information" },
+#endif /* COMMIT */
+    { 'j', "jobs", "Number of threads (default: number of CPUs)" },
+    { 0, NULL, NULL }
+  };
+
+  struct option opts[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "version", no_argument, NULL, 'V' },
+#ifdef COMMIT
+    { "commit", no_argument, NULL, OPT_COMMIT },
+#endif /* COMMIT */
+    { "jobs", required_argument, NULL, 'j' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while(1) {
+    int c = getopt_long(argc, argv, "hVj:", opts, NULL);
+
+    if(c == -1)
+      break;
+
+    switch(c) {
+    case('j'):
+      jobs = xatou(optarg, &err_v);
+      if(err_v || jobs == 0 || jobs > MAX_JOBS)
+        errx(EXIT_FAILURE, "invalid number of jobs");
+      break;
+#ifdef COMMIT
+    case(OPT_COMMIT):
+      commit();
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+#endif /* COMMIT */
+    case('V'):
+      version(TARGET);
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+    case('h'):
+      exit_status = EXIT_SUCCESS;
+    default:
+      help(name, "[OPTIONS] ... PCAP", helps);
+      goto EXIT;
+    }
+  }
+
+  if((argc - optind) != 1)
+    errx(EXIT_FAILURE, "except pcap file");
+
+  path = argv[optind];
+
+  if(jobs > MAX_JOBS)
+    jobs = MAX_JOBS;
+
+  chunks = calloc(jobs, sizeof(struct chunk));
+  if(!chunks)
+    errx(EXIT_FAILURE, "out of memory");
+
+  /* Each thread has its own scanner on the file. The file is split into
+     chunks of the same size which are then aligned on the next record. */
+  for(i = 0 ; i < jobs ; i++) {
+    chunks[i].scan = pcap_scan_open(path);
+    node_table_init(&chunks[i].nodes, NODES_INITIAL);
+  }
+
+  file_size = pcap_scan_file_size(chunks[0].scan);
+
+  chunks[0].start = PCAP_HEADER_SIZE;
+  for(i = 1 ; i < jobs ; i++) {
+    off_t offset = PCAP_HEADER_SIZE + (file_size - PCAP_HEADER_SIZE) * i / jobs;
+
+    offset = pcap_scan_resync(chunks[i].scan, offset);
+    if(offset < chunks[i - 1].start)
+      offset = chunks[i - 1].start;
+
+    chunks[i].start   = offset;
+    chunks[i - 1].end = offset;
+  }
+  chunks[jobs - 1].end = file_size;
+
+  for(i = 0 ; i < jobs ; i++) {
+    int ret = pthread_create(&chunks[i].thread, NULL, chunk_thread, &chunks[i]);
+    if(ret)
+      errx(EXIT_FAILURE, "cannot create thread");
+  }
+
+  memset(&total, 0, sizeof(struct chunk));
+  node_table_init(&total.nodes, NODES_INITIAL);
+
+  for(i = 0 ; i < jobs ; i++) {
+    pthread_join(chunks[i].thread, NULL);
+    merge_chunk(&total, &chunks[i]);
+
+    pcap_scan_close(chunks[i].scan);
+    free(chunks[i].nodes.nodes);
+  }
+
+  display_report(&total);
+
+  free(total.nodes.nodes);
+  free(chunks);
+
+  exit_status = EXIT_SUCCESS;
+
+EXIT:
+  return exit_status;
+}
@@ -15,52 +15,311 @@
    You should have received a copy of the GNU General Public License
    along with this program. If not, see <http://www.gnu.org/licenses/>. */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
 #include <err.h>
 
 #include "iobuf.h"
 #include "pcap.h"
+#include "pcap-scan.h"
+#include "pcap-write.h"
+
+/* With the adaptive policy, the frames are flushed as soon as the input is
+   quiet for a moment. Under heavy traffic they are batched up to a bounded
+   delay instead. */
+#define ADAPTIVE_QUIET 10  /* milliseconds */
+#define ADAPTIVE_DELAY 100 /* milliseconds */
 
 static iofile_t pcap;
 
-#define WRITE(size)                                               \
-  static void write ## size (uint ## size ## _t value) {          \
-    ssize_t n = iobuf_write(pcap, &value, sizeof(value));         \
-    if(n != sizeof(value))                                        \
-      err(EXIT_FAILURE, "cannot write to pcap file");             \
+/* Flush policy, whichever comes first. */
+static unsigned int flush_frames; /* frames */
+static unsigned int flush_delay;  /* milliseconds */
+static bool flush_adaptive;
+static bool flush_default = true; /* no policy was requested */
+
+/* Frames waiting in the buffer. */
+static unsigned int pending;
+static uint64_t pending_since;
+static uint64_t last_write;
+
+/* Durability policy. The file is synchronized by a thread so that the capture
+   never waits for the disk. */
+static bool sync_dsync;
+static unsigned int sync_interval; /* seconds */
+static unsigned long sync_bytes;
+static unsigned long unsynced;     /* bytes since the last wake up */
+static bool sync_stop;
+static bool sync_started;
+static pthread_t sync_thread;
+static sem_t sync_wakeup;
+
+struct pcap_writer {
+  iofile_t file;
+};
+
+#define WRITE(size)                                                   \
+  static void write ## size (iofile_t file, uint ## size ## _t value) { \
+    ssize_t n = iobuf_write(file, &value, sizeof(value));             \
+    if(n != sizeof(value))                                            \
+      err(EXIT_FAILURE, "cannot write to pcap file");                 \
   }
 
 WRITE(32)
 WRITE(16)
 
-void open_writing_pcap(const char *path)
+static void write_header(iofile_t file, uint32_t snaplen, uint32_t linktype)
+{
+  write32(file, PCAP_MAGIC); /* magic number */
+  write16(file, PCAP_MAJOR); /* PCAP version */
+  write16(file, PCAP_MINOR);
+  write32(file, 0);          /* timezone in seconds (GMT) */
+  write32(file, 0);          /* accuracy of timestamps */
+  write32(file, snaplen);    /* max length of packets */
+  write32(file, linktype);   /* data link type */
+}
+
+static void write_record(iofile_t file,
+                         const unsigned char *frame,
+                         unsigned int size,
+                         unsigned int length,
+                         const struct timeval *tv)
+{
+  ssize_t n;
+
+  write32(file, tv->tv_sec);  /* timestamp seconds */
+  write32(file, tv->tv_usec); /* timestamp microseconds */
+  write32(file, size);        /* number of octets of packet saved in file */
+  write32(file, length);      /* actual length of packet */
+
+  n = iobuf_write(file, frame, size);
+  if(n != size)
+    err(EXIT_FAILURE, "cannot write to pcap file");
+}
+
+static uint64_t now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void * sync_loop(void *arg)
 {
-  /* TODO: Append to the file if it already exists.
-           Well we could do this but will have to take
-           care of endianness. We can also do a tool
-           to merge PCAP files (which I will do later). */
-  pcap = iobuf_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  int fd = iobuf_fileno(pcap);
+
+  while(!__atomic_load_n(&sync_stop, __ATOMIC_ACQUIRE)) {
+    if(sync_interval) {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += sync_interval;
+      sem_timedwait(&sync_wakeup, &ts);
+    }
+    else
+      sem_wait(&sync_wakeup);
+
+    /* The frames still in the user-space buffer are not synchronized. The
+       flush policy bounds how long they stay there. */
+    if(fdatasync(fd) < 0)
+      warn("cannot sync pcap file");
+  }
 
+  return NULL;
+}
+
+static void start_sync(int fd)
+{
+  struct stat st;
+
+  if(!sync_interval && !sync_bytes)
+    return;
+
+  if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    warnx("pcap output cannot be synchronized");
+    return;
+  }
+
+  if(sem_init(&sync_wakeup, 0, 0) < 0)
+    err(EXIT_FAILURE, "cannot create semaphore");
+
+  if(pthread_create(&sync_thread, NULL, sync_loop, NULL))
+    errx(EXIT_FAILURE, "cannot create sync thread");
+
+  sync_started = true;
+}
+
+static void stop_sync(void)
+{
+  if(!sync_started)
+    return;
+
+  __atomic_store_n(&sync_stop, true, __ATOMIC_RELEASE);
+  sem_post(&sync_wakeup);
+  pthread_join(sync_thread, NULL);
+  sem_destroy(&sync_wakeup);
+
+  sync_started = false;
+}
+
+/* Remove a record that was only partially written when the previous capture
+   was interrupted. A record of zero bytes is never written by us and is what
+   the file system leaves when it extended the file without writing the data.
+   Return the size of the file that was kept. */
+static off_t recover_pcap(const char *path)
+{
+  pcap_scan_t ps;
+  struct pcap_record rec;
+  const unsigned char *header;
+  uint32_t magic, linktype;
+  struct stat st;
+  off_t size;
+
+  if(stat(path, &st) < 0) {
+    if(errno == ENOENT)
+      return 0;
+    err(EXIT_FAILURE, "cannot stat pcap file");
+  }
+
+  /* Not even the global header was written. */
+  if(st.st_size < PCAP_HEADER_SIZE)
+    return 0;
+
+  ps = pcap_scan_open(path);
+
+  /* We do not swap what we append. */
+  header = pcap_scan_header(ps);
+  memcpy(&magic, header, sizeof(magic));
+  memcpy(&linktype, header + 20, sizeof(linktype));
+  if(magic != PCAP_MAGIC || linktype != LINKTYPE_IEEE802_15_4)
+    errx(EXIT_FAILURE, "cannot append to a PCAP file of another format");
+
+  size = PCAP_HEADER_SIZE;
+  while(pcap_scan_next(ps, &rec, NULL) && rec.size)
+    size = pcap_scan_offset(ps);
+
+  if(size != st.st_size)
+    warnx("removed %lld bytes from the end of the pcap file",
+          (long long)(st.st_size - size));
+
+  pcap_scan_close(ps);
+
+  return size;
+}
+
+static void open_pcap(const char *path, bool append)
+{
+  struct stat st;
+  off_t size = 0;
+  int fd;
+
+  /* Anything else printed on the standard output would corrupt the PCAP. So
+     the standard output goes to the standard error instead. */
+  if(!strcmp(path, "-")) {
+    fd = dup(STDOUT_FILENO);
+    if(fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+      err(EXIT_FAILURE, "cannot redirect standard output");
+  }
+  else {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+    if(append) {
+      size  = recover_pcap(path);
+      flags = O_WRONLY | O_CREAT;
+    }
+
+    if(sync_dsync)
+      flags |= O_DSYNC;
+
+    fd = open(path, flags, 0666);
+    if(fd < 0)
+      err(EXIT_FAILURE, "cannot open pcap file");
+
+    if(append) {
+      if(ftruncate(fd, size) < 0)
+        err(EXIT_FAILURE, "cannot truncate pcap file");
+      if(lseek(fd, size, SEEK_SET) < 0)
+        err(EXIT_FAILURE, "cannot seek into pcap file");
+    }
+  }
+
+  /* Someone is watching the capture live on the other end of a pipe or a
+     FIFO. We do not make them wait for the buffer to fill. */
+  if(flush_default && !fstat(fd, &st) && S_ISFIFO(st.st_mode))
+    flush_adaptive = true;
+
+  pcap = iobuf_dopen(fd);
   if(!pcap)
     err(EXIT_FAILURE, "cannot open pcap file");
 
-  write32(PCAP_MAGIC);            /* magic number */
-  write16(PCAP_MAJOR);            /* PCAP version */
-  write16(PCAP_MINOR);
-  write32(0);                     /* timezone in seconds (GMT) */
-  write32(0);                     /* accuracy of timestamps */
-  write32(0xff);                  /* max length of packets */
-  write32(LINKTYPE_IEEE802_15_4); /* data link type */
+  start_sync(fd);
+
+  /* The header is already there. */
+  if(size)
+    return;
+
+  write_header(pcap, 0xff, LINKTYPE_IEEE802_15_4);
+}
+
+void open_writing_pcap(const char *path)
+{
+  open_pcap(path, false);
+}
+
+void open_appending_pcap(const char *path)
+{
+  open_pcap(path, true);
 }
 
 void pcap_append_frame(const unsigned char *frame, unsigned int size)
 {
-  ssize_t n;
   struct timeval tv;
 
+  /* Note that POSIX.1-2008 marks this function obsolete and it is recommended
+     to use clock_gettime() with nanoseconds timestamps instead. Since we just
+     want a microsecond timestamp and we don't care so much about time for now I
+     guess it would do perfectly well. */
+  gettimeofday(&tv, NULL);
+
+  pcap_write_frame(frame, size, &tv);
+}
+
+void pcap_append_truncated_frame(const unsigned char *frame,
+                                 unsigned int size,
+                                 unsigned int length)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  pcap_write_truncated_frame(frame, size, length, &tv);
+}
+
+void pcap_write_frame(const unsigned char *frame, unsigned int size,
+                      const struct timeval *tv)
+{
+  pcap_write_truncated_frame(frame, size, size, tv);
+}
+
+void pcap_write_truncated_frame(const unsigned char *frame,
+                                unsigned int size,
+                                unsigned int length,
+                                const struct timeval *tv)
+{
   /* If the pcap was not initialized we do nothing. */
   if(!pcap)
     return;
@@ -72,30 +331,186 @@ void pcap_append_frame(const unsigned char *frame, unsigned int size)
   if(!size)
     return;
 
-  /* Note that POSIX.1-2008 marks this function obsolete and it is recommended
-     to use clock_gettime() with nanoseconds timestamps instead. Since we just
-     want a microsecond timestamp and we don't care so much about time for now I
-     guess it would do perfectly well. */
-  gettimeofday(&tv, NULL);
+  write_record(pcap, frame, size, length, tv);
 
-  write32(tv.tv_sec);  /* timestamp seconds */
-  write32(tv.tv_usec); /* timestamp microseconds */
-  write32(size);       /* number of octets of packet saved in file */
-  write32(size);       /* actual length of packet */
+  /* Wake the sync thread up when enough data was written. The thread is
+     not started when the output cannot be synchronized. */
+  if(sync_started && sync_bytes) {
+    unsynced += PCAP_RECORD_HEADER_SIZE + size;
+    if(unsynced >= sync_bytes) {
+      unsynced = 0;
+      sem_post(&sync_wakeup);
+    }
+  }
 
-  n = iobuf_write(pcap, frame, size);
-  if(n != size)
-    err(EXIT_FAILURE, "cannot write to pcap file");
+  if(!flush_frames && !flush_delay && !flush_adaptive)
+    return;
+
+  last_write = now_ms();
+  if(!pending++)
+    pending_since = last_write;
+
+  if(flush_frames && pending >= flush_frames)
+    pcap_write_flush();
 }
 
 void pcap_write_flush(void)
 {
-  if(pcap)
-    iobuf_flush(pcap);
+  if(!pcap)
+    return;
+
+  iobuf_flush(pcap);
+  pending = 0;
+}
+
+void pcap_write_flush_policy(const char *policy)
+{
+  char *s = strdup(policy);
+  char *token, *saveptr;
+
+  if(!s)
+    errx(EXIT_FAILURE, "out of memory");
+
+  flush_default = false;
+
+  for(token = strtok_r(s, ",", &saveptr) ; token ;
+      token = strtok_r(NULL, ",", &saveptr)) {
+    unsigned long value;
+    char *end;
+
+    if(!strcmp(token, "adaptive")) {
+      flush_adaptive = true;
+      continue;
+    }
+    else if(!strcmp(token, "none"))
+      continue;
+
+    value = strtoul(token, &end, 10);
+    if(end == token || value == 0 || value > UINT32_MAX)
+      errx(EXIT_FAILURE, "invalid flush policy '%s'", token);
+
+    if(!*end)
+      flush_frames = value;
+    else if(!strcmp(end, "ms"))
+      flush_delay = value;
+    else if(!strcmp(end, "s") && value <= UINT32_MAX / 1000)
+      flush_delay = value * 1000;
+    else
+      errx(EXIT_FAILURE, "invalid flush policy '%s'", token);
+  }
+
+  free(s);
+}
+
+void pcap_write_sync_policy(const char *policy)
+{
+  char *s = strdup(policy);
+  char *token, *saveptr;
+
+  if(!s)
+    errx(EXIT_FAILURE, "out of memory");
+
+  for(token = strtok_r(s, ",", &saveptr) ; token ;
+      token = strtok_r(NULL, ",", &saveptr)) {
+    unsigned long value;
+    char *end;
+
+    if(!strcmp(token, "dsync")) {
+      sync_dsync = true;
+      continue;
+    }
+    else if(!strcmp(token, "none"))
+      continue;
+
+    value = strtoul(token, &end, 10);
+    if(end == token || value == 0 || value > UINT32_MAX)
+      errx(EXIT_FAILURE, "invalid sync policy '%s'", token);
+
+    if(!strcmp(end, "s"))
+      sync_interval = value;
+    else if(!strcmp(end, "M") && value <= ULONG_MAX >> 20)
+      sync_bytes = value << 20;
+    else
+      errx(EXIT_FAILURE, "invalid sync policy '%s'", token);
+  }
+
+  free(s);
+}
+
+unsigned int pcap_write_flush_interval(void)
+{
+  unsigned int interval = 0;
+
+  if(flush_delay)
+    interval = flush_delay / 4 ? flush_delay / 4 : 1;
+
+  if(flush_adaptive && (!interval || interval > ADAPTIVE_QUIET / 2))
+    interval = ADAPTIVE_QUIET / 2;
+
+  return interval;
+}
+
+void pcap_write_flush_check(void)
+{
+  uint64_t now;
+
+  if(!pending)
+    return;
+
+  now = now_ms();
+
+  if(flush_delay && now - pending_since >= flush_delay)
+    pcap_write_flush();
+  else if(flush_adaptive && (now - last_write >= ADAPTIVE_QUIET ||
+                             now - pending_since >= ADAPTIVE_DELAY))
+    pcap_write_flush();
 }
 
 void close_writing_pcap(void)
 {
-  if(pcap)
-    iobuf_close(pcap);
+  if(!pcap)
+    return;
+
+  iobuf_flush(pcap);
+
+  /* With a policy, a file closed properly is entirely on the disk. */
+  if(sync_started) {
+    stop_sync();
+    if(fdatasync(iobuf_fileno(pcap)) < 0)
+      warn("cannot sync pcap file");
+  }
+
+  iobuf_close(pcap);
+  pcap = NULL;
+}
+
+pcap_writer_t pcap_writer_open(const char *path, uint32_t linktype)
+{
+  struct pcap_writer *writer = malloc(sizeof(struct pcap_writer));
+  if(!writer)
+    errx(EXIT_FAILURE, "out of memory");
+
+  writer->file = iobuf_open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(!writer->file)
+    err(EXIT_FAILURE, "cannot open pcap file");
+
+  write_header(writer->file, UINT16_MAX, linktype);
+
+  return writer;
+}
+
+void pcap_writer_write(pcap_writer_t writer,
+                       const unsigned char *data,
+                       unsigned int size,
+                       const struct timeval *tv)
+{
+  if(size)
+    write_record(writer->file, data, size, size, tv);
+}
+
+void pcap_writer_close(pcap_writer_t writer)
+{
+  if(iobuf_close(writer->file) < 0)
+    err(EXIT_FAILURE, "cannot close pcap file");
+  free(writer);
 }
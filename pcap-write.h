@@ -18,16 +18,79 @@
 #ifndef _PCAP_WRITE_H_
 #define _PCAP_WRITE_H_
 
-/* Initialize the PCAP output for writing only. */
+#include <sys/time.h>
+#include <stdint.h>
+
+/* Initialize the PCAP output for writing only. The path "-" is the standard
+   output, in which case everything else printed on the standard output goes
+   to the standard error instead. Pipes and FIFOs are flushed with the adaptive
+   policy unless another policy was chosen before. */
 void open_writing_pcap(const char *path);
 
+/* Same as open_writing_pcap() but append to an existing file. A record that
+   was only partially written when the previous capture was interrupted is
+   removed first. */
+void open_appending_pcap(const char *path);
+
 /* Append a MAC frame to the PCAP file. */
 void pcap_append_frame(const unsigned char *frame, unsigned int size);
 
+/* Append a MAC frame to the PCAP file with the specified timestamp. */
+void pcap_write_frame(const unsigned char *frame, unsigned int size,
+                      const struct timeval *tv);
+
+/* Append the first size bytes of a MAC frame of the specified length. */
+void pcap_append_truncated_frame(const unsigned char *frame,
+                                 unsigned int size,
+                                 unsigned int length);
+
+/* Same as pcap_append_truncated_frame() with the specified timestamp. */
+void pcap_write_truncated_frame(const unsigned char *frame,
+                                unsigned int size,
+                                unsigned int length,
+                                const struct timeval *tv);
+
 /* Flush the PCAP file. */
 void pcap_write_flush(void);
 
+/* Choose when the frames are flushed, whichever comes first, from a comma
+   separated list. A number of frames (100), a delay (250ms or 1s), adaptive
+   (as soon as the input is quiet and within a short delay otherwise) or
+   none. By default the frames are only flushed when the buffer is full. */
+void pcap_write_flush_policy(const char *policy);
+
+/* Choose how the PCAP file is synchronized to the disk from a comma separated
+   list. A number of seconds (10s) or megabytes (8M) after which a thread calls
+   fdatasync(), dsync to open the file with O_DSYNC or none. This bounds what
+   is lost when the power fails. It must be chosen before opening the file. By
+   default the kernel writes the file back when it sees fit. */
+void pcap_write_sync_policy(const char *policy);
+
+/* Interval in milliseconds at which pcap_write_flush_check() must be called
+   for the policy or zero when it is not needed. */
+unsigned int pcap_write_flush_interval(void);
+
+/* Flush the frames which waited long enough according to the policy. */
+void pcap_write_flush_check(void);
+
 /* Close the PCAP file. */
 void close_writing_pcap(void);
 
+/* Additional PCAP files of any link type, independent from the main one
+   above. They are flushed when their buffer is full and when they are
+   closed. None of the policies apply to them. */
+typedef struct pcap_writer * pcap_writer_t;
+
+/* Create a PCAP file for the specified data link type. */
+pcap_writer_t pcap_writer_open(const char *path, uint32_t linktype);
+
+/* Append a record with the specified timestamp. */
+void pcap_writer_write(pcap_writer_t writer,
+                       const unsigned char *data,
+                       unsigned int size,
+                       const struct timeval *tv);
+
+/* Flush and close the PCAP file. */
+void pcap_writer_close(pcap_writer_t writer);
+
 #endif /* _PCAP_WRITING_H_ */
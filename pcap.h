@@ -26,5 +26,6 @@
 #define PCAP_MINOR 4
 
 #define LINKTYPE_IEEE802_15_4 195
+#define LINKTYPE_IPV6         229
 
 #endif /* _PCAP_H_ */
@@ -17,6 +17,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <err.h>
@@ -24,6 +25,10 @@
 
 #include "protocol.h"
 #include "string-utils.h"
+#include "crc16.h"
+
+static int version = 1;
+static struct prot_stats stats;
 
 static void full_write(int fd, const void *buf, size_t count, const char *error)
 {
@@ -36,6 +41,63 @@ static void full_write(int fd, const void *buf, size_t count, const char *error)
   }
 }
 
+void prot_set_version(int v)
+{
+  assert(v == 1 || v == 2);
+
+  version = v;
+}
+
+int prot_get_version(void)
+{
+  return version;
+}
+
+static unsigned char * slip_byte(unsigned char *dst, unsigned char c)
+{
+  switch(c) {
+  case(SLIP_END):
+    *dst++ = SLIP_ESC;
+    *dst++ = SLIP_ESC_END;
+    break;
+  case(SLIP_ESC):
+    *dst++ = SLIP_ESC;
+    *dst++ = SLIP_ESC_ESC;
+    break;
+  default:
+    *dst++ = c;
+    break;
+  }
+
+  return dst;
+}
+
+size_t prot_encode_packet(unsigned char *dst,
+                          const unsigned char *messages,
+                          size_t size)
+{
+  unsigned char *p = dst;
+  uint16_t crc;
+  size_t i;
+
+  assert(size + 2 <= MAX_PACKET_SIZE);
+
+  crc = crc16(messages, size, 0);
+
+  /* The first END byte flushes the noise that may be on the line. */
+  *p++ = SLIP_END;
+
+  for(i = 0 ; i < size ; i++)
+    p = slip_byte(p, messages[i]);
+
+  p = slip_byte(p, crc & 0xff);
+  p = slip_byte(p, crc >> 8);
+
+  *p++ = SLIP_END;
+
+  return p - dst;
+}
+
 void prot_write(int fd,
                 enum prot_mtype mt,
                 const unsigned char *message,
@@ -55,7 +117,110 @@ void prot_write(int fd,
 
   memcpy(buffer + 1, message, size);
 
-  full_write(fd, buffer, size + 1, "cannot write to UART");
+  if(version == 2) {
+    /* We send one message per packet as we do not need to batch them. */
+    unsigned char packet[2 * (MAX_MESSAGE_SIZE + 3) + 2];
+    size_t packet_size = prot_encode_packet(packet, buffer, size + 1);
+
+    full_write(fd, packet, packet_size, "cannot write to UART");
+  }
+  else
+    full_write(fd, buffer, size + 1, "cannot write to UART");
+}
+
+void prot_write_messages(int fd, const unsigned char *messages, size_t size)
+{
+  assert(size <= MAX_MESSAGE_SIZE + 1);
+
+  if(version == 2) {
+    unsigned char packet[2 * (MAX_MESSAGE_SIZE + 3) + 2];
+    size_t packet_size = prot_encode_packet(packet, messages, size);
+
+    full_write(fd, packet, packet_size, "cannot write to UART");
+  }
+  else
+    full_write(fd, messages, size, "cannot write to UART");
+}
+
+int prot_parse_packet(unsigned char *packet,
+                      size_t size,
+                      bool (*callback)(const unsigned char *,
+                                       enum prot_mtype,
+                                       size_t))
+{
+  const unsigned char *in, *esc, *end = packet + size;
+  unsigned char *out = packet;
+  unsigned char *p;
+  uint16_t crc;
+
+  if(size > MAX_ENCODED_PACKET_SIZE)
+    goto FRAMING_ERROR;
+
+  /* Unescape the packet. The bytes between two escape sequences are moved
+     at once. Most packets have only a few of them. */
+  for(in = packet ; (esc = memchr(in, SLIP_ESC, end - in)) ; in = esc + 2) {
+    if(out != in)
+      memmove(out, in, esc - in);
+    out += esc - in;
+
+    if(esc + 1 == end)
+      goto FRAMING_ERROR;
+
+    switch(esc[1]) {
+    case(SLIP_ESC_END):
+      *out++ = SLIP_END;
+      break;
+    case(SLIP_ESC_ESC):
+      *out++ = SLIP_ESC;
+      break;
+    default:
+      goto FRAMING_ERROR;
+    }
+  }
+
+  if(out != in)
+    memmove(out, in, end - in);
+  out += end - in;
+
+  /* At least one information byte and the CRC. */
+  size = out - packet;
+  if(size < 3)
+    goto FRAMING_ERROR;
+
+  size -= 2;
+  crc   = packet[size] | packet[size + 1] << 8;
+  if(crc != crc16(packet, size, 0)) {
+    stats.crc_errors++;
+    return 0;
+  }
+
+  /* The messages must fill the packet exactly. We check this before calling
+     back so that a packet is either accepted or dropped entirely. */
+  end = packet + size;
+  for(p = packet ; p < end ; p += 1 + (*p & 0x7f));
+  if(p != end)
+    goto FRAMING_ERROR;
+
+  stats.packets++;
+
+  for(p = packet ; p < end ; p += size + 1) {
+    enum prot_mtype type = *p & 0x80;
+    size = *p & 0x7f;
+
+    if(!callback(p + 1, type, size))
+      return p + size + 1 < end ? -2 : -1;
+  }
+
+  return 0;
+
+FRAMING_ERROR:
+  stats.framing_errors++;
+  return 0;
+}
+
+void prot_get_stats(struct prot_stats *s)
+{
+  *s = stats;
 }
 
 unsigned char * prot_read(unsigned char *message,
@@ -119,9 +284,47 @@ const char * prot_ctype_string(enum prot_ctype type)
     return "ACK";
   case(PROT_CTYPE_CONFIG_CHANNEL):
     return "CONFIG_CHANNEL";
+  case(PROT_CTYPE_CONFIG_FILTER):
+    return "CONFIG_FILTER";
+  case(PROT_CTYPE_CONFIG_SNAPLEN):
+    return "CONFIG_SNAPLEN";
+  case(PROT_CTYPE_TRUNCATED_FRAME):
+    return "TRUNCATED_FRAME";
+  case(PROT_CTYPE_CONFIG_BAUD):
+    return "CONFIG_BAUD";
+  case(PROT_CTYPE_CONFIG_TIMESTAMP):
+    return "CONFIG_TIMESTAMP";
+  case(PROT_CTYPE_TIMESTAMP):
+    return "TIMESTAMP";
+  case(PROT_CTYPE_STATS):
+    return "STATS";
+  case(PROT_CTYPE_SUBSCRIBE):
+    return "SUBSCRIBE";
   default:
     /* generic case */
     sprintf(generic, "(0x%x)", (unsigned char)type);
     return generic;
   }
 }
+
+const char * prot_counter_string(enum prot_counter counter)
+{
+  switch(counter) {
+  case(PROT_COUNTER_RX_FRAMES):
+    return "Radio frames";
+  case(PROT_COUNTER_RX_OVERFLOW):
+    return "RX overflows";
+  case(PROT_COUNTER_CRC_ERRORS):
+    return "CRC errors";
+  case(PROT_COUNTER_TX_BUSY):
+    return "TX busy";
+  case(PROT_COUNTER_UART_ERRORS):
+    return "UART errors";
+  case(PROT_COUNTER_FILTERED):
+    return "Filtered";
+  case(PROT_COUNTER_FORWARDED):
+    return "Forwarded";
+  default:
+    return "Unknown";
+  }
+}
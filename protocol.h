@@ -48,9 +48,107 @@ enum prot_ctype { PROT_CTYPE_INFO = 0x00,
                   PROT_CTYPE_SRV_ERROR,
                   PROT_CTYPE_PING,
                   PROT_CTYPE_ACK,
-                  PROT_CTYPE_CONFIG_CHANNEL
+                  PROT_CTYPE_CONFIG_CHANNEL,
+                  PROT_CTYPE_CONFIG_FILTER,
+                  PROT_CTYPE_CONFIG_SNAPLEN,
+                  PROT_CTYPE_TRUNCATED_FRAME,
+                  PROT_CTYPE_CONFIG_BAUD,
+                  PROT_CTYPE_CONFIG_TIMESTAMP,
+                  PROT_CTYPE_TIMESTAMP,
+                  PROT_CTYPE_STATS,
+                  PROT_CTYPE_SUBSCRIBE
                   /* add new types here */ };
 
+/* firmware statistics counter */
+enum prot_counter { PROT_COUNTER_RX_FRAMES = 0x00,
+                    PROT_COUNTER_RX_OVERFLOW,
+                    PROT_COUNTER_CRC_ERRORS,
+                    PROT_COUNTER_TX_BUSY,
+                    PROT_COUNTER_UART_ERRORS,
+                    PROT_COUNTER_FILTERED,
+                    PROT_COUNTER_FORWARDED,
+                    /* add new counters here */
+                    NB_PROT_COUNTERS };
+
+/*
+  The CONFIG_FILTER control message installs a filter on the frames that the
+  transceiver forwards. An empty payload removes the filter. Otherwise the
+  payload contains (multi-bytes values are little endian):
+
+    types (1 byte)  : accepted frame types (bit n for the type n)
+    flags (1 byte)  : which of the following fields are used (FILTER_*)
+    pan   (2 bytes) : source or destination PAN identifier
+    short (2 bytes) : source or destination short address
+    long  (8 bytes) : source or destination extended address
+
+  A frame is forwarded when its type is accepted, its PAN matches and one of
+  its addresses matches either the short or the extended address.
+
+  The CONFIG_SNAPLEN control message contains one byte, the number of bytes to
+  forward for each frame or zero for the entire frame. Larger frames are sent
+  with a TRUNCATED_FRAME control message which contains the original size of
+  the frame (one byte) followed by its first bytes.
+*/
+#define FILTER_PAN        0x01
+#define FILTER_SHORT_ADDR 0x02
+#define FILTER_LONG_ADDR  0x04
+
+#define FILTER_SIZE       14
+
+/* Truncated frames are sent in a control message
+   with the control type and the original size. */
+#define MAX_SNAPLEN       (MAX_MESSAGE_SIZE - 2)
+
+/*
+  The CONFIG_BAUD control message contains the new speed of the serial line in
+  bits per second (4 bytes, little endian). The firmware switches to the new
+  speed and answers OK at this speed or CLI_ERROR when it does not support it.
+  The host confirms with the same message at the new speed which the firmware
+  answers with OK. Without confirmation within BAUD_CONFIRM_TIMEOUT, or when
+  any other message is received first, the firmware falls back to the previous
+  speed. A speed of zero restores the initial speed of the line.
+*/
+#define BAUD_CONFIRM_TIMEOUT 2 /* seconds */
+
+/*
+  The CONFIG_TIMESTAMP control message contains one byte, non-zero to enable
+  the timestamps and zero to disable them. The firmware answers with the same
+  control type and the frequency of its clock in Hz (4 bytes, little endian)
+  or with CLI_ERROR when it has no clock. Then each frame (or truncated frame)
+  is preceded by a TIMESTAMP control message which contains the value of the
+  clock when the frame was received by the radio (4 bytes, little endian).
+  The clock wraps around.
+*/
+#define TIMESTAMP_SIZE       4
+
+/*
+  The firmware answers an empty STATS control message with its counters as 4
+  bytes little endian values in the order of enum prot_counter:
+
+    RX_FRAMES   : frames received by the radio
+    RX_OVERFLOW : frames dropped because the RX buffer was full
+    CRC_ERRORS  : frames dropped by the radio on invalid FCS
+    TX_BUSY     : injected frames refused because the radio was busy
+    UART_ERRORS : corrupted messages or packets received from the host
+    FILTERED    : frames dropped by the filter installed by the host
+    FORWARDED   : frames sent to the host
+
+  The counters are reset with the ready byte and wrap around. A host which
+  knows less counters ignores the last ones. Since the answer follows the
+  frames already forwarded, the host can compare FORWARDED with the number
+  of frames that it received to find the frames lost on the serial line.
+*/
+
+/*
+  The SUBSCRIBE control message is only understood by wsn-radiod. The daemon
+  holds the serial line and speaks the version 1 of the protocol with its
+  clients over a UNIX socket. It sends the ready byte as soon as a client is
+  connected. Only the clients which sent an empty SUBSCRIBE message receive
+  the frames (along with TRUNCATED_FRAME and TIMESTAMP messages). The other
+  messages of the clients go to the firmware in order and the answers are
+  sent back to the client which asked for them.
+*/
+
 /* The maximum allowed size for a message. */
 #define MAX_MESSAGE_SIZE 127
 
@@ -60,6 +158,31 @@ enum prot_ctype { PROT_CTYPE_INFO = 0x00,
 /* The time to wait for the ready byte. */
 #define READY_TIMEOUT    10
 
+/*
+  Version 2 of the protocol groups one or more messages into a packet.
+  The packet is delimited using SLIP (RFC 1055) and ends with a CRC-16
+  (ITU-T as used by 802.15.4, little endian) over the messages. So a
+  corrupted byte only costs one packet and the receiver synchronizes
+  again on the next END byte. The firmware announces the version of
+  the protocol with its ready byte.
+*/
+
+/* This byte is used by a firmware which speaks the version 2. */
+#define READY_BYTE_V2    0xfe
+
+/* SLIP special bytes. */
+#define SLIP_END         0xc0
+#define SLIP_ESC         0xdb
+#define SLIP_ESC_END     0xdc
+#define SLIP_ESC_ESC     0xdd
+
+/* The maximum size of a packet (messages and CRC) before escaping. */
+#define MAX_PACKET_SIZE  512
+
+/* The maximum size of a packet on the line, that is when all bytes are
+   escaped and with the two END bytes. */
+#define MAX_ENCODED_PACKET_SIZE (2 * MAX_PACKET_SIZE + 2)
+
 /* Encode a message with the specified type and payload and write it to the
    specified file descriptor. */
 void prot_write(int fd,
@@ -67,6 +190,12 @@ void prot_write(int fd,
                 const unsigned char *message,
                 size_t size);
 
+/* Write several messages at once. Each message is prefixed with its info byte
+   as on the line. With the version 2 they are sent in the same packet which
+   the firmware processes without interruption. The messages together must not
+   be larger than the largest message and its info byte. */
+void prot_write_messages(int fd, const unsigned char *messages, size_t size);
+
 /* Decode a message and call a function with the decoded message. It will return
    a pointer to the position just after the message being read. If the
    callback return false, the n returned pointer will be NULL which instructs
@@ -76,6 +205,39 @@ unsigned char * prot_read(unsigned char *message,
                                            unsigned char *,
                                            size_t));
 
+/* Statistics on the packets received with the version 2. */
+struct prot_stats {
+  unsigned long packets;        /* valid packets */
+  unsigned long crc_errors;     /* packets dropped because of the CRC */
+  unsigned long framing_errors; /* invalid escape, truncated or oversized */
+};
+
+/* Select the version of the protocol (1 or 2). This is done when we receive
+   the ready byte of the firmware. The default is version 1. */
+void prot_set_version(int version);
+int prot_get_version(void);
+
+/* Encode messages, that is information bytes each one followed by a payload,
+   into a version 2 packet including the END bytes. The destination must be
+   at least MAX_ENCODED_PACKET_SIZE long. Return the size of the packet. */
+size_t prot_encode_packet(unsigned char *dst,
+                          const unsigned char *messages,
+                          size_t size);
+
+/* Decode a version 2 packet in place, without the END bytes, and call a
+   function with each message. Invalid packets are dropped and accounted in
+   the statistics. Return 0 when the packet was parsed or dropped, -1 when
+   the callback returned false on the last message and -2 when it returned
+   false with messages left in the packet. */
+int prot_parse_packet(unsigned char *packet,
+                      size_t size,
+                      bool (*callback)(const unsigned char *,
+                                       enum prot_mtype,
+                                       size_t));
+
+/* Get the statistics on the packets received so far. */
+void prot_get_stats(struct prot_stats *stats);
+
 /* Decode a control message and take appropriate action with common control
    types. If the message is recognized and parsed this function will return
    true so you may skip the message. */
@@ -85,4 +247,7 @@ bool prot_preparse_control(const unsigned char *message, size_t size);
    not recognized it will return the associated hexadecimal code. */
 const char * prot_ctype_string(enum prot_ctype type);
 
+/* Convert a firmware counter to a human readable string. */
+const char * prot_counter_string(enum prot_counter counter);
+
 #endif /* _PROTOCOL_H_ */
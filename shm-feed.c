@@ -0,0 +1,310 @@
+/* File: shm-feed.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "protocol.h"
+#include "mac-decode.h"
+#include "shm-feed.h"
+
+#define SHM_FEED_MAGIC   0x57534e46 /* WSNF */
+#define SHM_FEED_VERSION 1
+
+/* Size of a record that only skips the end of the ring. */
+#define PADDING 0xffff
+
+#define ALIGN(n) (((n) + 7) & ~7)
+
+/* The positions count the bytes written since the creation so they never
+   wrap. The writer announces the end of the record that it is about to write
+   with reserved and then publishes it with head. A reader knows that what it
+   copied was not overwritten when reserved is still less than one ring ahead
+   of its cursor after the copy. The counters of the writer and the readers
+   are on different cache lines. */
+struct header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+  uint32_t closed;
+  unsigned char pad1[64 - 20];
+
+  uint64_t reserved;
+  uint64_t head;
+  unsigned char pad2[64 - 16];
+};
+
+struct record {
+  uint32_t seqno;
+  uint16_t size;
+  uint16_t length;
+  int64_t  sec;
+  int32_t  usec;
+  uint32_t pad;
+};
+
+struct shm_feed {
+  struct header *header;
+  unsigned char *ring;
+  uint64_t capacity;
+  size_t map_size;
+
+  bool writer;
+  char *name;
+
+  uint64_t cursor;   /* next position for the writer or the reader */
+  uint32_t seqno;    /* next sequence number expected */
+  bool resync;       /* the next sequence number is not known */
+
+  unsigned char data[MAX_MESSAGE_SIZE];
+};
+
+static struct shm_feed * new_feed(const char *name, bool writer)
+{
+  struct shm_feed *feed = malloc(sizeof(struct shm_feed));
+
+  if(!feed)
+    errx(EXIT_FAILURE, "out of memory");
+
+  memset(feed, 0, sizeof(struct shm_feed));
+
+  feed->writer = writer;
+  feed->name   = strdup(name);
+  if(!feed->name)
+    errx(EXIT_FAILURE, "out of memory");
+
+  return feed;
+}
+
+static void map_feed(struct shm_feed *feed, int fd, int prot)
+{
+  void *p = mmap(NULL, feed->map_size, prot, MAP_SHARED, fd, 0);
+
+  if(p == MAP_FAILED)
+    err(EXIT_FAILURE, "cannot map feed");
+
+  feed->header = p;
+  feed->ring   = (unsigned char *)p + sizeof(struct header);
+}
+
+shm_feed_t shm_feed_create(const char *name, size_t size)
+{
+  struct shm_feed *feed = new_feed(name, true);
+  uint64_t capacity;
+  int fd;
+
+  for(capacity = 4096 ; capacity < size ; capacity <<= 1);
+
+  feed->capacity = capacity;
+  feed->map_size = sizeof(struct header) + capacity;
+
+  /* The readers of the previous feed keep their own copy. */
+  shm_unlink(name);
+
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if(fd < 0)
+    err(EXIT_FAILURE, "cannot create feed '%s'", name);
+
+  if(ftruncate(fd, feed->map_size) < 0)
+    err(EXIT_FAILURE, "cannot size feed");
+
+  map_feed(feed, fd, PROT_READ | PROT_WRITE);
+  close(fd);
+
+  feed->header->capacity = capacity;
+  feed->header->version  = SHM_FEED_VERSION;
+  __atomic_store_n(&feed->header->magic, SHM_FEED_MAGIC, __ATOMIC_RELEASE);
+
+  return feed;
+}
+
+/* Copy to the ring at a position, the caller ensures that it does not wrap. */
+static void ring_write(struct shm_feed *feed, uint64_t pos,
+                       const void *data, size_t size)
+{
+  memcpy(feed->ring + (pos & (feed->capacity - 1)), data, size);
+}
+
+void shm_feed_publish(shm_feed_t feed,
+                      const unsigned char *data,
+                      unsigned int size,
+                      unsigned int length,
+                      const struct timeval *tv)
+{
+  struct record r = { .seqno  = feed->seqno++,
+                      .size   = size,
+                      .length = length,
+                      .sec    = tv->tv_sec,
+                      .usec   = tv->tv_usec };
+  uint64_t pos  = feed->cursor;
+  uint64_t room = feed->capacity - (pos & (feed->capacity - 1));
+  uint64_t n    = ALIGN(sizeof(struct record) + size);
+
+  /* Records do not wrap. The end of the ring is skipped instead. */
+  if(room < n) {
+    __atomic_store_n(&feed->header->reserved, pos + room + n,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if(room >= sizeof(struct record)) {
+      struct record pad = { .size = PADDING };
+      ring_write(feed, pos, &pad, sizeof(pad));
+    }
+    pos += room;
+  }
+  else {
+    __atomic_store_n(&feed->header->reserved, pos + n, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+
+  ring_write(feed, pos, &r, sizeof(r));
+  ring_write(feed, pos + sizeof(r), data, size);
+
+  feed->cursor = pos + n;
+  __atomic_store_n(&feed->header->head, feed->cursor, __ATOMIC_RELEASE);
+}
+
+shm_feed_t shm_feed_open(const char *name)
+{
+  struct shm_feed *feed = new_feed(name, false);
+  struct stat st;
+  int fd;
+
+  fd = shm_open(name, O_RDONLY, 0);
+  if(fd < 0)
+    err(EXIT_FAILURE, "cannot open feed '%s'", name);
+
+  if(fstat(fd, &st) < 0)
+    err(EXIT_FAILURE, "cannot stat feed");
+  if(st.st_size < sizeof(struct header))
+    errx(EXIT_FAILURE, "invalid feed");
+
+  feed->map_size = st.st_size;
+  map_feed(feed, fd, PROT_READ);
+  close(fd);
+
+  if(__atomic_load_n(&feed->header->magic, __ATOMIC_ACQUIRE) != SHM_FEED_MAGIC ||
+     feed->header->version != SHM_FEED_VERSION ||
+     feed->header->capacity + sizeof(struct header) != feed->map_size)
+    errx(EXIT_FAILURE, "invalid feed");
+
+  feed->capacity = feed->header->capacity;
+  feed->cursor   = __atomic_load_n(&feed->header->head, __ATOMIC_ACQUIRE);
+  feed->resync   = true;
+
+  return feed;
+}
+
+/* The writer may have written over what we copied from the cursor. */
+static bool overrun(struct shm_feed *feed)
+{
+  uint64_t reserved;
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  reserved = __atomic_load_n(&feed->header->reserved, __ATOMIC_RELAXED);
+
+  return reserved - feed->cursor > feed->capacity;
+}
+
+int shm_feed_read(shm_feed_t feed,
+                  struct shm_feed_frame *frame,
+                  unsigned long *lost)
+{
+  while(1) {
+    uint64_t head = __atomic_load_n(&feed->header->head, __ATOMIC_ACQUIRE);
+    uint64_t room = feed->capacity - (feed->cursor & (feed->capacity - 1));
+    struct record r;
+
+    if(head == feed->cursor) {
+      if(__atomic_load_n(&feed->header->closed, __ATOMIC_ACQUIRE) &&
+         head == __atomic_load_n(&feed->header->head, __ATOMIC_ACQUIRE))
+        return -1;
+      return 0;
+    }
+
+    /* Less than a record left means that the end of the ring was skipped. */
+    if(room < sizeof(struct record)) {
+      feed->cursor += room;
+      continue;
+    }
+
+    memcpy(&r, feed->ring + (feed->cursor & (feed->capacity - 1)), sizeof(r));
+    if(r.size != PADDING && r.size <= MAX_MESSAGE_SIZE)
+      memcpy(feed->data, feed->ring + (feed->cursor & (feed->capacity - 1)) +
+             sizeof(r), r.size);
+
+    /* Start again from the most recent frame. We will know how many frames
+       were lost with the next sequence number. */
+    if(overrun(feed)) {
+      feed->cursor = __atomic_load_n(&feed->header->head, __ATOMIC_ACQUIRE);
+      continue;
+    }
+
+    if(r.size == PADDING) {
+      feed->cursor += room;
+      continue;
+    }
+
+    if(r.size > MAX_MESSAGE_SIZE)
+      errx(EXIT_FAILURE, "corrupted feed");
+
+    feed->cursor += ALIGN(sizeof(struct record) + r.size);
+
+    if(!feed->resync && r.seqno != feed->seqno)
+      *lost += (uint32_t)(r.seqno - feed->seqno);
+    feed->seqno  = r.seqno + 1;
+    feed->resync = false;
+
+    frame->data       = feed->data;
+    frame->size       = r.size;
+    frame->length     = r.length;
+    frame->tv.tv_sec  = r.sec;
+    frame->tv.tv_usec = r.usec;
+
+    return 1;
+  }
+}
+
+int shm_feed_decode(const struct shm_feed_frame *frame,
+                    struct mac_frame *mac)
+{
+  /* Truncated frames do not end with the FCS. */
+  return mac_decode(mac, frame->data, frame->size == frame->length,
+                    frame->size);
+}
+
+void shm_feed_close(shm_feed_t feed)
+{
+  if(feed->writer) {
+    __atomic_store_n(&feed->header->closed, 1, __ATOMIC_RELEASE);
+    shm_unlink(feed->name);
+  }
+
+  munmap(feed->header, feed->map_size);
+
+  free(feed->name);
+  free(feed);
+}
@@ -0,0 +1,77 @@
+/* File: shm-feed.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _SHM_FEED_H_
+#define _SHM_FEED_H_
+
+#include <sys/time.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mac.h"
+
+/* Live feed of the captured frames in a POSIX shared memory ring. There is a
+   single writer which never waits for the readers. Each reader keeps its own
+   cursor and notices when the writer overwrote the frames that it did not
+   read yet. So any number of readers may attach without slowing down the
+   capture. */
+
+/* Default size of the ring in bytes. That is about 8000 frames of the
+   largest size. */
+#define SHM_FEED_SIZE (1 << 20)
+
+typedef struct shm_feed * shm_feed_t;
+
+/* Frame read from the feed. The data is valid until the next read. */
+struct shm_feed_frame {
+  const unsigned char *data;
+  unsigned int size;   /* bytes captured */
+  unsigned int length; /* bytes on air, larger when truncated */
+  struct timeval tv;
+};
+
+/* Create the feed with the specified name (such as /wsn-feed) and size in
+   bytes rounded up to a power of two. An existing feed is replaced. */
+shm_feed_t shm_feed_create(const char *name, size_t size);
+
+/* Append a frame of which only the first size bytes over length were
+   captured. This never blocks. */
+void shm_feed_publish(shm_feed_t feed,
+                      const unsigned char *data,
+                      unsigned int size,
+                      unsigned int length,
+                      const struct timeval *tv);
+
+/* Attach to an existing feed. The reader starts with the next frame. */
+shm_feed_t shm_feed_open(const char *name);
+
+/* Read the next frame. Return 1 when a frame was read, 0 when there is no new
+   frame yet and -1 when the writer is gone and all its frames were read. The
+   number of frames overwritten before they could be read is added to lost. */
+int shm_feed_read(shm_feed_t feed,
+                  struct shm_feed_frame *frame,
+                  unsigned long *lost);
+
+/* Decode a frame read from the feed with mac_decode(). */
+int shm_feed_decode(const struct shm_feed_frame *frame,
+                    struct mac_frame *mac);
+
+/* Detach from the feed. The writer also removes the feed. Readers which are
+   still attached drain the frames that are left. */
+void shm_feed_close(shm_feed_t feed);
+
+#endif /* _SHM_FEED_H_ */
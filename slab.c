@@ -0,0 +1,126 @@
+/* File: slab.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <err.h>
+
+#include "slab.h"
+
+/* Objects are aligned for any type that we store in them. */
+#define ALIGNMENT sizeof(uint64_t)
+
+/* Free objects are linked through their first bytes. */
+struct object {
+  struct object *next;
+};
+
+/* Pages are linked through a header in front of their objects. */
+struct page {
+  struct page *next;
+  uint64_t objects[];
+};
+
+struct slab {
+  size_t object_size;
+  unsigned int page_objects;
+
+  struct page *pages;
+  struct object *free;
+};
+
+slab_t slab_create(size_t object_size, unsigned int page_objects)
+{
+  struct slab *slab = malloc(sizeof(struct slab));
+  if(!slab)
+    errx(EXIT_FAILURE, "out of memory");
+
+  if(object_size < sizeof(struct object))
+    object_size = sizeof(struct object);
+  object_size = (object_size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+  slab->object_size  = object_size;
+  slab->page_objects = page_objects ? page_objects : 1;
+  slab->pages        = NULL;
+  slab->free         = NULL;
+
+  return slab;
+}
+
+static void grow(struct slab *slab)
+{
+  struct page *page;
+  unsigned char *p;
+  unsigned int i;
+
+  page = malloc(sizeof(struct page) + slab->object_size * slab->page_objects);
+  if(!page)
+    errx(EXIT_FAILURE, "out of memory");
+
+  page->next  = slab->pages;
+  slab->pages = page;
+
+  /* The objects are put in the free list in order of their address. */
+  p = (unsigned char *)page->objects + slab->object_size * slab->page_objects;
+  for(i = 0 ; i < slab->page_objects ; i++) {
+    struct object *object;
+
+    p -= slab->object_size;
+    object = (struct object *)p;
+    object->next = slab->free;
+    slab->free   = object;
+  }
+}
+
+void * slab_alloc(slab_t slab)
+{
+  struct object *object;
+
+  if(!slab->free)
+    grow(slab);
+
+  object     = slab->free;
+  slab->free = object->next;
+
+  return object;
+}
+
+void slab_free(slab_t slab, void *object)
+{
+  struct object *o = object;
+
+  o->next    = slab->free;
+  slab->free = o;
+}
+
+size_t slab_object_size(slab_t slab)
+{
+  return slab->object_size;
+}
+
+void slab_destroy(slab_t slab)
+{
+  struct page *page = slab->pages;
+
+  while(page) {
+    struct page *next = page->next;
+    free(page);
+    page = next;
+  }
+
+  free(slab);
+}
@@ -0,0 +1,46 @@
+/* File: slab.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stddef.h>
+
+/* Allocator of objects of a single size. Objects are carved out of pages
+   which are allocated when needed and only released when the slab is
+   destroyed. Freed objects are kept in a list and reused first, so that a
+   steady workload does not call malloc() at all. */
+
+typedef struct slab * slab_t;
+
+/* Create a slab for objects of the specified size, allocated by pages of
+   the specified number of objects. */
+slab_t slab_create(size_t object_size, unsigned int page_objects);
+
+/* Allocate an object. Its content is undefined. */
+void * slab_alloc(slab_t slab);
+
+/* Give an object back to the slab. */
+void slab_free(slab_t slab, void *object);
+
+/* Size of the objects, rounded up for their alignment. */
+size_t slab_object_size(slab_t slab);
+
+/* Release all the pages, including the objects still allocated. */
+void slab_destroy(slab_t slab);
+
+#endif /* _SLAB_H_ */
@@ -0,0 +1,84 @@
+/* File: termios2.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <asm/termbits.h>
+#else
+# define _BSD_SOURCE
+# include <termios.h>
+#endif /* __linux__ */
+
+#include "termios2.h"
+
+#ifdef __linux__
+int set_custom_speed(int fd, unsigned int rate)
+{
+  struct termios2 options;
+
+  if(ioctl(fd, TCGETS2, &options) < 0)
+    return -1;
+
+  /* Both speeds are taken from the structure with BOTHER. */
+  options.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+  options.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+  options.c_ispeed = rate;
+  options.c_ospeed = rate;
+
+  return ioctl(fd, TCSETS2, &options);
+}
+
+int get_custom_speed(int fd, unsigned int *rate)
+{
+  struct termios2 options;
+
+  if(ioctl(fd, TCGETS2, &options) < 0)
+    return -1;
+
+  /* The kernel always fills the speed fields
+     even for speeds configured with Bxxx. */
+  *rate = options.c_ospeed;
+
+  return 0;
+}
+#else
+int set_custom_speed(int fd, unsigned int rate)
+{
+  struct termios options;
+
+  if(tcgetattr(fd, &options) < 0)
+    return -1;
+
+  /* The BSD speed_t values are the speeds themselves. */
+  if(cfsetspeed(&options, rate) < 0)
+    return -1;
+
+  return tcsetattr(fd, TCSANOW, &options);
+}
+
+int get_custom_speed(int fd, unsigned int *rate)
+{
+  struct termios options;
+
+  if(tcgetattr(fd, &options) < 0)
+    return -1;
+
+  *rate = cfgetospeed(&options);
+
+  return 0;
+}
+#endif /* __linux__ */
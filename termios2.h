@@ -0,0 +1,34 @@
+/* File: termios2.h
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _TERMIOS2_H_
+#define _TERMIOS2_H_
+
+/* Speeds which have no Bxxx constant. On Linux they are configured with the
+   termios2 structure and the BOTHER flag. Other systems (BSD) accept the speed
+   in bits per second directly. These functions live in their own unit because
+   the Linux headers for termios2 conflict with the libc termios.h header. */
+
+/* Set the input and output speed of a serial line in bits per second.
+   Return -1 on error with errno set accordingly. */
+int set_custom_speed(int fd, unsigned int rate);
+
+/* Get the output speed of a serial line in bits per second.
+   Return -1 on error with errno set accordingly. */
+int get_custom_speed(int fd, unsigned int *rate);
+
+#endif /* _TERMIOS2_H_ */
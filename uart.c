@@ -18,9 +18,16 @@
 #define _BSD_SOURCE
 
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/times.h>
+#include <sys/select.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
@@ -29,34 +36,54 @@
 
 #include "xatoi.h"
 #include "protocol.h"
+#include "termios2.h"
+#include "uart.h"
+
+/* Time to wait for each answer of the firmware during the negotiation. */
+#define NEGOTIATE_TIMEOUT 1 /* seconds */
+
+static const struct baud_entry {
+  int     intval;
+  speed_t baud;
+} bauds[] = {
+#ifdef B4000000
+  { 4000000, B4000000 },
+  { 3500000, B3500000 },
+  { 3000000, B3000000 },
+  { 2500000, B2500000 },
+  { 2000000, B2000000 },
+  { 1500000, B1500000 },
+  { 1152000, B1152000 },
+  { 1000000, B1000000 },
+  { 921600, B921600 },
+  { 576000, B576000 },
+  { 500000, B500000 },
+  { 460800, B460800 },
+#endif /* B4000000 */
+  { 230400, B230400 },
+  { 115200, B115200 },
+  { 57600, B57600 },
+  { 38400, B38400 },
+  { 19200, B19200 },
+  { 9600, B9600 },
+  { 4800, B4800 },
+  { 2400, B2400 },
+  { 1800, B1800 },
+  { 1200, B1200 },
+  { 300, B300 },
+  { 200, B200 },
+  { 150, B150 },
+  { 134, B134 },
+  { 110, B110 },
+  { 75, B75 },
+  { 50, B50 },
+  { 0,  B0 }};
 
 speed_t baud(const char *arg)
 {
+  const struct baud_entry *b;
   int err;
 
-  const struct {
-    int     intval;
-    speed_t baud;
-  } *b, bauds[] = {
-    { 230400, B230400 },
-    { 115200, B115200 },
-    { 57600, B57600 },
-    { 38400, B38400 },
-    { 19200, B19200 },
-    { 9600, B9600 },
-    { 4800, B4800 },
-    { 2400, B2400 },
-    { 1800, B1800 },
-    { 1200, B1200 },
-    { 300, B300 },
-    { 200, B200 },
-    { 150, B150 },
-    { 134, B134 },
-    { 110, B110 },
-    { 75, B75 },
-    { 50, B50 },
-    { 0,  B0 }};
-
   int arg_val = xatou(arg, &err);
   if(err)
     goto ERR;
@@ -69,6 +96,28 @@ ERR:
   errx(EXIT_FAILURE, "unrecognized speed");
 }
 
+unsigned int negotiated_baud(const char *arg)
+{
+  int err;
+
+  unsigned int arg_val = xatou(arg, &err);
+  if(err || arg_val == 0 || arg_val > MAX_NEGOTIATED_BAUD)
+    errx(EXIT_FAILURE, "unrecognized speed");
+
+  return arg_val;
+}
+
+int baud_rate(speed_t speed)
+{
+  const struct baud_entry *b;
+
+  for(b = bauds; b->intval ; b++)
+    if(b->baud == speed)
+      return b->intval;
+
+  return 0;
+}
+
 static void wait_firmware(int fd)
 {
   /* The firmware will simply send the ready byte when he is ready.
@@ -104,16 +153,54 @@ static void wait_firmware(int fd)
   if(read(fd, &ready, 1) != 1)
     errx(EXIT_FAILURE, "cannot read the waiting byte");
 
-  /* Check the value of the ready byte. */
-  if(ready != READY_BYTE)
+  /* Check the value of the ready byte. It also
+     tells us which version of the protocol to use. */
+  switch(ready) {
+  case(READY_BYTE):
+    prot_set_version(1);
+    break;
+  case(READY_BYTE_V2):
+    prot_set_version(2);
+    break;
+  default:
     errx(EXIT_FAILURE, "invalid ready byte");
+  }
+}
+
+/* Connect to wsn-radiod which holds the serial line for us. */
+static int connect_radiod(const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  int fd;
+
+  if(strlen(path) >= sizeof(addr.sun_path))
+    errx(EXIT_FAILURE, "socket path too long");
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    err(EXIT_FAILURE, "cannot create socket");
+
+  if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    err(EXIT_FAILURE, "cannot connect to '%s'", path);
+
+  return fd;
 }
 
 int open_uart(const char *path, speed_t speed)
 {
   struct termios options = { 0 };
+  struct stat st;
   int fd;
 
+  /* The daemon is already connected to the firmware so we do not have to
+     wait for the line to settle. It sends the ready byte immediately. */
+  if(!stat(path, &st) && S_ISSOCK(st.st_mode)) {
+    fd = connect_radiod(path);
+    wait_firmware(fd);
+    return fd;
+  }
+
   fd = open(path, O_RDWR | O_NOCTTY);
 
   if(fd < 0)
@@ -152,3 +239,205 @@ int open_uart(const char *path, speed_t speed)
 
   return fd;
 }
+
+static void set_speed(int fd, unsigned int rate)
+{
+  const struct baud_entry *b;
+  struct termios options;
+
+  for(b = bauds; b->intval ; b++)
+    if(b->intval == rate)
+      break;
+
+  /* Use the standard interface when possible. */
+  if(b->intval) {
+    if(tcgetattr(fd, &options) < 0)
+      err(EXIT_FAILURE, "cannot get tty attributes");
+
+    cfsetspeed(&options, b->baud);
+
+    if(tcsetattr(fd, TCSANOW, &options) < 0)
+      err(EXIT_FAILURE, "cannot set tty attributes");
+  }
+  else if(set_custom_speed(fd, rate) < 0)
+    err(EXIT_FAILURE, "cannot set speed to %u", rate);
+}
+
+/* Type of the last answer received during the negotiation. */
+static int negotiate_reply;
+
+static bool negotiate_cb(const unsigned char *message,
+                         enum prot_mtype type,
+                         size_t size)
+{
+  /* Frames that were on their way are dropped. */
+  if(type != PROT_MTYPE_CONTROL || size == 0)
+    return true;
+
+  /* A refusal is an answer too. The common control messages would exit on
+     errors so they only see the other types. */
+  switch(message[0]) {
+  case(PROT_CTYPE_OK):
+  case(PROT_CTYPE_CLI_ERROR):
+  case(PROT_CTYPE_SRV_ERROR):
+    negotiate_reply = message[0];
+    return false;
+  default:
+    prot_preparse_control(message, size);
+    return true;
+  }
+}
+
+static uint64_t now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Read one byte unless the deadline is reached. */
+static bool read_byte(int fd, unsigned char *c, uint64_t deadline)
+{
+  fd_set rfds;
+
+  while(1) {
+    uint64_t t = now_ms();
+    struct timeval tv;
+    int ret;
+
+    if(t >= deadline)
+      return false;
+
+    tv.tv_sec  = (deadline - t) / 1000;
+    tv.tv_usec = (deadline - t) % 1000 * 1000;
+
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+
+    ret = select(fd + 1, &rfds, NULL, NULL, &tv);
+    if(ret < 0) {
+      if(errno == EINTR)
+        continue;
+      err(EXIT_FAILURE, "cannot select");
+    }
+    else if(!ret)
+      return false;
+
+    switch(read(fd, c, 1)) {
+    case(1):
+      return true;
+    case(0):
+      errx(EXIT_FAILURE, "end of file on input");
+    default:
+      if(errno == EINTR || errno == EAGAIN)
+        continue;
+      err(EXIT_FAILURE, "cannot read");
+    }
+  }
+}
+
+/* Read and parse the next message or packet. Unlike the input loop we never
+   read ahead so that the caller starts on a message boundary. This matters
+   with the version 1 of the protocol which cannot synchronize again. */
+static bool read_message(int fd, uint64_t deadline)
+{
+  unsigned char buf[MAX_ENCODED_PACKET_SIZE];
+  unsigned int i, size;
+
+  if(prot_get_version() == 2) {
+    for(size = 0 ; size < sizeof(buf) ; size++) {
+      if(!read_byte(fd, buf + size, deadline))
+        return false;
+      if(buf[size] == SLIP_END)
+        break;
+    }
+
+    /* Consecutive END bytes are empty packets. */
+    if(size)
+      prot_parse_packet(buf, size, negotiate_cb);
+
+    return true;
+  }
+
+  if(!read_byte(fd, buf, deadline))
+    return false;
+
+  size = buf[0] & 0x7f;
+  for(i = 1 ; i <= size ; i++)
+    if(!read_byte(fd, buf + i, deadline))
+      return false;
+
+  negotiate_cb(buf + 1, buf[0] & 0x80, size);
+
+  return true;
+}
+
+static void send_baud(int fd, unsigned int rate)
+{
+  unsigned char message[5];
+
+  message[0] = PROT_CTYPE_CONFIG_BAUD;
+  message[1] = rate;
+  message[2] = rate >> 8;
+  message[3] = rate >> 16;
+  message[4] = rate >> 24;
+
+  prot_write(fd, PROT_MTYPE_CONTROL, message, sizeof(message));
+}
+
+/* Wait for the answer of the firmware and return its control type
+   or -1 on timeout. */
+static int wait_reply(int fd)
+{
+  uint64_t deadline = now_ms() + NEGOTIATE_TIMEOUT * 1000;
+
+  negotiate_reply = -1;
+  while(negotiate_reply < 0 && read_message(fd, deadline));
+
+  return negotiate_reply;
+}
+
+bool uart_is_radiod(int fd)
+{
+  struct stat st;
+
+  return !fstat(fd, &st) && S_ISSOCK(st.st_mode);
+}
+
+bool negotiate_baud(int fd, unsigned int rate)
+{
+  unsigned int previous;
+
+  /* The speed of the line is up to the daemon. */
+  if(uart_is_radiod(fd))
+    return false;
+
+  if(get_custom_speed(fd, &previous) < 0)
+    err(EXIT_FAILURE, "cannot get tty speed");
+
+  /* The firmware answers the request at the new speed. So we switch as soon
+     as the request has been transmitted. The firmware also waits for its own
+     messages to be transmitted before switching so nothing is lost. */
+  send_baud(fd, rate);
+  tcdrain(fd);
+  set_speed(fd, rate);
+
+  /* The answer proves that the firmware to host direction works.
+     The confirmation proves that the other direction works too. */
+  if(wait_reply(fd) == PROT_CTYPE_OK) {
+    send_baud(fd, rate);
+    if(wait_reply(fd) == PROT_CTYPE_OK)
+      return true;
+  }
+
+  /* Without confirmation the firmware falls back to the previous speed by
+     itself. We wait until it has done so and discard what we received in
+     between. */
+  set_speed(fd, previous);
+  sleep(BAUD_CONFIRM_TIMEOUT);
+  tcflush(fd, TCIOFLUSH);
+
+  return false;
+}
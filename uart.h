@@ -19,14 +19,35 @@
 #define _UART_H_
 
 #include <sys/types.h>
+#include <stdbool.h>
 #include <termios.h>
 
+/* Highest speed that may be negotiated with the firmware. */
+#define MAX_NEGOTIATED_BAUD 4000000
+
 /* Open and setup the serial line and return a file descriptor to the serial
    line. The line will be left untouched if the speed is B0. Otherwise it will
-   use a default configuration for the line (8N1). */
+   use a default configuration for the line (8N1). When the path is a UNIX
+   socket we connect to wsn-radiod instead and the speed is ignored. */
 int open_uart(const char *path, speed_t speed);
 
+/* True when the file descriptor is a connection to wsn-radiod. */
+bool uart_is_radiod(int fd);
+
 /* Convert a string to a serial speed. */
 speed_t baud(const char *arg);
 
+/* Convert a string to a speed in bits per second which may be negotiated. */
+unsigned int negotiated_baud(const char *arg);
+
+/* Convert a serial speed to bits per second or zero if unknown. */
+int baud_rate(speed_t speed);
+
+/* Negotiate a new speed with the firmware after the ready byte using the
+   CONFIG_BAUD control message. The speed does not need a Bxxx constant. On
+   failure both sides fall back to the previous speed and false is returned.
+   This should be called before any other message is sent. This always fails
+   with wsn-radiod which negotiates the speed itself. */
+bool negotiate_baud(int fd, unsigned int rate);
+
 #endif /* _UART_H_ */
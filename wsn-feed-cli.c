@@ -0,0 +1,287 @@
+/* File: wsn-feed-cli.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+
+#include "version.h"
+#include "pcap-write.h"
+#include "dump.h"
+#include "help.h"
+#include "xatoi.h"
+#include "signal-utils.h"
+#include "mac-decode.h"
+#include "mac-display.h"
+#include "lowpan-decode.h"
+#include "lowpan-display.h"
+#include "shm-feed.h"
+
+#define TARGET "Feed-CLI"
+
+#define POLL_INTERVAL 1 /* milliseconds */
+
+static bool payload;
+static unsigned int mac_info;
+static shm_feed_t feed;
+static unsigned long received;
+static unsigned long lost;
+
+static void parse_frame(const struct shm_feed_frame *frame)
+{
+  struct mac_frame mac;
+  struct lowpan_packet packet;
+  bool truncated = frame->size < frame->length;
+
+  received++;
+
+  /* The feed contains the frames exactly as the sniffer received them. */
+  pcap_write_truncated_frame(frame->data, frame->size, frame->length,
+                             &frame->tv);
+
+  if(!mac_info && !payload)
+    return;
+
+  if(shm_feed_decode(frame, &mac) < 0) {
+    free_mac_frame(&mac);
+    warnx("cannot decode frame");
+    return;
+  }
+
+  if(truncated) {
+    mac_display(&mac, mac_info & ~MI_FCS);
+    if(mac_info)
+      printf(" Truncated     : %u of %u bytes\n", frame->size, frame->length);
+  }
+  else
+    mac_display(&mac, mac_info);
+
+  /* Anything else than 6LoWPAN is just dumped. */
+  if(payload && lowpan_decode(&packet, &mac) == 0) {
+    lowpan_display(&packet);
+
+    if(packet.size) {
+      printf("Payload:\n");
+      hex_dump((const unsigned char *)mac.payload + packet.offset,
+               packet.size);
+    }
+  }
+  else if(payload && mac.payload) {
+    printf("Payload:\n");
+    hex_dump(mac.payload, mac.size);
+  }
+
+  putchar('\n');
+
+  free_mac_frame(&mac);
+}
+
+static void cleanup(void)
+{
+  fprintf(stderr, "%lu frames read, %lu lost\n", received, lost);
+
+  close_writing_pcap();
+
+  if(feed)
+    shm_feed_close(feed);
+}
+
+static void sig_cleanup(int signum)
+{
+  exit(EXIT_SUCCESS);
+}
+
+static void sig_flush(int signum)
+{
+  pcap_write_flush();
+}
+
+int main(int argc, char *argv[])
+{
+  const char *name;
+  const char *pcap = NULL;
+  bool append = false;
+  unsigned int interval = POLL_INTERVAL;
+  struct timespec pause;
+  int err;
+
+  int exit_status = EXIT_FAILURE;
+
+  name = (const char *)strrchr(argv[0], '/');
+  name = name ? (name + 1) : argv[0];
+
+  enum opt {
+    OPT_COMMIT = 0x100,
+    OPT_APPEND
+  };
+
+  struct opt_help helps[] = {
+    { 'h', "help", "Show this help message" },
+    { 'V', "version", "Print version information" },
+#ifdef COMMIT
+    { 0, "commit", "Display commit information" },
+#endif /* COMMIT */
+    { 'i', "interval", "Poll interval in milliseconds when idle" },
+    { 'p', "pcap", "Save packets in the specified PCAP file (- for stdout)" },
+    { 'w', "flush", "Flush the PCAP every N frames, delay (ms) or adaptive" },
+    { 'y', "sync", "Sync the PCAP to disk every N seconds (s), MB (M) or dsync" },
+    { 0, "append", "Append to the PCAP file instead of replacing it" },
+    { 'c', "show-control", "Display frame control information" },
+    { 's', "show-seqno", "Display sequence number" },
+    { 'a', "show-addr", "Display addresses fields" },
+    { 'S', "show-security", "Display security auxiliary field" },
+    { 'M', "show-mac", "Display all informations about MAC frames" },
+    { 'P', "show-payload", "Try to decode and display the payload" },
+    { 'F', "show-fcs", "Display the frame check sequence" },
+    { 'A', "show-all", "Display all informations" },
+    { 0, NULL, NULL }
+  };
+
+  struct option opts[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "version", no_argument, NULL, 'V' },
+#ifdef COMMIT
+    { "commit", no_argument, NULL, OPT_COMMIT },
+#endif /* COMMIT */
+    { "interval", required_argument, NULL, 'i' },
+    { "pcap", required_argument, NULL, 'p' },
+    { "flush", required_argument, NULL, 'w' },
+    { "sync", required_argument, NULL, 'y' },
+    { "append", no_argument, NULL, OPT_APPEND },
+    { "show-control", no_argument, NULL, 'c' },
+    { "show-seqno", no_argument, NULL, 's' },
+    { "show-addr", no_argument, NULL, 'a' },
+    { "show-security", no_argument, NULL, 'S' },
+    { "show-mac", no_argument, NULL, 'M' },
+    { "show-fcs", no_argument, NULL, 'F' },
+    { "show-payload", no_argument, NULL, 'P' },
+    { "show-all", no_argument, NULL, 'A' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while(1) {
+    int c = getopt_long(argc, argv, "hVi:p:w:y:csaSMFPA", opts, NULL);
+
+    if(c == -1)
+      break;
+
+    switch(c) {
+    case('i'):
+      interval = xatou(optarg, &err);
+      if(err || interval == 0)
+        errx(EXIT_FAILURE, "invalid poll interval");
+      break;
+    case('p'):
+      pcap = optarg;
+      break;
+    case('w'):
+      pcap_write_flush_policy(optarg);
+      break;
+    case('y'):
+      pcap_write_sync_policy(optarg);
+      break;
+    case(OPT_APPEND):
+      append = true;
+      break;
+    case('c'):
+      mac_info |= MI_CONTROL;
+      break;
+    case('s'):
+      mac_info |= MI_SEQNO;
+      break;
+    case('a'):
+      mac_info |= MI_ADDR;
+      break;
+    case('S'):
+      mac_info |= MI_SECURITY;
+      break;
+    case('M'):
+      mac_info = MI_ALL;
+      break;
+    case('F'):
+      mac_info |= MI_FCS;
+      break;
+    case('P'):
+      payload = true;
+      break;
+    case('A'):
+      mac_info = MI_ALL;
+      payload  = true;
+      break;
+#ifdef COMMIT
+    case(OPT_COMMIT):
+      commit();
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+#endif /* COMMIT */
+    case('V'):
+      version(TARGET);
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+    case('h'):
+      exit_status = EXIT_SUCCESS;
+    default:
+      help(name, "[OPTIONS] ... FEED", helps);
+      goto EXIT;
+    }
+  }
+
+  if((argc - optind) != 1)
+    errx(EXIT_FAILURE, "except feed name");
+
+  if(pcap && append)
+    open_appending_pcap(pcap);
+  else if(pcap)
+    open_writing_pcap(pcap);
+
+  feed = shm_feed_open(argv[optind]);
+
+  setup_sig(cleanup, sig_cleanup, sig_flush);
+
+  pause.tv_sec  = interval / 1000;
+  pause.tv_nsec = (interval % 1000) * 1000000;
+
+  /* The writer never waits for us so we read as fast as we can and only
+     sleep when the feed is empty. */
+  while(1) {
+    struct shm_feed_frame frame;
+    int n = shm_feed_read(feed, &frame, &lost);
+
+    if(n < 0)
+      break;
+    else if(n == 0) {
+      fflush(stdout);
+      nanosleep(&pause, NULL);
+    }
+    else
+      parse_frame(&frame);
+
+    pcap_write_flush_check();
+  }
+
+  exit_status = EXIT_SUCCESS;
+
+EXIT:
+  return exit_status;
+}
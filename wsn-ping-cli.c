@@ -15,7 +15,7 @@
    You should have received a copy of the GNU General Public License
    along with this program. If not, see <http://www.gnu.org/licenses/>. */
 
-#define _BSD_SOURCE
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,20 +23,22 @@
 #include <stdbool.h>
 #include <sys/time.h>
 #include <sys/types.h>
-#include <sys/wait.h>
+#include <sys/timerfd.h>
 #include <string.h>
 #include <signal.h>
 #include <getopt.h>
 #include <termios.h>
 #include <unistd.h>
-#include <limits.h>
-#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <errno.h>
 #include <err.h>
 
 #include "version.h"
 #include "protocol.h"
 #include "string-utils.h"
 #include "signal-utils.h"
+#include "histogram.h"
 #include "xatoi.h"
 #include "uart.h"
 #include "dump.h"
@@ -46,112 +48,260 @@
 
 #define TARGET "Ping-CLI"
 
-/* The sequence number size may change.
-   The timevalue will always be defined
-   by its structure and the crc will
-   always be 32 bits wide. */
+/* The ping header contains the sequence number and the time at which the
+   ping was sent (monotonic clock in nanoseconds). It is followed by the
+   padding and a 32 bits CRC over the header and the padding. */
 typedef unsigned short seqno_t;
 
-#define PING_HDR_SIZE sizeof(seqno_t) + sizeof(struct timeval)
+#define PING_HDR_SIZE (sizeof(seqno_t) + sizeof(uint64_t))
 #define PING_CRC_SIZE sizeof(uint32_t)
 
-#define MAX_PING_PADDING_SIZE MAX_MESSAGE_SIZE + 1 -              \
-                              (PING_HDR_SIZE + PING_CRC_SIZE + 2)
+#define MAX_PING_PADDING_SIZE (MAX_MESSAGE_SIZE + 1 -                 \
+                               (PING_HDR_SIZE + PING_CRC_SIZE + 2))
 
-/* Statistics */
-static unsigned int error;
-static unsigned int ok;
-static unsigned long long min = ULLONG_MAX;
-static unsigned long long max = 0;
-static unsigned long long sum;
-static unsigned long long sq_sum;
+/* Bytes of a ping message on the line (information and control type bytes,
+   header, padding and CRC). */
+#define PING_LINE_SIZE(size) (2 + PING_HDR_SIZE + (size) + PING_CRC_SIZE)
+
+/* Time after which a ping is considered lost. */
+#define DEFAULT_TIMEOUT 1000 /* ms */
+
+/* Interval at which we check for lost pings. */
+#define TICK_INTERVAL   100  /* ms */
+
+/* Pending pings are tracked in a table indexed by sequence number. It must
+   be a power of two larger than the window. */
+#define PENDING_SIZE    1024
+#define MAX_WINDOW      256
+
+/* Throughput mode. The payload size is increased by SIZE_STEP bytes for each
+   step, up to the maximum padding size. */
+#define DEFAULT_WINDOW  8
+#define DEFAULT_STEP    2    /* s */
+#define SIZE_STEP       16
 
+/* Sweep mode. Number of pings for each size. */
+#define DEFAULT_PER_SIZE 100
+
+enum mode { MODE_INTERVAL,    /* one ping per interval */
+            MODE_FLOOD,       /* send whenever the UART is writable */
+            MODE_ADAPTIVE,    /* send as soon as a reply is received */
+            MODE_THROUGHPUT,  /* keep a window of pings in flight */
+            MODE_SWEEP        /* one ping at a time with increasing sizes */ };
+
+struct pending {
+  uint64_t sent;
+  unsigned int step;
+  seqno_t seqno;
+  bool active;
+};
+
+/* A step of the throughput mode. */
+struct step {
+  unsigned int id;
+  unsigned int size;
+  uint64_t start;
+  unsigned long sent;
+  unsigned long ok;
+  unsigned long error;
+  unsigned long lost;
+  histogram_t rtts;
+};
+
+/* Statistics */
+static unsigned long sent;
+static unsigned long ok;
+static unsigned long error;
+static unsigned long lost;
+static unsigned long late;
+static histogram_t rtts;          /* since the beginning */
+static histogram_t interval_rtts; /* since the last export */
+
+static struct pending pendings[PENDING_SIZE];
+static unsigned int inflight;
+static uint64_t timeout = DEFAULT_TIMEOUT * 1000000ULL;
+
+static struct step step;
+
+/* Least squares fit of the RTT against the bytes on the line. */
+struct fit {
+  double n;
+  double x, y;
+  double xx, xy, yy;
+};
+
+static struct fit fit;
+
+static enum mode mode = MODE_INTERVAL;
+static FILE *export;
 static bool flood;
-static int count  = -1;
-static pid_t pid;
+static long count = -1;
 static int fd;
 
-static void apply_crc(const unsigned char *sbuf, size_t size)
+static uint64_t now(void)
 {
-  unsigned long crc;
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static const char * ns_to_str(uint64_t ns)
+{
+  struct timeval tv;
+
+  tv.tv_sec  = ns / 1000000000;
+  tv.tv_usec = (ns % 1000000000) / 1000;
+
+  return tv_to_str(&tv);
+}
 
-  crc = crc32_c(sbuf, size, 0);
+static void apply_crc(unsigned char *buf, size_t size)
+{
+  uint32_t crc = crc32_c(buf, size, 0);
 
-  *((unsigned long *)(sbuf + size)) = crc;
+  memcpy(buf + size, &crc, sizeof(crc));
 }
 
 static bool check_crc(const unsigned char *buf, size_t size)
 {
-  uint32_t read_crc = *((unsigned long *)(buf + size));
-  uint32_t comp_crc;
+  uint32_t read_crc;
+
+  memcpy(&read_crc, buf + size, sizeof(read_crc));
+
+  return read_crc == crc32_c(buf, size, 0);
+}
+
+static void lose_ping(struct pending *p)
+{
+  p->active = false;
+  inflight--;
+  lost++;
+
+  if(p->step == step.id)
+    step.lost++;
+}
+
+static void send_ping(unsigned char *message, unsigned int size)
+{
+  static seqno_t seqno;
+  struct pending *p = &pendings[seqno % PENDING_SIZE];
+  uint64_t t = now();
 
-  comp_crc = crc32_c(buf, size, 0);
+  /* The message starts with the control type. */
+  memcpy(message + 1, &seqno, sizeof(seqno_t));
+  memcpy(message + 1 + sizeof(seqno_t), &t, sizeof(uint64_t));
+  apply_crc(message + 1, PING_HDR_SIZE + size);
 
-  return read_crc == comp_crc;
+  prot_write(fd, PROT_MTYPE_CONTROL, message,
+             1 + PING_HDR_SIZE + size + PING_CRC_SIZE);
+
+  if(flood)
+    write_slit(STDOUT_FILENO, ".");
+
+  /* This happens when we send faster than the timeout. */
+  if(p->active)
+    lose_ping(p);
+
+  p->active = true;
+  p->seqno  = seqno;
+  p->sent   = t;
+  p->step   = step.id;
+  inflight++;
+
+  seqno++;
+  sent++;
+  step.sent++;
 }
 
-static void print_ping(const struct timeval *delta,
+/* Consider the pings without reply as lost after the timeout. */
+static void expire_pings(void)
+{
+  uint64_t t = now();
+  int i;
+
+  for(i = 0 ; i < PENDING_SIZE ; i++)
+    if(pendings[i].active && t - pendings[i].sent >= timeout)
+      lose_ping(&pendings[i]);
+}
+
+static void print_ping(uint64_t rtt,
                        unsigned int size,
                        seqno_t seqno,
                        const char *flood_status,
                        char status)
 {
+  if(mode == MODE_THROUGHPUT || mode == MODE_SWEEP)
+    return;
+
   if(flood)
     write(STDOUT_FILENO, flood_status, strlen(flood_status));
   else {
     printf("(%c) %d bytes: ping_req=%d time=%s\n", status, size, seqno,
-           tv_to_str(delta));
+           ns_to_str(rtt));
   }
 }
 
-static const char * time_ull_to_str(unsigned long long time)
-{
-  struct timeval tv;
-
-  tv.tv_sec  = time / 1000000;
-  tv.tv_usec = time % 1000000;
-
-  return tv_to_str(&tv);
-}
-
-#define tv_to_ull(tv) (tv)->tv_usec + 1000000 * (tv)->tv_sec
-
 static void parse_ping_message(const unsigned char *data, size_t size)
 {
-  struct timeval t_now, t_sent;
-  struct timeval delta;
-
+  uint64_t t_now = now();
+  struct pending *p;
+  bool current;
   seqno_t seqno;
-  unsigned long long time;
+  uint64_t rtt;
 
-  gettimeofday(&t_now, NULL);        /* time received */
+  if(size < PING_HDR_SIZE + PING_CRC_SIZE) {
+    error++;
+    print_ping(0, size + 2, 0, "\bE", 'E');
+    return;
+  }
 
-  if(count != -1)
-    count--;
+  /* Extract the PING header and find the matching request. */
+  memcpy(&seqno, data, sizeof(seqno_t));
+
+  p = &pendings[seqno % PENDING_SIZE];
+  if(!p->active || p->seqno != seqno) {
+    /* The reply came after the timeout. */
+    late++;
+    return;
+  }
 
-  /* Extract the PING header */
-  seqno  = *((seqno_t *)data);
-  t_sent = *((struct timeval *)(data + sizeof(seqno_t)));
+  p->active = false;
+  inflight--;
 
-  timersub(&t_now, &t_sent, &delta); /* rtt */
+  rtt     = t_now - p->sent;
+  current = p->step == step.id;
 
   /* Check CRC */
   if(!check_crc(data, size - PING_CRC_SIZE)) {
     error++;
-    print_ping(&delta, size + 2, seqno, "\bE", 'E');
+    if(current)
+      step.error++;
+    print_ping(rtt, size + 2, seqno, "\bE", 'E');
     return;
   }
 
   /* register statistics */
-  time = tv_to_ull(&delta);
-  if(time < min)
-    min = time;
-  if(time > max)
-    max = time;
-  sum    += time;
-  sq_sum += time*time;
-
-  print_ping(&delta, size + 2, seqno, "\b", '*');
+  histogram_add(rtts, rtt);
+  if(interval_rtts)
+    histogram_add(interval_rtts, rtt);
+  if(current && step.rtts) {
+    histogram_add(step.rtts, rtt);
+    step.ok++;
+  }
+  if(current && mode == MODE_SWEEP) {
+    double x = PING_LINE_SIZE(step.size), y = rtt;
+
+    fit.n++;
+    fit.x  += x;
+    fit.y  += y;
+    fit.xx += x * x;
+    fit.xy += x * y;
+    fit.yy += y * y;
+  }
+
+  print_ping(rtt, size + 2, seqno, "\b", '*');
   ok++;
 }
 
@@ -195,58 +345,222 @@ static bool message_cb(const unsigned char *data,
     exit(EXIT_FAILURE);
   }
 
-  if(count != -1 && !count)
-    return false;
   return true;
 }
 
+static void start_step(unsigned int size)
+{
+  step.id++;
+  step.size  = size;
+  step.start = now();
+  step.sent  = step.ok = step.error = step.lost = 0;
+
+  histogram_reset(step.rtts);
+}
+
+/* Report a step of the throughput mode. The goodput counts the bytes of the
+   valid replies. The queueing delay is estimated as the average RTT above
+   the minimal RTT of the step. */
+static void report_step(void)
+{
+  double duration = (now() - step.start) / 1e9;
+  double avg  = histogram_mean(step.rtts) / 1000.;
+  double base = histogram_min(step.rtts) / 1000.;
+
+  printf("%4u %8lu %8lu %6lu %6lu %9.1f %10.0f %9.1f %9.1f %9.1f\n",
+         step.size, step.sent, step.ok, step.error, step.lost,
+         step.ok / duration,
+         step.ok * PING_LINE_SIZE(step.size) / duration,
+         avg, histogram_percentile(step.rtts, 99) / 1000.,
+         step.ok ? avg - base : 0.);
+  fflush(stdout);
+}
+
+/* Report the RTT distribution of a size in the sweep mode. */
+static void report_sweep_step(void)
+{
+  printf("%4u %5u %6lu %6lu %6lu %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+         step.size, (unsigned int)PING_LINE_SIZE(step.size),
+         step.ok, step.error, step.lost,
+         histogram_min(step.rtts) / 1000.,
+         histogram_percentile(step.rtts, 50) / 1000.,
+         histogram_percentile(step.rtts, 99) / 1000.,
+         histogram_mean(step.rtts) / 1000.,
+         histogram_stddev(step.rtts) / 1000.);
+  fflush(stdout);
+}
+
+/* Fit the RTT as a + b * bytes where the bytes are those of the request which
+   are echoed by the firmware. So the slope accounts for both directions. With
+   8N1 each byte takes ten bits on the line. */
+static void report_sweep(int rate)
+{
+  double det = fit.n * fit.xx - fit.x * fit.x;
+  double a, b, r2, var_y;
+
+  if(fit.n < 2 || det == 0) {
+    printf("\nnot enough samples to fit the model\n");
+    return;
+  }
+
+  b = (fit.n * fit.xy - fit.x * fit.y) / det;
+  a = (fit.y - b * fit.x) / fit.n;
+
+  var_y = fit.n * fit.yy - fit.y * fit.y;
+  r2    = var_y > 0 ? (b * (fit.n * fit.xy - fit.x * fit.y)) / var_y : 1.;
+
+  printf("\nrtt = %.1f us + %.3f us/byte (r2=%.3f)\n", a / 1000., b / 1000., r2);
+  printf("per-message overhead: %.1f us\n", a / 1000.);
+
+  if(b > 0)
+    printf("effective rate: %.0f bytes/s\n", 2e9 / b);
+
+  if(rate) {
+    double theoretical = rate / 10.;
+
+    printf("theoretical rate at %d baud: %.0f bytes/s (%.3f us/byte round trip)",
+           rate, theoretical, 2e6 / theoretical);
+    if(b > 0)
+      printf(", efficiency %.1f%%", 100. * (2e9 / b) / theoretical);
+    putchar('\n');
+  }
+  else
+    printf("no baud rate configured, cannot compare with the theoretical rate\n");
+}
+
+/* Export the histogram with a summary line. The values are in nanoseconds. */
+static void export_histogram(histogram_t h, const char *label)
+{
+  fprintf(export, "# %s time=%ld count=%llu min=%llu p50=%llu p90=%llu "
+          "p99=%llu p99.9=%llu max=%llu\n", label, (long)time(NULL),
+          (unsigned long long)histogram_count(h),
+          (unsigned long long)histogram_min(h),
+          (unsigned long long)histogram_percentile(h, 50),
+          (unsigned long long)histogram_percentile(h, 90),
+          (unsigned long long)histogram_percentile(h, 99),
+          (unsigned long long)histogram_percentile(h, 99.9),
+          (unsigned long long)histogram_max(h));
+  histogram_export(h, export);
+  fputc('\n', export);
+  fflush(export);
+}
+
+static void display_statistics(void)
+{
+  struct prot_stats stats;
+  unsigned long received = ok + error;
+  double pct_error = 0;
+
+  printf("\n--- ping statistics ---\n");
+
+  if(received > 0)
+    pct_error = (100. * error) / received;
+
+  /* The pings still in flight are lost. */
+  printf("%lu sent, %lu ok, %lu errors, %lu lost, %.1f%% erroneous\n",
+         sent, ok, error, lost + inflight, pct_error);
+
+  if(late)
+    printf("%lu replies received after the timeout\n", late);
+
+  prot_get_stats(&stats);
+  if(stats.crc_errors || stats.framing_errors)
+    printf("%lu packets dropped (%lu CRC errors, %lu framing errors)\n",
+           stats.crc_errors + stats.framing_errors,
+           stats.crc_errors, stats.framing_errors);
+
+  if(ok > 0) {
+    /* The static buffer of tv_to_str() forces us to split the lines. */
+    printf("rtt min/avg/max/mdev = %s /", ns_to_str(histogram_min(rtts)));
+    printf(" %s /", ns_to_str(histogram_mean(rtts)));
+    printf(" %s /", ns_to_str(histogram_max(rtts)));
+    printf(" %s\n", ns_to_str(histogram_stddev(rtts)));
+
+    printf("rtt p50/p90/p99/p99.9 = %s /",
+           ns_to_str(histogram_percentile(rtts, 50)));
+    printf(" %s /", ns_to_str(histogram_percentile(rtts, 90)));
+    printf(" %s /", ns_to_str(histogram_percentile(rtts, 99)));
+    printf(" %s\n", ns_to_str(histogram_percentile(rtts, 99.9)));
+  }
+}
+
 static void cleanup(void)
 {
   /* At least we have to close the file descriptor.
      So the firmware could reset the next time we
      open it. */
-  if(pid) {
-    close(fd);
+  close(fd);
+
+  display_statistics();
+
+  if(export) {
+    export_histogram(rtts, "total");
+    fclose(export);
   }
-  /* If we are the child however we will display
-     statistics if the flood option isn't set. */
-  else if(!flood) {
-    unsigned int pct_ok = 0;
-    printf("\n--- ping statistics ---\n");
+}
 
-    if(ok > 0)
-      pct_ok = (100 * error) / ok;
+static void sig_cleanup(int signum)
+{
+  exit(EXIT_SUCCESS);
+}
 
-    printf("%d ok, %d errors, %d%% erroneous\n", ok, error, pct_ok);
+static int create_timer(void)
+{
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
 
-    if(ok > 0) {
-      unsigned long long avg  = sum / ok;
-      unsigned long long mdev = sq_sum / ok - avg * avg;
+  if(timer < 0)
+    err(EXIT_FAILURE, "cannot create timer");
 
-      /* We don't care about the fractional part, we are already
-         computing this with microsecond precision anyway. */
-      mdev = sqrt(mdev);
+  return timer;
+}
 
-      printf("rtt min/avg/max/mdev =  %s /", time_ull_to_str(min));
-      printf(" %s /", time_ull_to_str(avg));
-      printf(" %s /", time_ull_to_str(max));
-      printf(" %s\n", time_ull_to_str(mdev));
-    }
-  }
+/* Arm a timer. It is periodic unless the interval is zero. */
+static void set_timer(int timer, uint64_t value, uint64_t interval)
+{
+  struct itimerspec its = {
+    .it_value    = { .tv_sec = value / 1000000000,
+                     .tv_nsec = value % 1000000000 },
+    .it_interval = { .tv_sec = interval / 1000000000,
+                     .tv_nsec = interval % 1000000000 }
+  };
+
+  if(timerfd_settime(timer, 0, &its, NULL) < 0)
+    err(EXIT_FAILURE, "cannot set timer");
 }
 
-static void sig_cleanup(int signum)
+/* Return the number of expirations of a timer. */
+static uint64_t read_timer(int timer)
 {
-  exit(EXIT_SUCCESS);
+  uint64_t expirations;
+
+  if(read(timer, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+    if(errno == EAGAIN || errno == EINTR)
+      return 0;
+    err(EXIT_FAILURE, "cannot read timer");
+  }
+
+  return expirations;
 }
 
 int main(int argc, char *argv[])
 {
   const char *name;
   const char *tty = NULL;
+  const char *export_path = NULL;
   speed_t speed = B0;
-  int interval  = 1000000;
-  int size      = 64;
+  unsigned int negotiate = 0;
+  uint64_t interval = 1000000000;
+  uint64_t step_duration = DEFAULT_STEP * 1000000000ULL;
+  uint64_t linger_end = 0;
+  unsigned int export_interval = 0;
+  uint64_t last_sent = 0;
+  unsigned int window = 0;
+  unsigned int per_size = DEFAULT_PER_SIZE;
+  unsigned char message[MAX_MESSAGE_SIZE];
+  bool lingering = false;
+  bool interval_set = false;
+  int size = 64;
+  int ping_timer, tick_timer, export_timer = -1;
   int err_v;
 
   int exit_status = EXIT_FAILURE;
@@ -265,10 +579,21 @@ int main(int argc, char *argv[])
     { 0, "commit", "Display commit information" },
 #endif /* COMMIT */
     { 'b', "baud", "Specify the baud rate" },
-    { 's', "size", "Number of data bytes to be send (max: 118)" },
+    { 'B', "negotiate", "Negotiate a higher baud rate with the firmware" },
+    { 's', "size", "Number of data bytes to be send (max: 112)" },
     { 'c', "count", "Stop after sending count messages" },
     { 'f', "flood", "Use a period/backspace display for the messages sent" },
     { 'i', "interval", "Wait interval milliseconds between each message" },
+    { 'A', "adaptive", "Send a message as soon as the previous reply arrives" },
+    { 'W', "timeout", "Time to wait for a reply in milliseconds (default: 1000)" },
+    { 't', "throughput", "Measure the throughput with increasing sizes" },
+    { 'w', "window", "Pings in flight in throughput (default: 8) "
+                     "and adaptive (default: 1) modes" },
+    { 'd', "step", "Duration of each size in seconds (default: 2)" },
+    { 'S', "sweep", "Fit the RTT against the size of the messages" },
+    { 'n', "per-size", "Messages for each size in sweep mode (default: 100)" },
+    { 'e', "export", "Export the RTT histogram (ns) into a file" },
+    { 'E', "export-interval", "Also export the histogram every N seconds" },
     { 0, NULL, NULL }
   };
 
@@ -279,25 +604,35 @@ int main(int argc, char *argv[])
     { "commit", no_argument, NULL, OPT_COMMIT },
 #endif /* COMMIT */
     { "baud", required_argument, NULL, 'b' },
+    { "negotiate", required_argument, NULL, 'B' },
     { "size", required_argument, NULL, 's' },
     { "adaptive", no_argument, NULL, 'A' },
     { "count", required_argument, NULL, 'c' },
     { "flood", no_argument, NULL, 'f' },
     { "interval", required_argument, NULL, 'i' },
+    { "timeout", required_argument, NULL, 'W' },
+    { "throughput", no_argument, NULL, 't' },
+    { "window", required_argument, NULL, 'w' },
+    { "step", required_argument, NULL, 'd' },
+    { "sweep", no_argument, NULL, 'S' },
+    { "per-size", required_argument, NULL, 'n' },
+    { "export", required_argument, NULL, 'e' },
+    { "export-interval", required_argument, NULL, 'E' },
     { NULL, 0, NULL, 0 }
   };
 
   while(1) {
-    int c = getopt_long(argc, argv, "hVb:s:Ac:fi:", opts, NULL);
+    int c = getopt_long(argc, argv, "hVb:B:s:Ac:fi:W:tw:d:Sn:e:E:", opts, NULL);
 
     if(c == -1)
       break;
 
     switch(c) {
     case('i'):
-      interval = xatou(optarg, &err_v) * 1000;
-      if(err)
+      interval = xatou(optarg, &err_v) * 1000000ULL;
+      if(err_v)
         errx(EXIT_FAILURE, "invalid interval value");
+      interval_set = true;
       break;
     case('c'):
       count = xatou(optarg, &err_v);
@@ -313,9 +648,50 @@ int main(int argc, char *argv[])
       flood = true;
       interval = 0;
       break;
+    case('W'):
+      timeout = xatou(optarg, &err_v) * 1000000ULL;
+      if(err_v || timeout == 0)
+        errx(EXIT_FAILURE, "invalid timeout value");
+      break;
+    case('t'):
+      mode = MODE_THROUGHPUT;
+      break;
+    case('A'):
+      if(mode != MODE_THROUGHPUT && mode != MODE_SWEEP)
+        mode = MODE_ADAPTIVE;
+      break;
+    case('S'):
+      mode = MODE_SWEEP;
+      break;
+    case('n'):
+      per_size = xatou(optarg, &err_v);
+      if(err_v || per_size == 0)
+        errx(EXIT_FAILURE, "invalid number of messages per size");
+      break;
+    case('w'):
+      window = xatou(optarg, &err_v);
+      if(err_v || window == 0 || window > MAX_WINDOW)
+        errx(EXIT_FAILURE, "window must be between 1 and %d", MAX_WINDOW);
+      break;
+    case('d'):
+      step_duration = xatou(optarg, &err_v) * 1000000000ULL;
+      if(err_v || step_duration == 0)
+        errx(EXIT_FAILURE, "invalid step duration");
+      break;
     case('b'):
       speed = baud(optarg);
       break;
+    case('B'):
+      negotiate = negotiated_baud(optarg);
+      break;
+    case('e'):
+      export_path = optarg;
+      break;
+    case('E'):
+      export_interval = xatou(optarg, &err_v);
+      if(err_v || export_interval == 0)
+        errx(EXIT_FAILURE, "invalid export interval");
+      break;
 #ifdef COMMIT
     case(OPT_COMMIT):
       commit();
@@ -339,6 +715,50 @@ int main(int argc, char *argv[])
 
   tty = argv[optind];
 
+  if(export_interval && !export_path)
+    errx(EXIT_FAILURE, "the export interval requires an export file");
+
+  switch(mode) {
+  case(MODE_THROUGHPUT):
+    flood = false;
+    if(!window)
+      window = DEFAULT_WINDOW;
+    break;
+  case(MODE_SWEEP):
+    /* One ping at a time so that we do not measure the queueing delay. */
+    flood = false;
+    window = 1;
+    break;
+  case(MODE_ADAPTIVE):
+    /* The interval is only a lower bound between two messages. */
+    if(!interval_set)
+      interval = 0;
+    if(!window)
+      window = 1;
+    break;
+  default:
+    if(!interval)
+      mode = MODE_FLOOD;
+    break;
+  }
+
+  rtts = histogram_create();
+
+  if(export_path) {
+    export = fopen(export_path, "w");
+    if(!export)
+      err(EXIT_FAILURE, "cannot open export file");
+  }
+
+  /* That's where we really start the operations */
+  fd = open_uart(tty, speed);
+
+  /* Switch to a faster speed before anything else is sent. */
+  if(negotiate && !negotiate_baud(fd, negotiate)) {
+    warnx("cannot negotiate %u bauds", negotiate);
+    negotiate = 0;
+  }
+
    /* Register the cleanup function as the most common way to leave the event
      loop is SIGINT. The program may also quit because of an error or the
      SIGTERM signal. So we need to register an exit hook and signals too. A
@@ -346,64 +766,169 @@ int main(int argc, char *argv[])
      the cleanup functions themselves. */
   setup_sig(cleanup, sig_cleanup, NULL);
 
-  /* That's where we really start the operations */
-  fd = open_uart(tty, speed);
+  /* We setup the message. Only the header and the CRC change between pings.
+     The padding is filled with random bytes. */
+  message[0] = PROT_CTYPE_PING;
+  fill_with_random(message + 1 + PING_HDR_SIZE, MAX_PING_PADDING_SIZE);
 
-  /* We divide the ping process in two. The parent sends pings and the child
-     receives and displays the responses. We proceed that way to ensure that we
-     use the same mechanisms (in particular the read buffer) that are used in
-     others clients in order to flow the steam in the pipes. */
-  pid = fork();
-  if(pid < 0)
-    err(EXIT_FAILURE, "cannot fork");
-  else if(pid) { /* parent */
-    seqno_t seqno = 0;
-    unsigned char sbuf[128];
+  /* The pings are sent on a timer so the interval does not drift with the
+     time spent processing replies. In flood mode we send whenever the UART
+     can accept more data. */
+  ping_timer = create_timer();
+  if(mode == MODE_INTERVAL)
+    set_timer(ping_timer, interval, interval);
 
-    /* We setup the send buffer. Note that we construct the ping message manually.
-       We do this to avoid copying the message at each ping we want to send. */
-    sbuf[0] = PROT_MTYPE_CONTROL | (size + PING_HDR_SIZE + PING_CRC_SIZE + 1);
+  tick_timer = create_timer();
+  set_timer(tick_timer, TICK_INTERVAL * 1000000ULL, TICK_INTERVAL * 1000000ULL);
 
-    /* Control message type. */
-    sbuf[1] = PROT_CTYPE_PING;
+  if(export_interval) {
+    uint64_t ns = export_interval * 1000000000ULL;
 
-    /* We fill the message with random bytes. */
-    fill_with_random(sbuf + 2 /* mtype + ctype */ + PING_HDR_SIZE, size);
+    interval_rtts = histogram_create();
+    export_timer  = create_timer();
+    set_timer(export_timer, ns, ns);
+  }
 
-    while(1) {
-      struct timeval tv;
+  if(mode == MODE_THROUGHPUT) {
+    step.rtts = histogram_create();
+    start_step(0);
 
-      usleep(interval);
+    printf("%4s %8s %8s %6s %6s %9s %10s %9s %9s %9s\n", "size", "sent", "ok",
+           "errors", "lost", "msg/s", "goodput", "rtt-avg", "rtt-p99",
+           "queueing");
+    printf("%4s %8s %8s %6s %6s %9s %10s %9s %9s %9s\n", "(B)", "", "", "", "",
+           "", "(B/s)", "(us)", "(us)", "(us)");
+  }
+  else if(mode == MODE_SWEEP) {
+    step.rtts = histogram_create();
+    start_step(0);
+
+    printf("%4s %5s %6s %6s %6s %9s %9s %9s %9s %9s\n", "size", "line", "ok",
+           "errors", "lost", "rtt-min", "rtt-p50", "rtt-p99", "rtt-avg",
+           "rtt-mdev");
+    printf("%4s %5s %6s %6s %6s %9s %9s %9s %9s %9s\n", "(B)", "(B)", "", "", "",
+           "(us)", "(us)", "(us)", "(us)", "(us)");
+  }
 
-      /* Create the ping template */
-      gettimeofday(&tv, NULL);
+  while(1) {
+    struct pollfd pfds[] = {
+      { .fd = fd, .events = POLLIN },
+      { .fd = ping_timer, .events = POLLIN },
+      { .fd = tick_timer, .events = POLLIN },
+      { .fd = export_timer, .events = POLLIN }
+    };
+    int ret;
+
+    if(mode == MODE_FLOOD && !lingering)
+      pfds[0].events |= POLLOUT;
+
+    ret = poll(pfds, export_timer < 0 ? 3 : 4, -1);
+    if(ret < 0) {
+      if(errno == EINTR)
+        continue;
+      err(EXIT_FAILURE, "cannot poll");
+    }
 
-      /* The ping header and apply the CRC */
-      *((seqno_t *)(sbuf + 2)) = seqno;
-      *((struct timeval *)(sbuf + 2 + sizeof(seqno_t))) = tv;
-      apply_crc(sbuf + 2, size + PING_HDR_SIZE);
+    if(pfds[0].revents & POLLIN)
+      input_read(fd, message_cb);
+
+    if(pfds[2].revents & POLLIN) {
+      read_timer(tick_timer);
+      expire_pings();
+
+      /* Move to the next size when the step is over. */
+      if(mode == MODE_THROUGHPUT && !lingering &&
+         now() - step.start >= step_duration) {
+        report_step();
+
+        if(step.size == MAX_PING_PADDING_SIZE)
+          count = sent;
+        else if(step.size + SIZE_STEP > MAX_PING_PADDING_SIZE)
+          start_step(MAX_PING_PADDING_SIZE);
+        else
+          start_step(step.size + SIZE_STEP);
+      }
+    }
 
-      /* Send this message */
-      write(fd, sbuf, size + 2 + PING_HDR_SIZE + PING_CRC_SIZE);
+    if(export_timer >= 0 && pfds[3].revents & POLLIN) {
+      read_timer(export_timer);
+      export_histogram(interval_rtts, "interval");
+      histogram_reset(interval_rtts);
+    }
 
-      /* Stdout if needed */
-      if(flood)
-        write_slit(STDOUT_FILENO, ".");
+    if(lingering) {
+      /* We are done when all the replies were received or on timeout. */
+      if(!inflight || now() >= linger_end)
+        break;
+      continue;
+    }
 
-      seqno++;
-      count--;
+    /* Send the pings that are due. */
+    switch(mode) {
+    case(MODE_INTERVAL):
+      /* We do not catch up on the missed intervals. */
+      if(pfds[1].revents & POLLIN && read_timer(ping_timer))
+        send_ping(message, size);
+      break;
+    case(MODE_FLOOD):
+      if(pfds[0].revents & POLLOUT)
+        send_ping(message, size);
+      break;
+    case(MODE_THROUGHPUT):
+      while(inflight < window)
+        send_ping(message, step.size);
+      break;
+    case(MODE_ADAPTIVE):
+      /* A slot in the window is freed by a reply or when a ping times out.
+         The timer only enforces the minimal interval. */
+      if(pfds[1].revents & POLLIN)
+        read_timer(ping_timer);
+
+      while(inflight < window && (count == -1 || sent < (unsigned long)count)) {
+        uint64_t t = now();
+
+        if(t - last_sent < interval) {
+          set_timer(ping_timer, interval - (t - last_sent), 0);
+          break;
+        }
+
+        send_ping(message, size);
+        last_sent = t;
+      }
+      break;
+    case(MODE_SWEEP):
+      if(inflight)
+        break;
 
-      if(count != -1 && !count)
+      if(step.sent < per_size) {
+        send_ping(message, step.size);
         break;
+      }
+
+      /* All the pings of this size were answered or lost. */
+      report_sweep_step();
+
+      if(step.size == MAX_PING_PADDING_SIZE)
+        count = sent;
+      else if(step.size + SIZE_STEP > MAX_PING_PADDING_SIZE)
+        start_step(MAX_PING_PADDING_SIZE);
+      else
+        start_step(step.size + SIZE_STEP);
+
+      if(count == -1)
+        send_ping(message, step.size);
+      break;
     }
 
-    /* Wait for our child. */
-    wait(NULL);
-  }
-  else { /* child */
-    input_loop(fd, message_cb, NULL, 0);
+    if(count != -1 && sent >= (unsigned long)count) {
+      lingering  = true;
+      linger_end = now() + timeout;
+    }
   }
 
+  if(mode == MODE_SWEEP)
+    report_sweep(negotiate ? (int)negotiate : baud_rate(speed));
+
   exit_status = EXIT_SUCCESS;
 
 EXIT:
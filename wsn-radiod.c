@@ -0,0 +1,796 @@
+/* File: wsn-radiod.c
+
+   Copyright (C) 2018 David Hauweele <david@hauweele.net>
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program. If not, see <http://www.gnu.org/licenses/>. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <termios.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+
+#include "version.h"
+#include "help.h"
+#include "uart.h"
+#include "input.h"
+#include "protocol.h"
+#include "signal-utils.h"
+
+#define TARGET "Radio-Daemon"
+
+#define MAX_CLIENTS        32
+#define CLIENT_BUFFER_SIZE 65536 /* frames waiting for each client */
+#define MAX_QUEUED         64    /* requests waiting for each client */
+#define MAX_PIPELINE       16    /* requests of a client sent at once */
+#define REPLY_TIMEOUT      1000  /* milliseconds */
+
+struct client {
+  int fd;
+  bool subscribed;
+  bool skip_frame;      /* the timestamp of the next frame was dropped */
+  unsigned int queued;  /* requests in the TX queue */
+  unsigned long dropped;
+
+  unsigned char in[2 * (MAX_MESSAGE_SIZE + 1)];
+  unsigned int in_size;
+
+  unsigned char *out;
+  size_t out_head;
+  size_t out_size;
+};
+
+/* Request of a client waiting for its turn. The message starts with its
+   information byte as on the line. */
+struct request {
+  struct client *client;
+  unsigned char message[MAX_MESSAGE_SIZE + 1];
+  struct request *next;
+};
+
+/* Request sent to the firmware whose answer is expected. When the request
+   has no answer, a ping follows it. Its echo is the marker which tells that
+   the firmware is done with the request. Until then the errors are for the
+   client. The client is NULL once it is gone. */
+struct pending {
+  struct client *client;
+  enum prot_ctype expect;
+  bool marker;
+  bool exclusive;
+  bool expired;   /* swallows the late answer */
+  uint64_t deadline;
+};
+
+static struct client clients[MAX_CLIENTS];
+static unsigned int nb_clients;
+
+static struct request *queue_head;
+static struct request *queue_tail;
+
+static struct pending pipeline[MAX_PIPELINE];
+static unsigned int pipeline_head;
+static unsigned int pipeline_size;
+
+static const char *socket_path;
+static int uart_fd = -1;
+static int listen_fd = -1;
+
+static struct stats {
+  unsigned long clients;
+  unsigned long frames;
+  unsigned long requests;
+  unsigned long timeouts;
+  unsigned long unexpected;
+  unsigned long dropped;
+} stats;
+
+static uint64_t now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Append bytes to the output buffer of a client. They are written from the
+   event loop. Return false when the buffer is full. */
+static bool client_put(struct client *c, const unsigned char *data,
+                       size_t size)
+{
+  if(c->out_size + size > CLIENT_BUFFER_SIZE)
+    return false;
+
+  if(c->out_head + c->out_size + size > CLIENT_BUFFER_SIZE) {
+    memmove(c->out, c->out + c->out_head, c->out_size);
+    c->out_head = 0;
+  }
+
+  memcpy(c->out + c->out_head + c->out_size, data, size);
+  c->out_size += size;
+
+  return true;
+}
+
+/* Send a message to a client using the version 1 of the protocol. A message
+   is dropped when the client does not read fast enough. */
+static bool client_send(struct client *c, enum prot_mtype type,
+                        const unsigned char *message, size_t size)
+{
+  unsigned char buf[MAX_MESSAGE_SIZE + 1];
+
+  buf[0] = type | size;
+  memcpy(buf + 1, message, size);
+
+  if(!client_put(c, buf, size + 1)) {
+    c->dropped++;
+    stats.dropped++;
+    return false;
+  }
+
+  return true;
+}
+
+static void client_error(struct client *c)
+{
+  unsigned char error = PROT_CTYPE_CLI_ERROR;
+
+  client_send(c, PROT_MTYPE_CONTROL, &error, sizeof(error));
+}
+
+static void client_flush(struct client *c)
+{
+  ssize_t n;
+
+  if(!c->out_size)
+    return;
+
+  n = send(c->fd, c->out + c->out_head, c->out_size, MSG_NOSIGNAL);
+  if(n < 0) {
+    /* A client which is gone is noticed when reading. */
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+       errno == EPIPE || errno == ECONNRESET)
+      return;
+    err(EXIT_FAILURE, "cannot write to client");
+  }
+
+  c->out_head += n;
+  c->out_size -= n;
+
+  if(!c->out_size)
+    c->out_head = 0;
+}
+
+static void accept_client(void)
+{
+  unsigned char ready = READY_BYTE;
+  struct client *c;
+  int fd;
+
+  fd = accept(listen_fd, NULL, NULL);
+  if(fd < 0) {
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+       errno == ECONNABORTED)
+      return;
+    err(EXIT_FAILURE, "cannot accept client");
+  }
+
+  if(nb_clients == MAX_CLIENTS) {
+    warnx("too many clients");
+    close(fd);
+    return;
+  }
+
+  for(c = clients ; c->fd >= 0 ; c++);
+
+  memset(c, 0, sizeof(struct client));
+  c->fd  = fd;
+  c->out = malloc(CLIENT_BUFFER_SIZE);
+  if(!c->out)
+    errx(EXIT_FAILURE, "out of memory");
+
+  if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+    err(EXIT_FAILURE, "cannot configure client");
+
+  nb_clients++;
+  stats.clients++;
+
+  /* The firmware is already up so the client may start at once. */
+  client_put(c, &ready, sizeof(ready));
+  client_flush(c);
+}
+
+static void close_client(struct client *c)
+{
+  struct request *r, *prev = NULL, *next;
+  unsigned int i;
+
+  /* Forget the requests that were not sent yet. */
+  for(r = queue_head ; r ; r = next) {
+    next = r->next;
+
+    if(r->client != c) {
+      prev = r;
+      continue;
+    }
+
+    if(prev)
+      prev->next = next;
+    else
+      queue_head = next;
+    if(queue_tail == r)
+      queue_tail = prev;
+
+    free(r);
+  }
+
+  /* The answers to those already sent are dropped. */
+  for(i = 0 ; i < pipeline_size ; i++) {
+    struct pending *p = &pipeline[(pipeline_head + i) % MAX_PIPELINE];
+    if(p->client == c)
+      p->client = NULL;
+  }
+
+  if(c->dropped)
+    warnx("%lu messages dropped for a slow client", c->dropped);
+
+  close(c->fd);
+  free(c->out);
+
+  c->fd = -1;
+  nb_clients--;
+}
+
+static void enqueue_request(struct client *c, const unsigned char *message)
+{
+  struct request *r = malloc(sizeof(struct request));
+
+  if(!r)
+    errx(EXIT_FAILURE, "out of memory");
+
+  r->client = c;
+  r->next   = NULL;
+  memcpy(r->message, message, (message[0] & 0x7f) + 1);
+
+  if(queue_tail)
+    queue_tail->next = r;
+  else
+    queue_head = r;
+  queue_tail = r;
+
+  c->queued++;
+}
+
+/* Some messages are for the daemon itself. The others are queued. */
+static void parse_client_message(struct client *c, const unsigned char *message)
+{
+  unsigned int size = message[0] & 0x7f;
+
+  if(message[0] & PROT_MTYPE_CONTROL && size) {
+    switch(message[1]) {
+    case(PROT_CTYPE_SUBSCRIBE):
+      c->subscribed = true;
+      return;
+    case(PROT_CTYPE_CONFIG_BAUD):
+      /* The speed of the line is shared by all the clients. */
+      client_error(c);
+      return;
+    default:
+      break;
+    }
+  }
+
+  enqueue_request(c, message);
+}
+
+/* Return false when the client is gone. */
+static bool read_client(struct client *c)
+{
+  unsigned char *p;
+  ssize_t n;
+
+  n = read(c->fd, c->in + c->in_size, sizeof(c->in) - c->in_size);
+  if(n < 0) {
+    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return true;
+    if(errno == ECONNRESET)
+      return false;
+    err(EXIT_FAILURE, "cannot read from client");
+  }
+  else if(n == 0)
+    return false;
+
+  c->in_size += n;
+
+  /* The socket is reliable so the information byte is enough. */
+  for(p = c->in ; p < c->in + c->in_size ; p += (p[0] & 0x7f) + 1) {
+    if(p + (p[0] & 0x7f) + 1 > c->in + c->in_size)
+      break;
+    parse_client_message(c, p);
+  }
+
+  c->in_size -= p - c->in;
+  memmove(c->in, p, c->in_size);
+
+  return true;
+}
+
+/* Answers that we can route on their type. The frames that requested an
+   acknowledgment are alone in the pipeline since the ACK may come late. */
+static void classify(const unsigned char *message, struct pending *p)
+{
+  unsigned int size = message[0] & 0x7f;
+
+  p->marker    = false;
+  p->exclusive = false;
+
+  if(!(message[0] & PROT_MTYPE_CONTROL)) {
+    if(size >= 1 && message[1] & 0x20 /* ACK request */) {
+      p->expect    = PROT_CTYPE_ACK;
+      p->exclusive = true;
+    }
+    else
+      p->expect = PROT_CTYPE_OK;
+    return;
+  }
+
+  switch(size ? message[1] : PROT_CTYPE_INFO) {
+  case(PROT_CTYPE_PING):
+  case(PROT_CTYPE_STATS):
+  case(PROT_CTYPE_CONFIG_TIMESTAMP):
+    p->expect = message[1];
+    break;
+  default:
+    p->expect = PROT_CTYPE_PING;
+    p->marker = true;
+    break;
+  }
+}
+
+/* Append a message to those sent at once to the firmware. */
+static void tx_message(unsigned char *buf, size_t *size,
+                       const unsigned char *message)
+{
+  size_t n = (message[0] & 0x7f) + 1;
+
+  if(*size + n > MAX_MESSAGE_SIZE + 1) {
+    prot_write_messages(uart_fd, buf, *size);
+    *size = 0;
+  }
+
+  memcpy(buf + *size, message, n);
+  *size += n;
+}
+
+/* Send the requests of the queue to the firmware. Requests of the same
+   client are pipelined. Those of another client wait until the firmware
+   answered all of them so that we know where the answers go. The requests
+   sent together are written at once so that the firmware does not receive
+   frames between a request and its marker. */
+static void dispatch(void)
+{
+  static const unsigned char marker[] = { PROT_MTYPE_CONTROL | 1,
+                                          PROT_CTYPE_PING };
+  unsigned char buf[MAX_MESSAGE_SIZE + 1];
+  size_t size = 0;
+
+  while(queue_head && pipeline_size < MAX_PIPELINE) {
+    struct request *r = queue_head;
+    struct pending *p, *last;
+
+    p    = &pipeline[(pipeline_head + pipeline_size) % MAX_PIPELINE];
+    last = &pipeline[(pipeline_head + pipeline_size - 1) % MAX_PIPELINE];
+
+    classify(r->message, p);
+
+    if(pipeline_size &&
+       (last->client != r->client || last->exclusive || p->exclusive))
+      break;
+
+    tx_message(buf, &size, r->message);
+    if(p->marker)
+      tx_message(buf, &size, marker);
+
+    p->client   = r->client;
+    p->expired  = false;
+    p->deadline = now_ms() + REPLY_TIMEOUT;
+    pipeline_size++;
+    stats.requests++;
+
+    r->client->queued--;
+    queue_head = r->next;
+    if(!queue_head)
+      queue_tail = NULL;
+    free(r);
+  }
+
+  if(size)
+    prot_write_messages(uart_fd, buf, size);
+}
+
+static void pop_pending(void)
+{
+  pipeline_head = (pipeline_head + 1) % MAX_PIPELINE;
+  pipeline_size--;
+}
+
+/* The firmware does not answer anymore. We give up on the oldest request.
+   Its answer may still come late so the request stays in the pipeline for
+   another timeout, only to swallow this answer. Otherwise it would go to the
+   client of the next request. */
+static void check_timeout(void)
+{
+  struct pending *p = &pipeline[pipeline_head];
+
+  if(!pipeline_size || now_ms() < p->deadline)
+    return;
+
+  if(p->expired) {
+    pop_pending();
+    return;
+  }
+
+  warnx("no answer from the firmware");
+  stats.timeouts++;
+
+  p->client   = NULL;
+  p->expired  = true;
+  p->deadline = now_ms() + REPLY_TIMEOUT;
+}
+
+/* Frames and what comes with them go to the subscribers. A frame whose
+   timestamp was dropped is dropped too. */
+static void fan_out(const unsigned char *message, enum prot_mtype type,
+                    size_t size)
+{
+  bool timestamp = type == PROT_MTYPE_CONTROL &&
+                   message[0] == PROT_CTYPE_TIMESTAMP;
+  struct client *c;
+
+  for(c = clients ; c < clients + MAX_CLIENTS ; c++) {
+    if(c->fd < 0 || !c->subscribed)
+      continue;
+
+    if(timestamp) {
+      c->skip_frame = CLIENT_BUFFER_SIZE - c->out_size <
+                      size + MAX_MESSAGE_SIZE + 2;
+      if(!c->skip_frame)
+        client_send(c, type, message, size);
+      else {
+        c->dropped++;
+        stats.dropped++;
+      }
+      continue;
+    }
+
+    if(c->skip_frame) {
+      c->skip_frame = false;
+      c->dropped++;
+      stats.dropped++;
+      continue;
+    }
+
+    client_send(c, type, message, size);
+  }
+}
+
+static bool uart_cb(const unsigned char *message, enum prot_mtype type,
+                    size_t size)
+{
+  struct pending *p;
+  struct client *c;
+
+  if(size == 0)
+    return true;
+
+  if(type == PROT_MTYPE_FRAME) {
+    stats.frames++;
+    fan_out(message, type, size);
+    return true;
+  }
+
+  switch(message[0]) {
+  case(PROT_CTYPE_TRUNCATED_FRAME):
+    stats.frames++;
+  case(PROT_CTYPE_TIMESTAMP):
+    fan_out(message, type, size);
+    return true;
+  case(PROT_CTYPE_INFO):
+  case(PROT_CTYPE_DEBUG):
+    for(c = clients ; c < clients + MAX_CLIENTS ; c++)
+      if(c->fd >= 0)
+        client_send(c, type, message, size);
+    return true;
+  default:
+    break;
+  }
+
+  /* Everything else is the answer to a request. */
+  if(!pipeline_size) {
+    stats.unexpected++;
+    return true;
+  }
+
+  p = &pipeline[pipeline_head];
+
+  if(p->marker && message[0] == PROT_CTYPE_PING) {
+    pop_pending();
+    return true;
+  }
+
+  if(p->client)
+    client_send(p->client, type, message, size);
+
+  /* The marker still follows an error. */
+  if(message[0] == p->expect ||
+     (!p->marker && (message[0] == PROT_CTYPE_CLI_ERROR ||
+                     message[0] == PROT_CTYPE_SRV_ERROR)))
+    pop_pending();
+
+  return true;
+}
+
+/* A previous instance may have left its socket behind. We only remove it
+   when nobody listens on it anymore. Anything else is left untouched. */
+static void remove_stale_socket(const struct sockaddr_un *addr)
+{
+  struct stat st;
+  int fd;
+
+  if(lstat(addr->sun_path, &st) < 0) {
+    if(errno == ENOENT)
+      return;
+    err(EXIT_FAILURE, "cannot stat '%s'", addr->sun_path);
+  }
+
+  if(!S_ISSOCK(st.st_mode))
+    errx(EXIT_FAILURE, "'%s' exists and is not a socket", addr->sun_path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    err(EXIT_FAILURE, "cannot create socket");
+
+  if(!connect(fd, (const struct sockaddr *)addr, sizeof(*addr)))
+    errx(EXIT_FAILURE, "another daemon listens on '%s'", addr->sun_path);
+  if(errno != ECONNREFUSED)
+    err(EXIT_FAILURE, "cannot connect to '%s'", addr->sun_path);
+
+  close(fd);
+
+  if(unlink(addr->sun_path) < 0)
+    err(EXIT_FAILURE, "cannot remove '%s'", addr->sun_path);
+}
+
+static int open_socket(const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  int fd;
+
+  if(strlen(path) >= sizeof(addr.sun_path))
+    errx(EXIT_FAILURE, "socket path too long");
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0)
+    err(EXIT_FAILURE, "cannot create socket");
+
+  remove_stale_socket(&addr);
+
+  if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    err(EXIT_FAILURE, "cannot bind to '%s'", path);
+
+  if(listen(fd, MAX_CLIENTS) < 0)
+    err(EXIT_FAILURE, "cannot listen on '%s'", path);
+
+  socket_path = path;
+
+  return fd;
+}
+
+static void cleanup(void)
+{
+  struct client *c;
+
+  for(c = clients ; c < clients + MAX_CLIENTS ; c++)
+    if(c->fd >= 0)
+      close_client(c);
+
+  if(listen_fd >= 0) {
+    close(listen_fd);
+    unlink(socket_path);
+  }
+
+  if(uart_fd >= 0)
+    close(uart_fd);
+
+  fprintf(stderr, "Clients   : %lu\n", stats.clients);
+  fprintf(stderr, "Frames    : %lu\n", stats.frames);
+  fprintf(stderr, "Requests  : %lu\n", stats.requests);
+  fprintf(stderr, "Timeouts  : %lu\n", stats.timeouts);
+  fprintf(stderr, "Unexpected: %lu answers\n", stats.unexpected);
+  fprintf(stderr, "Dropped   : %lu messages\n", stats.dropped);
+}
+
+static void sig_cleanup(int signum)
+{
+  exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *name;
+  struct pollfd pfds[MAX_CLIENTS + 2];
+  struct client *poll_clients[MAX_CLIENTS];
+  speed_t speed = B0;
+  unsigned int negotiate = 0;
+  int i;
+
+  int exit_status = EXIT_FAILURE;
+
+  name = (const char *)strrchr(argv[0], '/');
+  name = name ? (name + 1) : argv[0];
+
+  for(i = 0 ; i < MAX_CLIENTS ; i++)
+    clients[i].fd = -1;
+
+  enum opt {
+    OPT_COMMIT = 0x100
+  };
+
+  struct opt_help helps[] = {
+    { 'h', "help", "Show this help message" },
+    { 'V', "version", "Print version information" },
+#ifdef COMMIT
+    { 0, "commit", "Display commit information" },
+#endif /* COMMIT */
+    { 'b', "baud", "Specify the baud rate" },
+    { 'B', "negotiate", "Negotiate a higher baud rate with the firmware" },
+    { 0, NULL, NULL }
+  };
+
+  struct option opts[] = {
+    { "help", no_argument, NULL, 'h' },
+    { "version", no_argument, NULL, 'V' },
+#ifdef COMMIT
+    { "commit", no_argument, NULL, OPT_COMMIT },
+#endif /* COMMIT */
+    { "baud", required_argument, NULL, 'b' },
+    { "negotiate", required_argument, NULL, 'B' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  while(1) {
+    int c = getopt_long(argc, argv, "hVb:B:", opts, NULL);
+
+    if(c == -1)
+      break;
+
+    switch(c) {
+    case('b'):
+      speed = baud(optarg);
+      break;
+    case('B'):
+      negotiate = negotiated_baud(optarg);
+      break;
+#ifdef COMMIT
+    case(OPT_COMMIT):
+      commit();
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+#endif /* COMMIT */
+    case('V'):
+      version(TARGET);
+      exit_status = EXIT_SUCCESS;
+      goto EXIT;
+    case('h'):
+      exit_status = EXIT_SUCCESS;
+    default:
+      help(name, "[OPTIONS] ... TTY SOCKET", helps);
+      goto EXIT;
+    }
+  }
+
+  if((argc - optind) != 2)
+    errx(EXIT_FAILURE, "except tty device and socket path");
+
+  setup_sig(cleanup, sig_cleanup, NULL);
+
+  /* We hold the line for the clients. So they do not have to wait for
+     the firmware each time they start. */
+  uart_fd = open_uart(argv[optind], speed);
+  if(uart_is_radiod(uart_fd))
+    errx(EXIT_FAILURE, "the tty device is another daemon");
+
+  if(negotiate && !negotiate_baud(uart_fd, negotiate))
+    warnx("cannot negotiate %u bauds", negotiate);
+
+  listen_fd = open_socket(argv[optind + 1]);
+
+  while(1) {
+    uint64_t t;
+    int nfds = 2, timeout = -1;
+
+    pfds[0] = (struct pollfd){ .fd = uart_fd, .events = POLLIN };
+    pfds[1] = (struct pollfd){ .fd = listen_fd, .events = POLLIN };
+
+    for(i = 0 ; i < MAX_CLIENTS ; i++) {
+      struct client *c = &clients[i];
+
+      if(c->fd < 0)
+        continue;
+
+      /* A client which is far ahead waits for its requests to be sent. */
+      pfds[nfds].fd     = c->fd;
+      pfds[nfds].events = 0;
+      if(c->queued < MAX_QUEUED)
+        pfds[nfds].events |= POLLIN;
+      if(c->out_size)
+        pfds[nfds].events |= POLLOUT;
+
+      poll_clients[nfds - 2] = c;
+      nfds++;
+    }
+
+    if(pipeline_size) {
+      t = now_ms();
+      timeout = pipeline[pipeline_head].deadline > t ?
+                pipeline[pipeline_head].deadline - t : 0;
+    }
+
+    if(poll(pfds, nfds, timeout) < 0) {
+      if(errno == EINTR)
+        continue;
+      err(EXIT_FAILURE, "cannot poll");
+    }
+
+    if(pfds[0].revents & (POLLIN | POLLHUP | POLLERR))
+      input_read(uart_fd, uart_cb);
+
+    for(i = 2 ; i < nfds ; i++) {
+      struct client *c = poll_clients[i - 2];
+
+      if(pfds[i].revents & (POLLIN | POLLHUP | POLLERR) && !read_client(c))
+        close_client(c);
+    }
+
+    if(pfds[1].revents & POLLIN)
+      accept_client();
+
+    check_timeout();
+    dispatch();
+
+    /* The answers and frames of this round are written at once. */
+    for(i = 0 ; i < MAX_CLIENTS ; i++)
+      if(clients[i].fd >= 0)
+        client_flush(&clients[i]);
+  }
+
+EXIT:
+  return exit_status;
+}
@@ -17,9 +17,11 @@
 
 #define _POSIX_SOURCE
 
+#include <sys/time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <getopt.h>
 #include <string.h>
 #include <signal.h>
@@ -28,6 +30,7 @@
 #include <err.h>
 
 #include "version.h"
+#include "pcap.h"
 #include "pcap-write.h"
 #include "dump.h"
 #include "help.h"
@@ -40,22 +43,160 @@
 #include "mac-decode.h"
 #include "mac-display.h"
 #include "802154-parse.h"
+#include "clock-model.h"
+#include "shm-feed.h"
+#include "mac-security.h"
+#include "lowpan-decode.h"
+#include "lowpan-display.h"
+#include "lowpan-flows.h"
+#include "lowpan-reasm.h"
 
 #define TARGET "Sniffer-CLI"
 
+/* Number of frames after which the weight of a sample in the clock model is
+   divided by e. This is a trade-off between the jitter and the drift. */
+#define CLOCK_WINDOW 16384
+
+/* Default time spent on each channel when hopping in milliseconds. */
+#define HOP_DWELL 200
+
+/* First byte of the pings which follow a channel switch. */
+#define HOP_MARKER 'H'
+
 static bool payload;
+static bool raw;
+static bool has_keys;
 static unsigned int mac_info;
 /* static unsigned int payload_info; */
 
 static prot_mqueue_t mqueue;
 static int fd;
+static shm_feed_t feed;
+static lowpan_flows_t flows;
+static lowpan_reasm_t reasm;
+static pcap_writer_t reasm_pcap;
+
+/* Map the firmware timestamps to the host clock. The timestamp
+   received before a frame is kept until the frame arrives. */
+static clock_model_t clock_model;
+static uint32_t tick;
+static bool has_tick;
+
+/* Counters of the firmware at the first and last poll along with the number
+   of frames that we received at the same time. */
+static uint32_t stats_first[NB_PROT_COUNTERS];
+static uint32_t stats_last[NB_PROT_COUNTERS];
+static unsigned int nb_counters;
+static unsigned long received;
+static unsigned long received_first;
+static unsigned long received_last;
+
+/* Number of flows for which the datagrams are counted. */
+#define FLOWS_CAPACITY 4096
+
+/* Limits of the fragment reassembly. RFC 4944
+   recommends at most 60 seconds for the timeout. */
+#define REASM_TIMEOUT       60000000 /* us */
+#define REASM_MEMORY        1048576  /* bytes */
+#define REASM_SOURCE_MEMORY 65536    /* bytes */
+#define REASM_EXPIRE_PERIOD 1000     /* ms */
+
+/* Channel hopping. The schedule is the weight of each channel, that is the
+   number of dwells spent on it. Frames are tagged with the channel on which
+   the firmware was when it received them. */
+static unsigned int hop_weights[NB_CHANNELS];
+static unsigned int hop_dwell = HOP_DWELL;
+static unsigned int hop_next;
+static int hop_channel = -1;
+static uint64_t hop_since;
+static uint64_t hop_sent[NB_CHANNELS];
+static uint64_t hop_latency;
+static unsigned long nb_hops;
+
+static struct channel_stats {
+  unsigned long frames;
+  unsigned long bytes;
+  uint64_t dwell; /* microseconds */
+} channel_stats[NB_CHANNELS];
+
+/* Append the frame to the PCAP file and the live feed. */
+static void save_frame(const unsigned char *data,
+                       size_t size,
+                       size_t length,
+                       const struct timeval *tv)
+{
+  pcap_write_truncated_frame(data, size, length, tv);
+
+  if(feed)
+    shm_feed_publish(feed, data, size, length, tv);
+}
 
-static void parse_frame_message(const unsigned char *data, size_t size)
+/* Called by the reassembly for each complete datagram. */
+static void emit_datagram(const struct lowpan_datagram *datagram, void *data)
+{
+  (void)data;
+
+  if(reasm_pcap)
+    pcap_writer_write(reasm_pcap, datagram->data, datagram->size,
+                      &datagram->tv);
+
+  if(payload) {
+    lowpan_display_datagram(datagram);
+    putchar('\n');
+  }
+}
+
+/* Drop the stale datagrams even when no fragment comes in. */
+static void expire_datagrams(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  lowpan_reasm_expire(reasm, &tv);
+}
+
+/* Parse a frame of which only the first size bytes over length were sent. */
+static void parse_frame_message(const unsigned char *data,
+                                size_t size,
+                                size_t length)
 {
   struct mac_frame frame;
+  struct lowpan_packet packet;
+  struct timeval tv;
+  bool truncated = size < length;
+  bool lowpan = false;
+
+  received++;
+
+  if(hop_channel >= 0) {
+    channel_stats[hop_channel].frames++;
+    channel_stats[hop_channel].bytes += length;
+  }
+
+  /* We use the time at which the radio received the frame when we know it.
+     Otherwise this is the time at which we received the frame on UART. */
+  gettimeofday(&tv, NULL);
+  if(has_tick && clock_model)
+    clock_model_convert(clock_model, tick, &tv);
+  has_tick = false;
+
+  /* Every frame is recorded exactly as received, even those that we cannot
+     decode. The header itself may be truncated but this is what the user
+     asked for. */
+  save_frame(data, size, length, &tv);
+
+  /* Nothing else needs the decoded frame. */
+  if(raw)
+    return;
+
+  /* We   except a raw frame so we don't need to renormalize anything.
+     However truncated frames do not end with the FCS. */
+  if(mac_decode(&frame, data, !truncated, size) < 0) {
+    free_mac_frame(&frame);
+
+    if(truncated)
+      return;
 
-  /* We   except a raw frame so we don't need to renormalize anything. */
-  if(mac_decode(&frame, data, true, size) < 0) {
 #ifndef NDEBUG
     hex_dump(data, size);
 #endif /* NDEBUG */
@@ -63,30 +204,198 @@ static void parse_frame_message(const unsigned char *data, size_t size)
 
     /* We do not show invalid frame as most of it
        is probably uninitialized garbage. */
-    free_mac_frame(&frame);
     return;
   }
 
+  /* The status of the frame tells whether it could be authenticated. */
+  if(frame.security && has_keys)
+    mac_unsecure(&frame, data);
+
+  /* Decode the 6LoWPAN headers in place. */
+  if(payload || flows || reasm)
+    lowpan = lowpan_decode(&packet, &frame) == 0;
+
+  if(lowpan && flows)
+    lowpan_flows_add(flows, &packet);
+
   /*  Display the frame live. */
-  mac_display(&frame, mac_info);
+  if(truncated) {
+    mac_display(&frame, mac_info & ~MI_FCS);
+    if(mac_info)
+      printf(" Truncated     : %zu of %zu bytes\n", size, length);
+  }
+  else
+    mac_display(&frame, mac_info);
+
+  if(mac_info && hop_channel >= 0)
+    printf(" Channel       : %d\n", hop_channel);
 
-  /* For now we do not try decode payload.
-     Instead we just dump the packet. */
-  if(payload && frame.payload) {
+  /* Anything else than 6LoWPAN is just dumped. */
+  if(payload && lowpan) {
+    lowpan_display(&packet);
+
+    if(packet.size) {
+      printf("Payload:\n");
+      hex_dump((const unsigned char *)frame.payload + packet.offset,
+               packet.size);
+    }
+  }
+  else if(payload && frame.payload) {
     printf("Payload:\n");
     hex_dump(frame.payload, frame.size);
   }
 
   putchar('\n');
 
-  /* Append the frame to the PCAP file. */
-  pcap_append_frame(data, size);
+  /* The reassembled datagram is displayed after its last fragment. */
+  if(lowpan && reasm && !truncated)
+    lowpan_reasm_push(reasm, &frame, &packet, &tv);
 
   /* FIXME: This particular free call may be spared if we provided a way for
      mac_decode to avoid copying the payload. */
   free_mac_frame(&frame);
 }
 
+static void parse_stats(const unsigned char *data, size_t size)
+{
+  unsigned int i, n = size / 4;
+
+  /* We ignore the counters that we do not know. */
+  if(n > NB_PROT_COUNTERS)
+    n = NB_PROT_COUNTERS;
+
+  for(i = 0 ; i < n ; i++, data += 4)
+    stats_last[i] = data[0] | data[1] << 8 | data[2] << 16 |
+                    (uint32_t)data[3] << 24;
+
+  /* The answer follows the frames forwarded before it. So the
+     number of frames that we received is comparable. */
+  received_last = received;
+
+  if(!nb_counters) {
+    memcpy(stats_first, stats_last, sizeof(stats_first));
+    received_first = received;
+  }
+
+  nb_counters = n;
+}
+
+static void poll_stats(void)
+{
+  unsigned char type = PROT_CTYPE_STATS;
+
+  prot_write(fd, PROT_MTYPE_CONTROL, &type, sizeof(type));
+}
+
+/* Merge the firmware counters with our own between the first and the last
+   poll. This tells where the frames were lost. */
+static void display_stats(void)
+{
+  unsigned long forwarded;
+  unsigned int i;
+
+  fprintf(stderr, "Firmware:\n");
+  for(i = 0 ; i < nb_counters ; i++)
+    fprintf(stderr, "  %-13s : %lu\n", prot_counter_string(i),
+            (unsigned long)(uint32_t)(stats_last[i] - stats_first[i]));
+
+  fprintf(stderr, "Host:\n");
+  fprintf(stderr, "  %-13s : %lu\n", "Received",
+          received_last - received_first);
+
+  if(nb_counters > PROT_COUNTER_FORWARDED) {
+    forwarded = (uint32_t)(stats_last[PROT_COUNTER_FORWARDED] -
+                           stats_first[PROT_COUNTER_FORWARDED]);
+    fprintf(stderr, "  %-13s : %ld\n", "Lost on UART",
+            (long)(forwarded - (received_last - received_first)));
+  }
+}
+
+static uint64_t now_us(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Switch to the next channel of the schedule. We do not wait for the switch
+   to complete. Instead a ping follows the configuration and since the
+   firmware processes the messages in order, the frames that we receive after
+   the answer were heard on the new channel. */
+static void hop(void)
+{
+  unsigned char messages[2 * (2 + sizeof(unsigned short))];
+  unsigned short channel;
+
+  while(!hop_weights[hop_next])
+    hop_next = (hop_next + 1) % NB_CHANNELS;
+
+  channel  = hop_next;
+  hop_next = (hop_next + 1) % NB_CHANNELS;
+
+  /* Both messages are written at once so that the
+     firmware does not receive frames in between. */
+  messages[0] = PROT_MTYPE_CONTROL | (1 + sizeof(unsigned short));
+  messages[1] = PROT_CTYPE_CONFIG_CHANNEL;
+  memcpy(messages + 2, &channel, sizeof(unsigned short));
+
+  messages[4] = PROT_MTYPE_CONTROL | 3;
+  messages[5] = PROT_CTYPE_PING;
+  messages[6] = HOP_MARKER;
+  messages[7] = channel;
+
+  prot_write_messages(fd, messages, sizeof(messages));
+
+  hop_sent[channel] = now_us();
+
+  /* The timer starts now so the dwell overlaps the switch. */
+  input_set_timer(hop_weights[channel] * hop_dwell, hop);
+}
+
+static void parse_hop(unsigned int channel)
+{
+  uint64_t t = now_us();
+
+  if(channel >= NB_CHANNELS || !hop_weights[channel])
+    errx(EXIT_FAILURE, "invalid channel switch");
+
+  if(hop_channel >= 0)
+    channel_stats[hop_channel].dwell += t - hop_since;
+
+  hop_latency += t - hop_sent[channel];
+  nb_hops++;
+
+  hop_channel = channel;
+  hop_since   = t;
+}
+
+/* Activity on each channel of the schedule. */
+static void display_channels(void)
+{
+  unsigned int i;
+
+  if(hop_channel >= 0)
+    channel_stats[hop_channel].dwell += now_us() - hop_since;
+
+  fprintf(stderr, "Channel  Dwell (s)  Frames  Frames/s  Bytes\n");
+  for(i = 0 ; i < NB_CHANNELS ; i++) {
+    const struct channel_stats *c = &channel_stats[i];
+
+    if(!hop_weights[i])
+      continue;
+
+    fprintf(stderr, "%7u  %9.1f  %6lu  %8.1f  %lu\n", i, c->dwell / 1e6,
+            c->frames, c->dwell ? c->frames * 1e6 / c->dwell : 0.,
+            c->bytes);
+  }
+
+  if(nb_hops)
+    fprintf(stderr, "%lu channel switches, %.1f ms per switch\n",
+            nb_hops, hop_latency / 1000. / nb_hops);
+}
+
 static bool message_cb(const unsigned char *data,
                        enum prot_mtype type,
                        size_t size)
@@ -96,9 +405,54 @@ static bool message_cb(const unsigned char *data,
 
   switch(type) {
   case(PROT_MTYPE_FRAME):
-    parse_frame_message(data, size);
+    parse_frame_message(data, size, size);
     break;
   case(PROT_MTYPE_CONTROL):
+    /* Frames truncated by the firmware to the snap length. */
+    if(data[0] == PROT_CTYPE_TRUNCATED_FRAME) {
+      if(size < 3 || data[1] < size - 2)
+        errx(EXIT_FAILURE, "invalid truncated frame");
+      parse_frame_message(data + 2, size - 2, data[1]);
+      break;
+    }
+
+    /* Timestamp of the next frame. */
+    if(data[0] == PROT_CTYPE_TIMESTAMP) {
+      if(size != 1 + TIMESTAMP_SIZE)
+        errx(EXIT_FAILURE, "invalid timestamp");
+      tick = data[1] | data[2] << 8 | data[3] << 16 | (uint32_t)data[4] << 24;
+      has_tick = true;
+      break;
+    }
+
+    /* The firmware confirms the timestamps with the frequency of its clock. */
+    if(data[0] == PROT_CTYPE_CONFIG_TIMESTAMP) {
+      uint32_t hz;
+
+      if(size != 5)
+        errx(EXIT_FAILURE, "invalid timestamp configuration");
+
+      hz = data[1] | data[2] << 8 | data[3] << 16 | (uint32_t)data[4] << 24;
+      if(!hz)
+        errx(EXIT_FAILURE, "invalid firmware clock frequency");
+
+      if(!clock_model)
+        clock_model = clock_model_create(hz, CLOCK_WINDOW);
+      break;
+    }
+
+    /* The firmware switched to the channel of the ping. */
+    if(data[0] == PROT_CTYPE_PING && size == 3 && data[1] == HOP_MARKER) {
+      parse_hop(data[2]);
+      break;
+    }
+
+    /* Answer to our periodic poll. */
+    if(data[0] == PROT_CTYPE_STATS) {
+      parse_stats(data + 1, size - 1);
+      break;
+    }
+
     /* We do not accept any control message for the sniffer.
        Except the common ones. */
     if(!prot_preparse_control(data, size))
@@ -119,12 +473,58 @@ static bool message_cb(const unsigned char *data,
 
 static void cleanup(void)
 {
+  struct prot_stats stats;
+
   /* We have to close the file descriptor too. */
   close(fd);
 
+  /* Corrupted packets are dropped with the version 2 of the protocol. */
+  prot_get_stats(&stats);
+  if(stats.crc_errors || stats.framing_errors)
+    warnx("%lu packets dropped (%lu CRC errors, %lu framing errors)",
+          stats.crc_errors + stats.framing_errors,
+          stats.crc_errors, stats.framing_errors);
+
+  if(nb_counters)
+    display_stats();
+
+  if(nb_hops)
+    display_channels();
+
+  if(flows) {
+    lowpan_flows_display(flows, stderr);
+    lowpan_flows_destroy(flows);
+  }
+
+  if(reasm) {
+    struct lowpan_reasm_stats reasm_stats;
+
+    lowpan_reasm_get_stats(reasm, &reasm_stats);
+    fprintf(stderr, "%lu fragments, %lu datagrams reassembled, "
+            "%lu incomplete, %lu dropped for memory\n",
+            reasm_stats.fragments, reasm_stats.datagrams,
+            reasm_stats.expired + reasm_stats.pending,
+            reasm_stats.evicted + reasm_stats.refused);
+    lowpan_reasm_destroy(reasm);
+  }
+
+  if(reasm_pcap)
+    pcap_writer_close(reasm_pcap);
+
+  if(clock_model) {
+    fprintf(stderr, "firmware clock: %+.1f ppm, %.0f us jitter\n",
+            clock_model_drift(clock_model),
+            clock_model_jitter(clock_model));
+    clock_model_destroy(clock_model);
+  }
+
   /* Ensure that the PCAP file is closed properly to flush buffers. */
   close_writing_pcap();
 
+  /* The readers still attached will drain what is left. */
+  if(feed)
+    shm_feed_close(feed);
+
   /* Destroy the message queue. */
   prot_mqueue_destroy(mqueue);
 }
@@ -144,8 +544,27 @@ int main(int argc, char *argv[])
   const char *name;
   const char *tty  = NULL;
   const char *pcap = NULL;
+  bool append = false;
+  bool reassemble = false;
+  const char *reasm_pcap_name = NULL;
+  const char *feed_name = NULL;
   unsigned short channel;
+  unsigned int nb_channels = 0;
+  bool fixed_channel = false;
+  unsigned char filter[FILTER_SIZE] = { 0 };
+  unsigned char snaplen;
+  unsigned char enable = 1;
+  unsigned int value;
+  unsigned int stats_interval = 0;
+  uint16_t pan;
+  uint64_t addr;
+  unsigned char key[MAC_KEY_SIZE];
+  uint64_t key_source;
+  uint16_t short_addr;
+  uint8_t key_index;
+  int key_mode;
   speed_t speed = B0;
+  unsigned int negotiate = 0;
   int timeout = 0;
   int err;
 
@@ -158,7 +577,12 @@ int main(int argc, char *argv[])
   mqueue = prot_mqueue_creat();
 
   enum opt {
-    OPT_COMMIT = 0x100
+    OPT_COMMIT = 0x100,
+    OPT_APPEND,
+    OPT_DEVICE,
+    OPT_FLOWS,
+    OPT_REASSEMBLE,
+    OPT_REASSEMBLE_PCAP
   };
 
   struct opt_help helps[] = {
@@ -169,8 +593,27 @@ int main(int argc, char *argv[])
 #endif /* COMMIT */
     { 'T', "timeout", "Specify the timeout" },
     { 'C', "channel", "Configure the channel" },
+    { 'H', "hop", "Hop between channels (11-26 or 15:4,20,25)" },
+    { 'D', "dwell", "Time spent on each channel in milliseconds" },
+    { 't', "filter-type", "Only forward these frame types (data,ack,...)" },
+    { 'N', "filter-pan", "Only forward frames from or to this PAN" },
+    { 'f', "filter-addr", "Only forward frames from or to this address" },
+    { 'L', "snaplen", "Only forward the first bytes of the frames" },
+    { 'I', "stats", "Poll the firmware counters every interval seconds" },
+    { 'R', "radio-time", "Timestamp the frames with the firmware clock" },
     { 'b', "baud", "Specify the baud rate" },
-    { 'p', "pcap", "Save packets in the specified PCAP file" },
+    { 'B', "negotiate", "Negotiate a higher baud rate with the firmware" },
+    { 'p', "pcap", "Save packets in the specified PCAP file (- for stdout)" },
+    { 'r', "raw", "Only record the frames without decoding nor displaying them" },
+    { 'w', "flush", "Flush the PCAP every N frames, delay (ms) or adaptive" },
+    { 'y', "sync", "Sync the PCAP to disk every N seconds (s), MB (M) or dsync" },
+    { 0, "append", "Append to the PCAP file instead of replacing it" },
+    { 'm', "shm", "Publish packets to local readers in a shared memory feed" },
+    { 'k', "key", "Unsecure frames with this key ([[SOURCE/]INDEX:]KEY)" },
+    { 0, "device", "Extended address of a short address (SHORT=EXTENDED)" },
+    { 0, "flows", "Count the IPv6 datagrams of each flow and display them on exit" },
+    { 0, "reassemble", "Reassemble the fragmented IPv6 datagrams" },
+    { 0, "reassemble-pcap", "Save the reassembled datagrams in this PCAP file" },
     { 'c', "show-control", "Display frame control information" },
     { 's', "show-seqno", "Display sequence number" },
     { 'a', "show-addr", "Display addresses fields" },
@@ -190,8 +633,27 @@ int main(int argc, char *argv[])
 #endif /* COMMIT */
     { "timeout", required_argument, NULL, 'T'},
     { "channel", required_argument, NULL, 'C' },
+    { "hop", required_argument, NULL, 'H' },
+    { "dwell", required_argument, NULL, 'D' },
+    { "filter-type", required_argument, NULL, 't' },
+    { "filter-pan", required_argument, NULL, 'N' },
+    { "filter-addr", required_argument, NULL, 'f' },
+    { "snaplen", required_argument, NULL, 'L' },
+    { "stats", required_argument, NULL, 'I' },
+    { "radio-time", no_argument, NULL, 'R' },
     { "baud", required_argument, NULL, 'b' },
+    { "negotiate", required_argument, NULL, 'B' },
     { "pcap", required_argument, NULL, 'p' },
+    { "raw", no_argument, NULL, 'r' },
+    { "flush", required_argument, NULL, 'w' },
+    { "sync", required_argument, NULL, 'y' },
+    { "append", no_argument, NULL, OPT_APPEND },
+    { "shm", required_argument, NULL, 'm' },
+    { "key", required_argument, NULL, 'k' },
+    { "device", required_argument, NULL, OPT_DEVICE },
+    { "flows", no_argument, NULL, OPT_FLOWS },
+    { "reassemble", no_argument, NULL, OPT_REASSEMBLE },
+    { "reassemble-pcap", required_argument, NULL, OPT_REASSEMBLE_PCAP },
     { "show-control", no_argument, NULL, 'c' },
     { "show-seqno", no_argument, NULL, 's' },
     { "show-addr", no_argument, NULL, 'a' },
@@ -204,7 +666,7 @@ int main(int argc, char *argv[])
   };
 
   while(1) {
-    int c = getopt_long(argc, argv, "hVp:C:cb:T:saSMFPA", opts, NULL);
+    int c = getopt_long(argc, argv, "hVp:rm:k:w:y:C:H:D:t:N:f:L:I:Rcb:B:T:saSMFPA", opts, NULL);
 
     if(c == -1)
       break;
@@ -213,9 +675,27 @@ int main(int argc, char *argv[])
     case('p'):
       pcap = optarg;
       break;
+    case('r'):
+      raw = true;
+      break;
+    case('w'):
+      pcap_write_flush_policy(optarg);
+      break;
+    case('y'):
+      pcap_write_sync_policy(optarg);
+      break;
+    case(OPT_APPEND):
+      append = true;
+      break;
+    case('m'):
+      feed_name = optarg;
+      break;
     case('b'):
       speed = baud(optarg);
       break;
+    case('B'):
+      negotiate = negotiated_baud(optarg);
+      break;
     case('T'):
       timeout = xatou(optarg, &err);
       if(err || timeout == 0)
@@ -223,11 +703,66 @@ int main(int argc, char *argv[])
       break;
     case('C'):
       channel = parse_channel(optarg);
+      fixed_channel = true;
       prot_mqueue_add_control(mqueue,
                               PROT_CTYPE_CONFIG_CHANNEL,
                               &channel,
                               sizeof(unsigned short));
       break;
+    case('H'):
+      nb_channels = parse_channels(optarg, hop_weights);
+      break;
+    case('D'):
+      hop_dwell = xatou(optarg, &err);
+      if(err || hop_dwell == 0)
+        errx(EXIT_FAILURE, "invalid dwell time");
+      break;
+    case('t'):
+      filter[0] = parse_frame_types(optarg);
+      break;
+    case('N'):
+      pan = parse_pan(optarg);
+      filter[1] |= FILTER_PAN;
+      filter[2]  = pan & 0xff;
+      filter[3]  = pan >> 8;
+      break;
+    case('f'):
+      /* The filter accepts both a short and an extended address. */
+      if(parse_address(optarg, &addr) == MAM_SHORT) {
+        filter[1] |= FILTER_SHORT_ADDR;
+        filter[4]  = addr & 0xff;
+        filter[5]  = addr >> 8;
+      }
+      else {
+        int i;
+
+        filter[1] |= FILTER_LONG_ADDR;
+        for(i = 0 ; i < 8 ; i++, addr >>= 8)
+          filter[6 + i] = addr & 0xff;
+      }
+      break;
+    case('L'):
+      value = xatou(optarg, &err);
+      if(err || value == 0 || value > MAX_SNAPLEN)
+        errx(EXIT_FAILURE, "snap length must be between 1 and %d",
+             MAX_SNAPLEN);
+      snaplen = value;
+      prot_mqueue_add_control(mqueue,
+                              PROT_CTYPE_CONFIG_SNAPLEN,
+                              &snaplen,
+                              sizeof(snaplen));
+      break;
+    case('I'):
+      stats_interval = xatou(optarg, &err);
+      if(err || stats_interval == 0)
+        errx(EXIT_FAILURE, "invalid statistics interval");
+      break;
+    case('R'):
+      prot_mqueue_add_control(mqueue,
+                              PROT_CTYPE_CONFIG_TIMESTAMP,
+                              &enable,
+                              sizeof(enable));
+      break;
     case('c'):
       mac_info |= MI_CONTROL;
       break;
@@ -237,6 +772,24 @@ int main(int argc, char *argv[])
     case('a'):
       mac_info |= MI_ADDR;
       break;
+    case('k'):
+      key_mode = parse_key(optarg, key, &key_source, &key_index);
+      mac_security_add_key(key_mode, key_source, key_index, key);
+      has_keys = true;
+      break;
+    case(OPT_DEVICE):
+      parse_device(optarg, &short_addr, &addr);
+      mac_security_add_device(short_addr, addr);
+      break;
+    case(OPT_FLOWS):
+      if(!flows)
+        flows = lowpan_flows_create(FLOWS_CAPACITY);
+      break;
+    case(OPT_REASSEMBLE_PCAP):
+      reasm_pcap_name = optarg;
+    case(OPT_REASSEMBLE):
+      reassemble = true;
+      break;
     case('S'):
       mac_info |= MI_SECURITY;
       break;
@@ -276,12 +829,48 @@ int main(int argc, char *argv[])
 
   tty = argv[optind];
 
-  if(!pcap && !mac_info /* && !payload_info */)
+  if(fixed_channel && nb_channels)
+    errx(EXIT_FAILURE, "cannot hop and stay on one channel at once");
+
+  /* Filter the frames in the transceiver. All types are accepted unless
+     specified otherwise. */
+  if(filter[0] || filter[1]) {
+    if(!filter[0])
+      filter[0] = 0xff;
+
+    prot_mqueue_add_control(mqueue,
+                            PROT_CTYPE_CONFIG_FILTER,
+                            filter,
+                            FILTER_SIZE);
+  }
+
+  if(raw && (mac_info || payload || flows || reassemble))
+    errx(EXIT_FAILURE, "cannot display the frames in raw mode");
+
+  if(!pcap && !feed_name && !reasm_pcap_name && !flows &&
+     (raw || !mac_info) /* && !payload_info */)
     warnx("doing nothing as requested");
 
-  if(pcap)
+  /* Nothing needs the decoded frames when they are only recorded. The raw
+     mode forces this whatever the other options. */
+  if(!mac_info && !payload && !flows && !reassemble && !has_keys)
+    raw = true;
+
+  if(pcap && append)
+    open_appending_pcap(pcap);
+  else if(pcap)
     open_writing_pcap(pcap);
 
+  if(feed_name)
+    feed = shm_feed_create(feed_name, SHM_FEED_SIZE);
+
+  if(reasm_pcap_name)
+    reasm_pcap = pcap_writer_open(reasm_pcap_name, LINKTYPE_IPV6);
+
+  if(reassemble)
+    reasm = lowpan_reasm_create(REASM_TIMEOUT, REASM_MEMORY,
+                                REASM_SOURCE_MEMORY, emit_datagram, NULL);
+
   /* Register the cleanup function as the most common way to leave the event
      loop is SIGINT. The program may also quit because of an error or the
      SIGTERM signal. So we need to register an exit hook and signals too. A
@@ -292,10 +881,37 @@ int main(int argc, char *argv[])
   /* That's where we really start the operations. */
   fd = open_uart(tty, speed);
 
+  /* Switch to a faster speed before anything else is sent. */
+  if(negotiate && !negotiate_baud(fd, negotiate))
+    warnx("cannot negotiate %u bauds", negotiate);
+
+  /* The daemon only forwards the frames to the clients which ask for them. */
+  if(uart_is_radiod(fd)) {
+    unsigned char subscribe = PROT_CTYPE_SUBSCRIBE;
+    prot_write(fd, PROT_MTYPE_CONTROL, &subscribe, sizeof(subscribe));
+  }
+
   /* Initialisation of the transceiver
      with a set of commands. */
   prot_mqueue_sendall(mqueue, fd);
 
+  /* The first dwell starts as soon as possible. */
+  if(nb_channels)
+    hop();
+
+  /* The first poll is the reference for the statistics. */
+  if(stats_interval) {
+    poll_stats();
+    input_set_timer(stats_interval * 1000, poll_stats);
+  }
+
+  /* Live viewers of the PCAP see the frames within a bounded delay. */
+  if(pcap && (value = pcap_write_flush_interval()))
+    input_set_timer(value, pcap_write_flush_check);
+
+  if(reasm)
+    input_set_timer(REASM_EXPIRE_PERIOD, expire_datagrams);
+
   /* Read until timeout (if requested). */
   input_loop(fd, message_cb, "Waiting", timeout);
   exit_status = EXIT_SUCCESS;